@@ -195,6 +195,16 @@ typedef unsigned long long AIntU64;
 /* Thread-specific Alore stack size in bytes */
 #define A_ALORE_STACK_SIZE (A_VALUE_SIZE * 64 * 1024)
 
+/* Alore stack size and C stack size of fibers in bytes. The stacks of a fiber
+   are allocated using a single memory mapping, and only the parts that are
+   actually used consume physical memory. Calls that recurse through C code
+   (such as nested _str methods) use about 10 times more C stack than Alore
+   stack, so the C stack must be proportionally larger for the Alore stack
+   overflow check to trigger first. The ratio matches that of the main
+   thread (8 MB C stack by default). */
+#define A_FIBER_STACK_SIZE (A_VALUE_SIZE * 16 * 1024)
+#define A_FIBER_C_STACK_SIZE (16 * A_FIBER_STACK_SIZE)
+
 
 /* Convert a block-aligned pointer value to a short Int value. */
 #define APtrToIntValue(ptr) \
@@ -40,13 +40,96 @@ int athread_create(athread_t *ptr, void *(*func)(void *), void *param);
 #define athread_cond_broadcast pthread_cond_broadcast
 #define athread_cond_destroy pthread_cond_destroy
 
+int athread_cond_timedwait(athread_cond_t *cond, athread_mutex_t *mutex,
+                           double timeout);
+
+double athread_time(void);
+int athread_num_cpus(void);
+
+/* Atomic operations on int values. All the operations are sequentially
+   consistent. The add operation returns the new value, the swap operation
+   returns the old value, and the compare-and-swap operation returns non-zero
+   if the value was replaced. */
+#if defined(__ATOMIC_SEQ_CST)
+#define athread_atomic_load(ptr) __atomic_load_n(ptr, __ATOMIC_SEQ_CST)
+#define athread_atomic_store(ptr, value) \
+    __atomic_store_n(ptr, value, __ATOMIC_SEQ_CST)
+#define athread_atomic_add(ptr, delta) \
+    __atomic_add_fetch(ptr, delta, __ATOMIC_SEQ_CST)
+#define athread_atomic_swap(ptr, value) \
+    __atomic_exchange_n(ptr, value, __ATOMIC_SEQ_CST)
+#define athread_atomic_cas(ptr, old, new) \
+    __sync_bool_compare_and_swap(ptr, old, new)
+#elif defined(__GNUC__)
+#define athread_atomic_load(ptr) __sync_add_and_fetch(ptr, 0)
+#define athread_atomic_store(ptr, value) \
+    (__sync_synchronize(), *(ptr) = (value), __sync_synchronize())
+#define athread_atomic_add(ptr, delta) __sync_add_and_fetch(ptr, delta)
+#define athread_atomic_swap(ptr, value) \
+    (__sync_synchronize(), __sync_lock_test_and_set(ptr, value))
+#define athread_atomic_cas(ptr, old, new) \
+    __sync_bool_compare_and_swap(ptr, old, new)
+#else
+int athread_atomic_load(volatile int *ptr);
+void athread_atomic_store(volatile int *ptr, int value);
+int athread_atomic_add(volatile int *ptr, int delta);
+int athread_atomic_swap(volatile int *ptr, int value);
+int athread_atomic_cas(volatile int *ptr, int old, int new);
+#endif
+
+/* Atomic operations on unsigned long values (these have the same size as
+   pointers). */
+#if defined(__ATOMIC_SEQ_CST) || defined(__GNUC__)
+#define athread_atomic_load_long athread_atomic_load
+#define athread_atomic_store_long athread_atomic_store
+#define athread_atomic_swap_long athread_atomic_swap
+#define athread_atomic_cas_long athread_atomic_cas
+#else
+unsigned long athread_atomic_load_long(volatile unsigned long *ptr);
+void athread_atomic_store_long(volatile unsigned long *ptr,
+                               unsigned long value);
+unsigned long athread_atomic_swap_long(volatile unsigned long *ptr,
+                                       unsigned long value);
+int athread_atomic_cas_long(volatile unsigned long *ptr, unsigned long old,
+                            unsigned long new);
+#endif
+
+/* Hint to the processor that the current thread is spinning. */
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define athread_cpu_relax() __asm__ __volatile__("pause")
+#else
+#define athread_cpu_relax() ((void)0)
+#endif
+
+#if defined(__linux__)
+/* Use the futex system call for athread_futex_wait and athread_futex_wake.
+   Otherwise, they are emulated using mutexes and condition variables. */
+#define A_HAVE_LINUX_FUTEX
+#endif
+
+/* Wait until another thread calls athread_futex_wake for ptr, but only if
+   *ptr == value. Wait for at most timeout seconds (timeout < 0 means no
+   timeout). Return ETIMEDOUT if the wait timed out, and 0 otherwise. Note
+   that the function may also return spuriously. */
+int athread_futex_wait(volatile int *ptr, int value, double timeout);
+/* Wake up at most count threads waiting for ptr. */
+void athread_futex_wake(volatile int *ptr, int count);
+
+#ifndef A_HAVE_LINUX_FUTEX
+int athread_futex_init(void);
+#endif
+
 #elif defined(A_HAVE_WINDOWS) && defined(A_HAVE_THREADS)
 
 /* Windows implementation of the API */
 
-/* We need EBUSY */
+/* We need EBUSY and ETIMEDOUT */
 #include <errno.h>
 
+#ifndef ETIMEDOUT
+#define ETIMEDOUT 138
+#endif
+
 typedef struct {
     void *id;
 } athread_t;
@@ -80,14 +163,47 @@ void athread_cond_wait(athread_cond_t *cond, athread_mutex_t *mutex);
 void athread_cond_signal(athread_cond_t *cond);
 void athread_cond_broadcast(athread_cond_t *cond);
 void athread_cond_destroy(athread_cond_t *cond);
+int athread_cond_timedwait(athread_cond_t *cond, athread_mutex_t *mutex,
+                           double timeout);
+
+double athread_time(void);
+int athread_num_cpus(void);
+
+int athread_atomic_load(volatile int *ptr);
+void athread_atomic_store(volatile int *ptr, int value);
+int athread_atomic_add(volatile int *ptr, int delta);
+int athread_atomic_swap(volatile int *ptr, int value);
+int athread_atomic_cas(volatile int *ptr, int old, int new);
+
+unsigned long athread_atomic_load_long(volatile unsigned long *ptr);
+void athread_atomic_store_long(volatile unsigned long *ptr,
+                               unsigned long value);
+unsigned long athread_atomic_swap_long(volatile unsigned long *ptr,
+                                       unsigned long value);
+int athread_atomic_cas_long(volatile unsigned long *ptr, unsigned long old,
+                            unsigned long new);
+
+#if defined(_MSC_VER)
+#define athread_cpu_relax() YieldProcessor()
+#else
+#define athread_cpu_relax() ((void)0)
+#endif
+
+int athread_futex_wait(volatile int *ptr, int value, double timeout);
+void athread_futex_wake(volatile int *ptr, int count);
+int athread_futex_init(void);
 
 #else
 
 /* No thread support available - define an empty implementation of the API */
 
-/* We need EBUSY */
+/* We need EBUSY and ETIMEDOUT */
 #include <errno.h>
 
+#ifndef ETIMEDOUT
+#define ETIMEDOUT 138
+#endif
+
 
 typedef void *athread_t;
 
@@ -114,6 +230,30 @@ typedef void *athread_cond_t;
 #define athread_cond_signal(cond) 0
 #define athread_cond_broadcast(cond) 0
 #define athread_cond_destroy(cond) 0
+/* A timed wait always times out, since no other thread could signal the
+   condition variable. */
+#define athread_cond_timedwait(cond, mutex, timeout) ETIMEDOUT
+
+#define athread_time() 0.0
+#define athread_num_cpus() 1
+
+#define athread_atomic_load(ptr) (*(ptr))
+#define athread_atomic_store(ptr, value) (*(ptr) = (value))
+#define athread_atomic_add(ptr, delta) (*(ptr) += (delta))
+int athread_atomic_swap(volatile int *ptr, int value);
+#define athread_atomic_cas(ptr, old, new) \
+    (*(ptr) == (old) ? (*(ptr) = (new), 1) : 0)
+
+#define athread_atomic_load_long athread_atomic_load
+#define athread_atomic_store_long athread_atomic_store
+unsigned long athread_atomic_swap_long(volatile unsigned long *ptr,
+                                       unsigned long value);
+#define athread_atomic_cas_long athread_atomic_cas
+
+#define athread_futex_wait(ptr, value, timeout) ETIMEDOUT
+#define athread_futex_wake(ptr, count) ((void)0)
+
+#define athread_cpu_relax() ((void)0)
 
 #endif
 
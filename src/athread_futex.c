@@ -0,0 +1,111 @@
+/* athread_futex.c - Emulation of futex and atomic operations of the athread
+                    API
+
+   Copyright (c) 2010-2011 Jukka Lehtosalo
+
+   Alore is licensed under the terms of the MIT license.  See the file
+   LICENSE.txt in the distribution.
+*/
+
+/* Implementation of athread_futex_wait and athread_futex_wake for platforms
+   that do not support futexes. Waiting threads are distributed to a fixed
+   number of buckets based on the address, and each bucket has a mutex and a
+   condition variable. Waking up a thread wakes up all the threads in the same
+   bucket, which is allowed since futex waits may return spuriously.
+
+   This file also implements the atomic operations that cannot be defined as
+   macros if there is no thread support. */
+
+#include "athread.h"
+
+#if defined(A_HAVE_THREADS) && !defined(A_HAVE_LINUX_FUTEX) && \
+    (defined(HAVE_PTHREADS) || defined(A_HAVE_WINDOWS))
+
+
+/* Number of buckets (must be a power of two) */
+#define NUM_BUCKETS 64
+
+
+typedef struct {
+    athread_mutex_t mutex;
+    athread_cond_t cond;
+} FutexBucket;
+
+
+static FutexBucket Buckets[NUM_BUCKETS];
+
+
+#define GetBucket(ptr) \
+    (&Buckets[((AValue)(ptr) >> 4) & (NUM_BUCKETS - 1)])
+
+
+int athread_futex_init(void)
+{
+    int i;
+
+    for (i = 0; i < NUM_BUCKETS; i++) {
+        if (athread_mutex_init(&Buckets[i].mutex, NULL)
+            || athread_cond_init(&Buckets[i].cond, NULL))
+            return -1;
+    }
+
+    return 0;
+}
+
+
+int athread_futex_wait(volatile int *ptr, int value, double timeout)
+{
+    FutexBucket *bucket = GetBucket(ptr);
+    int result;
+
+    athread_mutex_lock(&bucket->mutex);
+
+    /* The waker modifies the value before locking the bucket mutex, and
+       therefore the wake-up cannot be lost. */
+    if (athread_atomic_load(ptr) != value)
+        result = 0;
+    else if (timeout < 0.0) {
+        athread_cond_wait(&bucket->cond, &bucket->mutex);
+        result = 0;
+    } else
+        result = athread_cond_timedwait(&bucket->cond, &bucket->mutex,
+                                        timeout);
+
+    athread_mutex_unlock(&bucket->mutex);
+
+    return result;
+}
+
+
+void athread_futex_wake(volatile int *ptr, int count)
+{
+    FutexBucket *bucket = GetBucket(ptr);
+
+    athread_mutex_lock(&bucket->mutex);
+    athread_cond_broadcast(&bucket->cond);
+    athread_mutex_unlock(&bucket->mutex);
+}
+
+#endif
+
+
+#if !(defined(A_HAVE_THREADS) && \
+      (defined(HAVE_PTHREADS) || defined(A_HAVE_WINDOWS)))
+
+int athread_atomic_swap(volatile int *ptr, int value)
+{
+    int old = *ptr;
+    *ptr = value;
+    return old;
+}
+
+
+unsigned long athread_atomic_swap_long(volatile unsigned long *ptr,
+                                       unsigned long value)
+{
+    unsigned long old = *ptr;
+    *ptr = value;
+    return old;
+}
+
+#endif
@@ -11,9 +11,29 @@
 #if defined(A_HAVE_THREADS) && defined(HAVE_PTHREADS) && \
     !defined(A_HAVE_WINDOWS)
 
+#include <sys/time.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef A_HAVE_LINUX_FUTEX
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+
+#if !defined(__ATOMIC_SEQ_CST) && !defined(__GNUC__)
+/* Mutex used for emulating atomic operations */
+static pthread_mutex_t AtomicMutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+
 int athread_init(void)
 {
+#ifdef A_HAVE_LINUX_FUTEX
     return 0;
+#else
+    return athread_futex_init();
+#endif
 }
 
 
@@ -30,4 +50,188 @@ int athread_create(athread_t *ptr, void *(*func)(void *), void *param)
     return result;
 }
 
+
+/* Like athread_cond_wait, but wait for at most timeout seconds. Return
+   ETIMEDOUT if the condition variable was not signaled before the timeout
+   expired, and 0 otherwise. */
+int athread_cond_timedwait(athread_cond_t *cond, athread_mutex_t *mutex,
+                           double timeout)
+{
+    struct timeval now;
+    struct timespec deadline;
+    long seconds;
+    long nanoseconds;
+
+    if (timeout < 0.0)
+        timeout = 0.0;
+    else if (timeout > 1e8)
+        timeout = 1e8; /* Avoid overflow; this is over 3 years. */
+
+    gettimeofday(&now, NULL);
+
+    seconds = (long)timeout;
+    nanoseconds = (long)((timeout - seconds) * 1e9) + now.tv_usec * 1000L;
+    deadline.tv_sec = now.tv_sec + seconds + nanoseconds / 1000000000L;
+    deadline.tv_nsec = nanoseconds % 1000000000L;
+
+    if (pthread_cond_timedwait(cond, mutex, &deadline) == ETIMEDOUT)
+        return ETIMEDOUT;
+    else
+        return 0;
+}
+
+
+/* Return the current time in seconds. Only differences between return values
+   are meaningful. */
+double athread_time(void)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec + now.tv_usec * 1e-6;
+}
+
+
+#ifdef A_HAVE_LINUX_FUTEX
+
+int athread_futex_wait(volatile int *ptr, int value, double timeout)
+{
+    struct timespec ts;
+    struct timespec *tsPtr;
+
+    if (timeout >= 0.0) {
+        if (timeout > 1e8)
+            timeout = 1e8; /* Avoid overflow; this is over 3 years. */
+        ts.tv_sec = (long)timeout;
+        ts.tv_nsec = (long)((timeout - ts.tv_sec) * 1e9);
+        tsPtr = &ts;
+    } else
+        tsPtr = NULL;
+
+    /* The timeout of FUTEX_WAIT is relative. */
+    if (syscall(SYS_futex, ptr, FUTEX_WAIT_PRIVATE, value, tsPtr, NULL, 0) < 0
+        && errno == ETIMEDOUT)
+        return ETIMEDOUT;
+    else
+        return 0;
+}
+
+
+void athread_futex_wake(volatile int *ptr, int count)
+{
+    syscall(SYS_futex, ptr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+#endif
+
+
+#if !defined(__ATOMIC_SEQ_CST) && !defined(__GNUC__)
+
+int athread_atomic_load(volatile int *ptr)
+{
+    int value;
+    pthread_mutex_lock(&AtomicMutex);
+    value = *ptr;
+    pthread_mutex_unlock(&AtomicMutex);
+    return value;
+}
+
+
+void athread_atomic_store(volatile int *ptr, int value)
+{
+    pthread_mutex_lock(&AtomicMutex);
+    *ptr = value;
+    pthread_mutex_unlock(&AtomicMutex);
+}
+
+
+int athread_atomic_add(volatile int *ptr, int delta)
+{
+    int value;
+    pthread_mutex_lock(&AtomicMutex);
+    value = *ptr += delta;
+    pthread_mutex_unlock(&AtomicMutex);
+    return value;
+}
+
+
+int athread_atomic_swap(volatile int *ptr, int value)
+{
+    int old;
+    pthread_mutex_lock(&AtomicMutex);
+    old = *ptr;
+    *ptr = value;
+    pthread_mutex_unlock(&AtomicMutex);
+    return old;
+}
+
+
+int athread_atomic_cas(volatile int *ptr, int old, int new)
+{
+    int result;
+    pthread_mutex_lock(&AtomicMutex);
+    result = *ptr == old;
+    if (result)
+        *ptr = new;
+    pthread_mutex_unlock(&AtomicMutex);
+    return result;
+}
+
+
+unsigned long athread_atomic_load_long(volatile unsigned long *ptr)
+{
+    unsigned long value;
+    pthread_mutex_lock(&AtomicMutex);
+    value = *ptr;
+    pthread_mutex_unlock(&AtomicMutex);
+    return value;
+}
+
+
+void athread_atomic_store_long(volatile unsigned long *ptr,
+                               unsigned long value)
+{
+    pthread_mutex_lock(&AtomicMutex);
+    *ptr = value;
+    pthread_mutex_unlock(&AtomicMutex);
+}
+
+
+unsigned long athread_atomic_swap_long(volatile unsigned long *ptr,
+                                       unsigned long value)
+{
+    unsigned long old;
+    pthread_mutex_lock(&AtomicMutex);
+    old = *ptr;
+    *ptr = value;
+    pthread_mutex_unlock(&AtomicMutex);
+    return old;
+}
+
+
+int athread_atomic_cas_long(volatile unsigned long *ptr, unsigned long old,
+                            unsigned long new)
+{
+    int result;
+    pthread_mutex_lock(&AtomicMutex);
+    result = *ptr == old;
+    if (result)
+        *ptr = new;
+    pthread_mutex_unlock(&AtomicMutex);
+    return result;
+}
+
+#endif
+
+
+/* Return the number of online processors (at least 1). */
+int athread_num_cpus(void)
+{
+#if defined(HAVE_UNISTD_H) && defined(_SC_NPROCESSORS_ONLN)
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n >= 1)
+        return (int)n;
+#endif
+    return 1;
+}
+
 #endif
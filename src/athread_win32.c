@@ -64,7 +64,7 @@ int athread_init(void)
 
     TlsSetValue(athread_tls_index, data);
 
-    return 0;
+    return athread_futex_init();
 }
 
 
@@ -189,6 +189,60 @@ void athread_cond_wait(athread_cond_t *cond, athread_mutex_t *mutex)
 }
 
 
+/* Like athread_cond_wait, but wait for at most timeout seconds. Return
+   ETIMEDOUT if the condition variable was not signaled before the timeout
+   expired, and 0 otherwise. */
+int athread_cond_timedwait(athread_cond_t *cond, athread_mutex_t *mutex,
+                           double timeout)
+{
+    athread_local_t *data;
+    athread_local_t **prev;
+    DWORD ms;
+    int result;
+
+    if (timeout <= 0.0)
+        ms = 0;
+    else if (timeout >= 1e6)
+        ms = 1000000000; /* Avoid overflow; this is over 11 days. */
+    else
+        ms = (DWORD)(timeout * 1000 + 0.5);
+
+    athread_mutex_lock(&cond->mutex);
+
+    data = TlsGetValue(athread_tls_index);
+    data->next = cond->events;
+    cond->events = data;
+
+    athread_mutex_unlock(&cond->mutex);
+    athread_mutex_unlock(mutex);
+
+    result = 0;
+    if (WaitForSingleObject(data->event, ms) == WAIT_TIMEOUT) {
+        athread_mutex_lock(&cond->mutex);
+
+        /* If the event is still in the list, nobody has signaled it and we
+           remove it. Otherwise the event was set while the list was locked
+           by a signaler, and we have to reset it by waiting for it. */
+        for (prev = &cond->events; *prev != NULL; prev = &(*prev)->next) {
+            if (*prev == data) {
+                *prev = data->next;
+                data->next = NULL;
+                result = ETIMEDOUT;
+                break;
+            }
+        }
+        if (result == 0)
+            WaitForSingleObject(data->event, INFINITE);
+
+        athread_mutex_unlock(&cond->mutex);
+    }
+
+    athread_mutex_lock(mutex);
+
+    return result;
+}
+
+
 /* Signal a condition variable. */
 void athread_cond_signal(athread_cond_t *cond)
 {
@@ -232,6 +286,90 @@ void athread_cond_destroy(athread_cond_t *cond)
 }
 
 
+/* Return the current time in seconds. Only differences between return values
+   are meaningful. */
+double athread_time(void)
+{
+    FILETIME ft;
+    ULARGE_INTEGER ticks;
+
+    GetSystemTimeAsFileTime(&ft);
+    ticks.LowPart = ft.dwLowDateTime;
+    ticks.HighPart = ft.dwHighDateTime;
+    /* The unit of FILETIME is 100 nanoseconds. */
+    return ticks.QuadPart * 1e-7;
+}
+
+
+/* Return the number of processors. */
+int athread_num_cpus(void)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors >= 1 ? (int)info.dwNumberOfProcessors : 1;
+}
+
+
+int athread_atomic_load(volatile int *ptr)
+{
+    return InterlockedCompareExchange((volatile LONG *)ptr, 0, 0);
+}
+
+
+void athread_atomic_store(volatile int *ptr, int value)
+{
+    InterlockedExchange((volatile LONG *)ptr, value);
+}
+
+
+int athread_atomic_add(volatile int *ptr, int delta)
+{
+    return InterlockedExchangeAdd((volatile LONG *)ptr, delta) + delta;
+}
+
+
+int athread_atomic_swap(volatile int *ptr, int value)
+{
+    return InterlockedExchange((volatile LONG *)ptr, value);
+}
+
+
+int athread_atomic_cas(volatile int *ptr, int old, int new)
+{
+    return InterlockedCompareExchange((volatile LONG *)ptr, new, old) == old;
+}
+
+
+/* Note that unsigned long and LONG are both 32-bit values on Windows. */
+
+unsigned long athread_atomic_load_long(volatile unsigned long *ptr)
+{
+    return InterlockedCompareExchange((volatile LONG *)ptr, 0, 0);
+}
+
+
+void athread_atomic_store_long(volatile unsigned long *ptr,
+                               unsigned long value)
+{
+    InterlockedExchange((volatile LONG *)ptr, value);
+}
+
+
+unsigned long athread_atomic_swap_long(volatile unsigned long *ptr,
+                                       unsigned long value)
+{
+    return InterlockedExchange((volatile LONG *)ptr, value);
+}
+
+
+int athread_atomic_cas_long(volatile unsigned long *ptr, unsigned long old,
+                            unsigned long new)
+{
+    return InterlockedCompareExchange((volatile LONG *)ptr, new, old)
+        == (LONG)old;
+}
+
+
 /* This function is called within each newly created thread. */
 static void __cdecl thread_func(void *ptr)
 {
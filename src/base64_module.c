@@ -6,150 +6,790 @@
    LICENSE.txt in the distribution.
 */
 
+/* The encoding and decoding kernels process complete groups of 3 bytes / 4
+   characters. Blocks of 12 or 24 bytes are processed at a time using SSSE3 or
+   AVX2 instructions if the processor supports them (the variants are
+   selected at runtime); otherwise portable C code processes a group at a
+   time. Padding, errors and partial groups are handled separately by scalar
+   code. */
+
+#include <string.h>
+
 #include "alore.h"
+#include "str.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) \
+    && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9) \
+        || defined(__clang__))
+#define HAVE_SIMD
+#include <immintrin.h>
+#endif
 
 
 static const char Base64Alpha[65] =
     "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
-static const signed char Base64DecMap[128] = {
+/* Map from characters to 6-bit values; -1 for non-alphabet characters
+   (including the padding character =) */
+static const signed char Base64DecMap[256] = {
     -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
     -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
     -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1, -1, 63,
-    52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1,  0, -1, -1,
+    52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
     -1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
     15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
     -1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
-    41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1
+    41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
 };
 
 
-/* Encode a string to base64 encoding. */
-static AValue Base64Encode(AThread *t, AValue *frame)
+/* State of Base64Encoder and Base64Decoder objects */
+typedef struct {
+    /* Unprocessed input (at most 2 bytes when encoding or 3 characters when
+       decoding) */
+    unsigned char pending[4];
+    int numPending;
+    /* Has the decoder seen padding? If so, no more input is accepted. */
+    ABool isPadded;
+} CoderData;
+
+
+#define GetCoderData(v) ((CoderData *)ADataPtr(v, CoderDataOffset))
+
+
+/* Padding error codes returned by the decoding functions */
+#define INCORRECT_PADDING -1
+#define PADDING_BEFORE_END -2
+
+
+static int CoderDataOffset;
+
+
+static void SelectImplementation(void);
+
+static void EncodeGroups_C(unsigned char *dst, const unsigned char *src,
+                           Assize_t len);
+static Assize_t DecodeGroups_C(unsigned char *dst, const unsigned char *src,
+                               Assize_t len);
+
+
+/* Implementations of the kernels. These point to the portable
+   implementations until SelectImplementation has been called. */
+static ABool IsInitialized;
+static void (*EncodeGroupsImpl)(unsigned char *dst, const unsigned char *src,
+                                Assize_t len) = EncodeGroups_C;
+static Assize_t (*DecodeGroupsImpl)(unsigned char *dst,
+                                    const unsigned char *src,
+                                    Assize_t len) = DecodeGroups_C;
+
+
+/* Encode src[0..len) to dst. The length must be a multiple of 3. */
+static void EncodeGroups(unsigned char *dst, const unsigned char *src,
+                         Assize_t len)
 {
-    /* FIX: Raise exception if argument is a wide string. */
+    if (!IsInitialized)
+        SelectImplementation();
+    EncodeGroupsImpl(dst, src, len);
+}
 
-    int srcLen;
-    int dstLen;
-    AValue res;
-    int i, j, resInd;
 
-    AExpectStr(t, frame[0]);
+/* Decode complete 4-character groups of src[0..len) to dst. Stop at the
+   first group that contains a padding or a non-alphabet character. Return
+   the number of characters decoded (a multiple of 4).
+
+   NOTE: Up to 18 bytes may be written past the end of the decoded data, but
+         never past dst + len / 4 * 3 - 2. */
+static Assize_t DecodeGroups(unsigned char *dst, const unsigned char *src,
+                             Assize_t len)
+{
+    if (!IsInitialized)
+        SelectImplementation();
+    return DecodeGroupsImpl(dst, src, len);
+}
 
-    srcLen = AStrLen(frame[0]);
-    dstLen = (srcLen + 2) / 3 * 4;
 
-    res = AMakeEmptyStr(t, dstLen);
+/* Encode the final 1 or 2 bytes of input as a padded 4-character group. */
+static void EncodeFinalGroup(unsigned char *dst, const unsigned char *src,
+                             int len)
+{
+    unsigned char b1 = src[0];
+    unsigned char b2 = len > 1 ? src[1] : 0;
+
+    dst[0] = Base64Alpha[b1 >> 2];
+    dst[1] = Base64Alpha[((b1 & 3) << 4) | (b2 >> 4)];
+    dst[2] = len > 1 ? Base64Alpha[(b2 & 15) << 2] : '=';
+    dst[3] = '=';
+}
+
+
+/* Decode a 4-character group that could not be decoded by DecodeGroups. It
+   is either a valid group with padding or invalid. Store the result in
+   dst[0..3) and return the number of bytes decoded (1 or 2), or
+   INCORRECT_PADDING. Raise ValueError if the group contains a non-alphabet
+   character. */
+static int DecodeFinalGroup(AThread *t, unsigned char *dst,
+                            const unsigned char *src)
+{
+    int in[4];
+    int numPad;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        in[i] = Base64DecMap[src[i]];
+        if (in[i] < 0 && src[i] != '=')
+            ARaiseValueError(t, "Non-alphabet input character");
+    }
 
-    resInd = 0;
+    if (in[0] < 0 || in[1] < 0)
+        return INCORRECT_PADDING;
+    if (in[2] < 0)
+        numPad = in[3] < 0 ? 2 : 0;
+    else
+        numPad = in[3] < 0 ? 1 : 0;
+    if (numPad == 0)
+        return INCORRECT_PADDING;
 
-    /* Process input in up to 3 byte chunks (each resulting in 4 target encoded
-       characters). */
-    for (i = 0; i < srcLen; i += 3) {
-        unsigned char b1, b2, b3;
-        char out[4];
+    dst[0] = (in[0] << 2) | (in[1] >> 4);
+    dst[1] = ((in[1] & 15) << 4) | (in[2] >> 2);
 
-        b1 = AStrItem(frame[0], i);
-        b2 = i + 1 < srcLen ? AStrItem(frame[0], i + 1) : 0;
-        b3 = i + 2 < srcLen ? AStrItem(frame[0], i + 2) : 0;
+    return 3 - numPad;
+}
 
-        /* Convert 3x8 bits to base64. */
-        out[0] = Base64Alpha[b1 >> 2];
-        out[1] = Base64Alpha[((b1 & 3) << 4) | (b2 >> 4)];
-        out[2] = Base64Alpha[((b2 & 15) << 2) | (b3 >> 6)];
-        out[3] = Base64Alpha[b3 & 63];
 
-        /* Add padding if needed. */
-        if (i + 2 >= srcLen)
-            out[3] = '=';
-        if (i + 1 >= srcLen)
-            out[2] = '=';
+/* Return the number of padding characters at the end of a chunk of input
+   whose last two characters are c1 and c2. */
+static int NumPadding(int c1, int c2)
+{
+    if (c2 != '=')
+        return 0;
+    else
+        return c1 == '=' ? 2 : 1;
+}
 
-        /* Output encoded characters. */
-        for (j = 0; j < 4; j++)
-            ASetStrItem(res, resInd + j, out[j]);
 
-        resInd += 4;
+/* Decode src[0..len) to dst. The length must be a multiple of 4, and only
+   the last group may contain padding. Return the number of bytes written,
+   or a padding error code (see RaisePaddingError) if the padding is
+   invalid. Raise ValueError if the group with invalid padding contains a
+   non-alphabet character. */
+static Assize_t DecodeChunk(AThread *t, unsigned char *dst,
+                            const unsigned char *src, Assize_t len)
+{
+    Assize_t i = DecodeGroups(dst, src, len);
+    Assize_t n = i / 4 * 3;
+
+    if (i < len) {
+        unsigned char out[3];
+        int num = DecodeFinalGroup(t, out, src + i);
+        if (num < 0)
+            return num;
+        if (i + 4 < len)
+            return PADDING_BEFORE_END;
+        dst[n] = out[0];
+        if (num > 1)
+            dst[n + 1] = out[1];
+        n += num;
     }
 
+    return n;
+}
+
+
+/* Raise ValueError for a padding error (INCORRECT_PADDING or
+   PADDING_BEFORE_END) in the narrow string str, or for a non-alphabet
+   character if str contains one. Invalid characters are reported before
+   padding errors regardless of their position in the input. */
+static AValue RaisePaddingError(AThread *t, AValue str, int code)
+{
+    const unsigned char *src = ANarrowStrItems(str);
+    Assize_t len = AStrLen(str);
+    Assize_t i;
+
+    for (i = 0; i < len; i++) {
+        if (Base64DecMap[src[i]] < 0 && src[i] != '=')
+            return ARaiseValueError(t, "Non-alphabet input character");
+    }
+    return ARaiseValueError(t, code == INCORRECT_PADDING
+                            ? "Incorrect padding"
+                            : "Padding before input end");
+}
+
+
+/* Return a narrow string or a narrow substring with the same contents as a
+   string argument. Raise ValueError with the given message if the string
+   contains characters larger than 255. */
+static AValue NarrowArg(AThread *t, AValue str, const char *msg)
+{
+    AExpectStr(t, str);
+    if (!AIsNarrowStr(str) && !AIsNarrowSubStr(str)) {
+        Assize_t len = AStrLen(str);
+        Assize_t i;
+
+        for (i = 0; i < len; i++) {
+            if (AStrItem(str, i) > 255)
+                ARaiseValueError(t, msg);
+        }
+        str = ANormalizeNarrowString(t, str);
+        if (AIsError(str))
+            ADispatchException(t);
+    }
+    return str;
+}
+
+
+/* base64::Base64Encode(str)
+   Encode a string to base64 encoding. */
+static AValue Base64Encode(AThread *t, AValue *frame)
+{
+    Assize_t srcLen;
+    Assize_t full;
+    AValue res;
+    unsigned char *dst;
+    const unsigned char *src;
+
+    frame[0] = NarrowArg(t, frame[0], "Non-narrow input string");
+    srcLen = AStrLen(frame[0]);
+
+    res = AMakeEmptyStr(t, (srcLen + 2) / 3 * 4);
+
+    src = ANarrowStrItems(frame[0]);
+    dst = (unsigned char *)AStrPtr(res);
+
+    full = srcLen - srcLen % 3;
+    EncodeGroups(dst, src, full);
+    if (full < srcLen)
+        EncodeFinalGroup(dst + full / 3 * 4, src + full, srcLen - full);
+
     return res;
 }
 
 
-/* Decode base64 encoded strings. The input must be valid; for example, it
+/* base64::Base64Decode(str)
+   Decode base64 encoded strings. The input must be valid; for example, it
    may not contain extra padding characters or any whitespace. */
 static AValue Base64Decode(AThread *t, AValue *frame)
 {
-    int srcLen;
-    int dstLen;
+    Assize_t srcLen;
+    Assize_t n;
     AValue res;
-    int i, j, resInd;
-
-    AExpectStr(t, frame[0]);
+    const unsigned char *src;
+    int numPad = 0;
 
+    frame[0] = NarrowArg(t, frame[0], "Non-alphabet input character");
     srcLen = AStrLen(frame[0]);
+    if ((srcLen & 3) != 0)
+        return RaisePaddingError(t, frame[0], INCORRECT_PADDING);
+
+    if (srcLen > 0) {
+        src = ANarrowStrItems(frame[0]);
+        numPad = NumPadding(src[srcLen - 2], src[srcLen - 1]);
+    }
 
-    /* Calculate exact result length. */
-    dstLen = srcLen / 4 * 3;
-    if (srcLen > 0 && AStrItem(frame[0], srcLen - 1) == '=')
-        dstLen--;
-    if (srcLen > 0 && AStrItem(frame[0], srcLen - 2) == '=')
-        dstLen--;
-
-    res = AMakeEmptyStr(t, dstLen);
-
-    resInd = 0;
-
-    /* Process data in 4-character chunks, each representing up to 3 result
-       bytes. */
-    for (i = 0; i + 3 < srcLen; i += 4) {
-        signed char in[4];
-        char out[3];
-        int pad = 0; /* Bit field marking pad characters in the input chunk */
-
-        /* Convert input chunk to 4 6-bit integers. */
-        for (j = 0; j < 4; j++) {
-            int c = AStrItem(frame[0], i + j);
-            if (c == '=')
-                pad |= 1 << j;
-            if (c < 128)
-                in[j] = Base64DecMap[c];
-            else
-                in[j] = -1;
-
-            if (in[j] == -1)
-                return ARaiseValueError(t, "Non-alphabet input character");
+    res = AMakeEmptyStr(t, srcLen / 4 * 3 - numPad);
+
+    src = ANarrowStrItems(frame[0]);
+    n = DecodeChunk(t, (unsigned char *)AStrPtr(res), src, srcLen);
+    if (n < 0)
+        return RaisePaddingError(t, frame[0], (int)n);
+
+    return res;
+}
+
+
+/* Base64Encoder create()
+   Base64Decoder create()
+   (the implementation is shared) */
+static AValue CoderCreate(AThread *t, AValue *frame)
+{
+    CoderData *data = GetCoderData(frame[0]);
+    data->numPending = 0;
+    data->isPadded = FALSE;
+    return frame[0];
+}
+
+
+/* Base64Encoder encode(str)
+   Encode all complete 3-byte groups of the pending input followed by str.
+   Keep the rest of the input (at most 2 bytes) pending. */
+static AValue Base64EncoderEncode(AThread *t, AValue *frame)
+{
+    CoderData *data;
+    Assize_t srcLen;
+    Assize_t total;
+    Assize_t i;
+    Assize_t full;
+    AValue res;
+    unsigned char *dst;
+    const unsigned char *src;
+
+    frame[1] = NarrowArg(t, frame[1], "Non-narrow input string");
+    srcLen = AStrLen(frame[1]);
+
+    data = GetCoderData(frame[0]);
+    total = data->numPending + srcLen;
+
+    res = AMakeEmptyStr(t, total / 3 * 4);
+
+    data = GetCoderData(frame[0]);
+    src = ANarrowStrItems(frame[1]);
+    dst = (unsigned char *)AStrPtr(res);
+
+    i = 0;
+    if (data->numPending > 0 && total >= 3) {
+        /* Complete the pending group. */
+        for (; data->numPending < 3; i++)
+            data->pending[data->numPending++] = src[i];
+        EncodeGroups(dst, data->pending, 3);
+        dst += 4;
+        data->numPending = 0;
+    }
+
+    full = (srcLen - i) - (srcLen - i) % 3;
+    EncodeGroups(dst, src + i, full);
+
+    for (i += full; i < srcLen; i++)
+        data->pending[data->numPending++] = src[i];
+
+    return res;
+}
+
+
+/* Base64Encoder finish()
+   Encode the pending input with padding. The encoder can be used to encode
+   new data after this. */
+static AValue Base64EncoderFinish(AThread *t, AValue *frame)
+{
+    CoderData *data = GetCoderData(frame[0]);
+    AValue res;
+
+    if (data->numPending == 0)
+        return AMakeStr(t, "");
+
+    res = AMakeEmptyStr(t, 4);
+
+    data = GetCoderData(frame[0]);
+    EncodeFinalGroup((unsigned char *)AStrPtr(res), data->pending,
+                     data->numPending);
+    data->numPending = 0;
+
+    return res;
+}
+
+
+/* Base64Decoder decode(str)
+   Decode all complete 4-character groups of the pending input followed by
+   str. Keep the rest of the input (at most 3 characters) pending. */
+static AValue Base64DecoderDecode(AThread *t, AValue *frame)
+{
+    CoderData *data;
+    Assize_t srcLen;
+    Assize_t total;
+    Assize_t groupsLen;
+    Assize_t i;
+    Assize_t full;
+    Assize_t n;
+    AValue res;
+    unsigned char *dst;
+    const unsigned char *src;
+    int numPad = 0;
+
+    frame[1] = NarrowArg(t, frame[1], "Non-alphabet input character");
+    srcLen = AStrLen(frame[1]);
+
+    data = GetCoderData(frame[0]);
+    if (data->isPadded && srcLen > 0)
+        return RaisePaddingError(t, frame[1], PADDING_BEFORE_END);
+
+    total = data->numPending + srcLen;
+    groupsLen = total - (total & 3);
+
+    if (groupsLen > 0) {
+        /* Find the padding characters at the end of the last group. */
+        int c[2];
+        int j;
+        src = ANarrowStrItems(frame[1]);
+        for (j = 0; j < 2; j++) {
+            Assize_t k = groupsLen - 2 + j;
+            c[j] = k < data->numPending ? data->pending[k]
+                : src[k - data->numPending];
         }
+        numPad = NumPadding(c[0], c[1]);
+    }
 
-        /* Convert 4x6 bits to 3x8 bits. */
-        out[0] = (in[0] << 2) | (in[1] >> 4);
-        out[1] = ((in[1] & 15) << 4) | (in[2] >> 2);
-        out[2] = ((in[2] & 3) << 6) | in[3];
+    res = AMakeEmptyStr(t, groupsLen / 4 * 3 - numPad);
+
+    data = GetCoderData(frame[0]);
+    src = ANarrowStrItems(frame[1]);
+    dst = (unsigned char *)AStrPtr(res);
+
+    i = 0;
+    if (data->numPending > 0 && total >= 4) {
+        /* Complete the pending group. */
+        for (; data->numPending < 4; i++)
+            data->pending[data->numPending++] = src[i];
+        data->numPending = 0;
+        if (groupsLen == 4)
+            n = DecodeChunk(t, dst, data->pending, 4);
+        else {
+            unsigned char out[3];
+            n = DecodeChunk(t, out, data->pending, 4);
+            if (n == 3) {
+                memcpy(dst, out, 3);
+                dst += 3;
+            } else if (n >= 0)
+                n = PADDING_BEFORE_END;
+        }
+        if (n < 0)
+            return RaisePaddingError(t, frame[1], (int)n);
+    }
 
-        /* Output result bytes and check padding. */
-        ASetStrItem(res, resInd, out[0]);
-        if (resInd + 1 < dstLen) {
-            ASetStrItem(res, resInd + 1, out[1]);
-            if (resInd + 2 < dstLen) {
-                ASetStrItem(res, resInd + 2, out[2]);
-                if (pad != 0)
-                    ARaiseValueError(t, "Padding before input end");
-            } else if (pad != 8)
-                ARaiseValueError(t, "Incorrect padding");
-        } else if (pad != 12)
-            ARaiseValueError(t, "Incorrect padding");
+    full = (srcLen - i) & ~(Assize_t)3;
+    n = DecodeChunk(t, dst, src + i, full);
+    if (n < 0)
+        return RaisePaddingError(t, frame[1], (int)n);
+
+    /* Keep the rest of the input pending. Check it now so that invalid
+       characters are not reported as incorrect padding by finish(). */
+    for (i += full; i < srcLen; i++) {
+        if (Base64DecMap[src[i]] < 0 && src[i] != '=')
+            return ARaiseValueError(t, "Non-alphabet input character");
+        data->pending[data->numPending++] = src[i];
+    }
 
-        resInd += 3;
+    if (numPad > 0) {
+        data->isPadded = TRUE;
+        if (data->numPending > 0)
+            return RaisePaddingError(t, frame[1], PADDING_BEFORE_END);
     }
 
-    if ((srcLen & 3) != 0)
+    return res;
+}
+
+
+/* Base64Decoder finish()
+   Check that there is no pending input. The decoder can be used to decode
+   new data after this. */
+static AValue Base64DecoderFinish(AThread *t, AValue *frame)
+{
+    CoderData *data = GetCoderData(frame[0]);
+    int numPending = data->numPending;
+
+    data->numPending = 0;
+    data->isPadded = FALSE;
+    if (numPending > 0)
         return ARaiseValueError(t, "Incorrect padding");
 
-    return res;
+    return AMakeStr(t, "");
+}
+
+
+/* Portable implementations */
+
+
+static void EncodeGroups_C(unsigned char *dst, const unsigned char *src,
+                           Assize_t len)
+{
+    Assize_t i;
+
+    for (i = 0; i < len; i += 3) {
+        unsigned long v = ((unsigned long)src[i] << 16) | (src[i + 1] << 8)
+            | src[i + 2];
+        dst[0] = Base64Alpha[v >> 18];
+        dst[1] = Base64Alpha[(v >> 12) & 63];
+        dst[2] = Base64Alpha[(v >> 6) & 63];
+        dst[3] = Base64Alpha[v & 63];
+        dst += 4;
+    }
+}
+
+
+static Assize_t DecodeGroups_C(unsigned char *dst, const unsigned char *src,
+                               Assize_t len)
+{
+    Assize_t i;
+
+    for (i = 0; i + 4 <= len; i += 4) {
+        int a = Base64DecMap[src[i]];
+        int b = Base64DecMap[src[i + 1]];
+        int c = Base64DecMap[src[i + 2]];
+        int d = Base64DecMap[src[i + 3]];
+        unsigned long v;
+
+        if ((a | b | c | d) < 0)
+            break;
+
+        v = ((unsigned long)a << 18) | (b << 12) | (c << 6) | d;
+        dst[0] = v >> 16;
+        dst[1] = v >> 8;
+        dst[2] = v;
+        dst += 3;
+    }
+
+    return i;
+}
+
+
+#ifdef HAVE_SIMD
+
+
+/* SSSE3 and AVX2 implementations (only used if supported by the processor).
+   Both use the same algorithm; the AVX2 variants process two 128-bit lanes
+   at a time. Encoding splits 3 bytes to 4 6-bit indices using shuffles and
+   multiplications and maps the indices to characters by adding an offset
+   that depends on the range of the index. Decoding validates characters
+   using a bitmap indexed by the high and low nibbles of each character,
+   maps them to 6-bit values by adding an offset that depends on the high
+   nibble and packs the values using multiply-add instructions. */
+
+
+#define SSSE3_FUNC __attribute__((target("ssse3")))
+#define AVX2_FUNC __attribute__((target("avx2")))
+
+
+/* Shuffle mask that places input bytes b1 b2 b3 of each group as b2 b1 b3 b2
+   (i.e. 16-bit little-endian words b1b2 and b2b3) */
+#define ENC_SHUFFLE 1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10
+/* Offsets to add to 6-bit indices, indexed by the range of the index */
+#define ENC_OFFSETS 'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, \
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, \
+        '+' - 62, '/' - 63, 'A', 0, 0
+/* Offsets to add to characters to get 6-bit values, indexed by the high
+   nibble ('/' needs a separate adjustment) */
+#define DEC_OFFSETS 0, 0, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0
+/* Bitmaps of valid high nibbles, indexed by the low nibble */
+#define DEC_VALID (char)0xa8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8, \
+        (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8, \
+        (char)0xf0, 0x54, 0x50, 0x50, 0x50, 0x54
+/* Bits corresponding to high nibbles */
+#define DEC_BITS 1, 2, 4, 8, 16, 32, 64, (char)128, 0, 0, 0, 0, 0, 0, 0, 0
+/* Shuffle mask that collects 3 bytes from each 32-bit word */
+#define DEC_SHUFFLE 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1
+
+
+SSSE3_FUNC
+static __m128i EncodeBlock_SSSE3(__m128i in)
+{
+    __m128i t0, t1, t2, t3, indices, range;
+
+    in = _mm_shuffle_epi8(in, _mm_setr_epi8(ENC_SHUFFLE));
+
+    t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    indices = _mm_or_si128(t1, t3);
+
+    range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    range = _mm_or_si128(range, _mm_and_si128(
+        _mm_cmpgt_epi8(_mm_set1_epi8(26), indices), _mm_set1_epi8(13)));
+
+    return _mm_add_epi8(indices, _mm_shuffle_epi8(
+        _mm_setr_epi8(ENC_OFFSETS), range));
+}
+
+
+SSSE3_FUNC
+static void EncodeGroups_SSSE3(unsigned char *dst, const unsigned char *src,
+                               Assize_t len)
+{
+    Assize_t i;
+
+    /* Each iteration reads 16 bytes but only uses 12 of them. */
+    for (i = 0; i + 16 <= len; i += 12) {
+        __m128i in = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)dst, EncodeBlock_SSSE3(in));
+        dst += 16;
+    }
+
+    EncodeGroups_C(dst, src + i, len - i);
+}
+
+
+/* Convert 16 characters to 6-bit values. Set *isValid to FALSE if some
+   character is not in the base64 alphabet. */
+SSSE3_FUNC
+static __m128i DecodeValues_SSSE3(__m128i in, ABool *isValid)
+{
+    __m128i hi = _mm_and_si128(_mm_srli_epi32(in, 4), _mm_set1_epi8(0x0f));
+    __m128i lo = _mm_and_si128(in, _mm_set1_epi8(0x0f));
+    __m128i valid = _mm_and_si128(
+        _mm_shuffle_epi8(_mm_setr_epi8(DEC_VALID), lo),
+        _mm_shuffle_epi8(_mm_setr_epi8(DEC_BITS), hi));
+    __m128i offset = _mm_shuffle_epi8(_mm_setr_epi8(DEC_OFFSETS), hi);
+
+    /* '/' and '+' share the high nibble; adjust the offset of '/'. */
+    offset = _mm_add_epi8(offset, _mm_and_si128(
+        _mm_cmpeq_epi8(in, _mm_set1_epi8('/')), _mm_set1_epi8(-3)));
+
+    *isValid = _mm_movemask_epi8(
+        _mm_cmpeq_epi8(valid, _mm_setzero_si128())) == 0;
+    return _mm_add_epi8(in, offset);
+}
+
+
+/* Pack 16 6-bit values to 12 bytes (followed by 4 zero bytes). */
+SSSE3_FUNC
+static __m128i PackValues_SSSE3(__m128i values)
+{
+    __m128i merged = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    merged = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+    return _mm_shuffle_epi8(merged, _mm_setr_epi8(DEC_SHUFFLE));
+}
+
+
+SSSE3_FUNC
+static Assize_t DecodeGroups_SSSE3(unsigned char *dst,
+                                   const unsigned char *src, Assize_t len)
+{
+    Assize_t i;
+
+    /* Each iteration writes 16 bytes but only 12 of them are used. Stop
+       early enough to stay within the bounds given in DecodeGroups. */
+    for (i = 0; i + 24 <= len; i += 16) {
+        __m128i in = _mm_loadu_si128((const __m128i *)(src + i));
+        ABool isValid;
+        __m128i values = DecodeValues_SSSE3(in, &isValid);
+        if (!isValid)
+            break;
+        _mm_storeu_si128((__m128i *)dst, PackValues_SSSE3(values));
+        dst += 12;
+    }
+
+    return i + DecodeGroups_C(dst, src + i, len - i);
+}
+
+
+AVX2_FUNC
+static void EncodeGroups_AVX2(unsigned char *dst, const unsigned char *src,
+                              Assize_t len)
+{
+    const __m256i shuffle = _mm256_setr_epi8(ENC_SHUFFLE, ENC_SHUFFLE);
+    const __m256i offsets = _mm256_setr_epi8(ENC_OFFSETS, ENC_OFFSETS);
+    Assize_t i;
+
+    /* Each iteration reads 28 bytes but only uses 24 of them. */
+    for (i = 0; i + 28 <= len; i += 24) {
+        __m256i in, t0, t1, t2, t3, indices, range;
+
+        /* Load bytes 0..11 to the low lane and 12..23 to the high lane. */
+        in = _mm256_inserti128_si256(_mm256_castsi128_si256(
+            _mm_loadu_si128((const __m128i *)(src + i))),
+            _mm_loadu_si128((const __m128i *)(src + i + 12)), 1);
+        in = _mm256_shuffle_epi8(in, shuffle);
+
+        t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+        t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+        t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        indices = _mm256_or_si256(t1, t3);
+
+        range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+        range = _mm256_or_si256(range, _mm256_and_si256(
+            _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices),
+            _mm256_set1_epi8(13)));
+
+        _mm256_storeu_si256((__m256i *)dst, _mm256_add_epi8(
+            indices, _mm256_shuffle_epi8(offsets, range)));
+        dst += 32;
+    }
+
+    EncodeGroups_SSSE3(dst, src + i, len - i);
+}
+
+
+AVX2_FUNC
+static Assize_t DecodeGroups_AVX2(unsigned char *dst,
+                                  const unsigned char *src, Assize_t len)
+{
+    const __m256i validLut = _mm256_setr_epi8(DEC_VALID, DEC_VALID);
+    const __m256i bitsLut = _mm256_setr_epi8(DEC_BITS, DEC_BITS);
+    const __m256i offsetLut = _mm256_setr_epi8(DEC_OFFSETS, DEC_OFFSETS);
+    const __m256i shuffle = _mm256_setr_epi8(DEC_SHUFFLE, DEC_SHUFFLE);
+    Assize_t i;
+
+    /* Each iteration writes 32 bytes but only 24 of them are used. Stop
+       early enough to stay within the bounds given in DecodeGroups. */
+    for (i = 0; i + 48 <= len; i += 32) {
+        __m256i in = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi32(in, 4),
+                                      _mm256_set1_epi8(0x0f));
+        __m256i lo = _mm256_and_si256(in, _mm256_set1_epi8(0x0f));
+        __m256i valid = _mm256_and_si256(_mm256_shuffle_epi8(validLut, lo),
+                                         _mm256_shuffle_epi8(bitsLut, hi));
+        __m256i offset = _mm256_shuffle_epi8(offsetLut, hi);
+        __m256i merged;
+
+        if (_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(valid, _mm256_setzero_si256())) != 0)
+            break;
+
+        offset = _mm256_add_epi8(offset, _mm256_and_si256(
+            _mm256_cmpeq_epi8(in, _mm256_set1_epi8('/')),
+            _mm256_set1_epi8(-3)));
+        merged = _mm256_maddubs_epi16(_mm256_add_epi8(in, offset),
+                                      _mm256_set1_epi32(0x01400140));
+        merged = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+        merged = _mm256_shuffle_epi8(merged, shuffle);
+        /* Move the 12 bytes of the high lane next to those of the low
+           lane. */
+        merged = _mm256_permutevar8x32_epi32(
+            merged, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+        _mm256_storeu_si256((__m256i *)dst, merged);
+        dst += 24;
+    }
+
+    return i + DecodeGroups_SSSE3(dst, src + i, len - i);
+}
+
+
+#endif /* HAVE_SIMD */
+
+
+/* Choose the fastest implementations supported by the processor. Multiple
+   threads may call this simultaneously; they all store the same values. */
+static void SelectImplementation(void)
+{
+#ifdef HAVE_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        EncodeGroupsImpl = EncodeGroups_AVX2;
+        DecodeGroupsImpl = DecodeGroups_AVX2;
+    } else if (__builtin_cpu_supports("ssse3")) {
+        EncodeGroupsImpl = EncodeGroups_SSSE3;
+        DecodeGroupsImpl = DecodeGroups_SSSE3;
+    }
+#endif
+
+    IsInitialized = TRUE;
 }
 
 
 A_MODULE(base64, "base64")
     A_DEF("Base64Encode", 1, 0, Base64Encode)
     A_DEF("Base64Decode", 1, 0, Base64Decode)
+
+    /* NOTE: The classes have no slots, so the offset of the binary data is
+             the same for both. */
+
+    A_CLASS("Base64Encoder")
+        A_BINARY_DATA_P(sizeof(CoderData), &CoderDataOffset)
+        A_METHOD("create", 0, 0, CoderCreate)
+        A_METHOD("encode", 1, 0, Base64EncoderEncode)
+        A_METHOD("finish", 0, 0, Base64EncoderFinish)
+    A_END_CLASS()
+
+    A_CLASS("Base64Decoder")
+        A_BINARY_DATA_P(sizeof(CoderData), &CoderDataOffset)
+        A_METHOD("create", 0, 0, CoderCreate)
+        A_METHOD("decode", 1, 0, Base64DecoderDecode)
+        A_METHOD("finish", 0, 0, Base64DecoderFinish)
+    A_END_CLASS()
 A_END_MODULE()
@@ -50,7 +50,7 @@ AValue ACallValue(AThread *t, AValue funcVal, int fullNumArgs,
 
         func = AValueToFunction(funcVal);
 
-        stackFrameSize = func->stackFrameSize;
+        stackFrameSize = ACallFrameSize(func, fullNumArgs, func->maxArgs);
         newStack = APreviousFrame(stack, stackFrameSize);
         if (newStack < t->stack)
             return ARaiseStackOverflowError(t);
@@ -183,23 +183,23 @@ AValue ACallValue(AThread *t, AValue funcVal, int fullNumArgs,
 
 AValue ACallMethodByNum(AThread *t, int member, int numArgs, AValue *args)
 {
-    AInstance *inst;
     ATypeInfo *type;
     AMemberHashTable *table;
     AMemberNode *node;
     AValue funcVal;
     AValue self;
 
+    /* Objects with special representations are only wrapped if calling a
+       data member. */
     self = args[0];
-    if (!AIsInstance(args[0])) {
-        self = AWrapObject(t, args[0]);
-        if (AIsError(self))
-            return AError;
+    if (AIsInstance(self))
+        type = AGetInstanceType(AValueToInstance(self));
+    else {
+        type = AWrapperType(self);
+        if (type == NULL)
+            return ARaiseMemberErrorND(t, self, -1);
     }
 
-    inst = AValueToInstance(self);
-    type = AGetInstanceType(inst);
-
     /* Try to find a method in the method table, going up in the inheritance
        chain if not found. */
     table = AGetMemberTable(type, MT_METHOD_PUBLIC);
@@ -209,7 +209,11 @@ AValue ACallMethodByNum(AThread *t, int member, int numArgs, AValue *args)
             if (type->super == NULL) {
                 /* Not found. Try to fetch a data member and call that
                    instead. */
-                funcVal = AGetInstanceDataMember(t, inst, member);
+                self = AWrapObject(t, args[0]);
+                if (AIsError(self))
+                    return AError;
+                funcVal = AGetInstanceDataMember(t, AValueToInstance(self),
+                                                 member);
                 if (!AIsError(funcVal)) {
                     int i;
 
@@ -276,7 +280,6 @@ AValue ACallIndirect(struct AThread_ *t, AValue funcVal,
 AValue ACallMethodIndirect(AThread *t, int member, int numArgs,
                           AOpcode *argInd)
 {
-    AInstance *inst;
     ATypeInfo *type;
     AMemberHashTable *table;
     AMemberNode *node;
@@ -284,16 +287,17 @@ AValue ACallMethodIndirect(AThread *t, int member, int numArgs,
     AValue self;
     AValue *newStack;
 
+    /* Objects with special representations are only wrapped if calling a
+       data member. */
     self = t->stackPtr[argInd[0]];
-    if (!AIsInstance(self)) {
-        self = AWrapObject(t, self);
-        if (AIsError(self))
-            return AError;
+    if (AIsInstance(self))
+        type = AGetInstanceType(AValueToInstance(self));
+    else {
+        type = AWrapperType(self);
+        if (type == NULL)
+            return ARaiseMemberErrorND(t, self, -1);
     }
 
-    inst = AValueToInstance(self);
-    type = AGetInstanceType(inst);
-
     /* Try to find a method in the method table, going up in the inheritance
        chain if not found. */
     table = AGetMemberTable(type, MT_METHOD_PUBLIC);
@@ -303,7 +307,11 @@ AValue ACallMethodIndirect(AThread *t, int member, int numArgs,
             if (type->super == NULL) {
                 /* Not found. Try to fetch a data member and call that
                    instead. */
-                funcVal = AGetInstanceDataMember(t, inst, member);
+                self = AWrapObject(t, t->stackPtr[argInd[0]]);
+                if (AIsError(self))
+                    return AError;
+                funcVal = AGetInstanceDataMember(t, AValueToInstance(self),
+                                                 member);
                 if (!AIsError(funcVal))
                     return ACallIndirect(t, funcVal, numArgs, argInd + 1);
                 else
@@ -370,7 +378,7 @@ AValue *ASetupFrame(AThread *t, AValue funcVal, int fullNumArgs,
 
         func = AValueToFunction(funcVal);
 
-        stackFrameSize = func->stackFrameSize;
+        stackFrameSize = ACallFrameSize(func, fullNumArgs, func->maxArgs);
         newStack = APreviousFrame(stack, stackFrameSize);
         if (newStack < t->stack) {
             ARaiseStackOverflowError(t);
@@ -469,7 +477,8 @@ AValue *ASetupMethodFrame(AThread *t, AValue funcVal, AValue instance,
 
     func = AValueToFunction(funcVal);
 
-    stackFrameSize = func->stackFrameSize;
+    stackFrameSize = ACallFrameSize(func, fullNumArgs,
+                                    func->maxArgs - 1);
     newStack = APreviousFrame(stack, stackFrameSize);
     if (newStack < t->stack) {
         ARaiseStackOverflowError(t);
@@ -487,7 +496,7 @@ AValue *ASetupMethodFrame(AThread *t, AValue funcVal, AValue instance,
         *sp = AZero;
 
     /* Store self. */
-    newStack[3] = AInstanceToValue(instance);
+    newStack[3] = instance;
 
     /* Check and store arguments. */
     if (fullNumArgs != func->maxArgs - 1 || numArgs != fullNumArgs) {
@@ -647,6 +656,17 @@ ABool ASetupArguments(AThread *t, AValue *src, const AOpcode *ip, int argc,
 
         aLen = (argc > maxArgsCnt ? argc - maxArgsCnt : 0);
 
+        /* The caller has reserved space for the extra arguments at the end
+           of the frame if the callee accepts them as a stack slice. */
+        if (AValueToFunction(t->stackPtr[1])->flags & A_FUNC_VAR_ARG_SLICE) {
+            AValue *slice = (AValue *)ANextFrame(t->stackPtr,
+                                                t->stackPtr[0]) - aLen;
+            for (i = 0; i < aLen; i++)
+                slice[i] = src[ip[maxArgsCnt + i]];
+            dst[maxArgsCnt] = AIntToValue(aLen);
+            return TRUE;
+        }
+
         /* Initialiaze the value of the vararg argument so that the gc won't
            see garbage. */
         dst[maxArgsCnt] = AZero;
@@ -23,6 +23,9 @@ extern AModuleDef AunicodeModuleDef[];
 extern AModuleDef A__packModuleDef[];
 extern AModuleDef AosModuleDef[];
 extern AModuleDef AsetModuleDef[];
+extern AModuleDef ApackedarrayModuleDef[];
+extern AModuleDef AjsonModuleDef[];
+extern AModuleDef AcsvModuleDef[];
 extern AModuleDef A__asmModuleDef[];
 
 
@@ -39,6 +42,9 @@ AModuleDef *AAllModules[] = {
     ArandomModuleDef,
     AbitopModuleDef,
     AsetModuleDef,
+    ApackedarrayModuleDef,
+    AjsonModuleDef,
+    AcsvModuleDef,
     A__timeModuleDef,
     A__packModuleDef,
 #ifdef A_HAVE_OS_MODULE
@@ -0,0 +1,796 @@
+/* csv_module.c - csv module (reading and writing CSV files)
+
+   Copyright (c) 2010-2011 Jukka Lehtosalo
+
+   Alore is licensed under the terms of the MIT license.  See the file
+   LICENSE.txt in the distribution.
+*/
+
+/* CsvReader parses rows directly from the input buffer of a Stream object,
+   i.e. the same buffer that Stream readLn uses, so that reading rows can be
+   freely mixed with other Stream read operations. A field that is contained
+   within a single buffer and has no escaped quotes is created as a substring
+   of the buffer, without copying it if it is long. Delimiters, line breaks
+   and quotes are found 16 characters at a time using SSE2 instructions if
+   available.
+
+   CsvWriter formats each row directly into the output buffer of a buffered
+   stream if there is room for it, and otherwise passes the formatted row to
+   the write method of the stream, which flushes the buffer as needed. */
+
+#include "alore.h"
+#include "runtime.h"
+#include "str.h"
+#include "array.h"
+#include "io_module.h"
+#include "errmsg.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__SSE2__) \
+    && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+
+/* Global num of the CsvReader iterator class */
+static int CsvReaderIterNum;
+
+
+/* Slot ids for CsvReader objects */
+#define READER_STREAM 0
+#define READER_DELIM 1
+#define READER_QUOTE 2
+#define READER_SKIP_LF 3  /* 1 if a LF that follows a CR should be skipped */
+
+/* Slot ids for CsvWriter objects */
+#define WRITER_STREAM 0
+#define WRITER_DELIM 1
+#define WRITER_QUOTE 2
+
+/* Slot ids for CsvReader iterator objects */
+#define ITER_READER 0
+
+
+/* Parser states */
+enum {
+    FIELD_START,  /* At the start of a field */
+    IN_FIELD,     /* Within an unquoted field */
+    IN_QUOTED,    /* Within the quoted part of a field */
+    AFTER_QUOTE   /* After a quote character within a quoted field */
+};
+
+
+/* Return the index of the first character in s[i..end) that is equal to c1,
+   c2, c3 or c4, or end if there is no such character. The characters must be
+   ASCII characters. */
+static Assize_t FindNarrow(const unsigned char *s, Assize_t i, Assize_t end,
+                           int c1, int c2, int c3, int c4)
+{
+#ifdef HAVE_SSE2
+    __m128i v1 = _mm_set1_epi8((char)c1);
+    __m128i v2 = _mm_set1_epi8((char)c2);
+    __m128i v3 = _mm_set1_epi8((char)c3);
+    __m128i v4 = _mm_set1_epi8((char)c4);
+
+    for (; i + 16 <= end; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        int mask = _mm_movemask_epi8(
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, v1),
+                                      _mm_cmpeq_epi8(v, v2)),
+                         _mm_or_si128(_mm_cmpeq_epi8(v, v3),
+                                      _mm_cmpeq_epi8(v, v4))));
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+#endif
+
+    for (; i < end; i++) {
+        int ch = s[i];
+        if (ch == c1 || ch == c2 || ch == c3 || ch == c4)
+            break;
+    }
+
+    return i;
+}
+
+
+/* Wide version of FindNarrow. */
+static Assize_t FindWide(const AWideChar *s, Assize_t i, Assize_t end,
+                         int c1, int c2, int c3, int c4)
+{
+    for (; i < end; i++) {
+        int ch = s[i];
+        if (ch == c1 || ch == c2 || ch == c3 || ch == c4)
+            break;
+    }
+    return i;
+}
+
+
+/* Return a pointer to the items of a Str object in *narrow or *wide (the
+   other one is set to NULL) and return the length of the string. */
+static Assize_t StrItems(AValue s, const unsigned char **narrow,
+                         const AWideChar **wide)
+{
+    *narrow = NULL;
+    *wide = NULL;
+    if (AIsNarrowStr(s)) {
+        *narrow = AGetStrElem(s);
+        return AGetStrLen(AValueToStr(s));
+    } else if (AIsWideStr(s)) {
+        *wide = AGetWideStrElem(s);
+        return AGetWideStrLen(AValueToWideStr(s));
+    } else if (AIsNarrowSubStr(s)) {
+        *narrow = AGetSubStrElem(s);
+        return AGetSubStrLen(AValueToSubStr(s));
+    } else {
+        *wide = AGetWideSubStrElem(s);
+        return AGetSubStrLen(AValueToSubStr(s));
+    }
+}
+
+
+/* Store the delimiter and the quote character given as optional arguments
+   frame[2] and frame[3] to slots delimSlot and delimSlot + 1 of frame[0]. */
+static AValue SetFormat(AThread *t, AValue *frame, int delimSlot)
+{
+    int delim = ',';
+    int quote = '"';
+
+    if (!AIsDefault(frame[2])) {
+        if (!AIsStr(frame[2]) || AStrLen(frame[2]) != 1)
+            return ARaiseTypeErrorND(t, "Delimiter must be a character");
+        delim = AStrItem(frame[2], 0);
+    }
+    if (!AIsDefault(frame[3])) {
+        if (!AIsStr(frame[3]) || AStrLen(frame[3]) != 1)
+            return ARaiseTypeErrorND(t, "Quote must be a character");
+        quote = AStrItem(frame[3], 0);
+    }
+
+    if (delim >= 128 || quote >= 128)
+        return ARaiseValueErrorND(
+            t, "Delimiter and quote must be ASCII characters");
+    if (delim == '\r' || delim == '\n' || quote == '\r' || quote == '\n')
+        return ARaiseValueErrorND(
+            t, "Line break used as a delimiter or a quote");
+    if (delim == quote)
+        return ARaiseValueErrorND(
+            t, "Delimiter and quote must be different");
+
+    ASetMemberDirect(t, frame[0], delimSlot, AIntToValue(delim));
+    ASetMemberDirect(t, frame[0], delimSlot + 1, AIntToValue(quote));
+
+    return ANil;
+}
+
+
+/* Reader */
+
+
+/* Return the character at index i of the input buffer of stream. */
+#define BufferItem(stream, i) \
+    AStrItem(AMemberDirect(stream, A_STREAM_INPUT_BUF), i)
+
+
+/* Return the index of the first character in range [i, end) of the input
+   buffer of stream that is equal to c1, c2 or c3, or end if not found. */
+static Assize_t FindInBuffer(AValue stream, Assize_t i, Assize_t end,
+                             int c1, int c2, int c3)
+{
+    AValue buf = AMemberDirect(stream, A_STREAM_INPUT_BUF);
+    if (AIsNarrowStr(buf))
+        return FindNarrow(AGetStrElem(buf), i, end, c1, c2, c3, c3);
+    else
+        return FindWide(AGetWideStrElem(buf), i, end, c1, c2, c3, c3);
+}
+
+
+/* Mark the input buffer of stream consumed up to index i. */
+static void ConsumeBuffer(AValue stream, Assize_t i)
+{
+    AInstance *inst = AValueToInstance(stream);
+
+    if (i == AValueToInt(inst->member[A_STREAM_INPUT_BUF_END])) {
+        inst->member[A_STREAM_INPUT_BUF] = AZero;
+        inst->member[A_STREAM_INPUT_BUF_IND] = AZero;
+        inst->member[A_STREAM_INPUT_BUF_END] = AZero;
+    } else
+        inst->member[A_STREAM_INPUT_BUF_IND] = AIntToValue(i);
+}
+
+
+/* Make sure that the input buffer of stream frame[1] is not empty. frame[2]
+   is a temporary location. Return 1 if successful, 0 at the end of the
+   stream and -1 if an exception was raised. */
+static int FillBuffer(AThread *t, AValue *frame)
+{
+    AInstance *inst = AValueToInstance(frame[1]);
+    AValue status;
+
+    if (inst->member[A_STREAM_INPUT_BUF] != AZero)
+        return 1;
+
+    if ((inst->member[A_STREAM_MODE] & A_MODE_INPUT) == 0) {
+        ARaiseIoError(t, AMsgWriteOnly);
+        return -1;
+    }
+
+    status = AStreamFillInputBuffer(t, frame + 1);
+    if (AIsError(status))
+        return -1;
+
+    return status != ANil;
+}
+
+
+/* Skip a LF that follows a CR at the end of the previous row if needed.
+   Return 1 if there is another row, 0 if there are no more rows and -1 if an
+   exception was raised. frame[0] is the reader, frame[1] the stream and
+   frame[2] a temporary location. */
+static int HasRow(AThread *t, AValue *frame)
+{
+    for (;;) {
+        Assize_t i;
+        int status;
+
+        status = FillBuffer(t, frame);
+        if (status <= 0)
+            return status;
+        if (AMemberDirect(frame[0], READER_SKIP_LF) == AZero)
+            return 1;
+
+        ASetMemberDirect(t, frame[0], READER_SKIP_LF, AZero);
+        i = AValueToInt(AMemberDirect(frame[1], A_STREAM_INPUT_BUF_IND));
+        if (BufferItem(frame[1], i) != '\n')
+            return 1;
+        ConsumeBuffer(frame[1], i + 1);
+    }
+}
+
+
+/* Append range [beg, end) of the input buffer of stream frame[1] to the
+   pieces of the current field in frame[4]. */
+static void AddPiece(AThread *t, AValue *frame, Assize_t beg, Assize_t end)
+{
+    if (frame[4] == AZero)
+        frame[4] = AMakeArray(t, 0);
+    frame[5] = ASubStr(t, AMemberDirect(frame[1], A_STREAM_INPUT_BUF), beg,
+                       end);
+    AAppendArray(t, frame[4], frame[5]);
+}
+
+
+/* Append the field that ends with range [beg, end) of the input buffer of
+   stream frame[1] to the row frame[3]. If beg < 0, the field consists only
+   of the pieces collected earlier. Return FALSE if an exception was
+   raised. */
+static ABool EndField(AThread *t, AValue *frame, Assize_t beg, Assize_t end)
+{
+    if (frame[4] == AZero) {
+        if (beg < 0)
+            frame[5] = AMakeStr(t, "");
+        else
+            frame[5] = ASubStr(t, AMemberDirect(frame[1], A_STREAM_INPUT_BUF),
+                               beg, end);
+    } else {
+        if (beg >= 0 && end > beg)
+            AddPiece(t, frame, beg, end);
+        frame[5] = AJoin(t, frame[4], ADefault);
+        if (AIsError(frame[5]))
+            return FALSE;
+        frame[4] = AZero;
+    }
+    AAppendArray(t, frame[3], frame[5]);
+    return TRUE;
+}
+
+
+/* Read a row from the reader frame[0]. Return an Array of Str objects, or nil
+   if there are no more rows. frame[1..5] are temporary locations. */
+static AValue ReadRow(AThread *t, AValue *frame)
+{
+    int delim = AValueToInt(AMemberDirect(frame[0], READER_DELIM));
+    int quote = AValueToInt(AMemberDirect(frame[0], READER_QUOTE));
+    int state = FIELD_START;
+    int status;
+
+    frame[1] = AMemberDirect(frame[0], READER_STREAM);
+    status = HasRow(t, frame);
+    if (status <= 0)
+        return status == 0 ? ANil : AError;
+
+    frame[3] = AMakeArray(t, 0);
+    frame[4] = AZero;
+
+    for (;;) {
+        Assize_t i;
+        Assize_t beg;
+        Assize_t end;
+
+        status = FillBuffer(t, frame);
+        if (status < 0)
+            return AError;
+        else if (status == 0) {
+            /* End of stream */
+            if (state == IN_QUOTED)
+                return ARaiseValueErrorND(t, "Unterminated quoted field");
+            if (!EndField(t, frame, -1, -1))
+                return AError;
+            return frame[3];
+        }
+
+        /* [beg, i) is the part of the current field that has been scanned
+           but not yet copied to frame[4]. */
+        i = AValueToInt(AMemberDirect(frame[1], A_STREAM_INPUT_BUF_IND));
+        end = AValueToInt(AMemberDirect(frame[1], A_STREAM_INPUT_BUF_END));
+        beg = i;
+
+        while (i < end) {
+            int ch;
+
+            switch (state) {
+            case FIELD_START:
+                ch = BufferItem(frame[1], i);
+                if (ch == quote) {
+                    i++;
+                    beg = i;
+                    state = IN_QUOTED;
+                    break;
+                } else if ((ch == '\r' || ch == '\n')
+                           && AArrayLen(frame[3]) == 0) {
+                    /* An empty line is an empty row. */
+                    i++;
+                    goto EndOfRow;
+                }
+                beg = i;
+                state = IN_FIELD;
+                /* Fall through */
+
+            case IN_FIELD:
+                i = FindInBuffer(frame[1], i, end, delim, '\r', '\n');
+                if (i == end)
+                    break;
+                ch = BufferItem(frame[1], i);
+                if (!EndField(t, frame, beg, i))
+                    return AError;
+                i++;
+                goto EndOfField;
+
+            case IN_QUOTED:
+                i = FindInBuffer(frame[1], i, end, quote, quote, quote);
+                if (i < end) {
+                    i++;
+                    state = AFTER_QUOTE;
+                }
+                break;
+
+            case AFTER_QUOTE:
+                /* The quote is at i - 1, or at the end of the previous
+                   buffer if i == beg. */
+                ch = BufferItem(frame[1], i);
+                if (ch == quote) {
+                    /* Escaped quote; the first quote is a part of the
+                       field. */
+                    if (i > beg)
+                        AddPiece(t, frame, beg, i);
+                    else {
+                        if (frame[4] == AZero)
+                            frame[4] = AMakeArray(t, 0);
+                        frame[5] = AMakeCh(t, quote);
+                        AAppendArray(t, frame[4], frame[5]);
+                    }
+                    i++;
+                    beg = i;
+                    state = IN_QUOTED;
+                } else if (ch == delim || ch == '\r' || ch == '\n') {
+                    if (!EndField(t, frame, beg, i > beg ? i - 1 : beg))
+                        return AError;
+                    i++;
+                    goto EndOfField;
+                } else {
+                    /* Text after the closing quote is a part of the
+                       field. */
+                    if (i - 1 > beg)
+                        AddPiece(t, frame, beg, i - 1);
+                    beg = i;
+                    state = IN_FIELD;
+                }
+                break;
+            }
+
+            continue;
+
+          EndOfField:
+
+            if (ch == delim) {
+                state = FIELD_START;
+                continue;
+            }
+
+          EndOfRow:
+
+            /* Consume a CR+LF line break in full if possible. */
+            if (ch == '\r') {
+                if (i == end)
+                    ASetMemberDirect(t, frame[0], READER_SKIP_LF,
+                                     AIntToValue(1));
+                else if (BufferItem(frame[1], i) == '\n')
+                    i++;
+            }
+            ConsumeBuffer(frame[1], i);
+            return frame[3];
+        }
+
+        /* The buffer ended within the row. Save the unsaved part of the
+           current field before reading more data. */
+        if (state == IN_FIELD || state == IN_QUOTED) {
+            if (end > beg)
+                AddPiece(t, frame, beg, end);
+        } else if (state == AFTER_QUOTE) {
+            if (end - 1 > beg)
+                AddPiece(t, frame, beg, end - 1);
+        }
+        ConsumeBuffer(frame[1], end);
+    }
+}
+
+
+/* CsvReader create(stream[, delimiter[, quote]]) */
+static AValue CsvReaderCreate(AThread *t, AValue *frame)
+{
+    if (AIsOfType(frame[1], AGlobalByNum(AStreamClassNum)) != A_IS_TRUE)
+        return ARaiseTypeErrorND(t, "Stream expected (but %T found)",
+                                 frame[1]);
+    ASetMemberDirect(t, frame[0], READER_STREAM, frame[1]);
+    ASetMemberDirect(t, frame[0], READER_SKIP_LF, AZero);
+    if (AIsError(SetFormat(t, frame, READER_DELIM)))
+        return AError;
+    return frame[0];
+}
+
+
+/* CsvReader readRow() */
+static AValue CsvReaderReadRow(AThread *t, AValue *frame)
+{
+    return ReadRow(t, frame);
+}
+
+
+/* CsvReader iterator() */
+static AValue CsvReaderIter(AThread *t, AValue *frame)
+{
+    return ACallValue(t, AGlobalByNum(CsvReaderIterNum), 1, frame);
+}
+
+
+/* The create method of CsvReader iterator. */
+static AValue CsvReaderIterCreate(AThread *t, AValue *frame)
+{
+    ASetMemberDirect(t, frame[0], ITER_READER, frame[1]);
+    return frame[0];
+}
+
+
+/* CsvReader iterator hasNext() */
+static AValue CsvReaderIterHasNext(AThread *t, AValue *frame)
+{
+    int status;
+
+    frame[1] = AMemberDirect(frame[0], ITER_READER);
+    frame[2] = AMemberDirect(frame[1], READER_STREAM);
+    status = HasRow(t, frame + 1);
+    if (status < 0)
+        return AError;
+    return status ? ATrue : AFalse;
+}
+
+
+/* CsvReader iterator next() */
+static AValue CsvReaderIterNext(AThread *t, AValue *frame)
+{
+    AValue row;
+
+    frame[1] = AMemberDirect(frame[0], ITER_READER);
+    row = ReadRow(t, frame + 1);
+    if (AIsNil(row))
+        return ARaiseValueErrorND(t, "No items left");
+    return row;
+}
+
+
+/* Writer */
+
+
+/* Return TRUE if a field with the given contents must be quoted. */
+static ABool NeedsQuotes(const unsigned char *s, const AWideChar *w,
+                         Assize_t len, int delim, int quote)
+{
+    if (s != NULL)
+        return FindNarrow(s, 0, len, delim, quote, '\r', '\n') < len;
+    else
+        return FindWide(w, 0, len, delim, quote, '\r', '\n') < len;
+}
+
+
+/* Return the number of characters in the formatted version of field v (a
+   Str object or nil). If quoteEmpty is TRUE, an empty field is quoted.
+   Set *isWide to TRUE if the field has wide characters. */
+static Assize_t FieldLength(AValue v, int delim, int quote, ABool quoteEmpty,
+                            ABool *isWide)
+{
+    const unsigned char *s;
+    const AWideChar *w;
+    Assize_t len;
+    Assize_t numQuotes;
+    Assize_t i;
+
+    if (AIsNil(v))
+        return quoteEmpty ? 2 : 0;
+
+    len = StrItems(v, &s, &w);
+    if (w != NULL)
+        *isWide = TRUE;
+    if (len == 0)
+        return quoteEmpty ? 2 : 0;
+    if (!NeedsQuotes(s, w, len, delim, quote))
+        return len;
+
+    /* Add the enclosing quotes and double each quote within the field. */
+    numQuotes = 0;
+    for (i = 0; ; i++) {
+        if (s != NULL)
+            i = FindNarrow(s, i, len, quote, quote, quote, quote);
+        else
+            i = FindWide(w, i, len, quote, quote, quote, quote);
+        if (i == len)
+            break;
+        numQuotes++;
+    }
+    return len + numQuotes + 2;
+}
+
+
+/* Store the formatted version of field v (a Str object or nil) at dst[pos]
+   or dstW[pos] (the other one is NULL). If quoteEmpty is TRUE, an empty
+   field is quoted. Return the position after the field. */
+static Assize_t FormatField(AValue v, unsigned char *dst, AWideChar *dstW,
+                            Assize_t pos, int delim, int quote,
+                            ABool quoteEmpty)
+{
+    const unsigned char *s;
+    const AWideChar *w;
+    Assize_t len;
+    Assize_t i;
+    ABool isQuoted;
+
+    if (AIsNil(v))
+        len = 0, s = NULL, w = NULL;
+    else
+        len = StrItems(v, &s, &w);
+
+    isQuoted = len == 0 ? quoteEmpty : NeedsQuotes(s, w, len, delim, quote);
+    if (isQuoted) {
+        if (dst != NULL)
+            dst[pos++] = quote;
+        else
+            dstW[pos++] = quote;
+    }
+
+    if (len == 0)
+        ;
+    else if (dst != NULL && s != NULL && !isQuoted) {
+        /* Fast path for narrow fields that need no escaping */
+        memcpy(dst + pos, s, len);
+        pos += len;
+    } else {
+        for (i = 0; i < len; i++) {
+            int ch = s != NULL ? s[i] : w[i];
+            if (dst != NULL)
+                dst[pos++] = ch;
+            else
+                dstW[pos++] = ch;
+            if (ch == quote && isQuoted) {
+                if (dst != NULL)
+                    dst[pos++] = ch;
+                else
+                    dstW[pos++] = ch;
+            }
+        }
+    }
+
+    if (isQuoted) {
+        if (dst != NULL)
+            dst[pos++] = quote;
+        else
+            dstW[pos++] = quote;
+    }
+
+    return pos;
+}
+
+
+/* Store the formatted version of the row in frame[2], followed by CR+LF, at
+   dst or dstW (the other one is NULL). A row with a single empty field is
+   written as "" so that it can be distinguished from an empty row. */
+static void FormatRow(AValue *frame, unsigned char *dst, AWideChar *dstW,
+                      int delim, int quote)
+{
+    Assize_t n = AArrayOrTupleLen(frame[2]);
+    Assize_t pos = 0;
+    Assize_t i;
+
+    for (i = 0; i < n; i++) {
+        if (i > 0) {
+            if (dst != NULL)
+                dst[pos++] = delim;
+            else
+                dstW[pos++] = delim;
+        }
+        pos = FormatField(AArrayOrTupleItem(frame[2], i), dst, dstW, pos,
+                          delim, quote, n == 1);
+    }
+
+    if (dst != NULL) {
+        dst[pos] = '\r';
+        dst[pos + 1] = '\n';
+    } else {
+        dstW[pos] = '\r';
+        dstW[pos + 1] = '\n';
+    }
+}
+
+
+/* Write row frame[1] using writer frame[0]. frame[2..4] are temporary
+   locations. */
+static AValue WriteRow(AThread *t, AValue *frame)
+{
+    int delim = AValueToInt(AMemberDirect(frame[0], WRITER_DELIM));
+    int quote = AValueToInt(AMemberDirect(frame[0], WRITER_QUOTE));
+    AInstance *inst;
+    ABool isWide;
+    Assize_t n;
+    Assize_t len;
+    Assize_t i;
+
+    /* Get the fields as an Array or a Tuple of Str and nil values in
+       frame[2]. Only copy the row if some fields must be converted. */
+    if (AIsArrayOrTuple(frame[1]))
+        frame[2] = frame[1];
+    else {
+        n = ALen(t, frame[1]);
+        if (n < 0)
+            return AError;
+        frame[2] = AMakeArray(t, n);
+        for (i = 0; i < n; i++) {
+            frame[3] = AGetItemAt(t, frame[1], i);
+            if (AIsError(frame[3]))
+                return AError;
+            ASetArrayItem(t, frame[2], i, frame[3]);
+        }
+        frame[1] = frame[2];
+    }
+
+    n = AArrayOrTupleLen(frame[2]);
+    for (i = 0; i < n; i++) {
+        AValue v = AArrayOrTupleItem(frame[2], i);
+        if (!AIsStr(v) && !AIsNil(v)) {
+            if (frame[2] == frame[1] && !AIsArray(frame[2])) {
+                Assize_t j;
+                frame[2] = AMakeArray(t, n);
+                for (j = 0; j < n; j++)
+                    ASetArrayItem(t, frame[2], j,
+                                  AArrayOrTupleItem(frame[1], j));
+            } else if (frame[2] == frame[1])
+                frame[2] = ASubArray(t, frame[1], 0, n);
+            frame[3] = AToStr(t, AArrayItem(frame[2], i));
+            if (AIsError(frame[3]))
+                return AError;
+            ASetArrayItem(t, frame[2], i, frame[3]);
+        }
+    }
+
+    /* Calculate the length of the formatted row, including CR+LF. */
+    len = n > 0 ? n + 1 : 2;
+    isWide = FALSE;
+    for (i = 0; i < n; i++)
+        len += FieldLength(AArrayOrTupleItem(frame[2], i), delim, quote,
+                           n == 1, &isWide);
+
+    frame[3] = AMemberDirect(frame[0], WRITER_STREAM);
+    inst = AValueToInstance(frame[3]);
+
+    if (!isWide
+        && inst->member[A_STREAM_OUTPUT_BUF] != AZero
+        && AIsNarrowStr(inst->member[A_STREAM_OUTPUT_BUF])
+        && inst->member[A_STREAM_BUF_MODE] == A_BUFMODE_BUFFERED
+        && AGetStrLen(AValueToStr(inst->member[A_STREAM_OUTPUT_BUF]))
+           - AValueToInt(inst->member[A_STREAM_OUTPUT_BUF_IND]) >= len) {
+        /* Format the row directly into the output buffer of the stream. */
+        Assize_t ind = AValueToInt(inst->member[A_STREAM_OUTPUT_BUF_IND]);
+        FormatRow(frame, AGetStrElem(inst->member[A_STREAM_OUTPUT_BUF]) + ind,
+                  NULL, delim, quote);
+        inst->member[A_STREAM_OUTPUT_BUF_IND] = AIntToValue(ind + len);
+        return ANil;
+    } else {
+        /* Format the row as a Str object and write it using the stream. */
+        if (isWide) {
+            frame[4] = AMakeEmptyStrW(t, len);
+            FormatRow(frame, NULL, AStrPtrW(frame[4]), delim, quote);
+        } else {
+            frame[4] = AMakeEmptyStr(t, len);
+            FormatRow(frame, AStrPtr(frame[4]), NULL, delim, quote);
+        }
+        return ACallMethod(t, "write", 1, frame + 3);
+    }
+}
+
+
+/* CsvWriter create(stream[, delimiter[, quote]]) */
+static AValue CsvWriterCreate(AThread *t, AValue *frame)
+{
+    if (AIsOfType(frame[1], AGlobalByNum(AStreamClassNum)) != A_IS_TRUE)
+        return ARaiseTypeErrorND(t, "Stream expected (but %T found)",
+                                 frame[1]);
+    ASetMemberDirect(t, frame[0], WRITER_STREAM, frame[1]);
+    if (AIsError(SetFormat(t, frame, WRITER_DELIM)))
+        return AError;
+    return frame[0];
+}
+
+
+/* CsvWriter writeRow(row) */
+static AValue CsvWriterWriteRow(AThread *t, AValue *frame)
+{
+    if (AIsError(WriteRow(t, frame)))
+        return AError;
+    return ANil;
+}
+
+
+/* CsvWriter writeRows(rows) */
+static AValue CsvWriterWriteRows(AThread *t, AValue *frame)
+{
+    Assize_t n = ALen(t, frame[1]);
+    Assize_t i;
+
+    if (n < 0)
+        return AError;
+
+    for (i = 0; i < n; i++) {
+        frame[2] = frame[0];
+        frame[3] = AGetItemAt(t, frame[1], i);
+        if (AIsError(frame[3]) || AIsError(WriteRow(t, frame + 2)))
+            return AError;
+        if (ACheckInterrupt(t))
+            return AError;
+    }
+
+    return ANil;
+}
+
+
+A_MODULE(csv, "csv")
+    A_IMPORT("io")
+
+    A_CLASS_PRIV("CsvReader", 4)
+        A_IMPLEMENT("std::Iterable")
+        A_METHOD_OPT("create", 1, 3, 0, CsvReaderCreate)
+        A_METHOD("readRow", 0, 5, CsvReaderReadRow)
+        A_METHOD("iterator", 0, 1, CsvReaderIter)
+    A_END_CLASS()
+
+    A_CLASS_PRIV_P(A_PRIVATE("CsvReaderIter"), 1, &CsvReaderIterNum)
+        A_METHOD("create", 1, 0, CsvReaderIterCreate)
+        A_METHOD("hasNext", 0, 3, CsvReaderIterHasNext)
+        A_METHOD("next", 0, 6, CsvReaderIterNext)
+    A_END_CLASS()
+
+    A_CLASS_PRIV("CsvWriter", 3)
+        A_METHOD_OPT("create", 1, 3, 0, CsvWriterCreate)
+        A_METHOD("writeRow", 1, 3, CsvWriterWriteRow)
+        A_METHOD("writeRows", 1, 5, CsvWriterWriteRows)
+    A_END_CLASS()
+A_END_MODULE()
@@ -701,6 +701,13 @@ void VerifyThreadData(AThread *t)
         VerifyValue(t->regExp[i]);
     }
 
+    /* Verify formatCache. */
+    for (i = 0; i < A_NUM_CACHED_FORMATS * 3; i++) {
+        if (!IsValidValue(t->formatCache[i]))
+            ADebugError_F("Invalid format cache entry in thread!\n");
+        VerifyValue(t->formatCache[i]);
+    }
+
     /* Verify untraced. */
     last = AGetGCListBlock(t->untracedEnd);
     for (b = t->untraced; b != last; b = b->next) {
@@ -291,6 +291,8 @@ void ADebugPrintValueWithType(AValue v)
 /* Display garbage collector statistics. */
 void AShowGCStats(void)
 {
+    int i;
+
     fprintf(stderr, "\n");
     fprintf(stderr, "*** Gargage collector stats ***\n");
     fprintf(stderr, "\n");
@@ -313,6 +315,17 @@ void AShowGCStats(void)
     fprintf(stderr,
             "  fullIncrementCount:  %lu\n", AGCStat.fullIncrementCount);
     fprintf(stderr, "\n");
+    fprintf(stderr, "Freezing threads\n");
+    fprintf(stderr, "----------------\n");
+    fprintf(stderr, "  freezeCount:   %lu\n", AGCStat.freezeCount);
+    fprintf(stderr, "  freezeTime:    %.6f s\n", AGCStat.freezeTime);
+    fprintf(stderr, "  maxFreezeTime: %.6f s\n", AGCStat.maxFreezeTime);
+    for (i = 0; i < A_FREEZE_HISTOGRAM_SIZE; i++) {
+        if (AGCStat.freezeHistogram[i] > 0)
+            fprintf(stderr, "    < %8lu us: %lu\n", 1UL << i,
+                    AGCStat.freezeHistogram[i]);
+    }
+    fprintf(stderr, "\n");
 }
 
 #endif
@@ -233,6 +233,16 @@ void ADisplayCode(void)
                     }
                 }
 
+                /* Pretty-print exception handler table. */
+                if (func->flags & A_FUNC_HANDLER_TABLE) {
+                    int n = code[j++];
+                    for (; n > 0; n--) {
+                        printf("%p handler_table %d, %d\n", code + j,
+                               code[j], code[j + 1]);
+                        j += 2;
+                    }
+                }
+
                 /* Pretty-print debugging and exception information. */
                 offset = 0;
                 line = 0;
@@ -11,6 +11,7 @@
 #include "str.h"
 #include "gc.h"
 #include "util.h"
+#include "utf8.h"
 
 
 /* Size of the reverse mapping (unicode => 8-bit) hash table of 8-bit
@@ -238,142 +239,125 @@ static AValue Utf8EncodingFactoryMethod(AThread *t, AValue *frame)
 }
 
 
-#define ITEM(s, i) \
-    (AIsNarrowSubStr(s) ? AGetSubStrElem(s)[(i)] : AStrItem(s, i))
-
-
-#define ChAt(self, str, i, unp) \
-    ((i) < 0 ? ENC_BUF(self)[(i) + (unp) + 1] : ITEM((str), (i)))
-
-
 /* Decode method of Utf8 */
 static AValue Utf8Decode(AThread *t, AValue *frame)
 {
-    int i, j;
-    int len;
-    int resultLen;
+    Assize_t i;
+    Assize_t len;
+    Assize_t start;
+    Assize_t end;
+    Assize_t numChars;
     int unprocessed;
-    int newUnprocessed;
-    AValue s;
+    int maxChar;
+    int first;
+    unsigned char *s;
+    AValue result;
 
     AExpectStr(t, frame[1]);
 
     len = AStrLen(frame[1]);
 
-    resultLen = 0;
+    /* Decode bytes from a narrow string. Wide characters larger than 255 are
+       invalid bytes; map them to 0xff, which is never valid in UTF-8. */
+    if (AIsNarrowStr(frame[1]) || AIsNarrowSubStr(frame[1]))
+        frame[2] = frame[1];
+    else {
+        frame[2] = AMakeEmptyStr(t, len);
+        for (i = 0; i < len; i++) {
+            AWideChar ch = AStrItem(frame[1], i);
+            AGetStrElem(frame[2])[i] = ch <= 0xff ? ch : 0xff;
+        }
+    }
 
+    /* Complete a sequence left unprocessed by the previous call. */
     unprocessed = ENC_BUF(frame[0])[0];
-    newUnprocessed = 0;
+    first = -1;
+    start = 0;
     if (unprocessed != 0) {
-        i = A_UTF8_SKIP(ENC_BUF(frame[0])[1]) - unprocessed;
-        if (i <= len)
-            resultLen++;
-        else
-            newUnprocessed = unprocessed;
-    } else
-        i = 0;
-
-    if (i < len) {
-        for (;;) {
-            AWideChar ch = ITEM(frame[1], i);
-            i += A_UTF8_SKIP_W(ch);
-            if (i < len)
-                resultLen++;
-            else if (i == len) {
-                resultLen++;
-                break;
-            } else
-                break;
-        }
-    }
+        unsigned char seq[4];
 
-    s = AMakeEmptyStrW(t, resultLen);
-    j = -unprocessed;
-    for (i = 0; i < resultLen; i++) {
-        AWideChar ch1 = ChAt(frame[0], frame[1], j, unprocessed);
-        AWideChar result;
+        start = A_UTF8_SKIP(ENC_BUF(frame[0])[1]) - unprocessed;
+        s = ANarrowStrItems(frame[2]);
 
-        if (ch1 <= 0x7f) {
-            result = ch1;
-            j++;
-        } else if (ch1 < 0xc2) {
-            j++;
-            goto DecodeError;
-        } else if (ch1 < 0xe0) {
-            AWideChar ch2 = AStrItem(frame[1], j + 1);
-            j += 2;
-            if (ch2 < 0x80 || ch2 > 0xbf)
-                goto DecodeError;
-            result = ((ch1 & 0x1f) << 6) | (ch2 & 0x3f);
-        } else if (ch1 < 0x100) {
-            AWideChar ch2 = ChAt(frame[0], frame[1], j + 1, unprocessed);
-            AWideChar ch3 = AStrItem(frame[1], j + 2);
-            j += 3;
-            if (ch2 < 0x80 || ch2 > 0xbf || ch3 < 0x80 || ch3 > 0xbf
-                || (ch1 == 0xe0 && ch2 < 0xa0))
-                goto DecodeError;
-            result = ((ch1 & 0xf) << 12) | ((ch2 & 0x3f) << 6) | (ch3 & 0x3f);
-        } else {
-            j++;
-            goto DecodeError;
+        if (start > len) {
+            /* The sequence is still incomplete. */
+            for (i = 0; i < len; i++)
+                ENC_BUF(frame[0])[unprocessed + i + 1] = s[i];
+            ENC_BUF(frame[0])[0] = unprocessed + len;
+            return AMakeEmptyStr(t, 0);
         }
 
-        ASetStrItemW(s, i, result);
-        continue;
+        memcpy(seq, ENC_BUF(frame[0]) + 1, unprocessed);
+        memcpy(seq + unprocessed, s, start);
+        first = ADecodeUtf8Char(seq);
+    }
 
-      DecodeError:
+    s = ANarrowStrItems(frame[2]);
+    end = start + AScanUtf8(s + start, len - start, &numChars, &maxChar);
+    if (first >= 0) {
+        numChars++;
+        if (first > maxChar)
+            maxChar = first;
+    }
 
-        if (AMemberDirect(frame[0], SLOT_MODE) == AMakeInt(t, MODE_STRICT))
-            return ARaiseByNum(t, ADecodeErrorNum, NULL);
+    if (maxChar == A_UTF8_INVALID
+        && AMemberDirect(frame[0], SLOT_MODE) == AMakeInt(t, MODE_STRICT))
+        return ARaiseByNum(t, ADecodeErrorNum, NULL);
 
-        ASetStrItem(s, i, 0xfffd);
+    if (maxChar < 0x80 && first < 0 && end == len) {
+        /* ASCII only; the input is also the result. */
+        return frame[2];
     }
 
-    if (j < 0)
-        j = 0;
+    if (maxChar < 0x100) {
+        unsigned char *d;
 
-    ENC_BUF(frame[0])[0] = newUnprocessed + len - j;
-    for (i = 0; i < len - j; i++)
-        ENC_BUF(frame[0])[i + 1 + newUnprocessed] = AStrItem(frame[1], j + i);
+        result = AMakeEmptyStr(t, numChars);
+        d = AGetStrElem(result);
+        if (first >= 0)
+            *d++ = first;
+        ADecodeUtf8(d, ANarrowStrItems(frame[2]) + start, end - start);
+    } else {
+        AWideChar *d;
 
-    return s;
+        result = AMakeEmptyStrW(t, numChars);
+        d = AGetWideStrElem(result);
+        if (first >= 0)
+            *d++ = first == A_UTF8_INVALID ? 0xfffd : first;
+        ADecodeUtf8W(d, ANarrowStrItems(frame[2]) + start, end - start);
+    }
+
+    /* Store the beginning of an incomplete sequence at the end of input. */
+    s = ANarrowStrItems(frame[2]);
+    ENC_BUF(frame[0])[0] = len - end;
+    for (i = end; i < len; i++)
+        ENC_BUF(frame[0])[i - end + 1] = s[i];
+
+    return result;
 }
 
 
 /* Encode method of Utf8 */
 static AValue Utf8Encode(AThread *t, AValue *frame)
 {
-    int i, j;
-    int len;
-    int resultLen;
+    Assize_t len;
+    Assize_t resultLen;
     AValue s;
 
     AExpectStr(t, frame[1]);
 
     len = AStrLen(frame[1]);
-    resultLen = 0;
-
-    for (i = 0; i < len; i++)
-        resultLen += A_UTF8_LEN(AStrItem(frame[1], i));
-
-    s = AMakeEmptyStr(t, resultLen);
 
-    j = 0;
-    for (i = 0; i < len; i++) {
-        AWideChar ch = AStrItem(frame[1], i);
-        if (ch <= 0x7f) {
-            ASetStrItem(s, j, ch);
-            j++;
-        } else if (ch <= 0x7ff) {
-            ASetStrItem(s, j, 0xc0 | (ch >> 6));
-            ASetStrItem(s, j + 1, 0x80 | (ch & 0x3f));
-            j += 2;
-        } else {
-            ASetStrItem(s, j, 0xe0 | (ch >> 12));
-            ASetStrItem(s, j + 1, 0x80 | ((ch >> 6) & 0x3f));
-            ASetStrItem(s, j + 2, 0x80 | (ch & 0x3f));
-            j += 3;
-        }
+    if (AIsNarrowStr(frame[1]) || AIsNarrowSubStr(frame[1])) {
+        resultLen = AUtf8Length(ANarrowStrItems(frame[1]), len);
+        if (resultLen == len)
+            return frame[1];
+        s = AMakeEmptyStr(t, resultLen);
+        AEncodeUtf8(AGetStrElem(s), ANarrowStrItems(frame[1]), len);
+    } else {
+        resultLen = AUtf8LengthW(AWideStrItems(frame[1]), len);
+        s = AMakeEmptyStr(t, resultLen);
+        AEncodeUtf8W(AGetStrElem(s), AWideStrItems(frame[1]), len);
     }
 
     return s;
@@ -954,7 +938,7 @@ A_MODULE(encodings, "encodings")
         A_IMPLEMENT("::Encoder")
         A_IMPLEMENT("::Decoder")
         A_BINARY_DATA(ENC_DATA_SIZE)
-        A_METHOD("decode", 1, 0, Utf8Decode)
+        A_METHOD("decode", 1, 1, Utf8Decode)
         A_METHOD("encode", 1, 0, Utf8Encode)
         A_METHOD("unprocessed", 0, 0, EncodingUnprocessed)
     A_END_CLASS()
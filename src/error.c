@@ -598,7 +598,7 @@ static Assize_t CopyToken(char *msg, Assize_t i, Assize_t max, AToken *tok)
 {
     ATokenType type = tok->type;
 
-    if (type == TT_ID || type == TT_ID_EXPOSED
+    if (AIsIdTokenType(type)
         || AIsAlphaOperator(type) || AIsReservedWord(type)) {
         if (i < max)
             msg[i++] = '\"';
@@ -0,0 +1,684 @@
+/* eventloop_module.c - __eventloop module (low-level I/O event notification)
+
+   Copyright (c) 2010-2011 Jukka Lehtosalo
+
+   Alore is licensed under the terms of the MIT license.  See the file
+   LICENSE.txt in the distribution.
+*/
+
+/* Implementation of the __eventloop module. The module defines the Poller
+   class that waits for readiness events on a set of file descriptors using
+   epoll (Linux) or poll (other Unix-like platforms), and performs
+   non-blocking reads and writes on sockets. The eventloop module is
+   implemented on top of this module.
+
+   Each Poller has a preallocated event buffer and a read buffer, so that
+   waiting for events and reading data do not allocate memory, other than the
+   Str objects that are returned. */
+
+#include "aconfig.h"
+
+#if defined(A_HAVE_SOCKET_MODULE) && !defined(A_HAVE_WINDOWS)
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__)
+#define A_HAVE_EPOLL
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+
+#include "alore.h"
+#include "runtime.h"
+#include "io_module.h"
+
+
+/* Event flags (visible as constants Readable, Writable and EdgeTriggered) */
+#define EV_READABLE 1
+#define EV_WRITABLE 2
+#define EV_EDGE_TRIGGERED 4
+
+#define DEFAULT_MAX_EVENTS 256
+#define READ_BUFFER_SIZE 65536
+
+/* Use non-blocking operations even if the socket is in blocking mode, if
+   possible. */
+#ifdef MSG_DONTWAIT
+#define DONTWAIT_FLAGS MSG_DONTWAIT
+#else
+#define DONTWAIT_FLAGS 0
+#endif
+
+
+typedef struct {
+    ABool isOpen;       /* Binary data is zero-initialized, so FALSE
+                           initially */
+    int handle;         /* epoll instance */
+    int maxEvents;      /* Size of the event buffer */
+    int numReady;       /* Number of events reported by the latest wait */
+#ifdef A_HAVE_EPOLL
+    struct epoll_event *events;
+#else
+    struct pollfd *fds; /* Registered file descriptors */
+    int numFds;
+    int fdsSize;
+    struct pollfd *ready; /* Copies of ready items in fds */
+#endif
+    char *buffer;       /* Read buffer (READ_BUFFER_SIZE bytes) */
+} PollerData;
+
+
+#define GetPollerData(v) ((PollerData *)ADataPtr(v, PollerDataOffset))
+
+
+static AValue CheckOpen(AThread *t, PollerData *data);
+static AValue RaiseEventLoopError(AThread *t);
+static void FreePollerData(PollerData *data);
+static ABool GetHandleAndEvents(AThread *t, AValue *frame, int *handle,
+                                int *events);
+#ifdef A_HAVE_EPOLL
+static unsigned EpollEvents(int events);
+#else
+static short PollEvents(int events);
+static int FindFd(PollerData *data, int handle);
+#endif
+
+
+/* Global nums of definitions */
+static int ReadableNum;
+static int WritableNum;
+static int EdgeTriggeredNum;
+
+static int PollerDataOffset;
+
+
+/* __eventloop::Main() */
+static AValue EventLoopMain(AThread *t, AValue *frame)
+{
+    ASetConstGlobalByNum(t, ReadableNum, AMakeInt(t, EV_READABLE));
+    ASetConstGlobalByNum(t, WritableNum, AMakeInt(t, EV_WRITABLE));
+    ASetConstGlobalByNum(t, EdgeTriggeredNum,
+                         AMakeInt(t, EV_EDGE_TRIGGERED));
+    return ANil;
+}
+
+
+/* __eventloop::Time()
+   Return a monotonic time in seconds. Only differences between return values
+   are meaningful. */
+static AValue EventLoopTime(AThread *t, AValue *frame)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+        return AMakeFloat(t, ts.tv_sec + ts.tv_nsec * 1e-9);
+#endif
+    {
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        return AMakeFloat(t, tv.tv_sec + tv.tv_usec * 1e-6);
+    }
+}
+
+
+/* Poller create([maxEvents]) */
+static AValue PollerCreate(AThread *t, AValue *frame)
+{
+    PollerData *data = GetPollerData(frame[0]);
+    int maxEvents;
+
+    if (AIsDefault(frame[1]))
+        maxEvents = DEFAULT_MAX_EVENTS;
+    else {
+        maxEvents = AGetInt(t, frame[1]);
+        if (maxEvents < 1)
+            return ARaiseValueError(t, "Invalid number of events");
+    }
+
+    if (data->isOpen)
+        return ARaiseValueError(t, "Poller already created");
+
+    data->maxEvents = maxEvents;
+    data->buffer = malloc(READ_BUFFER_SIZE);
+#ifdef A_HAVE_EPOLL
+    data->events = malloc(maxEvents * sizeof(struct epoll_event));
+    if (data->buffer == NULL || data->events == NULL) {
+        FreePollerData(data);
+        return ARaiseMemoryError(t);
+    }
+    data->handle = epoll_create(maxEvents);
+    if (data->handle < 0) {
+        FreePollerData(data);
+        return RaiseEventLoopError(t);
+    }
+    data->isOpen = TRUE;
+#else
+    data->fdsSize = 16;
+    data->fds = malloc(data->fdsSize * sizeof(struct pollfd));
+    data->ready = malloc(maxEvents * sizeof(struct pollfd));
+    if (data->buffer == NULL || data->fds == NULL || data->ready == NULL) {
+        FreePollerData(data);
+        return ARaiseMemoryError(t);
+    }
+    data->isOpen = TRUE;
+#endif
+
+    return frame[0];
+}
+
+
+/* Poller add(handle, events)
+   Start monitoring a file descriptor. Events is a combination of Readable,
+   Writable and EdgeTriggered. */
+static AValue PollerAdd(AThread *t, AValue *frame)
+{
+    PollerData *data = GetPollerData(frame[0]);
+    int handle;
+    int events;
+
+    if (AIsError(CheckOpen(t, data)))
+        return AError;
+    if (!GetHandleAndEvents(t, frame, &handle, &events))
+        return AError;
+
+#ifdef A_HAVE_EPOLL
+    {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EpollEvents(events);
+        ev.data.fd = handle;
+        if (epoll_ctl(data->handle, EPOLL_CTL_ADD, handle, &ev) < 0)
+            return RaiseEventLoopError(t);
+    }
+#else
+    if (FindFd(data, handle) >= 0) {
+        errno = EEXIST;
+        return RaiseEventLoopError(t);
+    }
+    if (data->numFds == data->fdsSize) {
+        int newSize = 2 * data->fdsSize;
+        struct pollfd *newFds = realloc(data->fds,
+                                        newSize * sizeof(struct pollfd));
+        if (newFds == NULL)
+            return ARaiseMemoryError(t);
+        data->fds = newFds;
+        data->fdsSize = newSize;
+    }
+    data->fds[data->numFds].fd = handle;
+    data->fds[data->numFds].events = PollEvents(events);
+    data->fds[data->numFds].revents = 0;
+    data->numFds++;
+#endif
+
+    return ANil;
+}
+
+
+/* Poller modify(handle, events)
+   Change the monitored events of a file descriptor. */
+static AValue PollerModify(AThread *t, AValue *frame)
+{
+    PollerData *data = GetPollerData(frame[0]);
+    int handle;
+    int events;
+
+    if (AIsError(CheckOpen(t, data)))
+        return AError;
+    if (!GetHandleAndEvents(t, frame, &handle, &events))
+        return AError;
+
+#ifdef A_HAVE_EPOLL
+    {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EpollEvents(events);
+        ev.data.fd = handle;
+        if (epoll_ctl(data->handle, EPOLL_CTL_MOD, handle, &ev) < 0)
+            return RaiseEventLoopError(t);
+    }
+#else
+    {
+        int i = FindFd(data, handle);
+        if (i < 0) {
+            errno = ENOENT;
+            return RaiseEventLoopError(t);
+        }
+        data->fds[i].events = PollEvents(events);
+    }
+#endif
+
+    return ANil;
+}
+
+
+/* Poller remove(handle)
+   Stop monitoring a file descriptor. */
+static AValue PollerRemove(AThread *t, AValue *frame)
+{
+    PollerData *data = GetPollerData(frame[0]);
+    int handle;
+
+    if (AIsError(CheckOpen(t, data)))
+        return AError;
+    handle = AGetInt(t, frame[1]);
+
+#ifdef A_HAVE_EPOLL
+    {
+        /* Older kernels require a non-NULL event argument. */
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        if (epoll_ctl(data->handle, EPOLL_CTL_DEL, handle, &ev) < 0)
+            return RaiseEventLoopError(t);
+    }
+#else
+    {
+        int i = FindFd(data, handle);
+        if (i < 0) {
+            errno = ENOENT;
+            return RaiseEventLoopError(t);
+        }
+        data->fds[i] = data->fds[data->numFds - 1];
+        data->numFds--;
+    }
+#endif
+
+    return ANil;
+}
+
+
+/* Poller wait([timeout])
+   Wait until at least one of the monitored file descriptors is ready or until
+   timeout seconds have passed, and return the number of ready file
+   descriptors. If timeout is omitted or nil, wait indefinitely. Use handle(i)
+   and events(i) to query the ready descriptors. */
+static AValue PollerWait(AThread *t, AValue *frame)
+{
+    PollerData *data = GetPollerData(frame[0]);
+    int timeout;
+    int num;
+
+    if (AIsError(CheckOpen(t, data)))
+        return AError;
+
+    if (AIsDefault(frame[1]) || frame[1] == ANil)
+        timeout = -1;
+    else {
+        /* Round the timeout up to whole milliseconds so that timers do not
+           expire early. */
+        double seconds = AGetFloat(t, frame[1]);
+        if (seconds <= 0.0)
+            timeout = 0;
+        else if (seconds > 1e6)
+            timeout = 1000000000;
+        else
+            timeout = (int)(seconds * 1000.0 + 0.999);
+    }
+
+    data->numReady = 0;
+
+    {
+        /* The poller object might be moved by the garbage collector while
+           blocking, but the malloc()ed buffers stay in place. */
+#ifdef A_HAVE_EPOLL
+        int handle = data->handle;
+        int maxEvents = data->maxEvents;
+        struct epoll_event *events = data->events;
+
+        AAllowBlocking();
+        num = epoll_wait(handle, events, maxEvents, timeout);
+        AEndBlocking();
+#else
+        struct pollfd *fds = data->fds;
+        int numFds = data->numFds;
+
+        AAllowBlocking();
+        num = poll(fds, numFds, timeout);
+        AEndBlocking();
+#endif
+    }
+
+    if (num < 0) {
+        if (errno == EINTR) {
+            if (AIsInterrupt && AHandleInterrupt(t))
+                return AError;
+            return AZero;
+        }
+        return RaiseEventLoopError(t);
+    }
+
+    data = GetPollerData(frame[0]);
+
+#ifndef A_HAVE_EPOLL
+    {
+        /* Collect the ready descriptors. They are copied, since the fds
+           array may be modified before the results have been processed. */
+        int i;
+        int n = 0;
+        for (i = 0; i < data->numFds && n < data->maxEvents; i++) {
+            if (data->fds[i].revents != 0)
+                data->ready[n++] = data->fds[i];
+        }
+        num = n;
+    }
+#endif
+
+    data->numReady = num;
+    return AMakeInt(t, num);
+}
+
+
+/* Poller handle(index)
+   Return the file descriptor of a ready item reported by the latest wait. */
+static AValue PollerHandle(AThread *t, AValue *frame)
+{
+    PollerData *data = GetPollerData(frame[0]);
+    int i = AGetInt(t, frame[1]);
+
+    if (i < 0 || i >= data->numReady)
+        return ARaiseIndexError(t, NULL);
+
+#ifdef A_HAVE_EPOLL
+    return AMakeInt(t, data->events[i].data.fd);
+#else
+    return AMakeInt(t, data->ready[i].fd);
+#endif
+}
+
+
+/* Poller events(index)
+   Return the events of a ready item reported by the latest wait, as a
+   combination of Readable and Writable. Errors and hangups are reported as
+   both readable and writable, so that the next read or write reports them. */
+static AValue PollerEvents(AThread *t, AValue *frame)
+{
+    PollerData *data = GetPollerData(frame[0]);
+    int i = AGetInt(t, frame[1]);
+    int result = 0;
+
+    if (i < 0 || i >= data->numReady)
+        return ARaiseIndexError(t, NULL);
+
+#ifdef A_HAVE_EPOLL
+    {
+        unsigned events = data->events[i].events;
+        if (events & (EPOLLIN | EPOLLRDHUP | EPOLLPRI))
+            result |= EV_READABLE;
+        if (events & EPOLLOUT)
+            result |= EV_WRITABLE;
+        if (events & (EPOLLERR | EPOLLHUP))
+            result |= EV_READABLE | EV_WRITABLE;
+    }
+#else
+    {
+        short revents = data->ready[i].revents;
+        if (revents & (POLLIN | POLLPRI))
+            result |= EV_READABLE;
+        if (revents & POLLOUT)
+            result |= EV_WRITABLE;
+        if (revents & (POLLERR | POLLHUP | POLLNVAL))
+            result |= EV_READABLE | EV_WRITABLE;
+    }
+#endif
+
+    return AMakeInt(t, result);
+}
+
+
+/* Poller read(handle)
+   Read all data that is immediately available from a socket, up to the size
+   of the read buffer. Return the data, an empty string if the connection has
+   been closed or reset by the peer, and nil if no data is available. */
+static AValue PollerRead(AThread *t, AValue *frame)
+{
+    PollerData *data = GetPollerData(frame[0]);
+    int handle;
+    Assize_t len;
+    AValue str;
+
+    if (AIsError(CheckOpen(t, data)))
+        return AError;
+    handle = AGetInt(t, frame[1]);
+
+    /* Fill the buffer in multiple reads if data keeps arriving. The socket is
+       non-blocking, so this does not need AAllowBlocking. */
+    len = 0;
+    while (len < READ_BUFFER_SIZE) {
+        ssize_t n = recv(handle, data->buffer + len, READ_BUFFER_SIZE - len,
+                         DONTWAIT_FLAGS);
+        if (n > 0)
+            len += n;
+        else if (n == 0) {
+            /* End of file */
+            if (len == 0)
+                return AMakeStr(t, "");
+            break;
+        } else if (errno == EINTR)
+            continue;
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            break;
+        else if (errno == ECONNRESET) {
+            if (len == 0)
+                return AMakeStr(t, "");
+            break;
+        } else {
+            if (len > 0)
+                break;
+            return RaiseEventLoopError(t);
+        }
+    }
+
+    if (len == 0)
+        return ANil;
+
+    str = AMakeEmptyStr(t, len);
+    /* The allocation might have moved the poller object. */
+    data = GetPollerData(frame[0]);
+    memcpy(AStrPtr(str), data->buffer, len);
+
+    return str;
+}
+
+
+/* Poller write(handle, str[, offset])
+   Write as much of str[offset:] as possible to a socket without blocking.
+   Return the number of characters written. */
+static AValue PollerWrite(AThread *t, AValue *frame)
+{
+    PollerData *data = GetPollerData(frame[0]);
+    int handle;
+    Assize_t offset;
+    Assize_t len;
+    Assize_t total;
+
+    if (AIsError(CheckOpen(t, data)))
+        return AError;
+    handle = AGetInt(t, frame[1]);
+    AExpectStr(t, frame[2]);
+    len = AStrLen(frame[2]);
+    if (AIsDefault(frame[3]))
+        offset = 0;
+    else {
+        offset = AGetInt(t, frame[3]);
+        if (offset < 0 || offset > len)
+            return ARaiseValueError(t, "Invalid offset");
+    }
+
+    total = 0;
+    while (offset < len) {
+        const char *ptr;
+        Assize_t n;
+        ssize_t written;
+
+        if (AIsNarrowStr(frame[2])) {
+            /* Write directly from the string. */
+            ptr = (const char *)AGetStrElem(frame[2]) + offset;
+            n = len - offset;
+        } else {
+            /* Copy a chunk of the string to the buffer. */
+            Assize_t i;
+            n = len - offset;
+            if (n > READ_BUFFER_SIZE)
+                n = READ_BUFFER_SIZE;
+            for (i = 0; i < n; i++) {
+                AWideChar ch = AStrItem(frame[2], offset + i);
+                if (ch > 0xff)
+                    return ARaiseValueError(t, "Wide character in output");
+                data->buffer[i] = ch;
+            }
+            ptr = data->buffer;
+        }
+
+        written = send(handle, ptr, n, DONTWAIT_FLAGS);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            else if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            else
+                return RaiseEventLoopError(t);
+        }
+        offset += written;
+        total += written;
+        if (written < n)
+            break;
+    }
+
+    return AMakeInt(t, total);
+}
+
+
+/* Poller close() */
+static AValue PollerClose(AThread *t, AValue *frame)
+{
+    FreePollerData(GetPollerData(frame[0]));
+    return ANil;
+}
+
+
+/* Poller #f */
+static AValue PollerFinalize(AThread *t, AValue *frame)
+{
+    FreePollerData(GetPollerData(frame[0]));
+    return ANil;
+}
+
+
+/* Raise IoError if the poller has been closed. */
+static AValue CheckOpen(AThread *t, PollerData *data)
+{
+    if (!data->isOpen)
+        return ARaiseIoError(t, "Poller is closed");
+    return ANil;
+}
+
+
+static AValue RaiseEventLoopError(AThread *t)
+{
+    return ARaiseErrnoIoError(t, NULL);
+}
+
+
+/* Free the resources related to a poller. This can be called multiple times
+   and for a partially initialized poller. */
+static void FreePollerData(PollerData *data)
+{
+#ifdef A_HAVE_EPOLL
+    if (data->isOpen)
+        close(data->handle);
+    free(data->events);
+    data->events = NULL;
+#else
+    free(data->fds);
+    free(data->ready);
+    data->fds = NULL;
+    data->ready = NULL;
+    data->numFds = 0;
+#endif
+    free(data->buffer);
+    data->buffer = NULL;
+    data->isOpen = FALSE;
+    data->numReady = 0;
+}
+
+
+/* Get the handle and events arguments (frame[1] and frame[2]) of a Poller
+   method. */
+static ABool GetHandleAndEvents(AThread *t, AValue *frame, int *handle,
+                                int *events)
+{
+    *handle = AGetInt(t, frame[1]);
+    *events = AGetInt(t, frame[2]);
+    if (*events & ~(EV_READABLE | EV_WRITABLE | EV_EDGE_TRIGGERED)) {
+        ARaiseValueError(t, "Invalid events");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+
+#ifdef A_HAVE_EPOLL
+/* Convert event flags to epoll event flags. */
+static unsigned EpollEvents(int events)
+{
+    return ((events & EV_READABLE) ? EPOLLIN | EPOLLRDHUP : 0) |
+           ((events & EV_WRITABLE) ? EPOLLOUT : 0) |
+           ((events & EV_EDGE_TRIGGERED) ? EPOLLET : 0);
+}
+#else
+/* Convert event flags to poll event flags. Edge triggering is not supported
+   by poll; level-triggered events are reported instead. */
+static short PollEvents(int events)
+{
+    return ((events & EV_READABLE) ? POLLIN : 0) |
+           ((events & EV_WRITABLE) ? POLLOUT : 0);
+}
+
+
+/* Return the index of a file descriptor in the fds array, or -1 if not
+   found. */
+static int FindFd(PollerData *data, int handle)
+{
+    int i;
+    for (i = 0; i < data->numFds; i++) {
+        if (data->fds[i].fd == handle)
+            return i;
+    }
+    return -1;
+}
+#endif
+
+
+A_MODULE(__eventloop, "__eventloop")
+    A_IMPORT("io")
+    A_DEF(A_PRIVATE("Main"), 0, 0, EventLoopMain)
+    A_DEF("Time", 0, 0, EventLoopTime)
+
+    A_EMPTY_CONST_P("Readable", &ReadableNum)
+    A_EMPTY_CONST_P("Writable", &WritableNum)
+    A_EMPTY_CONST_P("EdgeTriggered", &EdgeTriggeredNum)
+
+    A_CLASS("Poller")
+        A_BINARY_DATA_P(sizeof(PollerData), &PollerDataOffset)
+        A_METHOD_OPT("create", 0, 1, 0, PollerCreate)
+        A_METHOD("add", 2, 0, PollerAdd)
+        A_METHOD("modify", 2, 0, PollerModify)
+        A_METHOD("remove", 1, 0, PollerRemove)
+        A_METHOD_OPT("wait", 0, 1, 0, PollerWait)
+        A_METHOD("handle", 1, 0, PollerHandle)
+        A_METHOD("events", 1, 0, PollerEvents)
+        A_METHOD("read", 1, 0, PollerRead)
+        A_METHOD_OPT("write", 2, 3, 0, PollerWrite)
+        A_METHOD("close", 0, 0, PollerClose)
+        A_METHOD("#f", 0, 0, PollerFinalize)
+    A_END_CLASS()
+A_END_MODULE()
+
+#endif /* A_HAVE_SOCKET_MODULE && !A_HAVE_WINDOWS */
@@ -213,7 +213,7 @@ static int GetLineNumber(AThread *t, AOpcode *ip, AFunction *func)
 #endif
 
     line = 0 /* FIX: func->lineNum */;
-    opc = func->code.opc + func->codeLen;
+    opc = AGetExceptInfo(func);
     last = APtrAdd(func, sizeof(AValue) +
                                AGetNonPointerBlockDataLength(&func->header));
     cur = func->code.opc;
@@ -271,23 +271,26 @@ static int GetLineNumber(AThread *t, AOpcode *ip, AFunction *func)
 #define TMP (t->tempStackPtr - 3)
 
 
-/* Create an array of traceback entries (strings). The topmost included stack
-   frame is thread->uncaughtExceptionStackPtr and the bottommost stack frame
-   is thread->stackPtr. The traceback array will be included in the exception
-   instance. */
+/* Create an array of raw traceback entries. The topmost included stack frame
+   is thread->uncaughtExceptionStackPtr and the bottommost stack frame is
+   thread->stackPtr. The traceback array will be included in the exception
+   instance.
+
+   Each entry is a pair of items: the function of the stack frame and the
+   opcode index within the function (or nil for frames without location
+   information). The entries are converted to strings only when the
+   traceback is displayed (see AFilterTracebackArray), since most exceptions
+   are caught and their tracebacks are never looked at. */
 ABool ACreateTracebackArray(AThread *t)
 {
     AValue *stack;
     int len;
-    AOpcode *ip;
     int i, j;
     AInstance *exceptInst;
     AValue *oldStackPtr;
     AValue tmp;
     ASymbolInfo *prev;
 
-    /* FIX: split into smaller functions */
-
     /* Figure out the length of the traceback array. */
     stack = t->uncaughtExceptionStackPtr;
     len = t->isExceptionReraised ? 0 : 1;
@@ -321,7 +324,7 @@ ABool ACreateTracebackArray(AThread *t)
     TMP[1] = AZero;
     TMP[2] = AZero;
 
-    tmp = AMakeArrayND(t, AMin(MAX_TRACEBACK_ENTRIES, len));
+    tmp = AMakeArrayND(t, 2 * AMin(MAX_TRACEBACK_ENTRIES, len));
     if (AIsError(tmp))
         goto Fail;
     TMP[1] = tmp;
@@ -333,49 +336,13 @@ ABool ACreateTracebackArray(AThread *t)
     prev = NULL;
     j = 0;
     for (i = 0; i < len; ) {
-        if (AIsInterpretedFrame(stack))
-            ip = AGetFrameIp(stack) - 1;
-#ifdef HAVE_JIT_COMPILER
-        else if (stack[2] != A_COMPILED_FRAME_FLAG) {
-            /* Get the ip from a JIT compiled function. We must first map
-               the compiled function to the original, interpreted form. */
-            AFunction *func = AGetOriginalInterpretedFunction(
-                t, AValueToFunction(stack[1]));
-            ip = func->code.opc + AInterpretedOpcodeIndex(stack) - 1;
-        }
-#endif
-        else
-            ip = NULL;
-
         if (!AIsClassConstructor(stack[1])
             || AValueToFunction(stack[1])->sym != prev) {
             AFunction *func;
-            char msg[MAX_TRACEBACK_MESSAGE_LENGTH];
-            AValue str;
 
             func = AValueToFunction(stack[1]);
             prev = func->sym;
 
-            AFormatMessage(msg, MAX_TRACEBACK_MESSAGE_LENGTH, "%F", func);
-
-            if (!AIsCompiledFunction(func)
-                    || stack[2] != A_COMPILED_FRAME_FLAG) {
-                char file[MAX_PATH_LENGTH];
-                int line;
-
-                AGetFilePath(file, MAX_PATH_LENGTH, func->fileNum);
-                line = GetLineNumber(t, ip, func);
-
-                if (line > 0)
-                    AFormatMessage(msg + strlen(msg),
-                                  MAX_TRACEBACK_MESSAGE_LENGTH - strlen(msg),
-                                  " (%f, line %d)", file, line);
-                else
-                    AFormatMessage(msg + strlen(msg),
-                                  MAX_TRACEBACK_MESSAGE_LENGTH - strlen(msg),
-                                  " (%f)", file);
-            }
-
             if (t->isExceptionReraised) {
                 i--;
                 t->isExceptionReraised = FALSE;
@@ -386,19 +353,47 @@ ABool ACreateTracebackArray(AThread *t)
                 if (i < MAX_TRACEBACK_ENTRIES / 2 ||
                     i >= len - MAX_TRACEBACK_ENTRIES / 2) {
                     if (i + 1 == MAX_TRACEBACK_ENTRIES / 2
-                        && len > MAX_TRACEBACK_ENTRIES)
+                        && len > MAX_TRACEBACK_ENTRIES) {
+                        char msg[MAX_TRACEBACK_MESSAGE_LENGTH];
+                        AValue str;
+
                         AFormatMessage(msg, MAX_TRACEBACK_MESSAGE_LENGTH,
                                        "... %d entries skipped ...",
                                        len - MAX_TRACEBACK_ENTRIES + 1);
+                        str = ACreateStringFromCStr(t, msg);
+                        if (AIsError(str))
+                            goto Fail;
+                        if (!ASetArrayItemND(t, TMP[1], j, str))
+                            goto Fail;
+                        j++;
+                    } else {
+                        AValue funcVal = stack[1];
+                        AValue index;
+
+                        if (AIsCompiledFunction(func)
+                            && stack[2] == A_COMPILED_FRAME_FLAG)
+                            index = ANil;
+                        else if (AIsInterpretedFrame(stack))
+                            index = AIntToValue(
+                                AInterpretedOpcodeIndex(stack));
+#ifdef HAVE_JIT_COMPILER
+                        else if (stack[2] != A_COMPILED_FRAME_FLAG) {
+                            /* Refer to the original, interpreted form of a
+                               JIT compiled function. */
+                            funcVal = AFunctionToValue(
+                                AGetOriginalInterpretedFunction(t, func));
+                            index = AIntToValue(
+                                AInterpretedOpcodeIndex(stack) - 1);
+                        }
+#endif
+                        else
+                            index = AIntToValue(-1);
 
-                    str = ACreateStringFromCStr(t, msg);
-                    if (AIsError(str))
-                        goto Fail;
-
-                    if (!ASetArrayItemND(t, TMP[1], j, str))
-                        goto Fail;
-
-                    j++;
+                        if (!ASetArrayItemND(t, TMP[1], j, funcVal)
+                            || !ASetArrayItemND(t, TMP[1], j + 1, index))
+                            goto Fail;
+                        j += 2;
+                    }
                 }
             }
 
@@ -408,6 +403,9 @@ ABool ACreateTracebackArray(AThread *t)
         stack = ANextFrame(stack, stack[0]);
     }
 
+    /* Truncate the array if some entries were collapsed. */
+    ASetMemberDirect(t, TMP[1], A_ARRAY_LEN, AIntToValue(j));
+
     exceptInst = AValueToInstance(TMP[0]);
     if (exceptInst->member[AError_TRACEBACK] != ANil) {
         AValue newArr = AConcatArrays(t,
@@ -439,6 +437,92 @@ ABool ACreateTracebackArray(AThread *t)
 }
 
 
+/* Format a traceback entry for a function and an opcode index (nil if the
+   frame has no location information, -1 if the location is unknown). */
+static AValue FormatTracebackEntry(AThread *t, AValue funcVal, AValue index)
+{
+    AFunction *func;
+    char msg[MAX_TRACEBACK_MESSAGE_LENGTH];
+
+    func = AValueToFunction(funcVal);
+
+    AFormatMessage(msg, MAX_TRACEBACK_MESSAGE_LENGTH, "%F", func);
+
+    if (!AIsNil(index)) {
+        char file[MAX_PATH_LENGTH];
+        AOpcode *ip;
+        int line;
+
+        if (AValueToInt(index) >= 0)
+            ip = func->code.opc + AValueToInt(index);
+        else
+            ip = NULL;
+
+        AGetFilePath(file, MAX_PATH_LENGTH, func->fileNum);
+        line = GetLineNumber(t, ip, func);
+
+        if (line > 0)
+            AFormatMessage(msg + strlen(msg),
+                           MAX_TRACEBACK_MESSAGE_LENGTH - strlen(msg),
+                           " (%f, line %d)", file, line);
+        else
+            AFormatMessage(msg + strlen(msg),
+                           MAX_TRACEBACK_MESSAGE_LENGTH - strlen(msg),
+                           " (%f)", file);
+    }
+
+    return ACreateStringFromCStr(t, msg);
+}
+
+
+/* Convert raw traceback entries created by ACreateTracebackArray to an array
+   of strings. The argument array may also contain entries that are already
+   strings. */
+static AValue MaterializeTracebackArray(AThread *t, AValue raw)
+{
+    AValue *tmp;
+    int i, j;
+    int len;
+
+    tmp = AAllocTemps(t, 2);
+    if (tmp == NULL)
+        return AError;
+
+    tmp[0] = raw;
+    len = AArrayLen(raw);
+    tmp[1] = AMakeArrayND(t, len);
+    if (AIsError(tmp[1]))
+        goto Fail;
+
+    j = 0;
+    for (i = 0; i < len; i++) {
+        AValue item = AArrayItem(tmp[0], i);
+
+        if (!AIsStr(item)) {
+            item = FormatTracebackEntry(t, item, AArrayItem(tmp[0], i + 1));
+            if (AIsError(item))
+                goto Fail;
+            i++;
+        }
+
+        if (!ASetArrayItemND(t, tmp[1], j, item))
+            goto Fail;
+        j++;
+    }
+
+    ASetMemberDirect(t, tmp[1], A_ARRAY_LEN, AIntToValue(j));
+
+    raw = tmp[1];
+    AFreeTemps(t, 2);
+    return raw;
+
+  Fail:
+
+    AFreeTemps(t, 2);
+    return AError;
+}
+
+
 /* Filter lines from the traceback array that should not be displayed. */
 /* NOTE: Keeps thread->exception in thread->tempStack[1] */
 AValue AFilterTracebackArray(AThread *t)
@@ -449,12 +533,15 @@ AValue AFilterTracebackArray(AThread *t)
     AValue src;
     AValue dst;
 
-    t->tempStack[0] =
-        AValueToInstance(t->exception)->member[AError_TRACEBACK];
-    arrayLen = AArrayLen(t->tempStack[0]);
-
     t->tempStack[1] = t->exception;
 
+    src = MaterializeTracebackArray(
+        t, AValueToInstance(t->exception)->member[AError_TRACEBACK]);
+    if (AIsError(src))
+        return AError;
+    t->tempStack[0] = src;
+    arrayLen = AArrayLen(t->tempStack[0]);
+
     /* Create a new array in the new generation. It may be longer than what
        we'll need, but we will truncate it later if necessary. */
     dst = AMakeArrayND(t, arrayLen);
@@ -768,7 +855,29 @@ int AGetExceptionHandler(AThread *t, AFunction *func, int codeInd)
     int oldContextIndex;
 
     oldContextIndex = t->contextIndex;
-    exceptInfo = func->code.opc + func->codeLen;
+    exceptInfo = AGetExceptInfo(func);
+
+    /* If the function has a handler table, only the last outermost try
+       statement that begins at or before codeInd may contain codeInd. Earlier
+       try statements have no effect on the search below. */
+    if (func->flags & A_FUNC_HANDLER_TABLE) {
+        AOpcode *table = func->code.opc + func->codeLen;
+        int lo = 0;
+        int hi = table[0] - 1;
+
+        while (lo <= hi) {
+            int mid = (lo + hi) / 2;
+            if (table[1 + 2 * mid] <= codeInd)
+                lo = mid + 1;
+            else
+                hi = mid - 1;
+        }
+
+        if (hi < 0)
+            return A_PROPAGATE_TO_CALLER;
+
+        exceptInfo += table[2 + 2 * hi];
+    }
 
     /* If the exception was raised within an except block, skipDepth
        is used to keep track of the depth of the enclosing try statement
@@ -0,0 +1,805 @@
+/* floatconv.c - Float <-> Str conversions
+
+   Copyright (c) 2010-2011 Jukka Lehtosalo
+
+   Alore is licensed under the terms of the MIT license.  See the file
+   LICENSE.txt in the distribution.
+*/
+
+/* Floats are formatted using the Grisu3 algorithm by Florian Loitsch
+   ("Printing Floating-Point Numbers Quickly and Accurately with Integers",
+   PLDI 2010). It produces the shortest digits that convert back to the
+   original float using 64-bit integer arithmetic, but it gives up for about
+   0.5% of inputs; these are handled using printf and strtod.
+
+   Floats are parsed using the algorithm by Daniel Lemire and Michael Eisel
+   ("Number Parsing at a Gigabyte per Second", 2021). It multiplies the
+   decimal significand by a 128-bit approximation of the power of ten and
+   gives up in the rare cases where the approximation is not precise enough
+   for correct rounding, or if there are more than 19 significant digits;
+   these are handled using strtod. */
+
+#include "floatconv.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+
+#define SIGNIFICAND_MASK 0x000fffffffffffffULL
+#define HIDDEN_BIT 0x0010000000000000ULL
+#define SIGN_BIT 0x8000000000000000ULL
+#define EXPONENT_BIAS (0x3ff + 52)
+#define DENORMAL_EXPONENT (1 - EXPONENT_BIAS)
+
+/* Smallest positive normal float */
+#define MIN_NORMAL 2.2250738585072014e-308
+
+/* Range of binary exponents of the scaled values in Grisu */
+#define MIN_TARGET_EXPONENT (-60)
+#define MAX_TARGET_EXPONENT (-32)
+
+/* Maximum number of significant digits in the fast path of the parser (any
+   19-digit integer fits in 64 bits) */
+#define MAX_PARSE_DIGITS 19
+
+#define IsDigit(ch) ((ch) >= '0' && (ch) <= '9')
+
+
+/* A float as an unnormalized significand and a binary exponent (value is
+   f * 2**e) */
+typedef struct {
+    AIntU64 f;
+    int e;
+} DiyFp;
+
+
+static ABool Grisu3(double v, char *buffer, int *length, int *decimalExponent);
+static int ShortestDigitsSlow(double v, char *digits, int *pointPos);
+static int PrintfDigits(double v, int numDigits, char *digits, int *pointPos);
+static int RoundDigits(double v, char *digits, int n, int *pointPos,
+                       int numDigits);
+static int ShortestDigits(double v, char *digits, int *pointPos);
+static int FormatExponent(char *buf, int exp);
+static const unsigned char *ParseFloatSlow(const unsigned char *s,
+                                           const unsigned char *end,
+                                           double *f);
+static ABool EiselLemire(AIntU64 man, int exp10, ABool isNeg, double *f);
+
+
+static AIntU64 FloatBits(double f)
+{
+    AIntU64 bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+
+int AFormatFloat(char *buf, double f, int precision)
+{
+    AIntU64 bits = FloatBits(f);
+    char digits[A_MAX_FLOAT_DIGITS + 1];
+    int layoutPrecision = precision == 0 ? A_MAX_FLOAT_DIGITS : precision;
+    int pointPos;
+    int exp;
+    int n;
+    int i;
+    int len;
+
+    if (f != f) {
+        strcpy(buf, "nan");
+        return 3;
+    }
+
+    if (precision > A_MAX_FLOAT_DIGITS && f - f == 0.0)
+        return sprintf(buf, "%.*g", precision, f);
+
+    len = 0;
+    if (bits & SIGN_BIT)
+        buf[len++] = '-';
+
+    if (f - f != 0.0) {
+        /* Infinity */
+        strcpy(buf + len, "inf");
+        return len + 3;
+    }
+
+    n = AFloatDigits(fabs(f), precision, digits, &pointPos);
+    if (n == 0) {
+        buf[len++] = '0';
+        buf[len] = '\0';
+        return len;
+    }
+
+    exp = pointPos - 1;
+    if (exp < -4 || exp >= layoutPrecision) {
+        /* Scientific notation */
+        buf[len++] = digits[0];
+        if (n > 1) {
+            buf[len++] = '.';
+            memcpy(buf + len, digits + 1, n - 1);
+            len += n - 1;
+        }
+        len += FormatExponent(buf + len, exp);
+    } else if (pointPos <= 0) {
+        /* 0.000ddd */
+        buf[len++] = '0';
+        buf[len++] = '.';
+        for (i = pointPos; i < 0; i++)
+            buf[len++] = '0';
+        memcpy(buf + len, digits, n);
+        len += n;
+        buf[len] = '\0';
+    } else if (pointPos >= n) {
+        /* ddd000 */
+        memcpy(buf + len, digits, n);
+        len += n;
+        for (i = n; i < pointPos; i++)
+            buf[len++] = '0';
+        buf[len] = '\0';
+    } else {
+        /* ddd.ddd */
+        memcpy(buf + len, digits, pointPos);
+        len += pointPos;
+        buf[len++] = '.';
+        memcpy(buf + len, digits + pointPos, n - pointPos);
+        len += n - pointPos;
+        buf[len] = '\0';
+    }
+
+    return len;
+}
+
+
+int AFormatFloatFixed(char *buf, double f, int fractionLen)
+{
+    char digits[A_MAX_FLOAT_DIGITS + 1];
+    int pointPos;
+    int numDigits;
+    int n;
+    int i;
+    int len;
+
+    /* Larger values may have more significant digits than the shortest
+       representation when formatted exactly. */
+    if (!(fabs(f) < 9007199254740992.0))
+        return sprintf(buf, "%.*f", fractionLen, f);
+
+    n = ShortestDigits(fabs(f), digits, &pointPos);
+    numDigits = pointPos + fractionLen;
+
+    /* Values that round to less than 1 unit in the last place are rare
+       enough to not be worth special casing. */
+    if (n > 0 && numDigits <= 0)
+        return sprintf(buf, "%.*f", fractionLen, f);
+
+    if (n > numDigits) {
+        n = RoundDigits(fabs(f), digits, n, &pointPos, numDigits);
+        if (n < 0)
+            return sprintf(buf, "%.*f", fractionLen, f);
+    } else if (n > 0 && (numDigits > 15 || fabs(f) < MIN_NORMAL))
+        return sprintf(buf, "%.*f", fractionLen, f);
+
+    len = 0;
+    if (FloatBits(f) & SIGN_BIT)
+        buf[len++] = '-';
+
+    /* Integer part */
+    if (n == 0 || pointPos <= 0)
+        buf[len++] = '0';
+    else {
+        for (i = 0; i < pointPos; i++)
+            buf[len++] = i < n ? digits[i] : '0';
+    }
+
+    /* Fraction */
+    if (fractionLen > 0) {
+        buf[len++] = '.';
+        for (i = 0; i < fractionLen; i++) {
+            int j = pointPos + i;
+            buf[len++] = n > 0 && j >= 0 && j < n ? digits[j] : '0';
+        }
+    }
+
+    buf[len] = '\0';
+    return len;
+}
+
+
+int AFloatDigits(double f, int numDigits, char *digits, int *pointPos)
+{
+    int n = ShortestDigits(f, digits, pointPos);
+
+    if (numDigits == 0 || n == 0)
+        return n;
+
+    if (numDigits > A_MAX_FLOAT_DIGITS)
+        numDigits = A_MAX_FLOAT_DIGITS;
+
+    if (n <= numDigits) {
+        /* The shortest digits are also correctly rounded to numDigits
+           digits if the spacing of numDigits-digit decimals is larger than
+           the spacing of floats. */
+        if (numDigits <= 15 && f >= MIN_NORMAL)
+            return n;
+        else
+            return PrintfDigits(f, numDigits, digits, pointPos);
+    }
+
+    n = RoundDigits(f, digits, n, pointPos, numDigits);
+    if (n < 0)
+        return PrintfDigits(f, numDigits, digits, pointPos);
+    return n;
+}
+
+
+/* Store the shortest digits of a finite, non-negative float that convert
+   back to it. Return the number of digits. */
+static int ShortestDigits(double v, char *digits, int *pointPos)
+{
+    int n;
+    int exp;
+
+    if (v == 0.0) {
+        *pointPos = 1;
+        return 0;
+    }
+
+    if (!Grisu3(v, digits, &n, &exp))
+        return ShortestDigitsSlow(v, digits, pointPos);
+
+    while (digits[n - 1] == '0')
+        n--;
+    *pointPos = n + exp;
+    return n;
+}
+
+
+/* Round the shortest digits[0..n) of v to numDigits (< n) digits. Return the
+   new number of digits, or -1 if v might be exactly halfway between two
+   numDigits-digit decimals. The rounded digits are the correctly rounded
+   digits of v, since no numDigits-digit decimal or halfway point can be
+   between v and its shortest representation (otherwise there would be a
+   shorter or a closer representation). */
+static int RoundDigits(double v, char *digits, int n, int *pointPos,
+                       int numDigits)
+{
+    if (digits[numDigits] == '5' && n == numDigits + 1)
+        return -1;
+
+    if (digits[numDigits] >= '5') {
+        int i = numDigits - 1;
+        while (i >= 0 && digits[i] == '9')
+            i--;
+        if (i < 0) {
+            digits[0] = '1';
+            (*pointPos)++;
+            return 1;
+        }
+        digits[i]++;
+        n = i + 1;
+    } else
+        n = numDigits;
+
+    while (n > 0 && digits[n - 1] == '0')
+        n--;
+
+    return n;
+}
+
+
+/* Store the shortest digits of v > 0 using printf and strtod. Return the
+   number of digits. The closest decimal with k digits converts back to v if
+   any k-digit decimal does, and if k digits are enough, so are k + 1. */
+static int ShortestDigitsSlow(double v, char *digits, int *pointPos)
+{
+    int lo = 1;
+    int hi = A_MAX_FLOAT_DIGITS;
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        char buf[64];
+
+        sprintf(buf, "%.*e", mid - 1, v);
+        if (strtod(buf, NULL) == v)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    return PrintfDigits(v, lo, digits, pointPos);
+}
+
+
+/* Store the digits of v > 0 rounded to numDigits (<= A_MAX_FLOAT_DIGITS)
+   digits using printf. Return the number of digits. */
+static int PrintfDigits(double v, int numDigits, char *digits, int *pointPos)
+{
+    char buf[64];
+    char *s;
+    int n;
+
+    sprintf(buf, "%.*e", numDigits - 1, v);
+
+    n = 0;
+    for (s = buf; *s != 'e'; s++) {
+        if (IsDigit(*s))
+            digits[n++] = *s;
+    }
+    *pointPos = atoi(s + 1) + 1;
+
+    while (n > 0 && digits[n - 1] == '0')
+        n--;
+
+    return n;
+}
+
+
+/* Format the exponent part of a float in scientific notation like printf
+   (e.g. e+05, e-123). */
+static int FormatExponent(char *buf, int exp)
+{
+    int len = 0;
+
+    buf[len++] = 'e';
+    if (exp < 0) {
+        buf[len++] = '-';
+        exp = -exp;
+    } else
+        buf[len++] = '+';
+
+    if (exp >= 100)
+        buf[len++] = '0' + exp / 100;
+    buf[len++] = '0' + exp / 10 % 10;
+    buf[len++] = '0' + exp % 10;
+    buf[len] = '\0';
+
+    return len;
+}
+
+
+/* Grisu3 */
+
+
+static DiyFp Normalize(DiyFp x)
+{
+    while ((x.f & 0xffc0000000000000ULL) == 0) {
+        x.f <<= 10;
+        x.e -= 10;
+    }
+    while ((x.f & SIGN_BIT) == 0) {
+        x.f <<= 1;
+        x.e--;
+    }
+    return x;
+}
+
+
+/* Return x * y rounded to 64 bits. */
+static DiyFp Multiply(DiyFp x, DiyFp y)
+{
+    const AIntU64 m32 = 0xffffffffULL;
+    AIntU64 a = x.f >> 32;
+    AIntU64 b = x.f & m32;
+    AIntU64 c = y.f >> 32;
+    AIntU64 d = y.f & m32;
+    AIntU64 ac = a * c;
+    AIntU64 bc = b * c;
+    AIntU64 ad = a * d;
+    AIntU64 bd = b * d;
+    AIntU64 tmp = (bd >> 32) + (ad & m32) + (bc & m32) + (1U << 31);
+    DiyFp r;
+
+    r.f = ac + (ad >> 32) + (bc >> 32) + (tmp >> 32);
+    r.e = x.e + y.e + 64;
+    return r;
+}
+
+
+/* Adjust the last generated digit downwards to get the representation
+   closest to w, and check that the result is guaranteed to be within the
+   rounding interval of w. The arguments are distances scaled by the same
+   factor: distanceTooHighW is from too_high to w, unsafeInterval is the
+   length of the unsafe interval, rest is from too_high to the current
+   digits, tenKappa is the value of 1 in the last digit and unit is the
+   maximum error of the scaled values. */
+static ABool RoundWeed(char *buffer, int length, AIntU64 distanceTooHighW,
+                       AIntU64 unsafeInterval, AIntU64 rest,
+                       AIntU64 tenKappa, AIntU64 unit)
+{
+    AIntU64 smallDistance = distanceTooHighW - unit;
+    AIntU64 bigDistance = distanceTooHighW + unit;
+
+    while (rest < smallDistance
+           && unsafeInterval - rest >= tenKappa
+           && (rest + tenKappa < smallDistance
+               || smallDistance - rest >= rest + tenKappa - smallDistance)) {
+        buffer[length - 1]--;
+        rest += tenKappa;
+    }
+
+    /* Give up if the result might not be the closest representation. */
+    if (rest < bigDistance
+        && unsafeInterval - rest >= tenKappa
+        && (rest + tenKappa < bigDistance
+            || bigDistance - rest > rest + tenKappa - bigDistance))
+        return FALSE;
+
+    /* Check that the result is within the safe interval. */
+    return 2 * unit <= rest && rest <= unsafeInterval - 4 * unit;
+}
+
+
+/* Generate the shortest digits of a number in the interval (low, high)
+   with the value w. Each of the values is scaled so that the binary
+   exponent is between MIN_TARGET_EXPONENT and MAX_TARGET_EXPONENT. Store the
+   decimal exponent of the last digit in *kappa. */
+static ABool DigitGen(DiyFp low, DiyFp w, DiyFp high, char *buffer,
+                      int *length, int *kappa)
+{
+    static const unsigned pow10[10] = {
+        1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+        1000000000
+    };
+    AIntU64 unit = 1;
+    DiyFp tooLow;
+    DiyFp tooHigh;
+    AIntU64 unsafeInterval;
+    int shift = -w.e;
+    AIntU64 one = (AIntU64)1 << shift;
+    unsigned integrals;
+    AIntU64 fractionals;
+    unsigned divisor;
+    int k;
+
+    tooLow.f = low.f - unit;
+    tooLow.e = low.e;
+    tooHigh.f = high.f + unit;
+    tooHigh.e = high.e;
+    unsafeInterval = tooHigh.f - tooLow.f;
+
+    integrals = (unsigned)(tooHigh.f >> shift);
+    fractionals = tooHigh.f & (one - 1);
+
+    for (k = 9; k > 0 && pow10[k] > integrals; k--);
+    divisor = pow10[k];
+    *kappa = k + 1;
+    *length = 0;
+
+    /* Generate the digits of the integral part. */
+    while (*kappa > 0) {
+        AIntU64 rest;
+
+        buffer[(*length)++] = '0' + integrals / divisor;
+        integrals %= divisor;
+        (*kappa)--;
+
+        rest = ((AIntU64)integrals << shift) + fractionals;
+        if (rest < unsafeInterval)
+            return RoundWeed(buffer, *length, tooHigh.f - w.f,
+                             unsafeInterval, rest,
+                             (AIntU64)divisor << shift, unit);
+        divisor /= 10;
+    }
+
+    /* Generate the digits of the fractional part. */
+    for (;;) {
+        fractionals *= 10;
+        unit *= 10;
+        unsafeInterval *= 10;
+
+        buffer[(*length)++] = '0' + (int)(fractionals >> shift);
+        fractionals &= one - 1;
+        (*kappa)--;
+
+        if (fractionals < unsafeInterval)
+            return RoundWeed(buffer, *length, (tooHigh.f - w.f) * unit,
+                             unsafeInterval, fractionals, one, unit);
+    }
+}
+
+
+/* Generate the shortest digits of v > 0 that convert back to v. The value
+   is digits * 10**(*decimalExponent). Return FALSE if the digits could not
+   be determined. */
+static ABool Grisu3(double v, char *buffer, int *length, int *decimalExponent)
+{
+    AIntU64 bits = FloatBits(v);
+    AIntU64 significand = bits & SIGNIFICAND_MASK;
+    int biasedExponent = (int)(bits >> 52) & 0x7ff;
+    DiyFp w;
+    DiyFp plus;
+    DiyFp minus;
+    DiyFp c;
+    int k;
+    int index;
+    int kappa;
+    ABool result;
+
+    if (biasedExponent != 0) {
+        w.f = significand + HIDDEN_BIT;
+        w.e = biasedExponent - EXPONENT_BIAS;
+    } else {
+        w.f = significand;
+        w.e = DENORMAL_EXPONENT;
+    }
+
+    /* The boundaries of the rounding interval of v. The lower boundary is
+       closer if v is a power of two (except for the smallest exponent). */
+    plus.f = (w.f << 1) + 1;
+    plus.e = w.e - 1;
+    plus = Normalize(plus);
+    if (significand == 0 && biasedExponent > 1) {
+        minus.f = (w.f << 2) - 1;
+        minus.e = w.e - 2;
+    } else {
+        minus.f = (w.f << 1) - 1;
+        minus.e = w.e - 1;
+    }
+    minus.f <<= minus.e - plus.e;
+    minus.e = plus.e;
+
+    w = Normalize(w);
+
+    /* Find a cached power of ten c so that the binary exponent of w * c is
+       within the target range. */
+    k = (int)ceil((MIN_TARGET_EXPONENT - (w.e + 64) + 63)
+                  * 0.30102999566398114);
+    index = (-A_CACHED_POWERS_MIN_EXP10 + k - 1) / A_CACHED_POWERS_STEP + 1;
+    c.f = ACachedPowers[index].significand;
+    c.e = ACachedPowers[index].binaryExponent;
+
+    result = DigitGen(Multiply(minus, c), Multiply(w, c), Multiply(plus, c),
+                      buffer, length, &kappa);
+    *decimalExponent = -ACachedPowers[index].decimalExponent + kappa;
+    return result;
+}
+
+
+/* Parsing */
+
+
+const unsigned char *AParseFloat(const unsigned char *s,
+                                 const unsigned char *end, double *f)
+{
+    const unsigned char *p = s;
+    const unsigned char *digitsBeg;
+    ABool isNeg = FALSE;
+    ABool isTruncated = FALSE;
+    AIntU64 man = 0;
+    int numDigits = 0;
+    int exp10 = 0;
+
+    if (p != end && (*p == '-' || *p == '+')) {
+        isNeg = *p == '-';
+        p++;
+    }
+
+    /* Integer part */
+    digitsBeg = p;
+    for (; p != end && IsDigit(*p); p++) {
+        if (numDigits < MAX_PARSE_DIGITS) {
+            man = man * 10 + (*p - '0');
+            if (man != 0)
+                numDigits++;
+        } else {
+            exp10++;
+            if (*p != '0')
+                isTruncated = TRUE;
+        }
+    }
+
+    /* Fraction */
+    if (end - p >= 2 && *p == '.' && IsDigit(p[1])) {
+        for (p++; p != end && IsDigit(*p); p++) {
+            if (numDigits < MAX_PARSE_DIGITS) {
+                man = man * 10 + (*p - '0');
+                if (man != 0)
+                    numDigits++;
+                exp10--;
+            } else if (*p != '0')
+                isTruncated = TRUE;
+        }
+    }
+
+    if (p == digitsBeg)
+        return NULL;
+
+    /* Exponent */
+    if (end - p >= 2 && (*p == 'e' || *p == 'E')) {
+        const unsigned char *e = p + 1;
+        ABool isNegExp = FALSE;
+        int exp = 0;
+
+        if (*e == '-' || *e == '+') {
+            isNegExp = *e == '-';
+            e++;
+        }
+        if (e != end && IsDigit(*e)) {
+            for (; e != end && IsDigit(*e); e++) {
+                if (exp < 100000)
+                    exp = exp * 10 + (*e - '0');
+            }
+            exp10 += isNegExp ? -exp : exp;
+            p = e;
+        }
+    }
+
+    if (isTruncated)
+        return ParseFloatSlow(s, p, f);
+
+    if (man == 0) {
+        *f = isNeg ? -0.0 : 0.0;
+        return p;
+    }
+
+#if defined(__FLT_EVAL_METHOD__) && __FLT_EVAL_METHOD__ == 0
+    /* If the significand and the power of ten are exact floats, a single
+       correctly rounded operation gives the correctly rounded result. */
+    if (man <= 9007199254740992ULL && exp10 >= -22 && exp10 <= 22) {
+        static const double pow10[23] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+        double d = (double)man;
+        if (exp10 < 0)
+            d /= pow10[-exp10];
+        else
+            d *= pow10[exp10];
+        *f = isNeg ? -d : d;
+        return p;
+    }
+#endif
+
+    if (EiselLemire(man, exp10, isNeg, f))
+        return p;
+
+    return ParseFloatSlow(s, p, f);
+}
+
+
+/* Parse the float s[0..end) using strtod. */
+static const unsigned char *ParseFloatSlow(const unsigned char *s,
+                                           const unsigned char *end,
+                                           double *f)
+{
+    char buf[128];
+    char *tmp = buf;
+    size_t len = end - s;
+
+    if (len >= sizeof(buf)) {
+        tmp = malloc(len + 1);
+        if (tmp == NULL) {
+            /* Fall back to a truncated number; the parts that affect the
+               result are almost always near the start. */
+            tmp = buf;
+            len = sizeof(buf) - 1;
+        }
+    }
+
+    memcpy(tmp, s, len);
+    tmp[len] = '\0';
+    *f = strtod(tmp, NULL);
+
+    if (tmp != buf)
+        free(tmp);
+
+    return end;
+}
+
+
+/* Compute the high and low 64 bits of the 128-bit product a * b. */
+static void Multiply128(AIntU64 a, AIntU64 b, AIntU64 *hi, AIntU64 *lo)
+{
+#ifdef __SIZEOF_INT128__
+    unsigned __int128 r = (unsigned __int128)a * b;
+    *hi = (AIntU64)(r >> 64);
+    *lo = (AIntU64)r;
+#else
+    const AIntU64 m32 = 0xffffffffULL;
+    AIntU64 a0 = a & m32;
+    AIntU64 a1 = a >> 32;
+    AIntU64 b0 = b & m32;
+    AIntU64 b1 = b >> 32;
+    AIntU64 p00 = a0 * b0;
+    AIntU64 p01 = a0 * b1;
+    AIntU64 p10 = a1 * b0;
+    AIntU64 p11 = a1 * b1;
+    AIntU64 mid = (p00 >> 32) + (p01 & m32) + (p10 & m32);
+    *hi = p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+    *lo = (mid << 32) | (p00 & m32);
+#endif
+}
+
+
+static int LeadingZeros(AIntU64 x)
+{
+#ifdef __GNUC__
+    return __builtin_clzll(x);
+#else
+    int n = 0;
+    while ((x & SIGN_BIT) == 0) {
+        x <<= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+
+/* Convert man * 10**exp10 (man != 0) to the nearest float. Return FALSE if
+   the result could not be determined; this happens if the result might be
+   exactly halfway between two floats, or if it is not a normal float. */
+static ABool EiselLemire(AIntU64 man, int exp10, ABool isNeg, double *f)
+{
+    const AIntU64 *pow;
+    AIntU64 retExp2;
+    AIntU64 xHi, xLo;
+    AIntU64 retMantissa;
+    AIntU64 retBits;
+    int msb;
+    int clz;
+    int log2;
+
+    if (exp10 < A_POWERS_OF_TEN_128_MIN_EXP10
+        || exp10 >= A_POWERS_OF_TEN_128_MIN_EXP10 + A_NUM_POWERS_OF_TEN_128)
+        return FALSE;
+
+    /* Normalize the significand. */
+    clz = LeadingZeros(man);
+    man <<= clz;
+
+    /* floor(log2(10) * exp10), computed as in the paper */
+    log2 = 217706 * exp10;
+    log2 = log2 >= 0 ? log2 >> 16 : -((-log2 + 65535) >> 16);
+    retExp2 = (AIntU64)(log2 + 64 + 0x3ff) - (AIntU64)clz;
+
+    pow = APowersOfTen128[exp10 - A_POWERS_OF_TEN_128_MIN_EXP10];
+    Multiply128(man, pow[0], &xHi, &xLo);
+
+    /* If the low bits of the product are all ones, the truncated power of
+       ten may be too imprecise. Include the low 64 bits of the power. */
+    if ((xHi & 0x1ff) == 0x1ff && xLo + man < man) {
+        AIntU64 yHi, yLo;
+        AIntU64 mergedHi, mergedLo;
+
+        Multiply128(man, pow[1], &yHi, &yLo);
+        mergedHi = xHi;
+        mergedLo = xLo + yHi;
+        if (mergedLo < xLo)
+            mergedHi++;
+        if ((mergedHi & 0x1ff) == 0x1ff && mergedLo + 1 == 0
+            && yLo + man < man)
+            return FALSE;
+        xHi = mergedHi;
+        xLo = mergedLo;
+    }
+
+    /* Shift to 54 bits. */
+    msb = (int)(xHi >> 63);
+    retMantissa = xHi >> (msb + 9);
+    retExp2 -= 1 ^ msb;
+
+    /* The result might be exactly halfway between two floats. */
+    if (xLo == 0 && (xHi & 0x1ff) == 0 && (retMantissa & 3) == 1)
+        return FALSE;
+
+    /* Round to 53 bits. */
+    retMantissa += retMantissa & 1;
+    retMantissa >>= 1;
+    if (retMantissa >> 53 > 0) {
+        retMantissa >>= 1;
+        retExp2++;
+    }
+
+    /* Denormal, infinite and zero results are left to strtod. */
+    if (retExp2 - 1 >= 0x7ff - 1)
+        return FALSE;
+
+    retBits = (retExp2 << 52) | (retMantissa & SIGNIFICAND_MASK);
+    if (isNeg)
+        retBits |= SIGN_BIT;
+    memcpy(f, &retBits, sizeof(*f));
+    return TRUE;
+}
@@ -0,0 +1,69 @@
+/* floatconv.h - Float <-> Str conversions
+
+   Copyright (c) 2010-2011 Jukka Lehtosalo
+
+   Alore is licensed under the terms of the MIT license.  See the file
+   LICENSE.txt in the distribution.
+*/
+
+#ifndef FLOATCONV_H_INCL
+#define FLOATCONV_H_INCL
+
+#include "common.h"
+
+
+/* Maximum number of significant digits generated by AFloatDigits; this is
+   enough to identify any float uniquely */
+#define A_MAX_FLOAT_DIGITS 17
+
+/* Size of a buffer that is large enough for any result of AFormatFloat with
+   precision <= A_MAX_FLOAT_DIGITS, including the terminating zero */
+#define A_FLOAT_BUF_SIZE 32
+
+
+/* Format a float like printf("%.*g", precision, f). If precision is 0, use
+   the shortest representation that converts back to f, with the layout of
+   precision 17. Infinities and NaNs are formatted as inf, -inf and nan.
+   Return the length of the result. */
+int AFormatFloat(char *buf, double f, int precision);
+/* Format a finite float like printf("%.*f", fractionLen, f). The buffer must
+   have room for the result of printf. Return the length of the result. */
+int AFormatFloatFixed(char *buf, double f, int fractionLen);
+/* Store the decimal digits of a finite, non-negative float rounded to
+   numDigits significant digits in digits, without trailing zeros. If
+   numDigits is 0, store the shortest digits that convert back to f. Values
+   of numDigits larger than A_MAX_FLOAT_DIGITS are treated as
+   A_MAX_FLOAT_DIGITS. Store the decimal exponent in *pointPos so that the
+   value is 0.ddd * 10**pointPos. Return the number of digits (0 for zero). */
+int AFloatDigits(double f, int numDigits, char *digits, int *pointPos);
+
+/* Parse a float from s[0..end) in the syntax of Alore float literals
+   (digits, optional fraction and optional exponent), optionally preceded by
+   a sign. Either the integer part or the fraction may be empty, but not
+   both. The result is correctly rounded. Store the result in *f and return a
+   pointer to the first character after the number, or NULL if s does not
+   start with a number. */
+const unsigned char *AParseFloat(const unsigned char *s,
+                                 const unsigned char *end, double *f);
+
+
+/* Definitions for floatconv_tables.c */
+
+typedef struct {
+    AIntU64 significand;
+    short binaryExponent;
+    short decimalExponent;
+} ACachedPower;
+
+#define A_NUM_CACHED_POWERS 87
+#define A_CACHED_POWERS_MIN_EXP10 (-348)
+#define A_CACHED_POWERS_STEP 8
+
+#define A_NUM_POWERS_OF_TEN_128 696
+#define A_POWERS_OF_TEN_128_MIN_EXP10 (-348)
+
+extern const ACachedPower ACachedPowers[A_NUM_CACHED_POWERS];
+extern const AIntU64 APowersOfTen128[A_NUM_POWERS_OF_TEN_128][2];
+
+
+#endif
@@ -753,6 +753,9 @@ ABool ACollectGarbageForced(void)
         if (!PushOldGenStack(t->regExp, A_NUM_CACHED_REGEXPS * 2))
             goto Fail;
 
+        if (!PushOldGenStack(t->formatCache, A_NUM_CACHED_FORMATS * 3))
+            goto Fail;
+
         if (!PushOldGenStack(&t->exception, 1))
             goto Fail;
 
@@ -1150,6 +1153,7 @@ static ABool TraverseNewGen(void)
                         t->tempStackPtr - t->tempStack);
 
         PushNewGenStack(t->regExp, 2 * A_NUM_CACHED_REGEXPS);
+        PushNewGenStack(t->formatCache, 3 * A_NUM_CACHED_FORMATS);
         PushNewGenStack(&t->exception, 1);
     }
 
@@ -1271,6 +1275,8 @@ static ABool GetMarkUntracedSet(void)
 
         if (!PushOldGenStack(t->regExp, 2 * A_NUM_CACHED_REGEXPS))
             return FALSE;
+        if (!PushOldGenStack(t->formatCache, 3 * A_NUM_CACHED_FORMATS))
+            return FALSE;
         if (!PushOldGenStack(&t->exception, 1))
             return FALSE;
 
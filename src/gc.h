@@ -139,6 +139,36 @@ ABool AModifyObject(AThread *t, const AValue *header, AValue *objPtr,
     } while (0)
 
 
+/* Perform the write barrier of AModifyObject_M without storing the new value.
+   The caller must then store the value to *objPtr before the next garbage
+   collection. This allows the store to be performed using an atomic
+   operation; if the store does not happen, the only effect is that the
+   garbage collector may keep some objects alive longer than necessary. */
+#define AModifyObjectBarrier_M(t, header, objPtr, newValPtr, result) \
+    do {                                                          \
+        AValue newVal_ = *(newValPtr);                            \
+                                                                  \
+        (result) = TRUE;                                          \
+        if (!AIsShortInt(newVal_) && !AIsNewGenBlock(header)) {   \
+            AValue *ptr_ = AValueToPtr(newVal_);                  \
+                                                                  \
+            if ((!AIsFloat(newVal_) && AIsNewGenBlock(ptr_))      \
+                || (AIsFloat(newVal_) && AIsInNursery(ptr_))) {   \
+                if ((t)->newRefPtr != (t)->newRefEnd              \
+                    || AAdvanceNewRefList(t))                     \
+                    *(t)->newRefPtr++ = (objPtr);                 \
+                else                                              \
+                    (result) = FALSE;                             \
+            } else if (AGCState == A_GC_MARK && !AIsMarked(ptr_)) { \
+                if (AVerifyUntracedList(t))                       \
+                    *t->untracedPtr++ = newVal_;                  \
+                else                                              \
+                    (result) = FALSE;                             \
+            }                                                     \
+        }                                                         \
+    } while (0)
+
+
 /* Return value is true if non-zero and false otherwise. */
 AMarkBitmapInt AIsMarked(void *ptr);
 ABool AIsSwept(void *ptr);
@@ -165,6 +195,10 @@ extern AInstance *AOldGenFinalizeInst;
 extern AInstance *ANewGenFinalizeInst;
 
 
+/* Number of items in the freeze time histogram of AGCStatistics */
+#define A_FREEZE_HISTOGRAM_SIZE 24
+
+
 typedef struct {
     long long allocCount;  /* Number of bytes allocated during execution */
     long long retireCount; /* Number of bytes retired from newgen to old */
@@ -178,6 +212,17 @@ typedef struct {
     unsigned long forcedCollectCount; /* Number of full forced collections */
     unsigned long fullIncrementCount; /* Number of full collection
                                          increments */
+
+    /* Time needed for freezing other threads (time-to-safepoint). Only
+       freezes with multiple active threads are included. */
+    unsigned long freezeCount;  /* Number of freezes */
+    double freezeTime;          /* Total time (seconds) */
+    double maxFreezeTime;       /* Longest time (seconds) */
+    /* freezeHistogram[0] is the number of freezes that took less than 1 us,
+       and freezeHistogram[n] (n > 0) is the number of freezes that took at
+       least 2**(n - 1) us but less than 2**n us. The last item also includes
+       all longer freezes. */
+    unsigned long freezeHistogram[A_FREEZE_HISTOGRAM_SIZE];
 } AGCStatistics;
 
 
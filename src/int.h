@@ -91,6 +91,8 @@ AValue ADivModLongInt(AThread *t, AValue oldAVal, AValue oldBVal,
 AValue APowInt(AThread *t, AValue baseVal, AValue expVal);
 
 AValue ALongIntToStr(AThread *t, AValue a, int radix, int minWidth);
+AValue AStrToLongInt(AThread *t, AValue *str, const unsigned char *beg,
+                     Assize_t len, int radix, ABool isNeg);
 
 AValue AFloatToLongInt(AThread *t, double f);
 AValue ANormalize(AThread *t, ALongInt *li, ABool isNeg);
@@ -103,6 +105,22 @@ ALongInt *ADivModSingle(AThread *t, ALongInt *a, unsigned b,
                       unsigned *remPtr);
 
 
+/* Operand length (in digits) above which Karatsuba multiplication is used
+   (must be at least 4) */
+#define A_KARATSUBA_CUTOFF 40
+
+/* Minimum length of the scratch array passed to AMultiplyDigits */
+#define A_MULTIPLY_SCRATCH_LEN(aLen, bLen) (4 * ((aLen) + (bLen)) + 512)
+
+void AMultiplyDigits(ALongIntDigit *d, const ALongIntDigit *a, long aLen,
+                     const ALongIntDigit *b, long bLen,
+                     ALongIntDigit *scratch);
+ALongIntDigit AAddDigits(ALongIntDigit *r, long rLen, const ALongIntDigit *a,
+                         long aLen);
+ALongIntDigit ASubDigits(ALongIntDigit *r, long rLen, const ALongIntDigit *a,
+                         long aLen);
+
+
 AValue AIntDivMod(AThread *t, ASignedValue left, ASignedValue right,
                 AValue *modPtr);
 
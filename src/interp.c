@@ -181,20 +181,25 @@ AValue ARun(AThread *t, AOpcode *ip_, AValue *stack_)
         AValue val = stack[ip[1]];
         unsigned key = ip[2];
 
-        /* Create a temporary wrapper instance for values with special object
-           representations. */
-        if (!AIsInstance(val)) {
-            val = AWrapObject(t, val);
-            if (AIsError(val))
-                goto ExceptionRaised;
-        }
-
         {
-            AInstance *inst = AValueToInstance(val);
-            ATypeInfo *type = AGetInstanceType(inst);
-            AMemberHashTable *table = AGetMemberTable(type, MT_VAR_GET_PUBLIC);
+            ATypeInfo *type;
+            AMemberHashTable *table;
             AMemberNode *node;
 
+            /* Values with special object representations are wrapped in
+               temporary instances only if the member is not a getter
+               method. */
+            if (AIsInstance(val))
+                type = AGetInstanceType(AValueToInstance(val));
+            else {
+                type = AWrapperType(val);
+                if (type == NULL) {
+                    ARaiseMemberErrorND(t, val, -1);
+                    goto ExceptionRaised;
+                }
+            }
+
+            table = AGetMemberTable(type, MT_VAR_GET_PUBLIC);
             node = &table->item[key & table->size];
 
             /* Search the get hash table. */
@@ -203,7 +208,12 @@ AValue ARun(AThread *t, AOpcode *ip_, AValue *stack_)
                     if (type->super == NULL) {
                         AValue item;
 
-                        item = AGetInstanceCodeMember(t, inst, key);
+                        val = AWrapObject(t, val);
+                        if (AIsError(val))
+                            goto ExceptionRaised;
+
+                        item = AGetInstanceCodeMember(t, AValueToInstance(val),
+                                                      key);
                         if (!AIsError(item)) {
                             stack[ip[3]] = item;
                             goto LeaveASSIGN_ML;
@@ -227,7 +237,10 @@ AValue ARun(AThread *t, AOpcode *ip_, AValue *stack_)
                 goto FunctionCall;
             } else {
                 /* Direct access to slot. */
-                stack[ip[3]] = inst->member[node->item];
+                val = AWrapObject(t, val);
+                if (AIsError(val))
+                    goto ExceptionRaised;
+                stack[ip[3]] = AValueToInstance(val)->member[node->item];
             }
         }
 
@@ -1021,53 +1034,63 @@ AValue ARun(AThread *t, AOpcode *ip_, AValue *stack_)
 
             unsigned key = ip[1];
             AValue object = stack[ip[3]];
+            ATypeInfo *type;
+            AMemberHashTable *table;
+            AMemberNode *node;
 
-            /* Wrap non-instance objects (primitive types such as Int and
-               Str). */
-            if (!AIsInstance(object)) {
-                object = AWrapObject(t, object);
-                if (AIsError(object))
+            /* Look up methods of objects with special representations
+               (primitive types such as Int and Str) in the tables of the
+               corresponding wrapper class. The method gets the raw object as
+               self, so no wrapper instance is needed. */
+            if (AIsInstance(object))
+                type = AGetInstanceType(AValueToInstance(object));
+            else {
+                type = AWrapperType(object);
+                if (type == NULL) {
+                    ARaiseMemberErrorND(t, object, -1);
                     goto ExceptionRaised;
+                }
             }
 
             /* Search instance has tables. */
-            {
-                AInstance *inst = AValueToInstance(object);
-                ATypeInfo *type = AGetInstanceType(inst);
-                AMemberHashTable *table = AGetMemberTable(type,
-                                                          MT_METHOD_PUBLIC);
-                AMemberNode *node;
-
-                /* Get the initial node in a hash chain. */
-                node = &table->item[key & table->size];
-
-                while (node->key != key) {
-                    if (node->next == NULL) {
-                        if (type->super == NULL) {
-                            funcVal = AGetInstanceDataMember(t, inst, key);
-                            if (!AIsError(funcVal)) {
-                                ip += 4;
-                                fullArgCnt = ip[-2] - 1;
-                                goto FullArgcReady;
-                            } else {
-                                exception = EX_MEMBER_ERROR;
-                                args[0] = stack[ip[3]];
-                                member = key;
-                                goto RaiseException;
-                            }
+            table = AGetMemberTable(type, MT_METHOD_PUBLIC);
+
+            /* Get the initial node in a hash chain. */
+            node = &table->item[key & table->size];
+
+            while (node->key != key) {
+                if (node->next == NULL) {
+                    if (type->super == NULL) {
+                        /* Wrap primitive objects only when accessing a data
+                           member. */
+                        object = AWrapObject(t, object);
+                        if (AIsError(object))
+                            goto ExceptionRaised;
+
+                        funcVal = AGetInstanceDataMember(
+                            t, AValueToInstance(object), key);
+                        if (!AIsError(funcVal)) {
+                            ip += 4;
+                            fullArgCnt = ip[-2] - 1;
+                            goto FullArgcReady;
                         } else {
-                            type = type->super;
-                            table = AGetMemberTable(type, MT_METHOD_PUBLIC);
-                            node = &table->item[key & table->size];
+                            exception = EX_MEMBER_ERROR;
+                            args[0] = stack[ip[3]];
+                            member = key;
+                            goto RaiseException;
                         }
-                    } else
-                        node = node->next;
-                }
+                    } else {
+                        type = type->super;
+                        table = AGetMemberTable(type, MT_METHOD_PUBLIC);
+                        node = &table->item[key & table->size];
+                    }
+                } else
+                    node = node->next;
+            }
 
-                funcVal = AGlobalByNum(node->item);
+            funcVal = AGlobalByNum(node->item);
 
-                ip += 3;
-            }
+            ip += 3;
 
           Call:
 
@@ -1108,7 +1131,8 @@ AValue ARun(AThread *t, AOpcode *ip_, AValue *stack_)
 
                 func = AValueToFunction(funcVal);
 
-                stackFrameSize = func->stackFrameSize;
+                stackFrameSize = ACallFrameSize(func, fullArgCnt,
+                                                func->maxArgs);
                 newStack = APreviousFrame(stack, stackFrameSize);
                 if (newStack < t->stack) {
                     exception = AErrorId(EX_RUNTIME_ERROR,
@@ -1212,7 +1236,8 @@ AValue ARun(AThread *t, AOpcode *ip_, AValue *stack_)
 
                 func = AValueToFunction(funcVal);
 
-                stackFrameSize = func->stackFrameSize;
+                stackFrameSize = ACallFrameSize(func, fullArgCnt,
+                                                func->maxArgs - 1);
                 /* FIX: handle underflow? */
                 newStack = APreviousFrame(stack, stackFrameSize);
 
@@ -3110,7 +3135,7 @@ AValue ARun(AThread *t, AOpcode *ip_, AValue *stack_)
 
             func = AValueToFunction(funcVal);
 
-            stackFrameSize = func->stackFrameSize;
+            stackFrameSize = ACallFrameSize(func, numArgs, func->maxArgs);
             newStack = APreviousFrame(stack, stackFrameSize);
             if (newStack < t->stack) {
                 exception = AErrorId(EX_RUNTIME_ERROR,
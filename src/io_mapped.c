@@ -0,0 +1,585 @@
+/* io_mapped.c - io module (MappedFile related functionality)
+
+   Copyright (c) 2010-2011 Jukka Lehtosalo
+
+   Alore is licensed under the terms of the MIT license.  See the file
+   LICENSE.txt in the distribution.
+*/
+
+/* Implementation of io::MappedFile, a read-only file whose contents are
+   mapped to memory.
+
+   Str objects must live in the garbage collected heap, so the contents of a
+   mapping cannot be exposed directly as Str objects. Instead, slicing a
+   MappedFile and iterating over the lines of a MappedFile produce views,
+   which are MappedFile objects that refer to a range of the original mapping
+   without copying any data. Views support the same operations as the original
+   object, and a view is converted to a Str object only when explicitly
+   requested (Str(view)). The re module can match regular expressions directly
+   against a view (see AGetMappedFileContents). */
+
+#include "aconfig.h"
+
+#ifdef A_HAVE_POSIX
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "alore.h"
+#include "io_module.h"
+#include "str.h"
+
+
+/* Slot ids for MappedFile (slot 0 is reserved for the finalizer) */
+#define MF_BASE 1  /* The MappedFile object that owns the mapping */
+#define MF_START 2 /* Offset of the view in the mapping */
+#define MF_LEN 3   /* Length of the view */
+
+/* Slot ids for __MappedFileIter */
+#define MI_FILE 0
+#define MI_POS 1
+
+
+int AMappedFileClassNum;
+int AMappedFileDataOffset;
+int AMappedFileIterClassNum;
+
+
+#define GetMappedData(v) \
+    ((AMappedFileData *)ADataPtr(v, AMappedFileDataOffset))
+
+
+static ABool GetView(AThread *t, AValue v, unsigned char **data,
+                     AInt64 *len);
+static AValue MakeView(AThread *t, AValue *frame, AInt64 start, AInt64 len);
+static ABool ReadWholeFile(const char *path, AMappedFileData *m);
+static void FreeMapping(AMappedFileData *m);
+
+
+/* MappedFile create(path)
+   Map the contents of a file to memory for reading. */
+AValue AMappedFileCreate(AThread *t, AValue *frame)
+{
+    char path[A_MAX_PATH_LEN];
+    AMappedFileData *m;
+    AMappedFileData tmp;
+
+    AGetStr(t, frame[1], path, A_MAX_PATH_LEN);
+
+    tmp.data = NULL;
+    tmp.size = 0;
+    tmp.isOwner = TRUE;
+    tmp.isClosed = FALSE;
+    tmp.isMapped = FALSE;
+
+#ifdef A_HAVE_POSIX
+    {
+        struct stat st;
+        int fileNum;
+
+        AAllowBlocking();
+        fileNum = open(path, O_RDONLY);
+        AEndBlocking();
+
+        if (fileNum < 0)
+            return ARaiseErrnoIoError(t, path);
+
+        if (fstat(fileNum, &st) < 0) {
+            int err = errno;
+            close(fileNum);
+            errno = err;
+            return ARaiseErrnoIoError(t, path);
+        }
+
+        if (S_ISREG(st.st_mode) && st.st_size > 0) {
+            void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE,
+                           fileNum, 0);
+            if (p != MAP_FAILED) {
+                tmp.data = p;
+                tmp.size = st.st_size;
+                tmp.isMapped = TRUE;
+#ifdef MADV_SEQUENTIAL
+                /* Files are usually scanned from start to end. */
+                madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+            }
+        }
+
+        close(fileNum);
+
+        /* Files that cannot be mapped (such as special files) are read into
+           memory. This includes regular files whose size is reported as 0,
+           since many files in /proc have a size of 0 but are not empty. */
+        if (!tmp.isMapped) {
+            AAllowBlocking();
+            if (!ReadWholeFile(path, &tmp)) {
+                AEndBlocking();
+                return ARaiseErrnoIoError(t, path);
+            }
+            AEndBlocking();
+        }
+    }
+#else
+    AAllowBlocking();
+    if (!ReadWholeFile(path, &tmp)) {
+        AEndBlocking();
+        return ARaiseErrnoIoError(t, path);
+    }
+    AEndBlocking();
+#endif
+
+    m = GetMappedData(frame[0]);
+    *m = tmp;
+
+    ASetMemberDirect(t, frame[0], MF_BASE, frame[0]);
+    ASetMemberDirect(t, frame[0], MF_START, AZero);
+    ASetMemberDirect(t, frame[0], MF_LEN, AMakeInt64(t, tmp.size));
+
+    return frame[0];
+}
+
+
+/* MappedFile length() */
+AValue AMappedFileLength(AThread *t, AValue *frame)
+{
+    unsigned char *data;
+    AInt64 len;
+
+    if (!GetView(t, frame[0], &data, &len))
+        return AError;
+    return AMakeInt64(t, len);
+}
+
+
+/* MappedFile _get(index)
+   If index is an integer, return the character at index. If it is a pair
+   lo : hi, return a view that refers to the range without copying data. */
+AValue AMappedFile_get(AThread *t, AValue *frame)
+{
+    unsigned char *data;
+    AInt64 len;
+
+    if (!GetView(t, frame[0], &data, &len))
+        return AError;
+
+    if (AIsPair(frame[1])) {
+        AValue loVal, hiVal;
+        AInt64 lo, hi;
+
+        AGetPair(t, frame[1], &loVal, &hiVal);
+        lo = AIsNil(loVal) ? 0 : AGetInt64(t, loVal);
+        hi = AIsNil(hiVal) ? len : AGetInt64(t, hiVal);
+
+        if (lo < 0) {
+            lo += len;
+            if (lo < 0)
+                lo = 0;
+        } else if (lo > len)
+            lo = len;
+        if (hi < 0)
+            hi += len;
+        else if (hi > len)
+            hi = len;
+        if (hi < lo)
+            hi = lo;
+
+        return MakeView(t, frame, lo, hi - lo);
+    } else {
+        AInt64 i = AGetInt64(t, frame[1]);
+        if (i < 0)
+            i += len;
+        if (i < 0 || i >= len)
+            return ARaiseIndexError(t, NULL);
+        return AMakeCh(t, data[i]);
+    }
+}
+
+
+/* MappedFile find(str[, start])
+   Return the index of the first occurrence of str at or after start, or -1
+   if there is none. Search the mapping directly without creating strings. */
+AValue AMappedFileFind(AThread *t, AValue *frame)
+{
+    unsigned char *data;
+    AInt64 len;
+    AInt64 start;
+    AInt64 subLen;
+    AInt64 i;
+    unsigned char *sub;
+
+    if (!GetView(t, frame[0], &data, &len))
+        return AError;
+
+    AExpectStr(t, frame[1]);
+
+    if (!AIsDefault(frame[2])) {
+        start = AGetInt64(t, frame[2]);
+        if (start < 0)
+            return ARaiseValueError(t, "Negative start index");
+    } else
+        start = 0;
+
+    subLen = AStrLen(frame[1]);
+    if (subLen == 0)
+        return AMakeInt64(t, start <= len ? start : -1);
+    if (start > len - subLen)
+        return AMakeInt(t, -1);
+
+    if (AIsNarrowStr(frame[1]) || AIsNarrowSubStr(frame[1]))
+        sub = ANarrowStrItems(frame[1]);
+    else {
+        /* The mapping contains only 8-bit characters; convert a wide string
+           to a temporary narrow buffer. */
+        sub = malloc(subLen);
+        if (sub == NULL)
+            return ARaiseMemoryError(t);
+        for (i = 0; i < subLen; i++) {
+            AWideChar ch = AStrItem(frame[1], i);
+            if (ch > 255) {
+                free(sub);
+                return AMakeInt(t, -1);
+            }
+            sub[i] = ch;
+        }
+    }
+
+    /* Scan for the first character using memchr and compare the rest. No
+       allocation happens during the scan, so sub remains valid even if it
+       points to a heap object. */
+    i = -1;
+    {
+        unsigned char *p = data + start;
+        unsigned char *last = data + len - subLen;
+
+        while (p <= last) {
+            p = memchr(p, sub[0], last - p + 1);
+            if (p == NULL)
+                break;
+            if (memcmp(p + 1, sub + 1, subLen - 1) == 0) {
+                i = p - data;
+                break;
+            }
+            p++;
+        }
+    }
+
+    if (!AIsNarrowStr(frame[1]) && !AIsNarrowSubStr(frame[1]))
+        free(sub);
+
+    return AMakeInt64(t, i);
+}
+
+
+/* MappedFile _str()
+   Return the contents of the view as a Str object. */
+AValue AMappedFile_str(AThread *t, AValue *frame)
+{
+    unsigned char *data;
+    AInt64 len;
+    AValue s;
+
+    if (!GetView(t, frame[0], &data, &len))
+        return AError;
+
+    if (len > A_SSIZE_T_MAX)
+        return ARaiseMemoryError(t);
+
+    /* The data pointer is not affected by garbage collection. */
+    s = AMakeEmptyStr(t, len);
+    if (AIsError(s))
+        return AError;
+    memcpy(AStrPtr(s), data, len);
+    return s;
+}
+
+
+/* MappedFile _eq(object)
+   Compare the contents of the view with a Str or another MappedFile object
+   without creating strings. */
+AValue AMappedFile_eq(AThread *t, AValue *frame)
+{
+    unsigned char *data;
+    AInt64 len;
+    Assize_t i;
+
+    if (!GetView(t, frame[0], &data, &len))
+        return AError;
+
+    if (AIsStr(frame[1])) {
+        if (AStrLen(frame[1]) != len)
+            return AFalse;
+        if (AIsNarrowStr(frame[1]) || AIsNarrowSubStr(frame[1]))
+            return memcmp(ANarrowStrItems(frame[1]), data, len) == 0 ?
+                ATrue : AFalse;
+        for (i = 0; i < len; i++) {
+            if (AStrItem(frame[1], i) != data[i])
+                return AFalse;
+        }
+        return ATrue;
+    } else if (AIsInstance(frame[1])
+               && AIsOfType(frame[1], AGlobalByNum(AMappedFileClassNum))
+                  == A_IS_TRUE) {
+        unsigned char *data2;
+        AInt64 len2;
+
+        if (!GetView(t, frame[1], &data2, &len2))
+            return AError;
+        return len == len2 && memcmp(data, data2, len) == 0 ? ATrue : AFalse;
+    } else
+        return AFalse;
+}
+
+
+/* MappedFile iterator()
+   Return an iterator that produces the lines of the view as views. Line
+   endings (CR, LF or CR+LF) are not included in the lines. */
+AValue AMappedFileIter(AThread *t, AValue *frame)
+{
+    unsigned char *data;
+    AInt64 len;
+
+    if (!GetView(t, frame[0], &data, &len))
+        return AError;
+
+    frame[1] = AMakeUninitializedObject(t,
+                                        AGlobalByNum(AMappedFileIterClassNum));
+    ASetMemberDirect(t, frame[1], MI_FILE, frame[0]);
+    ASetMemberDirect(t, frame[1], MI_POS, AZero);
+    return frame[1];
+}
+
+
+/* MappedFile close()
+   Unmap the file. Any operations on the object or views derived from it will
+   fail after this. Calling close on a closed object does nothing. */
+AValue AMappedFileClose(AThread *t, AValue *frame)
+{
+    AValue base = AMemberDirect(frame[0], MF_BASE);
+    if (!AIsNil(base))
+        FreeMapping(GetMappedData(base));
+    return ANil;
+}
+
+
+/* MappedFile #f */
+AValue AMappedFileFinalize(AThread *t, AValue *frame)
+{
+    AMappedFileData *m = GetMappedData(frame[0]);
+    if (m->isOwner)
+        FreeMapping(m);
+    return ANil;
+}
+
+
+/* __MappedFileIter hasNext() */
+AValue AMappedFileIterHasNext(AThread *t, AValue *frame)
+{
+    unsigned char *data;
+    AInt64 len;
+
+    if (!GetView(t, AMemberDirect(frame[0], MI_FILE), &data, &len))
+        return AError;
+
+    return AGetInt64(t, AMemberDirect(frame[0], MI_POS)) < len ?
+        ATrue : AFalse;
+}
+
+
+/* __MappedFileIter next() */
+AValue AMappedFileIterNext(AThread *t, AValue *frame)
+{
+    unsigned char *data;
+    unsigned char *p;
+    unsigned char *lineEnd;
+    unsigned char *cr;
+    AInt64 len;
+    AInt64 pos;
+    AInt64 next;
+
+    frame[1] = AMemberDirect(frame[0], MI_FILE);
+    if (!GetView(t, frame[1], &data, &len))
+        return AError;
+
+    pos = AGetInt64(t, AMemberDirect(frame[0], MI_POS));
+    if (pos >= len)
+        return ARaiseValueError(t, "No more items");
+
+    /* Find the first LF and then check if there is a CR before it. */
+    p = data + pos;
+    lineEnd = memchr(p, '\n', len - pos);
+    if (lineEnd == NULL)
+        lineEnd = data + len;
+    cr = memchr(p, '\r', lineEnd - p);
+    if (cr != NULL)
+        lineEnd = cr;
+
+    next = lineEnd - data;
+    if (next < len) {
+        if (data[next] == '\r' && next + 1 < len && data[next + 1] == '\n')
+            next += 2;
+        else
+            next++;
+    }
+
+    ASetMemberDirect(t, frame[0], MI_POS, AMakeInt64(t, next));
+
+    /* MakeView expects the view in frame[0]. */
+    frame[0] = frame[1];
+    return MakeView(t, frame, pos, lineEnd - p);
+}
+
+
+/* If v is an open MappedFile object (or a view), store a pointer to its
+   contents in *data and the length in *len and return 1. If v is not a
+   MappedFile object, return 0. If it has been closed, raise an exception and
+   return -1. The pointer remains valid until the object is closed. */
+int AGetMappedFileContents(AThread *t, AValue v, unsigned char **data,
+                           AInt64 *len)
+{
+    if (AMappedFileClassNum == 0 || !AIsInstance(v)
+        || AIsOfType(v, AGlobalByNum(AMappedFileClassNum)) != A_IS_TRUE)
+        return 0;
+    return GetView(t, v, data, len) ? 1 : -1;
+}
+
+
+/* Return the contents of range [i1, i2) of a MappedFile object as a Str
+   object. The range is assumed to be valid. */
+AValue AMappedFileSubStr(AThread *t, AValue v, AInt64 i1, AInt64 i2)
+{
+    unsigned char *data;
+    AInt64 len;
+    AValue s;
+
+    if (!GetView(t, v, &data, &len))
+        return AError;
+
+    s = AMakeEmptyStr(t, i2 - i1);
+    if (AIsError(s))
+        return AError;
+    memcpy(AStrPtr(s), data + i1, i2 - i1);
+    return s;
+}
+
+
+/* Get a pointer to the start of a view and its length. Raise an exception and
+   return FALSE if the mapping has been closed. */
+static ABool GetView(AThread *t, AValue v, unsigned char **data,
+                     AInt64 *len)
+{
+    AValue base = AMemberDirect(v, MF_BASE);
+    AMappedFileData *m;
+
+    if (AIsNil(base)) {
+        ARaiseValueError(t, "MappedFile not initialized");
+        return FALSE;
+    }
+
+    m = GetMappedData(base);
+    if (m->isClosed) {
+        ARaiseIoError(t, "MappedFile is closed");
+        return FALSE;
+    }
+
+    *data = m->data + AGetInt64(t, AMemberDirect(v, MF_START));
+    *len = AGetInt64(t, AMemberDirect(v, MF_LEN));
+    return TRUE;
+}
+
+
+/* Create a view that refers to a range of the view at frame[0]. Start is
+   relative to the view. Overwrites frame[1]. */
+static AValue MakeView(AThread *t, AValue *frame, AInt64 start, AInt64 len)
+{
+    AInt64 offset = AGetInt64(t, AMemberDirect(frame[0], MF_START));
+
+    frame[1] = AMakeUninitializedObject(t, AGlobalByNum(AMappedFileClassNum));
+    ASetMemberDirect(t, frame[1], MF_BASE, AMemberDirect(frame[0], MF_BASE));
+    ASetMemberDirect(t, frame[1], MF_START, AMakeInt64(t, offset + start));
+    ASetMemberDirect(t, frame[1], MF_LEN, AMakeInt64(t, len));
+    return frame[1];
+}
+
+
+/* Read the contents of a file into a malloc'd buffer. Return FALSE and set
+   errno on error. */
+static ABool ReadWholeFile(const char *path, AMappedFileData *m)
+{
+    FILE *file;
+    unsigned char *buf = NULL;
+    size_t size = 0;
+    size_t capacity = 0;
+
+    file = fopen(path, "rb");
+    if (file == NULL)
+        return FALSE;
+
+    for (;;) {
+        size_t n;
+
+        if (size == capacity) {
+            unsigned char *newBuf;
+
+            capacity = capacity == 0 ? 65536 : 2 * capacity;
+            newBuf = realloc(buf, capacity);
+            if (newBuf == NULL) {
+                free(buf);
+                fclose(file);
+                errno = ENOMEM;
+                return FALSE;
+            }
+            buf = newBuf;
+        }
+
+        n = fread(buf + size, 1, capacity - size, file);
+        if (n == 0) {
+            if (ferror(file)) {
+                int err = errno;
+                free(buf);
+                fclose(file);
+                errno = err;
+                return FALSE;
+            }
+            break;
+        }
+        size += n;
+    }
+
+    fclose(file);
+
+    /* Do not keep a buffer for an empty file. */
+    if (size == 0) {
+        free(buf);
+        buf = NULL;
+    }
+
+    m->data = buf;
+    m->size = size;
+    m->isMapped = FALSE;
+    return TRUE;
+}
+
+
+static void FreeMapping(AMappedFileData *m)
+{
+    if (m->isClosed)
+        return;
+    if (m->data != NULL) {
+#ifdef A_HAVE_POSIX
+        if (m->isMapped)
+            munmap(m->data, (size_t)m->size);
+        else
+#endif
+            free(m->data);
+    }
+    m->data = NULL;
+    m->isClosed = TRUE;
+}
@@ -13,6 +13,7 @@
 #include "io_module.h"
 #include "errmsg.h"
 #include "internal.h"
+#include "runtime.h"
 #include "thread_athread.h"
 #include "gc.h"
 
@@ -20,7 +21,12 @@
 static AValue StreamReadAll(AThread *t, AValue *frame);
 
 static AValue CreateBuffer(AThread *t, AValue inst);
-static AValue StreamFillInputBuffer(AThread *t, AValue *frame);
+static AValue ResetBuffer(AThread *t, AValue inst, ABool isFull);
+static AValue WriteDirect(AThread *t, AValue *frame, int bufInd, int ind,
+                          int len);
+static int StreamBufferSize(AInstance *inst);
+static ABool GrowStreamBuffer(AInstance *inst);
+static int GetFileDescriptor(AValue stream);
 
 
 int AUnbufferedNum;
@@ -43,16 +49,25 @@ int AStdErrNum;
 int AFlushOutputBuffersNum;
 
 int AFileClassNum;
+int AStreamClassNum;
 
 int ANameMemberNum;
 
 static int StreamIterClassNum;
 
 
+/* Classes registered using ARegisterFileDescriptorStream (File is not
+   included) */
+#define MAX_FD_STREAM_CLASSES 4
+static int FdStreamClasses[MAX_FD_STREAM_CLASSES];
+static int NumFdStreamClasses;
+
+
 AValue AStreamCreate(AThread *t, AValue *frame)
 {
     AInstance *inst;
     AValue bufMode;
+    AValue bufSize;
     AValue mode;
     int i;
 
@@ -60,9 +75,16 @@ AValue AStreamCreate(AThread *t, AValue *frame)
 
     mode = 0;
     bufMode = A_BUFMODE_BUFFERED;
+    bufSize = AZero;
 
     for (i = 1; i <= 4; i++) {
-        if (frame[i] == AGlobalByNum(ABufferedNum))
+        if (AIsShortInt(frame[i])) {
+            /* Explicit buffer size */
+            if (AValueToInt(frame[i]) <= 0
+                || AValueToInt(frame[i]) > A_MAX_READ_SIZE)
+                return ARaiseValueError(t, "Invalid buffer size");
+            bufSize = frame[i];
+        } else if (frame[i] == AGlobalByNum(ABufferedNum))
             bufMode = A_BUFMODE_BUFFERED;
         else if (frame[i] == AGlobalByNum(ALineBufferedNum))
             bufMode = A_BUFMODE_LINE_BUFFERED;
@@ -93,6 +115,7 @@ AValue AStreamCreate(AThread *t, AValue *frame)
     inst->member[A_STREAM_INPUT_BUF_END] = AZero;
     inst->member[A_STREAM_OUTPUT_BUF] = AZero;
     inst->member[A_STREAM_OUTPUT_BUF_IND] = AZero;
+    inst->member[A_STREAM_BUF_SIZE] = bufSize;
 
     return frame[0];
 }
@@ -107,6 +130,7 @@ AValue AStreamInitialize(AThread *t, AValue *frame)
     inst->member[A_STREAM_MODE] = AZero;
     inst->member[A_STREAM_INPUT_BUF] = AZero;
     inst->member[A_STREAM_OUTPUT_BUF] = AZero;
+    inst->member[A_STREAM_BUF_SIZE] = AZero;
 
     return ANil;
 }
@@ -128,7 +152,7 @@ AValue AStreamWrite(AThread *t, AValue *frame)
         unsigned bufInd;
         unsigned origBufInd;
 
-        aLen = AArrayLen(frame[1]);
+        aLen = AVarArgLen(t, frame[1]);
 
         buf = AValueToStr(inst->member[A_STREAM_OUTPUT_BUF]);
         bufLen = AGetStrLen(buf);
@@ -140,7 +164,7 @@ AValue AStreamWrite(AThread *t, AValue *frame)
             unsigned len;
             unsigned ind;
 
-            frame[2] = AArrayItem(frame[1], i);
+            frame[2] = AVarArgItem(t, frame[1], i);
 
             for (;;) {
                 if (AIsNarrowStr(frame[2])) {
@@ -214,6 +238,7 @@ AValue AStreamWrite(AThread *t, AValue *frame)
                             inst = AValueToInstance(frame[0]);
                             buf = AValueToStr(
                                 inst->member[A_STREAM_OUTPUT_BUF]);
+                            bufLen = AGetStrLen(buf);
                             s = AValueToStr(frame[2])->elem;
 
                             bufInd = 0;
@@ -253,6 +278,24 @@ AValue AStreamWrite(AThread *t, AValue *frame)
                 }
             }
 
+            /* Pass long narrow strings directly to the _write method of a
+               file together with the buffered data instead of copying them
+               through the buffer. */
+            if (len >= bufLen && AIsNarrowStr(frame[2])
+                && !AIsWideStr(inst->member[A_STREAM_OUTPUT_BUF])
+                && GetFileDescriptor(frame[0]) >= 0) {
+                if (AIsError(WriteDirect(t, frame, bufInd, ind, len)))
+                    return AError;
+
+                inst = AValueToInstance(frame[0]);
+                buf = AValueToStr(inst->member[A_STREAM_OUTPUT_BUF]);
+                bufLen = AGetStrLen(buf);
+                bufInd = 0;
+                origBufInd = 0;
+
+                continue;
+            }
+
             while (bufInd + len > bufLen) {
                 /* Fill the rest of the buffer by copying from the source
                    string. */
@@ -268,6 +311,7 @@ AValue AStreamWrite(AThread *t, AValue *frame)
                 /* Update values that could have been moved by gc. */
                 inst = AValueToInstance(frame[0]);
                 buf = AValueToStr(inst->member[A_STREAM_OUTPUT_BUF]);
+                bufLen = AGetStrLen(buf);
                 s = AValueToStr(frame[2])->elem;
 
                 bufInd = 0;
@@ -306,6 +350,7 @@ AValue AStreamWrite(AThread *t, AValue *frame)
                     /* Update values that could have been moved by gc. */
                     inst = AValueToInstance(frame[0]);
                     buf = AValueToStr(inst->member[A_STREAM_OUTPUT_BUF]);
+                    bufLen = AGetStrLen(buf);
                     wbuf = (AWideString *)buf;
                     s = AValueToStr(frame[2])->elem;
 
@@ -333,6 +378,7 @@ AValue AStreamWrite(AThread *t, AValue *frame)
 
                 inst = AValueToInstance(frame[0]);
                 buf = AValueToStr(inst->member[A_STREAM_OUTPUT_BUF]);
+                bufLen = AGetStrLen(buf);
                 bufInd = 0;
             }
 
@@ -355,6 +401,7 @@ AValue AStreamWrite(AThread *t, AValue *frame)
 
                 inst = AValueToInstance(frame[0]);
                 buf = AValueToStr(inst->member[A_STREAM_OUTPUT_BUF]);
+                bufLen = AGetStrLen(buf);
                 bufInd = 0;
             }
 
@@ -409,32 +456,30 @@ AValue AStreamWrite(AThread *t, AValue *frame)
         ABool isNewLine;
         ABool result;
 
-        aLen = AArrayLen(frame[1]);
+        aLen = AVarArgLen(t, frame[1]);
+        isNewLine = (inst->member[A_STREAM_MODE] & A_MODE_WRITELINE) != 0;
 
-        if (inst->member[A_STREAM_MODE] & A_MODE_WRITELINE) {
+        if (isNewLine || AIsShortInt(frame[1])) {
             dstA = AZero;
 
-            /* Create a new array for arguments that will contain an
-               additional item for newline. */
-            AMakeUninitArray_M(t, aLen + 1, dstA, result);
+            /* Create a new array for arguments, with an additional item for
+               newline if needed. The arguments may also be stored in the
+               stack frame instead of an array. */
+            AMakeUninitArray_M(t, aLen + isNewLine, dstA, result);
             if (!result)
                 return AError;
 
             /* Initialize the array to zero. */
-            for (i = 0; i < aLen + 1; i++)
+            for (i = 0; i < aLen + isNewLine; i++)
                 ASetArrayItemNewGen(dstA, i, AZero);
 
             frame[2] = dstA;
-
-            isNewLine = TRUE;
-        } else {
+        } else
             frame[2] = frame[1];
-            isNewLine = FALSE;
-        }
 
         /* Convert all arguments to strings. */
         for (i = 0; i < aLen; i++) {
-            AValue item = AArrayItem(frame[1], i);
+            AValue item = AVarArgItem(t, frame[1], i);
             if (!AIsStr(item)) {
                 AValue *strFrame = AAllocTemp(t, item);
                 item = AStdStr(t, strFrame);
@@ -568,7 +613,7 @@ static AValue StreamRead(AThread *t, AValue *frame)
                 /* Perform a buffered read. */
                 AValue status;
 
-                status = StreamFillInputBuffer(t, frame);
+                status = AStreamFillInputBuffer(t, frame);
                 if (AIsError(status))
                     return AError;
 
@@ -640,6 +685,7 @@ static AValue StreamRead(AThread *t, AValue *frame)
 static AValue StreamReadAll(AThread *t, AValue *frame)
 {
     AInstance *inst;
+    int blockSize;
 
     /* Collect all read blocks in an array. */
     frame[2] = AMakeArray(t, 0);
@@ -670,11 +716,15 @@ static AValue StreamReadAll(AThread *t, AValue *frame)
     inst->member[A_STREAM_INPUT_BUF_IND] = AZero;
     inst->member[A_STREAM_INPUT_BUF_END] = AZero;
 
-    /* Read data from the stream a block at a time. */
+    /* Read data from the stream a block at a time. Grow the block size so that
+       large streams can be read using fewer _read calls. */
+    blockSize = A_IO_BUFFER_SIZE;
     for (;;) {
         AValue v;
 
-        frame[1] = AIntToValue(A_IO_BUFFER_SIZE);
+        frame[1] = AIntToValue(blockSize);
+        if (blockSize < A_IO_MAX_BUFFER_SIZE)
+            blockSize *= 2;
         v = ACallMethodByNum(t, AM__READ, 1, frame);
         if (AIsError(v))
             return AError;
@@ -789,7 +839,7 @@ AValue AStreamReadLn(AThread *t, AValue *frame)
                 /* End of buffer reached. */
                 AValue fillRes;
 
-                fillRes = StreamFillInputBuffer(t, frame);
+                fillRes = AStreamFillInputBuffer(t, frame);
                 if (AIsError(fillRes))
                     return AError;
                 if (AIsNil(fillRes))
@@ -804,7 +854,7 @@ AValue AStreamReadLn(AThread *t, AValue *frame)
                         == AValueToInt(inst->member[A_STREAM_INPUT_BUF_END])) {
                         AValue fillRes;
 
-                        fillRes = StreamFillInputBuffer(t, frame);
+                        fillRes = AStreamFillInputBuffer(t, frame);
                         if (AIsError(fillRes))
                             return AError;
                         if (AIsNil(fillRes))
@@ -847,7 +897,7 @@ AValue AStreamReadLn(AThread *t, AValue *frame)
 
         AValue fillRes;
 
-        fillRes = StreamFillInputBuffer(t, frame);
+        fillRes = AStreamFillInputBuffer(t, frame);
         if (AIsError(fillRes))
             return AError;
         else if (AIsNil(fillRes)) {
@@ -911,7 +961,11 @@ AValue AStreamFlush(AThread *t, AValue *frame)
     if (inst->member[A_STREAM_OUTPUT_BUF] != AZero) {
         /* Write the contents of the output buffer. */
 
+        ABool isFull;
+
         len = AValueToInt(inst->member[A_STREAM_OUTPUT_BUF_IND]);
+        isFull = len == AGetStrLen(AValueToStr(
+                            inst->member[A_STREAM_OUTPUT_BUF]));
         if (AIsWideStr(inst->member[A_STREAM_OUTPUT_BUF]))
             len /= sizeof(AWideChar);
 
@@ -933,16 +987,7 @@ AValue AStreamFlush(AThread *t, AValue *frame)
 
         t->tempStackPtr -= 3;
 
-        if (AGetInstanceType(&AValueToInstance(frame[0])->type)
-            != AValueToType(AGlobalByNum(AFileClassNum)))
-            return CreateBuffer(t, frame[0]);
-        else {
-            /* File objects may reuse the output buffer because the _write
-               method will not store a reference to the buffer. */
-            AValueToInstance(frame[0])->member[A_STREAM_OUTPUT_BUF_IND] =
-                AZero;
-            return ANil;
-        }
+        return ResetBuffer(t, frame[0], isFull);
     } else
         return ANil;
 }
@@ -969,7 +1014,7 @@ static AValue StreamEof(AThread *t, AValue *frame)
 
         /* Fill the input buffer, even if the stream is unbuffered. If the
            buffer could not be filled, we must be at the end of the stream. */
-        v = StreamFillInputBuffer(t, frame);
+        v = AStreamFillInputBuffer(t, frame);
         if (AIsNil(v))
             return ATrue;
         else if (v == AZero)
@@ -1056,16 +1101,167 @@ static AValue StreamIterNext(AThread *t, AValue *frame)
 }
 
 
+/* Stream copyTo(stream[, count])
+   Copy the rest of the stream (or at most count characters) to another
+   stream. Return the number of characters copied. If both the streams read
+   and write file descriptors directly, the data is copied without creating
+   Str objects. */
+static AValue StreamCopyTo(AThread *t, AValue *frame)
+{
+    AInstance *inst;
+    AInt64 count;
+    AInt64 total;
+    int srcFd;
+    int dstFd;
+
+    if (AIsDefault(frame[2]) || AIsNil(frame[2]))
+        count = -1;
+    else {
+        count = AGetInt64(t, frame[2]);
+        if (count < 0)
+            return ARaiseValueError(t, NULL);
+    }
+
+    if (AIsOfType(frame[1], AGlobalByNum(AStreamClassNum)) != A_IS_TRUE)
+        return ARaiseTypeError(t, NULL);
+
+    if ((AMemberDirect(frame[0], A_STREAM_MODE) & A_MODE_INPUT) == 0)
+        return ARaiseByNum(t, AStdIoErrorNum, AMsgWriteOnly);
+    if ((AMemberDirect(frame[1], A_STREAM_MODE) & A_MODE_OUTPUT) == 0)
+        return ARaiseByNum(t, AStdIoErrorNum, AMsgReadOnly);
+
+    /* Write any data buffered in the target stream before the copied data. */
+    if (AIsError(ACallMethodByNum(t, AM_FLUSH, 0, frame + 1)))
+        return AError;
+
+    total = 0;
+
+    /* Copy the data in the input buffer first. */
+    if (AMemberDirect(frame[0], A_STREAM_INPUT_BUF) != AZero) {
+        int ind = AValueToInt(AMemberDirect(frame[0], A_STREAM_INPUT_BUF_IND));
+        int end = AValueToInt(AMemberDirect(frame[0], A_STREAM_INPUT_BUF_END));
+
+        if (count >= 0 && end - ind > count)
+            end = ind + count;
+
+        frame[4] = frame[1];
+        frame[5] = ASubStr(t, AMemberDirect(frame[0], A_STREAM_INPUT_BUF),
+                           ind, end);
+        frame[6] = AZero;
+
+        inst = AValueToInstance(frame[0]);
+        if (end == AValueToInt(inst->member[A_STREAM_INPUT_BUF_END])) {
+            inst->member[A_STREAM_INPUT_BUF] = AZero;
+            inst->member[A_STREAM_INPUT_BUF_IND] = AZero;
+            inst->member[A_STREAM_INPUT_BUF_END] = AZero;
+        } else
+            inst->member[A_STREAM_INPUT_BUF_IND] = AIntToValue(end);
+
+        if (AIsError(ACallMethodByNum(t, AM__WRITE, 1, frame + 4)))
+            return AError;
+
+        total = end - ind;
+    }
+
+    srcFd = GetFileDescriptor(frame[0]);
+    dstFd = GetFileDescriptor(frame[1]);
+
+#ifdef A_HAVE_POSIX
+    if (srcFd >= 0 && dstFd >= 0) {
+        AInt64 n = 0;
+
+        if (count < 0 || total < count) {
+            n = ACopyFileDescriptor(t, dstFd, srcFd, -1,
+                                    count < 0 ? -1 : count - total);
+            if (n < 0)
+                return AError;
+        }
+
+        return AMakeInt64(t, total + n);
+    }
+#endif
+
+    /* Generic implementation: read and write a block at a time. */
+    while (count < 0 || total < count) {
+        AInt64 len = A_IO_BUFFER_SIZE;
+        AValue v;
+
+        if (count >= 0 && count - total < len)
+            len = count - total;
+
+        frame[3] = frame[0];
+        frame[4] = AIntToValue(len);
+        v = ACallMethodByNum(t, AM__READ, 1, frame + 3);
+        if (AIsError(v))
+            return AError;
+        if (AIsNil(v))
+            break;
+        if (!AIsStr(v))
+            return ARaiseTypeErrorND(t, NULL);
+
+        frame[4] = frame[1];
+        frame[5] = v;
+        frame[6] = AZero;
+        if (AIsError(ACallMethodByNum(t, AM__WRITE, 1, frame + 4)))
+            return AError;
+
+        total += AStrLen(frame[5]);
+
+        if (ACheckInterrupt(t))
+            return AError; /* Interrupted */
+    }
+
+    return AMakeInt64(t, total);
+}
+
+
+/* Return the file descriptor of an open File object or an instance of a
+   class registered using ARegisterFileDescriptorStream. Return -1 if the
+   stream is some other kind of stream or if it is closed. */
+static int GetFileDescriptor(AValue stream)
+{
+#ifdef A_HAVE_POSIX
+    ATypeInfo *type = AGetInstanceType(AValueToInstance(stream));
+    int i;
+
+    if (type != AValueToType(AGlobalByNum(AFileClassNum))) {
+        for (i = 0; i < NumFdStreamClasses
+                 && type != AValueToType(AGlobalByNum(FdStreamClasses[i]));
+             i++);
+        if (i == NumFdStreamClasses)
+            return -1;
+    }
+
+    if (AMemberDirect(stream, A_STREAM_MODE) == AZero
+        || !AIsShortInt(AMemberDirect(stream, A_FILE_ID)))
+        return -1;
+
+    return AValueToInt(AMemberDirect(stream, A_FILE_ID));
+#else
+    return -1;
+#endif
+}
+
+
+void ARegisterFileDescriptorStream(int classNum)
+{
+    int i;
+
+    for (i = 0; i < NumFdStreamClasses; i++) {
+        if (FdStreamClasses[i] == classNum)
+            return;
+    }
+    if (NumFdStreamClasses < MAX_FD_STREAM_CLASSES)
+        FdStreamClasses[NumFdStreamClasses++] = classNum;
+}
+
+
 static AValue CreateBuffer(AThread *t, AValue inst)
 {
     int bufSize;
     AString *buf;
 
-    if (AValueToInstance(inst)->member[A_STREAM_BUF_MODE] ==
-            A_BUFMODE_BUFFERED)
-        bufSize = A_IO_BUFFER_SIZE;
-    else
-        bufSize = A_IO_LINE_BUFFER_SIZE;
+    bufSize = StreamBufferSize(AValueToInstance(inst));
 
     *t->tempStack = inst;
     buf = AAlloc(t, sizeof(AValue) + bufSize);
@@ -1091,12 +1287,112 @@ static AValue CreateBuffer(AThread *t, AValue inst)
 }
 
 
+/* Prepare the output buffer of a stream for new data after the buffered data
+   has been passed to _write. If the buffer was full, the stream is probably
+   used for bulk output and the buffer may be grown. */
+static AValue ResetBuffer(AThread *t, AValue inst, ABool isFull)
+{
+    if ((isFull && GrowStreamBuffer(AValueToInstance(inst)))
+        || AGetInstanceType(AValueToInstance(inst))
+               != AValueToType(AGlobalByNum(AFileClassNum)))
+        return CreateBuffer(t, inst);
+    else {
+        /* File objects may reuse the output buffer because the _write
+           method will not store a reference to the buffer. */
+        AValueToInstance(inst)->member[A_STREAM_OUTPUT_BUF_IND] = AZero;
+        return ANil;
+    }
+}
+
+
+/* Write the first bufInd bytes of the output buffer of stream frame[0]
+   followed by the range [ind, ind + len) of the narrow string frame[2] using
+   a single _write call, and empty the output buffer. Since File _write can
+   write multiple strings using a single system call, this avoids copying long
+   strings to the buffer. */
+static AValue WriteDirect(AThread *t, AValue *frame, int bufInd, int ind,
+                          int len)
+{
+    AValue *args;
+    AValue v;
+    int numArgs;
+
+    if (!AAllocTempStack(t, 4))
+        return AError;
+
+    args = t->tempStackPtr - 4;
+    args[0] = frame[0];
+    args[1] = AZero;
+    args[2] = AZero;
+    args[3] = AZero;
+
+    numArgs = 0;
+    if (bufInd > 0) {
+        v = ASubStr(t, AMemberDirect(frame[0], A_STREAM_OUTPUT_BUF), 0,
+                    bufInd);
+        args[++numArgs] = v;
+    }
+    if (ind == 0 && len == AGetStrLen(AValueToStr(frame[2])))
+        v = frame[2];
+    else
+        v = ASubStr(t, frame[2], ind, ind + len);
+    args[++numArgs] = v;
+
+    v = ACallMethodByNum(t, AM__WRITE, numArgs, args);
+    t->tempStackPtr -= 4;
+    if (AIsError(v))
+        return AError;
+
+    return ResetBuffer(t, frame[0], FALSE);
+}
+
+
+/* Return the size of the input and output buffers of a stream. Explicit
+   sizes smaller than A_IO_LINE_BUFFER_SIZE are rounded up, since a tiny input
+   buffer makes readLn collect a line one buffer-sized fragment at a time. */
+static int StreamBufferSize(AInstance *inst)
+{
+    ASignedValue size = AValueToInt(inst->member[A_STREAM_BUF_SIZE]);
+
+    if (size > 0)
+        return AMax(size, A_IO_LINE_BUFFER_SIZE);
+    else if (size < 0)
+        return -size;
+    else if (inst->member[A_STREAM_BUF_MODE] == A_BUFMODE_BUFFERED)
+        return A_IO_BUFFER_SIZE;
+    else
+        return A_IO_LINE_BUFFER_SIZE;
+}
+
+
+/* Double the buffer size of a fully buffered stream, up to
+   A_IO_MAX_BUFFER_SIZE bytes, unless the size was specified when creating the
+   stream. Larger buffers reduce the number of system calls when transferring
+   large amounts of data. Return TRUE if the size was changed. */
+static ABool GrowStreamBuffer(AInstance *inst)
+{
+    int size;
+
+    if (AValueToInt(inst->member[A_STREAM_BUF_SIZE]) > 0
+        || inst->member[A_STREAM_BUF_MODE] != A_BUFMODE_BUFFERED)
+        return FALSE;
+
+    size = StreamBufferSize(inst);
+    if (size >= A_IO_MAX_BUFFER_SIZE)
+        return FALSE;
+
+    inst->member[A_STREAM_BUF_SIZE] = AIntToValue(-2 * size);
+    return TRUE;
+}
+
+
 /* Read data to the input buffer of stream frame[0]. frame[0] must be a Stream
    object. Return AZero if successful, AError if there was an error and ANil
    if could not fill the buffer due to being at the end of stream. Assume that
    the input buffer is empty and that the stream is an input stream. */
-static AValue StreamFillInputBuffer(AThread *t, AValue *frame)
+AValue AStreamFillInputBuffer(AThread *t, AValue *frame)
 {
+    int bufSize;
     int begInd;
     int endInd;
     AInstance *inst;
@@ -1108,18 +1404,14 @@ static AValue StreamFillInputBuffer(AThread *t, AValue *frame)
 
         /* Figure out the preferred size of the buffer. */
 #ifdef A_HAVE_POSIX
-        if (inst->member[A_STREAM_BUF_MODE] == A_BUFMODE_BUFFERED)
-            frame[1] = AIntToValue(A_IO_BUFFER_SIZE);
-        else
-            frame[1] = AIntToValue(A_IO_LINE_BUFFER_SIZE);
+        bufSize = StreamBufferSize(inst);
 #else
-        if (inst->member[A_STREAM_BUF_MODE] == A_BUFMODE_BUFFERED)
-            frame[1] = AIntToValue(A_IO_BUFFER_SIZE);
-        else if (inst->member[A_STREAM_BUF_MODE] == A_BUFMODE_LINE_BUFFERED)
-            frame[1] = AIntToValue(A_IO_LINE_BUFFER_SIZE);
+        if (inst->member[A_STREAM_BUF_MODE] == A_BUFMODE_UNBUFFERED)
+            bufSize = 1;
         else
-            frame[1] = AIntToValue(1);
+            bufSize = StreamBufferSize(inst);
 #endif
+        frame[1] = AIntToValue(bufSize);
 
         /* If the stream is unbuffered, function as if the stream was line
            buffered. We need to support buffering on unbuffered streams to
@@ -1180,6 +1472,11 @@ static AValue StreamFillInputBuffer(AThread *t, AValue *frame)
     inst->member[A_STREAM_INPUT_BUF_IND] = AIntToValue(begInd);
     inst->member[A_STREAM_INPUT_BUF_END] = AIntToValue(endInd);
 
+    /* If the read filled the whole buffer, more data is probably available
+       and the stream may benefit from a larger buffer. */
+    if (endInd - begInd == bufSize)
+        GrowStreamBuffer(inst);
+
     /* Store the Str value that holds the stream buffer. */
     ASetMemberDirect(t, frame[0], A_STREAM_INPUT_BUF, v);
 
@@ -1246,11 +1543,11 @@ A_MODULE(io, "io")
     /* NOTE: The stack frames of write, writeLn and flush methods must
              have the same size. Other functions may depend on some of these
              methods having these specific sizes. */
-    A_CLASS_PRIV("Stream", A_NUM_STREAM_MEMBER_VARS)
+    A_CLASS_PRIV_P("Stream", A_NUM_STREAM_MEMBER_VARS, &AStreamClassNum)
         A_IMPLEMENT("std::Iterable")
         A_METHOD_OPT("create", 0, 4, 0, AStreamCreate)
-        A_METHOD_VARARG("write", 0, 0, 1, AStreamWrite)
-        A_METHOD_VARARG("writeLn", 0, 0, 1, AStreamWriteLn)
+        A_METHOD_VARARG_SLICE("write", 0, 0, 1, AStreamWrite)
+        A_METHOD_VARARG_SLICE("writeLn", 0, 0, 1, AStreamWriteLn)
         A_METHOD_OPT("read", 0, 1, 1, StreamRead)
         /* Frame size compatibility requirements: std::ReadLn (+1),
              __StreamIter next (+1) */
@@ -1261,6 +1558,7 @@ A_MODULE(io, "io")
         A_METHOD("close", 0, 0, StreamClose)
         A_METHOD("peek", 0, 0, StreamPeek)
         A_METHOD("iterator", 0, 1, StreamIter)
+        A_METHOD_OPT("copyTo", 1, 2, 4, StreamCopyTo)
         A_METHOD("#i", 0, 0, AStreamInitialize)
     A_END_CLASS()
 
@@ -1306,4 +1604,25 @@ A_MODULE(io, "io")
       A_INHERIT("::TextStream")
       A_METHOD_OPT("create", 1, 6, 2, ATextFileCreate)
     A_END_CLASS()
+
+    /* Members are for the owner object, start offset and length. */
+    A_CLASS_PRIV_P("MappedFile", 3, &AMappedFileClassNum)
+        A_IMPLEMENT("std::Iterable")
+        A_BINARY_DATA_P(sizeof(AMappedFileData), &AMappedFileDataOffset)
+        A_METHOD("create", 1, 0, AMappedFileCreate)
+        A_METHOD("length", 0, 0, AMappedFileLength)
+        A_METHOD("_get", 1, 1, AMappedFile_get)
+        A_METHOD_OPT("find", 1, 2, 0, AMappedFileFind)
+        A_METHOD("_str", 0, 0, AMappedFile_str)
+        A_METHOD("_eq", 1, 0, AMappedFile_eq)
+        A_METHOD("iterator", 0, 1, AMappedFileIter)
+        A_METHOD("close", 0, 0, AMappedFileClose)
+        A_METHOD("#f", 0, 0, AMappedFileFinalize)
+    A_END_CLASS()
+
+    A_CLASS_PRIV_P("__MappedFileIter", 2, &AMappedFileIterClassNum)
+        A_IMPLEMENT("std::Iterator")
+        A_METHOD("hasNext", 0, 0, AMappedFileIterHasNext)
+        A_METHOD("next", 0, 1, AMappedFileIterNext)
+    A_END_CLASS()
 A_END_MODULE()
@@ -35,7 +35,8 @@ extern int ABomNum;
 
 extern int AFlushOutputBuffersNum;
 
-extern int AFileClassNum;
+A_APIVAR extern int AFileClassNum;
+A_APIVAR extern int AStreamClassNum;
 
 extern int AUnstrictMemberNum;
 
@@ -78,6 +79,64 @@ AValue ATextStreamFlush(AThread *t, AValue *frame);
 AValue ATextFileCreate(AThread *t, AValue *frame);
 AValue AInitDefaultEncoding(AThread *t);
 
+/* Binary data of an io::MappedFile object. Only the object created using the
+   constructor owns a mapping; views derived from it refer to the data of the
+   owner. */
+typedef struct {
+    unsigned char *data; /* NULL if closed or empty */
+    AInt64 size;
+    ABool isOwner;       /* Is this object responsible for freeing data? */
+    ABool isClosed;
+    ABool isMapped;      /* Was data allocated using mmap? */
+} AMappedFileData;
+
+extern int AMappedFileClassNum;
+extern int AMappedFileDataOffset;
+extern int AMappedFileIterClassNum;
+
+AValue AMappedFileCreate(AThread *t, AValue *frame);
+AValue AMappedFileLength(AThread *t, AValue *frame);
+AValue AMappedFile_get(AThread *t, AValue *frame);
+AValue AMappedFileFind(AThread *t, AValue *frame);
+AValue AMappedFile_str(AThread *t, AValue *frame);
+AValue AMappedFile_eq(AThread *t, AValue *frame);
+AValue AMappedFileIter(AThread *t, AValue *frame);
+AValue AMappedFileClose(AThread *t, AValue *frame);
+AValue AMappedFileFinalize(AThread *t, AValue *frame);
+AValue AMappedFileIterHasNext(AThread *t, AValue *frame);
+AValue AMappedFileIterNext(AThread *t, AValue *frame);
+
+/* If v is an io::MappedFile object, store a pointer to its contents and the
+   length of the contents in *data and *len and return 1. Return 0 if v is not
+   a MappedFile object, and raise an exception and return -1 if it has been
+   closed. The contents are not moved by the garbage collector. */
+A_APIFUNC int AGetMappedFileContents(AThread *t, AValue v,
+                                     unsigned char **data, AInt64 *len);
+/* Return range [i1, i2) of the contents of a MappedFile object as a Str. */
+A_APIFUNC AValue AMappedFileSubStr(AThread *t, AValue v, AInt64 i1,
+                                   AInt64 i2);
+
+/* Copy up to count bytes (or until the end of file if count is negative)
+   from file descriptor src to file descriptor dst. If offset is non-negative,
+   read starting from offset without modifying the file position of src.
+   Avoid copying the data through user space if possible. Return the number
+   of bytes copied, or raise an exception and return -1 on error. Only
+   available on POSIX platforms. */
+A_APIFUNC AInt64 ACopyFileDescriptor(AThread *t, int dst, int src,
+                                     AInt64 offset, AInt64 count);
+
+/* Register a class whose instances are streams that read and write a file
+   descriptor stored in the A_FILE_ID member using the _read and _write
+   methods of File (such as socket::Socket). Stream copyTo copies data between
+   these streams and File objects without creating strings. */
+A_APIFUNC void ARegisterFileDescriptorStream(int classNum);
+
+/* Read data to the input buffer of the Stream object frame[0] by calling its
+   _read method. frame[1] is a temporary location. Return AZero if successful,
+   ANil at the end of the stream or AError on error. Assume that the input
+   buffer is empty and that the stream is an input stream. */
+A_APIFUNC AValue AStreamFillInputBuffer(AThread *t, AValue *frame);
+
 /* Raise an IoError exception. Use errno to specify the error condition.
    The path argument may be NULL.*/
 A_APIFUNC AValue ARaiseErrnoIoError(AThread *t, const char *path);
@@ -104,16 +163,24 @@ enum {
     A_STREAM_INPUT_BUF_END,
     A_STREAM_OUTPUT_BUF,
     A_STREAM_OUTPUT_BUF_IND,
+    A_STREAM_BUF_SIZE,
     A_FILE_ID
 };
 
 
 #define A_NUM_FILE_MEMBER_VARS (A_FILE_ID + 1)
-#define A_NUM_STREAM_MEMBER_VARS (A_STREAM_OUTPUT_BUF_IND + 1)
+#define A_NUM_STREAM_MEMBER_VARS (A_STREAM_BUF_SIZE + 1)
+
 
+/* The A_STREAM_BUF_SIZE member is 0 if the stream uses the default buffer
+   size, a positive value if the buffer size was given explicitly when
+   creating the stream and a negative value -n if the buffer of a fully
+   buffered stream has been grown to n bytes because the stream was used for
+   bulk transfers. */
 
-#define A_IO_BUFFER_SIZE 8192 /* IDEA: Find out the optimal value */
+#define A_IO_BUFFER_SIZE 8192 /* Initial size of a full buffer */
 #define A_IO_LINE_BUFFER_SIZE 256 /* IDEA: Find out the optimal value */
+#define A_IO_MAX_BUFFER_SIZE (256 * 1024) /* Maximum size of a grown buffer */
 #define A_MAX_READ_SIZE (8 * 1024 * 1024)
 
 
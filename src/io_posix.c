@@ -12,11 +12,23 @@
 #include "aconfig.h"
 
 #ifdef A_HAVE_POSIX
+#ifdef __linux__
+/* Needed for splice */
+#define _GNU_SOURCE
+#endif
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <signal.h>
+#ifndef A_HAVE_WINDOWS
+#include <sys/socket.h>
+#include <sys/uio.h>
+#define HAVE_WRITEV
+#endif
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 #endif
 
 #if defined(A_HAVE_WINDOWS) && defined(A_HAVE_SOCKET_MODULE)
@@ -28,6 +40,7 @@
 #endif
 
 #include <errno.h>
+#include <stdlib.h>
 #include "alore.h"
 #include "runtime.h"
 #include "memberid.h"
@@ -38,14 +51,22 @@
 #include "mem.h"
 #include "gc.h"
 #include "thread_athread.h"
+#include "thread_fiber.h"
 #include "internal.h"
 
 /* NOTE: Much of this implementation is shared by the socket module. */
 
 
-#define MAX_READ 8192
+#define MAX_READ A_MAX_READ_SIZE
 #define WRITE_BUF_SIZE 1024
 
+/* Maximum number of strings written using a single writev call */
+#define MAX_IOVEC 16
+
+/* Maximum number of bytes moved by a single system call when copying data
+   between file descriptors */
+#define COPY_BLOCK_SIZE (64 * 1024)
+
 
 static ABool WriteBlock(AThread *t, AValue file, char *buf, int len,
                        int status);
@@ -55,6 +76,16 @@ static ABool RemoveOutputStreamList(AThread *t, AValue *file);
 
 #ifdef A_HAVE_POSIX
 static AValue CreateFileObject(AThread *t, AValue *frame, int fileNum);
+static ssize_t FiberRead(AThread *t, int fileNum, char *buf, size_t len,
+                         int method);
+static ssize_t FiberWrite(AThread *t, int fileNum, char *buf, size_t len,
+                          int method);
+static ABool WriteAll(AThread *t, int fileNum, const char *buf, size_t len);
+#ifdef HAVE_WRITEV
+static ABool CanWriteVector(AValue args, int aLen);
+static ABool WriteVector(AThread *t, AValue *frame, int aLen);
+#endif
+static ABool WaitIfAgain(AThread *t, int fileNum, int events);
 #else
 static AValue CreateFileObject(AThread *t, AValue *frame, FILE *file);
 #define GetFILE(v, dst) \
@@ -336,7 +367,16 @@ AValue AFile_WriteWithMethod(AThread *t, AValue *frame, int method)
 
         if (!WriteBlock(t, frame[0], (char *)s, sLen, method))
             return AError;
-    } else {
+    }
+#ifdef HAVE_WRITEV
+    else if (aLen <= MAX_IOVEC && !AIsFiber(t)
+             && CanWriteVector(frame[1], aLen)) {
+        /* Write multiple strings without copying them. */
+        if (!WriteVector(t, frame, aLen))
+            return AError;
+    }
+#endif
+    else {
         char buf[WRITE_BUF_SIZE];
         int i;
         int bufInd;
@@ -476,9 +516,14 @@ AValue AFile_ReadWithMethod(AThread *t, AValue *frame, int method)
     {
 #ifdef A_HAVE_POSIX
         /* Posix implementation */
-        AAllowBlocking();
-        numRead = read(fileNum, block + sizeof(AValue), readLen);
-        AEndBlocking();
+        if (AIsFiber(t))
+            numRead = FiberRead(t, fileNum, block + sizeof(AValue), readLen,
+                                method);
+        else {
+            AAllowBlocking();
+            numRead = read(fileNum, block + sizeof(AValue), readLen);
+            AEndBlocking();
+        }
 
         if (numRead == -1) {
             if (errno == EINTR) {
@@ -538,9 +583,11 @@ AValue AFile_ReadWithMethod(AThread *t, AValue *frame, int method)
     if (numRead == 0)
         return ANil;
 
-    /* IDEA: Truncate the block so that we do not waste memory if only a
-             small portion of a large request can be satisfied. Alternatively,
-             make MAX_READ smaller, but this might hurt performance. */
+    /* Copy the data if only a small portion of a large request could be
+       satisfied so that we do not waste memory. This is common with sockets
+       and pipes. */
+    if (readLen > A_IO_BUFFER_SIZE && numRead < readLen / 4)
+        return ACreateString(t, (char *)AStrPtr(frame[1]), numRead);
 
     return ASubStr(t, frame[1], 0, numRead);
 }
@@ -585,9 +632,13 @@ static ABool WriteBlock(AThread *t, AValue file, char *buf, int len,
         do {
             ssize_t numWritten;
 
-            AAllowBlocking();
-            numWritten = write(fileNum, buf, len);
-            AEndBlocking();
+            if (AIsFiber(t))
+                numWritten = FiberWrite(t, fileNum, buf, len, method);
+            else {
+                AAllowBlocking();
+                numWritten = write(fileNum, buf, len);
+                AEndBlocking();
+            }
 
             /* Check for keyboard interrupts. */
             if (AIsInterrupt && AHandleInterrupt(t))
@@ -822,6 +873,338 @@ AValue AFile__Handle(AThread *t, AValue *frame)
 }
 
 
+#ifdef A_HAVE_POSIX
+static int SpliceOut(AThread *t, int pipeFd, int dst, size_t len, char **buf);
+
+
+AInt64 ACopyFileDescriptor(AThread *t, int dst, int src, AInt64 offset,
+                           AInt64 count)
+{
+    enum { COPY_SENDFILE, COPY_SPLICE, COPY_READ } method;
+    struct stat st;
+    ABool isSrcRegular;
+    ABool isDstRegular;
+    int srcFlags = -1;
+    int dstFlags = -1;
+    int pipeFds[2] = { -1, -1 };
+    char *buf = NULL;
+    AInt64 total = 0;
+
+    if (fstat(src, &st) < 0)
+        goto Error;
+    isSrcRegular = S_ISREG(st.st_mode);
+    if (fstat(dst, &st) < 0)
+        goto Error;
+    isDstRegular = S_ISREG(st.st_mode);
+
+    if (offset >= 0 && !isSrcRegular) {
+        errno = ESPIPE;
+        goto Error;
+    }
+
+    /* Data is moved within the kernel using sendfile (from regular files) or
+       splice through a pipe (from other files) if available. Otherwise fall
+       back to reading and writing a block at a time using a single buffer. */
+#ifdef __linux__
+    method = isSrcRegular ? COPY_SENDFILE : COPY_SPLICE;
+#else
+    method = COPY_READ;
+#endif
+
+    /* A fiber must not block the thread. Switch pipes and sockets to
+       non-blocking mode during the copy and wait for them when they are not
+       ready. */
+    if (AIsFiber(t)) {
+        if (!isSrcRegular && (srcFlags = fcntl(src, F_GETFL)) >= 0)
+            fcntl(src, F_SETFL, srcFlags | O_NONBLOCK);
+        if (!isDstRegular && (dstFlags = fcntl(dst, F_GETFL)) >= 0)
+            fcntl(dst, F_SETFL, dstFlags | O_NONBLOCK);
+    }
+
+    while (count < 0 || total < count) {
+        size_t len = COPY_BLOCK_SIZE;
+        ssize_t n;
+
+        if (count >= 0 && count - total < (AInt64)len)
+            len = count - total;
+
+#ifdef __linux__
+        if (method == COPY_SENDFILE) {
+            off_t pos = offset + total;
+
+            AAllowBlocking();
+            n = sendfile(dst, src, offset >= 0 ? &pos : NULL, len);
+            AEndBlocking();
+
+            if (n < 0 && total == 0 && (errno == EINVAL || errno == ENOSYS)) {
+                /* Not supported for these files */
+                method = COPY_READ;
+                continue;
+            }
+            if (n < 0 && WaitIfAgain(t, dst, A_FIBER_WRITABLE))
+                continue;
+        } else if (method == COPY_SPLICE) {
+            if (pipeFds[0] < 0 && pipe(pipeFds) < 0)
+                goto Error;
+
+            AAllowBlocking();
+            n = splice(src, NULL, pipeFds[1], NULL, len, SPLICE_F_MOVE);
+            AEndBlocking();
+
+            if (n < 0 && total == 0 && errno == EINVAL) {
+                method = COPY_READ;
+                continue;
+            }
+            if (n < 0 && WaitIfAgain(t, src, A_FIBER_READABLE))
+                continue;
+            if (n > 0) {
+                int status = SpliceOut(t, pipeFds[0], dst, n, &buf);
+                if (status < 0)
+                    goto Failed;
+                if (status > 0)
+                    method = COPY_READ;
+            }
+        } else
+#endif
+        {
+            if (buf == NULL && (buf = malloc(COPY_BLOCK_SIZE)) == NULL) {
+                ARaiseMemoryError(t);
+                goto Failed;
+            }
+
+            AAllowBlocking();
+            if (offset >= 0)
+                n = pread(src, buf, len, offset + total);
+            else
+                n = read(src, buf, len);
+            AEndBlocking();
+
+            if (n < 0 && WaitIfAgain(t, src, A_FIBER_READABLE))
+                continue;
+            if (n > 0 && !WriteAll(t, dst, buf, n))
+                goto Failed;
+        }
+
+        if (n == 0)
+            break; /* End of file */
+
+        if (n < 0) {
+            if (errno != EINTR)
+                goto Error;
+            n = 0;
+        }
+
+        total += n;
+
+        if (AIsInterrupt && AHandleInterrupt(t))
+            goto Failed;
+    }
+
+  Cleanup:
+
+    if (srcFlags >= 0)
+        fcntl(src, F_SETFL, srcFlags);
+    if (dstFlags >= 0)
+        fcntl(dst, F_SETFL, dstFlags);
+    if (pipeFds[0] >= 0) {
+        close(pipeFds[0]);
+        close(pipeFds[1]);
+    }
+    free(buf);
+
+    return total;
+
+  Error:
+
+    ARaiseErrnoIoError(t, NULL);
+
+  Failed:
+
+    total = -1;
+    goto Cleanup;
+}
+
+
+/* Move len bytes from a pipe to file descriptor dst. If dst does not support
+   splicing, copy the data using a buffer (allocated if *buf is NULL) and
+   return 1. Return 0 if successful, or raise an exception and return -1 on
+   error. */
+static int SpliceOut(AThread *t, int pipeFd, int dst, size_t len, char **buf)
+{
+#ifdef __linux__
+    while (len > 0) {
+        ssize_t n;
+
+        AAllowBlocking();
+        n = splice(pipeFd, NULL, dst, NULL, len, SPLICE_F_MOVE);
+        AEndBlocking();
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                if (AIsInterrupt && AHandleInterrupt(t))
+                    return -1;
+            } else if (errno == EINVAL)
+                break;
+            else if (!WaitIfAgain(t, dst, A_FIBER_WRITABLE)) {
+                ARaiseErrnoIoError(t, NULL);
+                return -1;
+            }
+        } else
+            len -= n;
+    }
+
+    if (len == 0)
+        return 0;
+#endif
+
+    /* The pipe contains exactly len bytes, so reading it never blocks. */
+    if (*buf == NULL && (*buf = malloc(COPY_BLOCK_SIZE)) == NULL) {
+        ARaiseMemoryError(t);
+        return -1;
+    }
+    while (len > 0) {
+        ssize_t n = read(pipeFd, *buf, len < COPY_BLOCK_SIZE ? len
+                         : COPY_BLOCK_SIZE);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            ARaiseErrnoIoError(t, NULL);
+            return -1;
+        }
+        if (!WriteAll(t, dst, *buf, n))
+            return -1;
+        len -= n;
+    }
+
+    return 1;
+}
+
+
+/* Write all the data in a buffer that is not in the garbage collected
+   heap. */
+static ABool WriteAll(AThread *t, int fileNum, const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n;
+
+        AAllowBlocking();
+        n = write(fileNum, buf, len);
+        AEndBlocking();
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                if (AIsInterrupt && AHandleInterrupt(t))
+                    return FALSE;
+                continue;
+            }
+            if (WaitIfAgain(t, fileNum, A_FIBER_WRITABLE))
+                continue;
+            ARaiseErrnoIoError(t, NULL);
+            return FALSE;
+        }
+
+        buf += n;
+        len -= n;
+    }
+
+    return TRUE;
+}
+
+
+#ifdef HAVE_WRITEV
+/* Can the items of an array be written directly using WriteVector? This is
+   true if they are narrow strings or substrings of narrow strings that are
+   not stored in the nursery, and thus they will not be moved by the garbage
+   collector while the thread is blocked. */
+static ABool CanWriteVector(AValue args, int aLen)
+{
+    int i;
+
+    for (i = 0; i < aLen; i++) {
+        AValue s = AArrayItem(args, i);
+
+        if (AIsSubStr(s))
+            s = AValueToSubStr(s)->str;
+        if (!AIsNarrowStr(s) || AIsInNursery(AValueToPtr(s)))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+/* Write the strings in the array frame[1] to file frame[0] using writev. The
+   strings must be valid for CanWriteVector. */
+static ABool WriteVector(AThread *t, AValue *frame, int aLen)
+{
+    struct iovec iov[MAX_IOVEC];
+    struct iovec *cur;
+    int fileNum;
+    int i;
+
+    for (i = 0; i < aLen; i++) {
+        AValue s = AArrayItem(frame[1], i);
+
+        if (AIsSubStr(s)) {
+            ASubString *ss = AValueToSubStr(s);
+            iov[i].iov_base = AValueToStr(ss->str)->elem
+                + AValueToInt(ss->ind);
+            iov[i].iov_len = AValueToInt(ss->len);
+        } else {
+            iov[i].iov_base = AValueToStr(s)->elem;
+            iov[i].iov_len = AGetStrLen(AValueToStr(s));
+        }
+    }
+
+    fileNum = AValueToInt(AMemberDirect(frame[0], A_FILE_ID));
+    cur = iov;
+
+    while (aLen > 0) {
+        ssize_t numWritten;
+
+        AAllowBlocking();
+        numWritten = writev(fileNum, cur, aLen);
+        AEndBlocking();
+
+        /* Check for keyboard interrupts. */
+        if (AIsInterrupt && AHandleInterrupt(t))
+            return FALSE;
+
+        if (numWritten == -1) {
+            if (errno == EINTR)
+                continue;
+            ARaiseErrnoIoError(t, NULL);
+            return FALSE;
+        }
+
+        /* Skip fully written strings and adjust a partially written one. */
+        while (aLen > 0 && numWritten >= (ssize_t)cur->iov_len) {
+            numWritten -= cur->iov_len;
+            cur++;
+            aLen--;
+        }
+        if (aLen > 0) {
+            cur->iov_base = (char *)cur->iov_base + numWritten;
+            cur->iov_len -= numWritten;
+        }
+    }
+
+    return TRUE;
+}
+#endif
+
+
+/* If the previous operation failed since the file descriptor was not ready,
+   suspend the current fiber until the descriptor is ready and return TRUE.
+   Otherwise, return FALSE. */
+static ABool WaitIfAgain(AThread *t, int fileNum, int events)
+{
+    return (errno == EAGAIN || errno == EWOULDBLOCK)
+        && AFiberWaitForIo(t, fileNum, events);
+}
+#endif
+
+
 static ABool CreateTextStreamWrapper(AThread *t, int wrapperNum, int origNum,
                                      int bufMode)
 {
@@ -968,6 +1351,64 @@ static AValue CreateFileObject(AThread *t, AValue *frame, int fileNum)
 
     return frame[0];
 }
+
+
+/* Read from a file in a fiber. Suspend the fiber instead of blocking the
+   thread until data is available. Regular files are always considered
+   readable, and reading them may block. */
+static ssize_t FiberRead(AThread *t, int fileNum, char *buf, size_t len,
+                         int method)
+{
+    ssize_t numRead;
+
+#ifdef MSG_DONTWAIT
+    if (method == A_SOCKET_METHOD) {
+        while ((numRead = recv(fileNum, buf, len, MSG_DONTWAIT)) == -1
+               && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (!AFiberWaitForIo(t, fileNum, A_FIBER_READABLE))
+                break;
+        }
+        if (numRead != -1 || (errno != EAGAIN && errno != EWOULDBLOCK))
+            return numRead;
+    } else
+#endif
+        AFiberWaitForIo(t, fileNum, A_FIBER_READABLE);
+
+    AAllowBlocking();
+    numRead = read(fileNum, buf, len);
+    AEndBlocking();
+
+    return numRead;
+}
+
+
+/* Write to a file in a fiber. Suspend the fiber instead of blocking the
+   thread until the file is writable. Return the number of bytes written,
+   which may be less than len. */
+static ssize_t FiberWrite(AThread *t, int fileNum, char *buf, size_t len,
+                          int method)
+{
+    ssize_t numWritten;
+
+#ifdef MSG_DONTWAIT
+    if (method == A_SOCKET_METHOD) {
+        while ((numWritten = send(fileNum, buf, len, MSG_DONTWAIT)) == -1
+               && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (!AFiberWaitForIo(t, fileNum, A_FIBER_WRITABLE))
+                break;
+        }
+        if (numWritten != -1 || (errno != EAGAIN && errno != EWOULDBLOCK))
+            return numWritten;
+    } else
+#endif
+        AFiberWaitForIo(t, fileNum, A_FIBER_WRITABLE);
+
+    AAllowBlocking();
+    numWritten = write(fileNum, buf, len);
+    AEndBlocking();
+
+    return numWritten;
+}
 #else
 static AValue CreateFileObject(AThread *t, AValue *frame, FILE *file)
 {
@@ -0,0 +1,421 @@
+/* json_decode_inc.c - JSON decoder (#included by json_module.c)
+
+   Copyright (c) 2010-2011 Jukka Lehtosalo
+
+   Alore is licensed under the terms of the MIT license.  See the file
+   LICENSE.txt in the distribution.
+*/
+
+/* NOTE: This file is not a stand-alone source file! It is included by
+         json_module.c twice, once for narrow and once for wide input
+         strings. */
+
+
+/* The following defines are required by this file:
+
+     JSON_CHAR: character type of the input (unsigned char or AWideChar)
+     JSON_IS_WIDE: 1 if the input is wide, 0 otherwise
+     PLAIN_LENGTH: function that returns the number of leading characters
+                   that need no special processing in a string literal
+                   (i.e. anything but '"', '\\' and control characters)
+     MAKE_PLAIN_STR: function that creates a Str object from a part of the
+                     input that contains no escape sequences
+     DECODE_FN, PARSE_VALUE_FN, PARSE_ARRAY_FN, PARSE_OBJECT_FN,
+     PARSE_STRING_FN, PARSE_NUMBER_FN, SKIP_SPACE_FN, DECODE_ESCAPE_FN,
+     MAKE_KEY_FN: names of the functions defined in this file */
+
+
+/* The items of the input string */
+#define S ((const JSON_CHAR *)p->s)
+
+
+static AValue PARSE_VALUE_FN(JsonParser *p);
+
+
+/* Skip whitespace and return the next character, or -1 at the end of the
+   input. */
+static int SKIP_SPACE_FN(JsonParser *p)
+{
+    const JSON_CHAR *s = S;
+    Assize_t i = p->i;
+
+    while (i < p->len && IsJsonSpace(s[i]))
+        i++;
+    p->i = i;
+
+    return i < p->len ? s[i] : -1;
+}
+
+
+/* Decode the escape sequence that follows a backslash at s[*i - 1]. Update
+   *i to point past the sequence and return the character, or return -1 if
+   the sequence is not valid. */
+static int DECODE_ESCAPE_FN(const JSON_CHAR *s, Assize_t len, Assize_t *i)
+{
+    Assize_t j = *i;
+    int ch;
+
+    if (j == len)
+        return -1;
+
+    switch (s[j]) {
+    case '"':
+    case '\\':
+    case '/':
+        ch = s[j];
+        break;
+    case 'b':
+        ch = '\b';
+        break;
+    case 'f':
+        ch = '\f';
+        break;
+    case 'n':
+        ch = '\n';
+        break;
+    case 'r':
+        ch = '\r';
+        break;
+    case 't':
+        ch = '\t';
+        break;
+    case 'u': {
+        int k;
+        if (len - j < 5)
+            return -1;
+        ch = 0;
+        for (k = 1; k <= 4; k++) {
+            int digit = s[j + k] < 128 ? HexValue[s[j + k]] : -1;
+            if (digit < 0)
+                return -1;
+            ch = ch * 16 + digit;
+        }
+        j += 4;
+        break;
+    }
+    default:
+        return -1;
+    }
+
+    *i = j + 1;
+    return ch;
+}
+
+
+/* Return an interned Str object with the characters s[beg..end) of the
+   input, which must contain no escape sequences. */
+static AValue MAKE_KEY_FN(JsonParser *p, Assize_t beg, Assize_t end)
+{
+    const JSON_CHAR *s = S;
+    Assize_t len = end - beg;
+    unsigned hash;
+    Assize_t k;
+    AValue key;
+
+    if (len > MAX_INTERNED_KEY_LEN)
+        return MAKE_PLAIN_STR(p, beg, end);
+
+    hash = 2166136261U;
+    for (k = beg; k < end; k++)
+        hash = (hash ^ s[k]) * 16777619U;
+    hash &= KEY_CACHE_SIZE - 1;
+
+    if (p->frame[2] != ANil) {
+        key = AFixArrayItem(p->frame[2], hash);
+        if (key != ANil && AStrLen(key) == len) {
+            if (AIsNarrowStr(key)) {
+                const unsigned char *ks = AGetStrElem(key);
+                for (k = 0; k < len && ks[k] == s[beg + k]; k++);
+            } else {
+                const AWideChar *ks = AGetWideStrElem(key);
+                for (k = 0; k < len && ks[k] == s[beg + k]; k++);
+            }
+            if (k == len)
+                return key;
+        }
+    }
+
+    p->frame[6] = MAKE_PLAIN_STR(p, beg, end);
+    if (p->frame[2] == ANil) {
+        p->frame[2] = AMakeFixArray(p->t, KEY_CACHE_SIZE, ANil);
+        if (AIsError(p->frame[2]))
+            ADispatchException(p->t);
+        Refresh(p);
+    }
+    ASetFixArrayItem(p->t, p->frame[2], hash, p->frame[6]);
+
+    return p->frame[6];
+}
+
+
+/* Parse a string literal. Assume that p->i points past the opening quote.
+   Intern the result if isKey is TRUE. */
+static AValue PARSE_STRING_FN(JsonParser *p, ABool isKey)
+{
+    const JSON_CHAR *s = S;
+    Assize_t beg = p->i;
+    Assize_t len = p->len;
+    Assize_t i;
+    Assize_t n;
+    ABool isWide;
+    unsigned char *dst;
+    AWideChar *dstW;
+
+    /* Fast path for strings without escape sequences */
+    i = beg + PLAIN_LENGTH(s + beg, len - beg);
+    if (i < len && s[i] == '"') {
+        p->i = i + 1;
+        if (isKey)
+            return MAKE_KEY_FN(p, beg, i);
+        else
+            return MAKE_PLAIN_STR(p, beg, i);
+    }
+
+    /* Find the end of the string, validate it and calculate the length and
+       the width of the result. */
+    n = 0;
+    i = beg;
+    isWide = FALSE;
+    for (;;) {
+        Assize_t plain = PLAIN_LENGTH(s + i, len - i);
+        int ch;
+
+#if JSON_IS_WIDE
+        if (!isWide) {
+            Assize_t k;
+            for (k = i; k < i + plain; k++) {
+                if (s[k] > 0xff)
+                    isWide = TRUE;
+            }
+        }
+#endif
+        i += plain;
+        n += plain;
+        if (i == len)
+            return ParseError(p, "Unterminated string", beg - 1);
+        ch = s[i];
+        if (ch == '"')
+            break;
+        else if (ch == '\\') {
+            Assize_t escape = i;
+            i++;
+            ch = DECODE_ESCAPE_FN(s, len, &i);
+            if (ch < 0)
+                return ParseError(p, "Invalid escape sequence", escape);
+        } else
+            return ParseError(p, "Control character in string", i);
+        if (ch > 0xff)
+            isWide = TRUE;
+        n++;
+    }
+
+    p->i = i + 1;
+
+    /* Decode the string. */
+    if (isWide) {
+        p->frame[6] = AMakeEmptyStrW(p->t, n);
+        dst = NULL;
+        dstW = AStrPtrW(p->frame[6]);
+    } else {
+        p->frame[6] = AMakeEmptyStr(p->t, n);
+        dst = AStrPtr(p->frame[6]);
+        dstW = NULL;
+    }
+    Refresh(p);
+    s = S;
+
+    for (n = 0; beg < i; n++) {
+        int ch = s[beg++];
+        if (ch == '\\')
+            ch = DECODE_ESCAPE_FN(s, len, &beg);
+        if (isWide)
+            dstW[n] = ch;
+        else
+            dst[n] = ch;
+    }
+
+    return p->frame[6];
+}
+
+
+/* Parse a number. Integers are converted to Int objects and numbers with a
+   fraction or an exponent to Float objects. */
+static AValue PARSE_NUMBER_FN(JsonParser *p)
+{
+    const JSON_CHAR *s = S;
+    Assize_t beg = p->i;
+    Assize_t len = p->len;
+    Assize_t i = beg;
+    Assize_t digitsBeg;
+    ABool isNeg = FALSE;
+    ABool isFloat = FALSE;
+    AValue v;
+
+    if (s[i] == '-') {
+        isNeg = TRUE;
+        i++;
+    }
+
+    digitsBeg = i;
+    if (i < len && s[i] == '0')
+        i++;
+    else if (i < len && IsDigit(s[i])) {
+        while (i < len && IsDigit(s[i]))
+            i++;
+    } else
+        return ParseError(p, "Invalid number", beg);
+
+    if (i < len && s[i] == '.') {
+        i++;
+        if (i == len || !IsDigit(s[i]))
+            return ParseError(p, "Invalid number", beg);
+        while (i < len && IsDigit(s[i]))
+            i++;
+        isFloat = TRUE;
+    }
+
+    if (i < len && (s[i] == 'e' || s[i] == 'E')) {
+        i++;
+        if (i < len && (s[i] == '+' || s[i] == '-'))
+            i++;
+        if (i == len || !IsDigit(s[i]))
+            return ParseError(p, "Invalid number", beg);
+        while (i < len && IsDigit(s[i]))
+            i++;
+        isFloat = TRUE;
+    }
+
+    p->i = i;
+
+    if (isFloat)
+        v = NumberToFloat(p, beg, i);
+    else if (i - digitsBeg <= MAX_INT64_DIGITS) {
+        AInt64 n = 0;
+        Assize_t k;
+        for (k = digitsBeg; k < i; k++)
+            n = n * 10 + (s[k] - '0');
+        v = AMakeInt64(p->t, isNeg ? -n : n);
+    } else
+        v = NumberToLongInt(p, digitsBeg, i, isNeg);
+
+    Refresh(p);
+    return v;
+}
+
+
+/* Parse an array. Assume that p->i points past the opening bracket. */
+static AValue PARSE_ARRAY_FN(JsonParser *p)
+{
+    Assize_t base = p->sp;
+    int ch;
+
+    if (++p->depth > MAX_DEPTH)
+        return ParseError(p, "Maximum nesting depth exceeded", p->i - 1);
+
+    ch = SKIP_SPACE_FN(p);
+    if (ch != ']') {
+        for (;;) {
+            Push(p, PARSE_VALUE_FN(p));
+            ch = SKIP_SPACE_FN(p);
+            if (ch == ']')
+                break;
+            else if (ch != ',')
+                return ParseError(p, ch < 0 ? "Unexpected end of input" :
+                                  "Expected , or ]", p->i);
+            p->i++;
+        }
+    }
+    p->i++;
+
+    p->depth--;
+    return MakeArray(p, base);
+}
+
+
+/* Parse an object. Assume that p->i points past the opening brace. */
+static AValue PARSE_OBJECT_FN(JsonParser *p)
+{
+    Assize_t base = p->sp;
+    int ch;
+
+    if (++p->depth > MAX_DEPTH)
+        return ParseError(p, "Maximum nesting depth exceeded", p->i - 1);
+
+    ch = SKIP_SPACE_FN(p);
+    if (ch != '}') {
+        for (;;) {
+            if (ch != '"')
+                return ParseError(p, ch < 0 ? "Unexpected end of input" :
+                                  "Expected string", p->i);
+            p->i++;
+            Push(p, PARSE_STRING_FN(p, TRUE));
+
+            ch = SKIP_SPACE_FN(p);
+            if (ch != ':')
+                return ParseError(p, ch < 0 ? "Unexpected end of input" :
+                                  "Expected :", p->i);
+            p->i++;
+            Push(p, PARSE_VALUE_FN(p));
+
+            ch = SKIP_SPACE_FN(p);
+            if (ch == '}')
+                break;
+            else if (ch != ',')
+                return ParseError(p, ch < 0 ? "Unexpected end of input" :
+                                  "Expected , or }", p->i);
+            p->i++;
+            ch = SKIP_SPACE_FN(p);
+        }
+    }
+    p->i++;
+
+    p->depth--;
+    return MakeMap(p, base);
+}
+
+
+/* Parse any value. */
+static AValue PARSE_VALUE_FN(JsonParser *p)
+{
+    int ch = SKIP_SPACE_FN(p);
+
+    switch (ch) {
+    case '{':
+        p->i++;
+        return PARSE_OBJECT_FN(p);
+    case '[':
+        p->i++;
+        return PARSE_ARRAY_FN(p);
+    case '"':
+        p->i++;
+        return PARSE_STRING_FN(p, FALSE);
+    case '-':
+    case '0': case '1': case '2': case '3': case '4':
+    case '5': case '6': case '7': case '8': case '9':
+        return PARSE_NUMBER_FN(p);
+    case 't':
+        return ParseLiteral(p, "true", ATrue);
+    case 'f':
+        return ParseLiteral(p, "false", AFalse);
+    case 'n':
+        return ParseLiteral(p, "null", ANil);
+    case -1:
+        return ParseError(p, "Unexpected end of input", p->i);
+    default:
+        return ParseError(p, "Unexpected character", p->i);
+    }
+}
+
+
+/* Parse a JSON document that contains a single value, optionally surrounded
+   by whitespace. */
+static AValue DECODE_FN(JsonParser *p)
+{
+    AValue v = PARSE_VALUE_FN(p);
+    if (SKIP_SPACE_FN(p) >= 0)
+        return ParseError(p, "Extra data after value", p->i);
+    return v;
+}
+
+
+#undef S
@@ -0,0 +1,746 @@
+/* json_module.c - json module (JSON encoding and decoding)
+
+   Copyright (c) 2010-2011 Jukka Lehtosalo
+
+   Alore is licensed under the terms of the MIT license.  See the file
+   LICENSE.txt in the distribution.
+*/
+
+/* The decoder parses the items of a narrow or a wide Str object directly in a
+   single pass, without tokenizing the input into an intermediate
+   representation. Parsed values are kept in a value stack until the
+   enclosing array or object is complete, so that the Array and Map objects
+   can be created with their final sizes. Short object keys are interned in a
+   small cache, since the same keys are typically repeated in every element
+   of an array of objects.
+
+   The encoder writes ASCII output to a local buffer, and to a growable heap
+   buffer once the local buffer is full. Runs of string characters that need
+   no escaping are found and copied in blocks of 16 bytes using SSE2
+   instructions if available. */
+
+#include "alore.h"
+#include "runtime.h"
+#include "str.h"
+#include "array.h"
+#include "int.h"
+#include "std_module.h"
+#include "floatconv.h"
+#include "utf8.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__SSE2__) \
+    && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+
+/* Maximum nesting depth of arrays and objects */
+#define MAX_DEPTH 1000
+/* Initial size of the decoder value stack */
+#define INITIAL_STACK_SIZE 64
+/* Number of entries in the key cache (must be a power of two) */
+#define KEY_CACHE_SIZE 128
+/* Longer keys are not interned */
+#define MAX_INTERNED_KEY_LEN 64
+/* Size of the local encoder output buffer */
+#define OUTPUT_BUF_SIZE 1024
+/* Initial size of the encoder container stack */
+#define INITIAL_CONTAINER_STACK_SIZE 16
+/* Integers with at most this many digits fit in a 64-bit integer */
+#define MAX_INT64_DIGITS 18
+
+
+#define IsJsonSpace(ch) \
+    ((ch) == ' ' || (ch) == '\n' || (ch) == '\r' || (ch) == '\t')
+#define IsDigit(ch) ((ch) >= '0' && (ch) <= '9')
+
+
+/* Values of hexadecimal digits in ASCII, or -1 for other characters */
+static const signed char HexValue[128] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+static const char HexDigits[] = "0123456789abcdef";
+
+
+/* Return the number of leading bytes of s[0..len) that are not '"', '\\' or
+   control characters. If stopAtNonAscii is TRUE, stop also at bytes that are
+   at least 128. */
+static Assize_t PlainLength(const unsigned char *s, Assize_t len,
+                            ABool stopAtNonAscii)
+{
+    Assize_t i = 0;
+
+#ifdef HAVE_SSE2
+    __m128i quote = _mm_set1_epi8('"');
+    __m128i backslash = _mm_set1_epi8('\\');
+    /* Control characters and bytes that are at least 128 are less than limit
+       as signed bytes. After flipping the highest bit, only control
+       characters are less than flippedLimit. */
+    __m128i limit = _mm_set1_epi8(0x20);
+    __m128i flip = _mm_set1_epi8((char)0x80);
+    __m128i flippedLimit = _mm_set1_epi8((char)(0x20 ^ 0x80));
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i special = _mm_or_si128(_mm_cmpeq_epi8(v, quote),
+                                       _mm_cmpeq_epi8(v, backslash));
+        int mask;
+        if (stopAtNonAscii)
+            special = _mm_or_si128(special, _mm_cmplt_epi8(v, limit));
+        else
+            special = _mm_or_si128(special, _mm_cmplt_epi8(
+                                       _mm_xor_si128(v, flip), flippedLimit));
+        mask = _mm_movemask_epi8(special);
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+#endif
+
+    if (stopAtNonAscii) {
+        while (i < len && s[i] >= 0x20 && s[i] < 0x80 && s[i] != '"'
+               && s[i] != '\\')
+            i++;
+    } else {
+        while (i < len && s[i] >= 0x20 && s[i] != '"' && s[i] != '\\')
+            i++;
+    }
+
+    return i;
+}
+
+
+/* Return the number of leading characters of s[0..len) that are not '"',
+   '\\' or control characters. */
+static Assize_t PlainLengthW(const AWideChar *s, Assize_t len)
+{
+    Assize_t i = 0;
+    while (i < len && s[i] >= 0x20 && s[i] != '"' && s[i] != '\\')
+        i++;
+    return i;
+}
+
+
+/* Decoder */
+
+
+typedef struct {
+    AThread *t;
+    /* frame[0]: input string
+       frame[1]: value stack (FixArray)
+       frame[2]: key cache (FixArray) or nil if not created yet
+       frame[3..6]: map, key, value and temporary for AMap_set; frame[6] is
+                    also used as a temporary by other functions */
+    AValue *frame;
+    const void *s;     /* Items of the input string */
+    ABool isWide;
+    Assize_t len;      /* Length of the input */
+    Assize_t i;        /* Current index in the input */
+    Assize_t sp;       /* Number of items in the value stack */
+    Assize_t stackSize;
+    int depth;
+} JsonParser;
+
+
+/* Update the pointer to the items of the input string. This must be called
+   after every allocation, since the input may have been moved. */
+static void Refresh(JsonParser *p)
+{
+    if (p->isWide)
+        p->s = AWideStrItems(p->frame[0]);
+    else
+        p->s = ANarrowStrItems(p->frame[0]);
+}
+
+
+/* Raise ValueError with a message that includes the location of the
+   character at index i. */
+static AValue ParseError(JsonParser *p, const char *msg, Assize_t i)
+{
+    int line = 1;
+    int column = 1;
+    Assize_t j;
+
+    for (j = 0; j < i && j < p->len; j++) {
+        if (AStrItem(p->frame[0], j) == '\n') {
+            line++;
+            column = 1;
+        } else
+            column++;
+    }
+
+    return ARaiseValueError(p->t, "%s at line %d, column %d", msg, line,
+                            column);
+}
+
+
+/* Push a value to the value stack, growing the stack if needed. */
+static void Push(JsonParser *p, AValue v)
+{
+    if (p->sp == p->stackSize) {
+        AValue old;
+        AValue new;
+        Assize_t i;
+
+        p->frame[6] = v;
+        new = AMakeFixArray(p->t, 2 * p->stackSize, ANil);
+        if (AIsError(new))
+            ADispatchException(p->t);
+        old = p->frame[1];
+        for (i = 0; i < p->sp; i++)
+            ASetFixArrayItem(p->t, new, i, AFixArrayItem(old, i));
+        p->frame[1] = new;
+        p->stackSize *= 2;
+        v = p->frame[6];
+        Refresh(p);
+    }
+
+    ASetFixArrayItem(p->t, p->frame[1], p->sp++, v);
+}
+
+
+/* Create an Array object from the values at the top of the value stack
+   starting at index base and pop them. */
+static AValue MakeArray(JsonParser *p, Assize_t base)
+{
+    Assize_t n = p->sp - base;
+    Assize_t i;
+
+    p->frame[6] = AMakeArray(p->t, n);
+    Refresh(p);
+    for (i = 0; i < n; i++)
+        ASetArrayItem(p->t, p->frame[6], i,
+                      AFixArrayItem(p->frame[1], base + i));
+    p->sp = base;
+
+    return p->frame[6];
+}
+
+
+/* Create a Map object from the key/value pairs at the top of the value stack
+   starting at index base and pop them. */
+static AValue MakeMap(JsonParser *p, Assize_t base)
+{
+    Assize_t i;
+
+    p->frame[3] = AMakeMapWithCapacity(p->t, (p->sp - base) / 2);
+    for (i = base; i < p->sp; i += 2) {
+        p->frame[4] = AFixArrayItem(p->frame[1], i);
+        p->frame[5] = AFixArrayItem(p->frame[1], i + 1);
+        if (AIsError(AMap_set(p->t, p->frame + 3)))
+            ADispatchException(p->t);
+    }
+    Refresh(p);
+    p->sp = base;
+
+    return p->frame[3];
+}
+
+
+/* Convert the digits at s[beg..end) of the input to a long Int object. The
+   caller must refresh the input pointer. */
+static AValue NumberToLongInt(JsonParser *p, Assize_t beg, Assize_t end,
+                              ABool isNeg)
+{
+    AValue v;
+
+    if (p->isWide) {
+        /* Copy the digits to a temporary narrow string. */
+        Assize_t len = end - beg;
+        p->frame[6] = AMakeEmptyStr(p->t, len);
+        Refresh(p);
+        ANarrowChars(AStrPtr(p->frame[6]), (const AWideChar *)p->s + beg,
+                     len);
+        v = AStrToLongInt(p->t, p->frame + 6, AStrPtr(p->frame[6]), len, 10,
+                          isNeg);
+    } else
+        v = AStrToLongInt(p->t, p->frame, (const unsigned char *)p->s + beg,
+                          end - beg, 10, isNeg);
+
+    if (AIsError(v))
+        ADispatchException(p->t);
+    return v;
+}
+
+
+/* Convert the number at s[beg..end) of the input to a Float object. The
+   caller must refresh the input pointer. */
+static AValue NumberToFloat(JsonParser *p, Assize_t beg, Assize_t end)
+{
+    Assize_t len = end - beg;
+    double f;
+
+    if (!p->isWide)
+        AParseFloat((const unsigned char *)p->s + beg,
+                    (const unsigned char *)p->s + end, &f);
+    else if (len <= 64) {
+        unsigned char buf[64];
+        ANarrowChars(buf, (const AWideChar *)p->s + beg, len);
+        AParseFloat(buf, buf + len, &f);
+    } else {
+        p->frame[6] = AMakeEmptyStr(p->t, len);
+        Refresh(p);
+        ANarrowChars(AStrPtr(p->frame[6]), (const AWideChar *)p->s + beg,
+                     len);
+        AParseFloat(AStrPtr(p->frame[6]), AStrPtr(p->frame[6]) + len, &f);
+    }
+
+    return AMakeFloat(p->t, f);
+}
+
+
+/* Parse the literal lit whose first character is at the current index and
+   return value. */
+static AValue ParseLiteral(JsonParser *p, const char *lit, AValue value)
+{
+    Assize_t n = strlen(lit);
+    Assize_t i;
+
+    for (i = 0; i < n; i++) {
+        if (p->i + i == p->len
+            || AStrItem(p->frame[0], p->i + i) != (unsigned char)lit[i])
+            return ParseError(p, "Unexpected character", p->i);
+    }
+    p->i += n;
+
+    return value;
+}
+
+
+/* Create a Str object from the narrow input characters s[beg..end), which
+   contain no escape sequences. The result never refers to the input string,
+   so that small strings do not keep a large input string alive. */
+static AValue MakePlainStrNarrow(JsonParser *p, Assize_t beg, Assize_t end)
+{
+    p->frame[6] = AMakeEmptyStr(p->t, end - beg);
+    Refresh(p);
+    memcpy(AStrPtr(p->frame[6]), (const unsigned char *)p->s + beg,
+           end - beg);
+    return p->frame[6];
+}
+
+
+/* Create a Str object from the wide input characters s[beg..end), which
+   contain no escape sequences. Create a narrow string if possible. */
+static AValue MakePlainStrWide(JsonParser *p, Assize_t beg, Assize_t end)
+{
+    Assize_t len = end - beg;
+
+    if (ANarrowPrefixLength((const AWideChar *)p->s + beg, len) == len) {
+        p->frame[6] = AMakeEmptyStr(p->t, len);
+        Refresh(p);
+        ANarrowChars(AStrPtr(p->frame[6]), (const AWideChar *)p->s + beg,
+                     len);
+    } else {
+        p->frame[6] = AMakeEmptyStrW(p->t, len);
+        Refresh(p);
+        memcpy(AStrPtrW(p->frame[6]), (const AWideChar *)p->s + beg,
+               len * sizeof(AWideChar));
+    }
+    return p->frame[6];
+}
+
+
+#define NarrowPlainLength(s, len) PlainLength(s, len, FALSE)
+
+
+/* Define the decoder functions for narrow input. */
+#define JSON_CHAR unsigned char
+#define JSON_IS_WIDE 0
+#define PLAIN_LENGTH NarrowPlainLength
+#define MAKE_PLAIN_STR MakePlainStrNarrow
+#define DECODE_FN DecodeNarrow
+#define PARSE_VALUE_FN ParseValueNarrow
+#define PARSE_ARRAY_FN ParseArrayNarrow
+#define PARSE_OBJECT_FN ParseObjectNarrow
+#define PARSE_STRING_FN ParseStringNarrow
+#define PARSE_NUMBER_FN ParseNumberNarrow
+#define SKIP_SPACE_FN SkipSpaceNarrow
+#define DECODE_ESCAPE_FN DecodeEscapeNarrow
+#define MAKE_KEY_FN MakeKeyNarrow
+
+#include "json_decode_inc.c"
+
+#undef JSON_CHAR
+#undef JSON_IS_WIDE
+#undef PLAIN_LENGTH
+#undef MAKE_PLAIN_STR
+#undef DECODE_FN
+#undef PARSE_VALUE_FN
+#undef PARSE_ARRAY_FN
+#undef PARSE_OBJECT_FN
+#undef PARSE_STRING_FN
+#undef PARSE_NUMBER_FN
+#undef SKIP_SPACE_FN
+#undef DECODE_ESCAPE_FN
+#undef MAKE_KEY_FN
+
+
+/* Define the decoder functions for wide input. */
+#define JSON_CHAR AWideChar
+#define JSON_IS_WIDE 1
+#define PLAIN_LENGTH PlainLengthW
+#define MAKE_PLAIN_STR MakePlainStrWide
+#define DECODE_FN DecodeWide
+#define PARSE_VALUE_FN ParseValueWide
+#define PARSE_ARRAY_FN ParseArrayWide
+#define PARSE_OBJECT_FN ParseObjectWide
+#define PARSE_STRING_FN ParseStringWide
+#define PARSE_NUMBER_FN ParseNumberWide
+#define SKIP_SPACE_FN SkipSpaceWide
+#define DECODE_ESCAPE_FN DecodeEscapeWide
+#define MAKE_KEY_FN MakeKeyWide
+
+#include "json_decode_inc.c"
+
+#undef JSON_CHAR
+#undef JSON_IS_WIDE
+#undef PLAIN_LENGTH
+#undef MAKE_PLAIN_STR
+#undef DECODE_FN
+#undef PARSE_VALUE_FN
+#undef PARSE_ARRAY_FN
+#undef PARSE_OBJECT_FN
+#undef PARSE_STRING_FN
+#undef PARSE_NUMBER_FN
+#undef SKIP_SPACE_FN
+#undef DECODE_ESCAPE_FN
+#undef MAKE_KEY_FN
+
+
+/* json::JsonDecode(str) */
+static AValue JsonDecode(AThread *t, AValue *frame)
+{
+    JsonParser p;
+
+    AExpectStr(t, frame[0]);
+
+    frame[1] = AMakeFixArray(t, INITIAL_STACK_SIZE, ANil);
+    if (AIsError(frame[1]))
+        return AError;
+    frame[2] = ANil;
+
+    p.t = t;
+    p.frame = frame;
+    p.isWide = AIsWideStr(frame[0]) || AIsWideSubStr(frame[0]);
+    p.len = AStrLen(frame[0]);
+    p.i = 0;
+    p.sp = 0;
+    p.stackSize = INITIAL_STACK_SIZE;
+    p.depth = 0;
+    Refresh(&p);
+
+    if (p.isWide)
+        return DecodeWide(&p);
+    else
+        return DecodeNarrow(&p);
+}
+
+
+/* Encoder */
+
+
+typedef struct {
+    AThread *t;
+    /* frame[1]: heap output buffer (a narrow Str object) or nil
+       frame[2]: container stack (FixArray) or nil
+       frame[3]: temporary */
+    AValue *frame;
+    unsigned char buf[OUTPUT_BUF_SIZE];
+    ABool isInBuf;    /* Is the output in buf (and not in frame[1])? */
+    Assize_t len;     /* Length of the output */
+    Assize_t cap;     /* Capacity of the current output buffer */
+    int depth;
+} JsonOutput;
+
+
+/* Return a pointer to the start of the output. The pointer is valid until
+   the next allocation. */
+#define OutputData(out) \
+    ((out)->isInBuf ? (out)->buf : AStrPtr((out)->frame[1]))
+
+
+/* Make sure that there is room for n more bytes in the output and return a
+   pointer to the end of the output. The caller must increment out->len by
+   the number of bytes written. */
+static unsigned char *Reserve(JsonOutput *out, Assize_t n)
+{
+    if (out->len + n > out->cap) {
+        Assize_t newCap = 2 * out->cap;
+        AValue new;
+
+        if (newCap < out->len + n)
+            newCap = out->len + n;
+        new = AMakeEmptyStr(out->t, newCap);
+        memcpy(AStrPtr(new), OutputData(out), out->len);
+        out->frame[1] = new;
+        out->isInBuf = FALSE;
+        out->cap = newCap;
+    }
+
+    return OutputData(out) + out->len;
+}
+
+
+static void Write(JsonOutput *out, const char *s, Assize_t n)
+{
+    memcpy(Reserve(out, n), s, n);
+    out->len += n;
+}
+
+
+#define WriteChar(out, ch) \
+    (*Reserve(out, 1) = (ch), (out)->len++)
+
+
+/* Write an escaped string character that needs special processing. */
+static void WriteEscape(JsonOutput *out, int ch)
+{
+    unsigned char *d = Reserve(out, 6);
+
+    d[0] = '\\';
+    switch (ch) {
+    case '"':
+    case '\\':
+        d[1] = ch;
+        break;
+    case '\b':
+        d[1] = 'b';
+        break;
+    case '\f':
+        d[1] = 'f';
+        break;
+    case '\n':
+        d[1] = 'n';
+        break;
+    case '\r':
+        d[1] = 'r';
+        break;
+    case '\t':
+        d[1] = 't';
+        break;
+    default:
+        d[1] = 'u';
+        d[2] = HexDigits[(ch >> 12) & 15];
+        d[3] = HexDigits[(ch >> 8) & 15];
+        d[4] = HexDigits[(ch >> 4) & 15];
+        d[5] = HexDigits[ch & 15];
+        out->len += 6;
+        return;
+    }
+    out->len += 2;
+}
+
+
+/* Write the string literal that represents the Str object out->frame[3]. */
+static void EncodeStr(JsonOutput *out)
+{
+    Assize_t len = AStrLen(out->frame[3]);
+    Assize_t i;
+
+    WriteChar(out, '"');
+
+    if (AIsNarrowStr(out->frame[3]) || AIsNarrowSubStr(out->frame[3])) {
+        i = 0;
+        while (i < len) {
+            const unsigned char *s = ANarrowStrItems(out->frame[3]);
+            Assize_t n = PlainLength(s + i, len - i, TRUE);
+            if (n > 0) {
+                unsigned char *d = Reserve(out, n);
+                memcpy(d, ANarrowStrItems(out->frame[3]) + i, n);
+                out->len += n;
+                i += n;
+            } else
+                WriteEscape(out, s[i++]);
+        }
+    } else {
+        i = 0;
+        while (i < len) {
+            const AWideChar *s = AWideStrItems(out->frame[3]);
+            Assize_t n;
+            for (n = 0; i + n < len && s[i + n] >= 0x20 && s[i + n] < 0x80
+                     && s[i + n] != '"' && s[i + n] != '\\'; n++);
+            if (n > 0) {
+                unsigned char *d = Reserve(out, n);
+                ANarrowChars(d, AWideStrItems(out->frame[3]) + i, n);
+                out->len += n;
+                i += n;
+            } else
+                WriteEscape(out, s[i++]);
+        }
+    }
+
+    WriteChar(out, '"');
+}
+
+
+/* Store v at index depth of the container stack. */
+static void SetContainer(JsonOutput *out, AValue v)
+{
+    if (out->frame[2] == ANil
+        || out->depth >= AFixArrayLen(out->frame[2])) {
+        Assize_t size = out->frame[2] == ANil ? INITIAL_CONTAINER_STACK_SIZE
+            : 2 * AFixArrayLen(out->frame[2]);
+        AValue new;
+        Assize_t i;
+
+        out->frame[3] = v;
+        new = AMakeFixArray(out->t, size, ANil);
+        if (AIsError(new))
+            ADispatchException(out->t);
+        if (out->frame[2] != ANil) {
+            for (i = 0; i < AFixArrayLen(out->frame[2]); i++)
+                ASetFixArrayItem(out->t, new, i,
+                                 AFixArrayItem(out->frame[2], i));
+        }
+        out->frame[2] = new;
+        v = out->frame[3];
+    }
+
+    ASetFixArrayItem(out->t, out->frame[2], out->depth, v);
+}
+
+
+#define Container(out) AFixArrayItem((out)->frame[2], (out)->depth)
+
+
+static void EncodeValue(JsonOutput *out, AValue v)
+{
+    if (AIsStr(v)) {
+        out->frame[3] = v;
+        EncodeStr(out);
+    } else if (AIsShortInt(v)) {
+        char buf[24];
+        char *b = buf + sizeof(buf);
+        AInt64 n = AValueToInt(v);
+        ABool isNeg = n < 0;
+
+        if (isNeg)
+            n = -n;
+        do {
+            *--b = '0' + n % 10;
+            n /= 10;
+        } while (n != 0);
+        if (isNeg)
+            *--b = '-';
+        Write(out, b, buf + sizeof(buf) - b);
+    } else if (AIsLongInt(v)) {
+        unsigned char *d;
+        Assize_t n;
+
+        out->frame[3] = ALongIntToStr(out->t, v, 10, 0);
+        if (AIsError(out->frame[3]))
+            ADispatchException(out->t);
+        n = AStrLen(out->frame[3]);
+        d = Reserve(out, n);
+        memcpy(d, AGetStrElem(out->frame[3]), n);
+        out->len += n;
+    } else if (AIsFloat(v)) {
+        char buf[A_FLOAT_BUF_SIZE + 2];
+        double f = AValueToFloat(v);
+        int n;
+
+        if (AIsInf(f) || AIsNaN(f))
+            ARaiseValueError(out->t, "Cannot encode %s as JSON",
+                             AIsNaN(f) ? "nan" : "inf");
+
+        n = AFormatFloat(buf, f, 0);
+        if (strchr(buf, '.') == NULL && strchr(buf, 'e') == NULL) {
+            buf[n++] = '.';
+            buf[n++] = '0';
+        }
+        Write(out, buf, n);
+    } else if (v == ANil)
+        Write(out, "null", 4);
+    else if (v == ATrue)
+        Write(out, "true", 4);
+    else if (v == AFalse)
+        Write(out, "false", 5);
+    else if (AIsArrayOrTuple(v) || AIsMap(v)) {
+        if (out->depth >= MAX_DEPTH)
+            ARaiseValueError(out->t, "Maximum nesting depth exceeded");
+
+        out->depth++;
+        SetContainer(out, v);
+
+        if (AIsMap(Container(out))) {
+            Assize_t index = 0;
+            Assize_t prev = 0;
+            AValue key;
+            AValue value;
+            ABool isFirst = TRUE;
+
+            WriteChar(out, '{');
+            while (AMapNextItem(Container(out), &index, &key, &value)) {
+                if (!AIsStr(key))
+                    ARaiseTypeError(out->t,
+                                    "Cannot encode %T key as JSON", key);
+                out->frame[3] = key;
+                if (!isFirst)
+                    WriteChar(out, ',');
+                isFirst = FALSE;
+                EncodeStr(out);
+                WriteChar(out, ':');
+                /* The value may have been moved; fetch it again. */
+                index = prev;
+                AMapNextItem(Container(out), &index, &key, &value);
+                prev = index;
+                EncodeValue(out, value);
+            }
+            WriteChar(out, '}');
+        } else {
+            Assize_t i;
+
+            WriteChar(out, '[');
+            for (i = 0; i < AArrayOrTupleLen(Container(out)); i++) {
+                if (i > 0)
+                    WriteChar(out, ',');
+                EncodeValue(out, AArrayOrTupleItem(Container(out), i));
+            }
+            WriteChar(out, ']');
+        }
+
+        out->depth--;
+    } else
+        ARaiseTypeError(out->t, "Cannot encode %T as JSON", v);
+}
+
+
+/* json::JsonEncode(value) */
+static AValue JsonEncode(AThread *t, AValue *frame)
+{
+    JsonOutput out;
+    AValue result;
+
+    out.t = t;
+    out.frame = frame;
+    out.isInBuf = TRUE;
+    out.len = 0;
+    out.cap = OUTPUT_BUF_SIZE;
+    out.depth = 0;
+    frame[1] = ANil;
+    frame[2] = ANil;
+
+    EncodeValue(&out, frame[0]);
+
+    result = AMakeEmptyStr(t, out.len);
+    memcpy(AStrPtr(result), OutputData(&out), out.len);
+
+    return result;
+}
+
+
+A_MODULE(json, "json")
+    A_DEF("JsonDecode", 1, 6, JsonDecode)
+    A_DEF("JsonEncode", 1, 3, JsonEncode)
+A_END_MODULE()
@@ -18,6 +18,7 @@
 #include "gc.h"
 #include "internal.h"
 #include "str.h"
+#include "utf8.h"
 
 
 #define TOKEN_BLOCK_SIZE 64
@@ -33,7 +34,6 @@ static int CreateStringLiteral(const unsigned char *p,
                                const unsigned char *end, char quote,
                                int numQuotes, int numUnicodeSequences,
                                ABool isWide, AEncoding encoding);
-static ABool IsInvalidUtf8Sequence(const unsigned char *s);
 
 
 #define IsUnicodeSequence(p) \
@@ -186,15 +186,15 @@ ABool ATokenize(const unsigned char *src, const unsigned char *srcEnd,
                 } else if (encoding == AENC_UTF8) {
                     /* Check that the comment does not include invalid UTF-8
                        sequences. */
+                    const unsigned char *start = src;
 
                     do {
-                        if (*src > 127 && IsInvalidUtf8Sequence(src)) {
-                            isInvalid = TRUE;
-                            src++;
-                        } else
-                            src += A_UTF8_SKIP(*src);
+                        src++;
                     } while (*src != '\n' && *src != '\r');
 
+                    if (AValidUtf8Length(start, src - start) != src - start)
+                        isInvalid = TRUE;
+
                     /* Report error if an error was found. */
                     if (isInvalid) {
                         tok->type = TT_ERR_INVALID_UTF8_SEQUENCE;
@@ -377,13 +377,18 @@ ABool ATokenize(const unsigned char *src, const unsigned char *srcEnd,
                         /* Invalid character (non-ascii). */
                         isInvalid = TRUE;
                     } else if (encoding == AENC_UTF8) {
-                        isWide = TRUE;
                         /* Check the validity of a UTF-8 sequence and skip
-                           the multi-byte character if it is valid. */
-                        if (IsInvalidUtf8Sequence(p))
+                           the multi-byte character if it is valid. Only
+                           characters larger than 255 require a wide
+                           string. */
+                        int ch = ADecodeUtf8Char(p);
+                        if (ch == A_UTF8_INVALID)
                             isInvalid = TRUE;
-                        else
+                        else {
+                            if (ch > 0xff)
+                                isWide = TRUE;
                             p += A_UTF8_SKIP(*p) - 1;
+                        }
                     }
                 }
             }
@@ -645,11 +650,15 @@ static int CreateStringLiteral(const unsigned char *p,
 
     if (!isWide) {
         /* Pure ascii literal or Latin-1 literal, potentially with \u sequences
-           with character values less than 255. */
+           with character values less than 255. In UTF-8 source files each
+           non-ascii character is encoded as a 2-byte sequence. */
         AString *str;
+        unsigned len = (end - p) - numQuotes - 5 * numUnicodeSequences;
+
+        if (encoding == AENC_UTF8)
+            len -= ANonAsciiCount(p, end - p) / 2;
 
-        str = AAlloc(ACompilerThread, sizeof(AValue) + (end - p) - numQuotes -
-                    5 * numUnicodeSequences);
+        str = AAlloc(ACompilerThread, sizeof(AValue) + len);
         if (str == NULL)
             return -1;
 
@@ -660,6 +669,9 @@ static int CreateStringLiteral(const unsigned char *p,
             if (IsUnicodeSequence(p)) {
                 str->elem[i++] = AUnicodeSequenceValue(p + 2);
                 p += 6;
+            } else if (p[0] >= 128 && encoding == AENC_UTF8) {
+                str->elem[i++] = ((p[0] & 0x1f) << 6) | (p[1] & 0x3f);
+                p += 2;
             } else
                 str->elem[i++] = *p++;
         }
@@ -757,32 +769,6 @@ static int CreateStringLiteral(const unsigned char *p,
 }
 
 
-static ABool IsInvalidUtf8Sequence(const unsigned char *s)
-{
-    unsigned char ch1 = s[0];
-
-    if (ch1 < 0xc2)
-        return TRUE;
-    else if (ch1 < 0xe0) {
-        unsigned char ch2 = s[1];
-        if (ch2 < 0x80 || ch2 > 0xbf)
-            return TRUE;
-    } else {
-        unsigned char ch2, ch3;
-
-        ch2 = s[1];
-        if (ch2 < 0x80)
-            return TRUE;
-        ch3 = s[2];
-        if (ch2 > 0xbf || ch3 < 0x80 || ch3 > 0xbf
-            || (ch1 == 0xe0 && ch2 < 0xa0))
-            return TRUE;
-    }
-
-    return FALSE;
-}
-
-
 /* Helper function for tokenizing a single zero-terminated string. As always,
    free with AFreeTokens. Return NULL if out of memory or if the input string
    is too long. Append a newline after the provided string before tokenizing.
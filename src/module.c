@@ -367,7 +367,7 @@ static ABool RealizeSecondPass(AModuleDef *modDef, ASymbolInfo *module)
 
 
 #define MinArgs(def) ((def)->num1)
-#define MaxArgs(def) ((def)->num2)
+#define MaxArgs(def) ((def)->num2 & ~A_VAR_ARG_SLICE_FLAG)
 #define ANumLocals(def) ((def)->num3)
 
 
@@ -428,6 +428,10 @@ static ABool CreateCFunctionObject(unsigned num, ASymbolInfo *sym,
     func->maxArgs = MaxArgs(fnDef);
     func->stackFrameSize = (3 + ANumLocals(fnDef)) * sizeof(AValue);
     func->codeLen = 0; /* Dummy initializer. */
+    func->fileNum = 0;
+    func->flags = 0;
+    if (fnDef->num2 & A_VAR_ARG_SLICE_FLAG)
+        func->flags |= A_FUNC_VAR_ARG_SLICE;
 #ifdef HAVE_JIT_COMPILER
     func->num = num;
 #endif
@@ -576,7 +580,7 @@ static ABool ProcessConstructor(AModuleDef *def, ATypeInfo *type)
     if (create->type != MD_END_TYPE) {
         /* Explicit create; update argument counts. */
         symInfo->info.global.minArgs = create->num1 - 1;
-        symInfo->info.global.maxArgs = create->num2 - 1;
+        symInfo->info.global.maxArgs = MaxArgs(create) - 1;
 
         if (!CreateCMethod(symInfo, create, &type->create))
             return FALSE;
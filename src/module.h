@@ -104,6 +104,12 @@ enum {
 #define A_DEF_VARARG(name, minArgs, maxArgs, numLocals, cfunc) \
     { MD_DEF, minArgs, name, (maxArgs + 1) | A_VAR_ARG_FLAG, \
        numLocals + maxArgs + 1, cfunc, NULL },
+/* Like A_DEF_VARARG, but the extra arguments of ordinary calls are stored in
+   the stack frame; they must be accessed using AVarArgLen and AVarArgItem. */
+#define A_DEF_VARARG_SLICE(name, minArgs, maxArgs, numLocals, cfunc) \
+    { MD_DEF, minArgs, name, \
+       (maxArgs + 1) | A_VAR_ARG_FLAG | A_VAR_ARG_SLICE_FLAG, \
+       numLocals + maxArgs + 1, cfunc, NULL },
 #define A_SUB_VARARG_P(name, minArgs, maxArgs, numLocals, cfunc, ptr) \
     { MD_DEF, minArgs, name, (maxArgs + 1) | A_VAR_ARG_FLAG, \
        numLocals + maxArgs + 1, cfunc, ptr },
@@ -116,6 +122,10 @@ enum {
 #define A_METHOD_VARARG(name, minArgs, maxArgs, numLocals, cfunc) \
     { MD_METHOD, minArgs + 1, name, (maxArgs + 2) | A_VAR_ARG_FLAG, \
        numLocals + maxArgs + 2, cfunc, NULL },
+#define A_METHOD_VARARG_SLICE(name, minArgs, maxArgs, numLocals, cfunc) \
+    { MD_METHOD, minArgs + 1, name, \
+       (maxArgs + 2) | A_VAR_ARG_FLAG | A_VAR_ARG_SLICE_FLAG, \
+       numLocals + maxArgs + 2, cfunc, NULL },
 
 #define A_PRIVATE(name) ("-" name)
 
@@ -171,4 +171,15 @@ extern unsigned char AOpcodeSizes[];
     (((code) & A_EXCEPT_CODE_MASK) == A_LINE_NUMBER)
 
 
+/* Functions with at least this many outermost try statements have an
+   exception handler table before the exception information. */
+#define A_MIN_HANDLER_TABLE_LENGTH 4
+
+/* Return pointer to the exception information of a function. */
+#define AGetExceptInfo(func) \
+    ((func)->code.opc + (func)->codeLen + \
+     (((func)->flags & A_FUNC_HANDLER_TABLE) \
+      ? 1 + 2 * (func)->code.opc[(func)->codeLen] : 0))
+
+
 #endif
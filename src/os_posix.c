@@ -24,6 +24,7 @@
 #include <sys/wait.h>
 #include "alore.h"
 #include "os_module.h"
+#include "thread_fiber.h"
 #include "io_module.h"
 #include "str.h"
 #include "array.h"
@@ -163,6 +164,9 @@ AValue AOsReadSymLink(AThread *t, AValue *frame)
 AValue AOsSleep(AThread *t, AValue *frame)
 {
     double seconds = AGetFloat(t, frame[0]);
+    /* A fiber only suspends itself. */
+    if (AFiberSleep(t, seconds))
+        return ANil;
      /* FIX: Rounding? Overflow? */
     BLOCKING(usleep((int)(seconds * 1000000)));
     return ANil;
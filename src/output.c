@@ -52,6 +52,8 @@ ASectionState ASection[A_MAX_ACTIVE_SECTIONS];
 static ABool GrowOutputBuffer(void);
 static ABool GrowBuffer(AOpcode **buffer, unsigned *length,
                         unsigned newLength);
+static int CountOuterTryBlocks(AOpcode *info, int len);
+static void BuildHandlerTable(AOpcode *table, AOpcode *info, int len);
 
 
 /* Initialize bytecode output. */
@@ -159,6 +161,8 @@ AValue ALeaveSection(ASymbolInfo *sym, int minArgs, int maxArgs, int num)
     int blockLen;
     int debugInfoLen;
     int exceptInfoLen;
+    int numOuterTry;
+    int tableLen;
     AFunction *func;
     AFunction dummy;
     int fixedSize;
@@ -180,11 +184,20 @@ AValue ALeaveSection(ASymbolInfo *sym, int minArgs, int maxArgs, int num)
     exceptInfoLen = ExceptBufIndex - ASection[ANumActiveSections].exceptInd;
     ExceptBufIndex = ASection[ANumActiveSections].exceptInd;
 
+    /* Functions with many try statements get a sorted table of the outermost
+       try statements for finding exception handlers quickly. */
+    numOuterTry = CountOuterTryBlocks(ExceptBuf + ExceptBufIndex,
+                                      exceptInfoLen);
+    if (numOuterTry >= A_MIN_HANDLER_TABLE_LENGTH)
+        tableLen = 1 + 2 * numOuterTry;
+    else
+        tableLen = 0;
+
     /* Calculate the fixed size of a Functin object (all the data before the
        opcodes). */
     fixedSize = APtrDiff(&dummy.code, &dummy.header);
 
-    blockLen = fixedSize + (codeLen + exceptInfoLen +
+    blockLen = fixedSize + (codeLen + tableLen + exceptInfoLen +
                             debugInfoLen) * sizeof(AOpcode);
     func = AAllocUnmovable(blockLen);
     if (func == NULL) {
@@ -197,10 +210,13 @@ AValue ALeaveSection(ASymbolInfo *sym, int minArgs, int maxArgs, int num)
     APrevOpcodeInd = 0;
 
     ACopyMem(func->code.opc, ABuf + ABufInd, codeLen * sizeof(AOpcode));
-    ACopyMem(func->code.opc + codeLen, ExceptBuf + ExceptBufIndex,
+    if (tableLen > 0)
+        BuildHandlerTable(func->code.opc + codeLen,
+                          ExceptBuf + ExceptBufIndex, exceptInfoLen);
+    ACopyMem(func->code.opc + codeLen + tableLen, ExceptBuf + ExceptBufIndex,
             exceptInfoLen * sizeof(AOpcode));
-    ACopyMem(func->code.opc + codeLen + exceptInfoLen, DebugInfoBuf +
-            DebugInfoBufIndex, debugInfoLen * sizeof(AOpcode));
+    ACopyMem(func->code.opc + codeLen + tableLen + exceptInfoLen,
+             DebugInfoBuf + DebugInfoBufIndex, debugInfoLen * sizeof(AOpcode));
 
     func->sym = sym;
     func->minArgs = minArgs;
@@ -208,6 +224,7 @@ AValue ALeaveSection(ASymbolInfo *sym, int minArgs, int maxArgs, int num)
     func->stackFrameSize = ANumLocals * sizeof(AValue);
     func->codeLen = codeLen;
     func->fileNum = ACurFileNum;
+    func->flags = tableLen > 0 ? A_FUNC_HANDLER_TABLE : 0;
 #ifdef HAVE_JIT_COMPILER
     func->num = num;
     func->isJitFunction = AIsJitModule;
@@ -459,6 +476,68 @@ static ABool GrowBuffer(AOpcode **buffer, unsigned *length, unsigned newLength)
 }
 
 
+/* Return the number of outermost try statements in exception information. */
+static int CountOuterTryBlocks(AOpcode *info, int len)
+{
+    int i;
+    int depth = 0;
+    int num = 0;
+
+    for (i = 0; i < len; ) {
+        AOpcode code = info[i];
+
+        if (AIsEndTryCode(code)) {
+            depth--;
+            i++;
+        } else if (AIsBeginTryCode(code)) {
+            if (depth == 0)
+                num++;
+            depth++;
+            i++;
+        } else if (AIsExceptCode(code))
+            i += 3;
+        else
+            i += 2;
+    }
+
+    return num;
+}
+
+
+/* Build the exception handler table of a function. The table contains the
+   number of outermost try statements followed by a (code index, exception
+   information offset) pair for each of them. The pairs are sorted by code
+   index, since try statements are recorded in code order. */
+static void BuildHandlerTable(AOpcode *table, AOpcode *info, int len)
+{
+    int i;
+    int depth = 0;
+    int num = 0;
+
+    for (i = 0; i < len; ) {
+        AOpcode code = info[i];
+
+        if (AIsEndTryCode(code)) {
+            depth--;
+            i++;
+        } else if (AIsBeginTryCode(code)) {
+            if (depth == 0) {
+                table[1 + 2 * num] = AGetBeginTryCodeIndex(code);
+                table[2 + 2 * num] = i;
+                num++;
+            }
+            depth++;
+            i++;
+        } else if (AIsExceptCode(code))
+            i += 3;
+        else
+            i += 2;
+    }
+
+    table[0] = num;
+}
+
+
 /* Functions dealing with specific opcodes. */
 
 
@@ -0,0 +1,858 @@
+/* packedarray_module.c - packedarray module
+
+   Copyright (c) 2010-2011 Jukka Lehtosalo
+
+   Alore is licensed under the terms of the MIT license.  See the file
+   LICENSE.txt in the distribution.
+*/
+
+/* The packedarray module implements fixed-length arrays of 64-bit integers
+   (IntArray), floats (FloatArray) and bytes (ByteArray). The items are
+   stored unboxed in a non-pointer block, so the garbage collector never
+   scans them.
+
+   Slicing an array creates a view that refers to the same data block as the
+   original array. All views refer to the base array that owns the data
+   block, and the data is always accessed through the base array. The data
+   block of a base array may be shared with a Str object (an array created
+   from a narrow Str refers to the Str object, and toStr() may return the data
+   block). Shared data is copied before it is modified. */
+
+#include "alore.h"
+#include "runtime.h"
+#include "str.h"
+
+
+/* Slot ids for packed array objects */
+#define PA_DATA 0    /* Data block (narrow Str object); only in base arrays */
+#define PA_BASE 1    /* Base array that owns the data (self in base arrays) */
+#define PA_START 2   /* Offset of the first item in the data block, in bytes */
+#define PA_LEN 3     /* Number of items */
+#define PA_SHARED 4  /* True if the data is shared with a Str object */
+
+#define PA_NUM_SLOTS 5
+
+/* Slot ids for packed array iterator objects */
+#define ITER_ARRAY 0
+#define ITER_I 1
+
+
+/* Item kinds */
+enum {
+    KIND_INT,
+    KIND_FLOAT,
+    KIND_BYTE
+};
+
+
+/* Operations for Elementwise */
+enum {
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV
+};
+
+
+static const int ItemSize[] = { sizeof(AInt64), sizeof(double), 1 };
+
+
+/* Global nums of the classes */
+static int IntArrayNum;
+static int FloatArrayNum;
+static int ByteArrayNum;
+static int IterNum;
+
+
+#define Len(a) AValueToInt(AMemberDirect(a, PA_LEN))
+
+#define MAX_INT64 ((AInt64)(((AIntU64)1 << 63) - 1))
+#define MIN_INT64 (-MAX_INT64 - 1)
+
+
+static int GetKind(AValue a);
+static AValue MakeArray(AThread *t, int kind, Assize_t len, AValue *tmp);
+static void InitBase(AThread *t, AValue a, AValue data, Assize_t len,
+                     ABool isShared);
+static AValue GetItem(AThread *t, int kind, void *data, Assize_t i);
+static void SetItem(AThread *t, int kind, void *data, Assize_t i, AValue v);
+static ABool PrepareWrite(AThread *t, AValue *a);
+static AValue Elementwise(AThread *t, AValue *frame, int op);
+
+
+/* Return a pointer to the first item of an array. The pointer is valid until
+   the next memory allocation. */
+static void *ItemPtr(AValue a)
+{
+    AValue base = AMemberDirect(a, PA_BASE);
+    return (char *)AMemPtr(AMemberDirect(base, PA_DATA)) +
+        AValueToInt(AMemberDirect(a, PA_START));
+}
+
+
+/* Return the global num of the class of arrays of the given kind. */
+static int KindNum(int kind)
+{
+    if (kind == KIND_INT)
+        return IntArrayNum;
+    else if (kind == KIND_FLOAT)
+        return FloatArrayNum;
+    else
+        return ByteArrayNum;
+}
+
+
+/* Raise an exception and return FALSE if an array with n items of the given
+   size cannot be created. */
+static ABool CheckLength(AThread *t, Assize_t n, int size)
+{
+    if (n < 0) {
+        ARaiseValueErrorND(t, AMsgNegativeValueNotExpected);
+        return FALSE;
+    } else if (n > A_SHORT_INT_MAX / size) {
+        ARaiseMemoryErrorND(t);
+        return FALSE;
+    } else
+        return TRUE;
+}
+
+
+/* Packed array create(length or iterable or str) */
+static AValue PackedArrayCreate(AThread *t, AValue *frame)
+{
+    int kind = GetKind(frame[0]);
+    int size = ItemSize[kind];
+    Assize_t i, n;
+
+    if (AIsShortInt(frame[1]) || AIsLongInt(frame[1])) {
+        /* Initialize the items to zero. */
+        n = AGetInt_ssize_t(t, frame[1]);
+        if (!CheckLength(t, n, size))
+            return AError;
+        frame[2] = AAllocMem(t, n * size);
+        memset(AMemPtr(frame[2]), 0, n * size);
+        InitBase(t, frame[0], frame[2], n, FALSE);
+    } else if (AIsStr(frame[1])) {
+        /* Use the characters of the str as the raw data. */
+        n = AStrLen(frame[1]);
+        if (n % size != 0)
+            return ARaiseValueError(
+                t, "Length of Str must be a multiple of %d", size);
+        if (AIsNarrowStr(frame[1]))
+            InitBase(t, frame[0], frame[1], n / size, TRUE);
+        else {
+            unsigned char *data;
+            frame[2] = AAllocMem(t, n);
+            data = AMemPtr(frame[2]);
+            for (i = 0; i < n; i++) {
+                AWideChar ch = AStrItem(frame[1], i);
+                if (ch > 255)
+                    return ARaiseValueError(
+                        t, "Character code out of range (%d)", ch);
+                data[i] = ch;
+            }
+            InitBase(t, frame[0], frame[2], n / size, FALSE);
+        }
+    } else {
+        /* Copy the items of an iterable. */
+        if (AIsArray(frame[1]))
+            frame[2] = frame[1];
+        else {
+            frame[2] = AMakeArray(t, 0);
+            frame[3] = AIterator(t, frame[1]);
+            if (AIsError(frame[3]))
+                return AError;
+            for (;;) {
+                int res = ANext(t, frame[3], &frame[4]);
+                if (res == 0)
+                    break;
+                else if (res < 0)
+                    return AError;
+                AAppendArray(t, frame[2], frame[4]);
+            }
+        }
+
+        n = AArrayLen(frame[2]);
+        if (!CheckLength(t, n, size))
+            return AError;
+        frame[3] = AAllocMem(t, n * size);
+        for (i = 0; i < n; i++)
+            SetItem(t, kind, AMemPtr(frame[3]), i, AArrayItem(frame[2], i));
+        InitBase(t, frame[0], frame[3], n, FALSE);
+    }
+
+    return frame[0];
+}
+
+
+/* Packed array length() */
+static AValue PackedArrayLength(AThread *t, AValue *frame)
+{
+    return AMemberDirect(frame[0], PA_LEN);
+}
+
+
+/* Packed array _get(index or pair) */
+static AValue PackedArray_get(AThread *t, AValue *frame)
+{
+    Assize_t len = Len(frame[0]);
+    int kind = GetKind(frame[0]);
+
+    if (AIsShortInt(frame[1])) {
+        Assize_t i = AValueToInt(frame[1]);
+        if (i < 0)
+            i += len;
+        if (i < 0 || i >= len)
+            return ARaiseIndexError(t, NULL);
+        return GetItem(t, kind, ItemPtr(frame[0]), i);
+    } else if (AIsPair(frame[1])) {
+        /* Create a view that shares the data of the original array. */
+        AValue loVal, hiVal;
+        Assize_t lo, hi;
+
+        AGetPair(t, frame[1], &loVal, &hiVal);
+        lo = AIsNil(loVal) ? 0 : AGetInt_ssize_t(t, loVal);
+        hi = AIsNil(hiVal) ? len : AGetInt_ssize_t(t, hiVal);
+
+        if (lo < 0) {
+            lo += len;
+            if (lo < 0)
+                lo = 0;
+        } else if (lo > len)
+            lo = len;
+        if (hi < 0)
+            hi += len;
+        else if (hi > len)
+            hi = len;
+        if (hi < lo)
+            hi = lo;
+
+        frame[2] = AMakeUninitializedObject(t, AGlobalByNum(KindNum(kind)));
+        ASetMemberDirect(t, frame[2], PA_BASE,
+                         AMemberDirect(frame[0], PA_BASE));
+        ASetMemberDirect(t, frame[2], PA_START, AIntToValue(
+            AValueToInt(AMemberDirect(frame[0], PA_START)) +
+            lo * ItemSize[kind]));
+        ASetMemberDirect(t, frame[2], PA_LEN, AIntToValue(hi - lo));
+        return frame[2];
+    } else if (AIsLongInt(frame[1]))
+        return ARaiseIndexError(t, NULL);
+    else
+        return ARaiseTypeError(t, AMsgIntExpected);
+}
+
+
+/* Packed array _set(index, value) */
+static AValue PackedArray_set(AThread *t, AValue *frame)
+{
+    Assize_t len = Len(frame[0]);
+    Assize_t i;
+
+    if (!AIsShortInt(frame[1])) {
+        if (AIsLongInt(frame[1]))
+            return ARaiseIndexError(t, NULL);
+        else
+            return ARaiseTypeError(t, AMsgIntExpected);
+    }
+
+    i = AValueToInt(frame[1]);
+    if (i < 0)
+        i += len;
+    if (i < 0 || i >= len)
+        return ARaiseIndexError(t, NULL);
+
+    if (!PrepareWrite(t, frame))
+        return AError;
+    SetItem(t, GetKind(frame[0]), ItemPtr(frame[0]), i, frame[2]);
+
+    return ANil;
+}
+
+
+/* Packed array iterator() */
+static AValue PackedArrayIter(AThread *t, AValue *frame)
+{
+    return ACallValue(t, AGlobalByNum(IterNum), 1, frame);
+}
+
+
+/* Packed array _eq(object) */
+static AValue PackedArray_eq(AThread *t, AValue *frame)
+{
+    int kind = GetKind(frame[0]);
+    Assize_t len = Len(frame[0]);
+    Assize_t i;
+
+    if (!AIsInstance(frame[1]) || GetKind(frame[1]) != kind
+        || Len(frame[1]) != len)
+        return AFalse;
+
+    if (kind == KIND_FLOAT) {
+        /* Compare Float values, since memcmp would not handle nan and -0.0
+           correctly. */
+        double *a = ItemPtr(frame[0]);
+        double *b = ItemPtr(frame[1]);
+        for (i = 0; i < len; i++) {
+            if (a[i] != b[i])
+                return AFalse;
+        }
+        return ATrue;
+    } else
+        return memcmp(ItemPtr(frame[0]), ItemPtr(frame[1]),
+                      len * ItemSize[kind]) == 0 ? ATrue : AFalse;
+}
+
+
+/* Packed array _str() */
+static AValue PackedArray_str(AThread *t, AValue *frame)
+{
+    int kind = GetKind(frame[0]);
+    Assize_t len = Len(frame[0]);
+    Assize_t i;
+    AValue str;
+
+    frame[1] = AMakeArray(t, len);
+    for (i = 0; i < len; i++) {
+        AValue item = GetItem(t, kind, ItemPtr(frame[0]), i);
+        ASetArrayItem(t, frame[1], i, item);
+    }
+
+    frame[1] = ARepr(t, frame[1]);
+    if (kind == KIND_INT)
+        str = AMakeStr(t, "IntArray(");
+    else if (kind == KIND_FLOAT)
+        str = AMakeStr(t, "FloatArray(");
+    else
+        str = AMakeStr(t, "ByteArray(");
+    frame[1] = AConcat(t, str, frame[1]);
+    str = AMakeStr(t, ")");
+    return AConcat(t, frame[1], str);
+}
+
+
+/* Packed array copy() */
+static AValue PackedArrayCopy(AThread *t, AValue *frame)
+{
+    int kind = GetKind(frame[0]);
+    Assize_t len = Len(frame[0]);
+
+    MakeArray(t, kind, len, frame + 1);
+    memcpy(ItemPtr(frame[1]), ItemPtr(frame[0]), len * ItemSize[kind]);
+    return frame[1];
+}
+
+
+/* Packed array toStr() */
+static AValue PackedArrayToStr(AThread *t, AValue *frame)
+{
+    AValue base = AMemberDirect(frame[0], PA_BASE);
+    AValue data = AMemberDirect(base, PA_DATA);
+    Asize_t size = Len(frame[0]) * ItemSize[GetKind(frame[0])];
+
+    if (AMemberDirect(frame[0], PA_START) == AZero
+        && size == AGetStrLen(AValueToStr(data))) {
+        /* The array covers the whole data block. Return the block instead of
+           a copy, but copy the data before the next modification. */
+        ASetMemberDirect(t, base, PA_SHARED, ATrue);
+        return data;
+    }
+
+    frame[1] = AMakeEmptyStr(t, size);
+    memcpy(AStrPtr(frame[1]), ItemPtr(frame[0]), size);
+    return frame[1];
+}
+
+
+/* Packed array sum() */
+static AValue PackedArraySum(AThread *t, AValue *frame)
+{
+    int kind = GetKind(frame[0]);
+    Assize_t len = Len(frame[0]);
+    Assize_t i;
+
+    if (kind == KIND_INT) {
+        /* Accumulate a 64-bit sum and flush it to an Int object when it
+           would overflow. */
+        AInt64 sum = 0;
+        frame[1] = AZero;
+        for (i = 0; i < len; i++) {
+            AInt64 x = ((AInt64 *)ItemPtr(frame[0]))[i];
+            if ((x > 0 && sum > MAX_INT64 - x)
+                || (x < 0 && sum < MIN_INT64 - x)) {
+                frame[2] = AMakeInt64(t, sum);
+                frame[1] = AAdd(t, frame[1], frame[2]);
+                sum = 0;
+            }
+            sum += x;
+        }
+        frame[2] = AMakeInt64(t, sum);
+        return AAdd(t, frame[1], frame[2]);
+    } else if (kind == KIND_FLOAT) {
+        /* Use independent partial sums so that the loop can be
+           vectorized. */
+        double *a = ItemPtr(frame[0]);
+        double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+        for (i = 0; i + 4 <= len; i += 4) {
+            s0 += a[i];
+            s1 += a[i + 1];
+            s2 += a[i + 2];
+            s3 += a[i + 3];
+        }
+        for (; i < len; i++)
+            s0 += a[i];
+        return AMakeFloat(t, (s0 + s1) + (s2 + s3));
+    } else {
+        unsigned char *a = ItemPtr(frame[0]);
+        AInt64 sum = 0;
+        for (i = 0; i < len; i++)
+            sum += a[i];
+        return AMakeInt64(t, sum);
+    }
+}
+
+
+/* Return the minimum (if isMax is FALSE) or the maximum item of an array. */
+static AValue MinMax(AThread *t, AValue *frame, ABool isMax)
+{
+    int kind = GetKind(frame[0]);
+    Assize_t len = Len(frame[0]);
+    Assize_t i;
+
+    if (len == 0)
+        return ARaiseValueError(t, "Empty array");
+
+    if (kind == KIND_INT) {
+        AInt64 *a = ItemPtr(frame[0]);
+        AInt64 m = a[0];
+        if (isMax) {
+            for (i = 1; i < len; i++)
+                m = a[i] > m ? a[i] : m;
+        } else {
+            for (i = 1; i < len; i++)
+                m = a[i] < m ? a[i] : m;
+        }
+        return AMakeInt64(t, m);
+    } else if (kind == KIND_FLOAT) {
+        double *a = ItemPtr(frame[0]);
+        double m = a[0];
+        if (isMax) {
+            for (i = 1; i < len; i++)
+                m = a[i] > m ? a[i] : m;
+        } else {
+            for (i = 1; i < len; i++)
+                m = a[i] < m ? a[i] : m;
+        }
+        return AMakeFloat(t, m);
+    } else {
+        unsigned char *a = ItemPtr(frame[0]);
+        unsigned char m = a[0];
+        if (isMax) {
+            for (i = 1; i < len; i++)
+                m = a[i] > m ? a[i] : m;
+        } else {
+            for (i = 1; i < len; i++)
+                m = a[i] < m ? a[i] : m;
+        }
+        return AIntToValue(m);
+    }
+}
+
+
+/* Packed array min() */
+static AValue PackedArrayMin(AThread *t, AValue *frame)
+{
+    return MinMax(t, frame, FALSE);
+}
+
+
+/* Packed array max() */
+static AValue PackedArrayMax(AThread *t, AValue *frame)
+{
+    return MinMax(t, frame, TRUE);
+}
+
+
+/* Packed array dot(array) */
+static AValue PackedArrayDot(AThread *t, AValue *frame)
+{
+    int kind = GetKind(frame[0]);
+    Assize_t len = Len(frame[0]);
+    Assize_t i;
+
+    if (!AIsInstance(frame[1]) || GetKind(frame[1]) != kind)
+        return ARaiseTypeError(t, "%T expected (but %T found)", frame[0],
+                               frame[1]);
+    if (Len(frame[1]) != len)
+        return ARaiseValueError(t, "Array lengths differ");
+
+    if (kind == KIND_INT) {
+        /* Products of items that fit in 32 bits cannot overflow. Other
+           products and sums that would overflow are calculated using Int
+           objects. */
+        AInt64 sum = 0;
+        frame[2] = AZero;
+        for (i = 0; i < len; i++) {
+            AInt64 x = ((AInt64 *)ItemPtr(frame[0]))[i];
+            AInt64 y = ((AInt64 *)ItemPtr(frame[1]))[i];
+            if (x >= -2147483647 && x <= 2147483647
+                && y >= -2147483647 && y <= 2147483647) {
+                AInt64 p = x * y;
+                if ((p > 0 && sum > MAX_INT64 - p)
+                    || (p < 0 && sum < MIN_INT64 - p)) {
+                    frame[3] = AMakeInt64(t, sum);
+                    frame[2] = AAdd(t, frame[2], frame[3]);
+                    sum = 0;
+                }
+                sum += p;
+            } else {
+                frame[3] = AMakeInt64(t, x);
+                frame[4] = AMakeInt64(t, y);
+                frame[3] = AMul(t, frame[3], frame[4]);
+                frame[2] = AAdd(t, frame[2], frame[3]);
+            }
+        }
+        frame[3] = AMakeInt64(t, sum);
+        return AAdd(t, frame[2], frame[3]);
+    } else if (kind == KIND_FLOAT) {
+        double *a = ItemPtr(frame[0]);
+        double *b = ItemPtr(frame[1]);
+        double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+        for (i = 0; i + 4 <= len; i += 4) {
+            s0 += a[i] * b[i];
+            s1 += a[i + 1] * b[i + 1];
+            s2 += a[i + 2] * b[i + 2];
+            s3 += a[i + 3] * b[i + 3];
+        }
+        for (; i < len; i++)
+            s0 += a[i] * b[i];
+        return AMakeFloat(t, (s0 + s1) + (s2 + s3));
+    } else {
+        unsigned char *a = ItemPtr(frame[0]);
+        unsigned char *b = ItemPtr(frame[1]);
+        AInt64 sum = 0;
+        for (i = 0; i < len; i++)
+            sum += a[i] * b[i];
+        return AMakeInt64(t, sum);
+    }
+}
+
+
+/* Packed array _add(x) */
+static AValue PackedArray_add(AThread *t, AValue *frame)
+{
+    return Elementwise(t, frame, OP_ADD);
+}
+
+
+/* Packed array _sub(x) */
+static AValue PackedArray_sub(AThread *t, AValue *frame)
+{
+    return Elementwise(t, frame, OP_SUB);
+}
+
+
+/* Packed array _mul(x) */
+static AValue PackedArray_mul(AThread *t, AValue *frame)
+{
+    return Elementwise(t, frame, OP_MUL);
+}
+
+
+/* FloatArray _div(x) */
+static AValue PackedArray_div(AThread *t, AValue *frame)
+{
+    return Elementwise(t, frame, OP_DIV);
+}
+
+
+/* Calculate an elementwise operation between an array and another array of
+   the same kind and length or a scalar. Integer operations wrap around. The
+   frame must have 2 temporary slots. */
+static AValue Elementwise(AThread *t, AValue *frame, int op)
+{
+    int kind = GetKind(frame[0]);
+    Assize_t len = Len(frame[0]);
+    ABool isScalar;
+    Assize_t i;
+
+    if (AIsInstance(frame[1]) && GetKind(frame[1]) == kind) {
+        if (Len(frame[1]) != len)
+            return ARaiseValueError(t, "Array lengths differ");
+        isScalar = FALSE;
+    } else if (AIsShortInt(frame[1]) || AIsLongInt(frame[1])
+               || (kind == KIND_FLOAT && AIsFloat(frame[1])))
+        isScalar = TRUE;
+    else
+        return ARaiseTypeError(t, "%T or number expected (but %T found)",
+                               frame[0], frame[1]);
+
+    MakeArray(t, kind, len, frame + 2);
+
+    if (kind == KIND_INT) {
+        /* Use unsigned arithmetic to get well-defined wraparound. */
+        AIntU64 *r = ItemPtr(frame[2]);
+        AIntU64 *a = ItemPtr(frame[0]);
+        if (isScalar) {
+            AIntU64 b = AGetInt64(t, frame[1]);
+            if (op == OP_ADD)
+                for (i = 0; i < len; i++) r[i] = a[i] + b;
+            else if (op == OP_SUB)
+                for (i = 0; i < len; i++) r[i] = a[i] - b;
+            else
+                for (i = 0; i < len; i++) r[i] = a[i] * b;
+        } else {
+            AIntU64 *b = ItemPtr(frame[1]);
+            if (op == OP_ADD)
+                for (i = 0; i < len; i++) r[i] = a[i] + b[i];
+            else if (op == OP_SUB)
+                for (i = 0; i < len; i++) r[i] = a[i] - b[i];
+            else
+                for (i = 0; i < len; i++) r[i] = a[i] * b[i];
+        }
+    } else if (kind == KIND_FLOAT) {
+        double *r = ItemPtr(frame[2]);
+        double *a = ItemPtr(frame[0]);
+        if (isScalar) {
+            double b = AGetFloat(t, frame[1]);
+            if (op == OP_ADD)
+                for (i = 0; i < len; i++) r[i] = a[i] + b;
+            else if (op == OP_SUB)
+                for (i = 0; i < len; i++) r[i] = a[i] - b;
+            else if (op == OP_MUL)
+                for (i = 0; i < len; i++) r[i] = a[i] * b;
+            else
+                for (i = 0; i < len; i++) r[i] = a[i] / b;
+        } else {
+            double *b = ItemPtr(frame[1]);
+            if (op == OP_ADD)
+                for (i = 0; i < len; i++) r[i] = a[i] + b[i];
+            else if (op == OP_SUB)
+                for (i = 0; i < len; i++) r[i] = a[i] - b[i];
+            else if (op == OP_MUL)
+                for (i = 0; i < len; i++) r[i] = a[i] * b[i];
+            else
+                for (i = 0; i < len; i++) r[i] = a[i] / b[i];
+        }
+    } else {
+        unsigned char *r = ItemPtr(frame[2]);
+        unsigned char *a = ItemPtr(frame[0]);
+        if (isScalar) {
+            unsigned char b = (unsigned char)AGetInt64(t, frame[1]);
+            if (op == OP_ADD)
+                for (i = 0; i < len; i++) r[i] = a[i] + b;
+            else if (op == OP_SUB)
+                for (i = 0; i < len; i++) r[i] = a[i] - b;
+            else
+                for (i = 0; i < len; i++) r[i] = a[i] * b;
+        } else {
+            unsigned char *b = ItemPtr(frame[1]);
+            if (op == OP_ADD)
+                for (i = 0; i < len; i++) r[i] = a[i] + b[i];
+            else if (op == OP_SUB)
+                for (i = 0; i < len; i++) r[i] = a[i] - b[i];
+            else
+                for (i = 0; i < len; i++) r[i] = a[i] * b[i];
+        }
+    }
+
+    return frame[2];
+}
+
+
+/* The create method of packed array iterator. */
+static AValue PackedArrayIterCreate(AThread *t, AValue *frame)
+{
+    ASetMemberDirect(t, frame[0], ITER_ARRAY, frame[1]);
+    ASetMemberDirect(t, frame[0], ITER_I, AZero);
+    return frame[0];
+}
+
+
+/* Packed array iterator hasNext() */
+static AValue PackedArrayIterHasNext(AThread *t, AValue *frame)
+{
+    Assize_t i = AValueToInt(AMemberDirect(frame[0], ITER_I));
+    return i < Len(AMemberDirect(frame[0], ITER_ARRAY)) ? ATrue : AFalse;
+}
+
+
+/* Packed array iterator next() */
+static AValue PackedArrayIterNext(AThread *t, AValue *frame)
+{
+    Assize_t i = AValueToInt(AMemberDirect(frame[0], ITER_I));
+    AValue a = AMemberDirect(frame[0], ITER_ARRAY);
+
+    if (i >= Len(a))
+        return ARaiseValueError(t, "No items left");
+
+    AValueToInstance(frame[0])->member[ITER_I] = AIntToValue(i + 1);
+    return GetItem(t, GetKind(a), ItemPtr(a), i);
+}
+
+
+/* Return the item kind of a packed array object, or -1 if the argument is
+   not a packed array. */
+static int GetKind(AValue a)
+{
+    ATypeInfo *type = AGetInstanceType(AValueToInstance(a));
+
+    for (; type != NULL; type = type->super) {
+        if (type == AValueToType(AGlobalByNum(IntArrayNum)))
+            return KIND_INT;
+        else if (type == AValueToType(AGlobalByNum(FloatArrayNum)))
+            return KIND_FLOAT;
+        else if (type == AValueToType(AGlobalByNum(ByteArrayNum)))
+            return KIND_BYTE;
+    }
+
+    return -1;
+}
+
+
+/* Construct a base array with len items initialized to zero and store it in
+   tmp[0]. Use tmp[1] as a temporary location. */
+static AValue MakeArray(AThread *t, int kind, Assize_t len, AValue *tmp)
+{
+    tmp[0] = AMakeUninitializedObject(t, AGlobalByNum(KindNum(kind)));
+    tmp[1] = AAllocMem(t, len * ItemSize[kind]);
+    memset(AMemPtr(tmp[1]), 0, len * ItemSize[kind]);
+    InitBase(t, tmp[0], tmp[1], len, FALSE);
+    return tmp[0];
+}
+
+
+/* Initialize a base array object that owns the data block. */
+static void InitBase(AThread *t, AValue a, AValue data, Assize_t len,
+                     ABool isShared)
+{
+    ASetMemberDirect(t, a, PA_DATA, data);
+    ASetMemberDirect(t, a, PA_BASE, a);
+    ASetMemberDirect(t, a, PA_START, AZero);
+    ASetMemberDirect(t, a, PA_LEN, AIntToValue(len));
+    ASetMemberDirect(t, a, PA_SHARED, isShared ? ATrue : AFalse);
+}
+
+
+static AValue GetItem(AThread *t, int kind, void *data, Assize_t i)
+{
+    if (kind == KIND_INT)
+        return AMakeInt64(t, ((AInt64 *)data)[i]);
+    else if (kind == KIND_FLOAT)
+        return AMakeFloat(t, ((double *)data)[i]);
+    else
+        return AIntToValue(((unsigned char *)data)[i]);
+}
+
+
+/* Store an item in a data block. Raise a direct exception if the value has
+   an invalid type or is out of range. The conversions do not allocate
+   memory, so data remains valid. */
+static void SetItem(AThread *t, int kind, void *data, Assize_t i, AValue v)
+{
+    if (kind == KIND_INT)
+        ((AInt64 *)data)[i] = AGetInt64(t, v);
+    else if (kind == KIND_FLOAT)
+        ((double *)data)[i] = AGetFloat(t, v);
+    else {
+        int x = AGetInt(t, v);
+        if (x < 0 || x > 255)
+            ARaiseValueError(t, "Byte value out of range (%d)", x);
+        ((unsigned char *)data)[i] = x;
+    }
+}
+
+
+/* Make the data of an array writable by copying it if it is shared with a
+   Str object. The argument must point to a location visible to the garbage
+   collector. */
+static ABool PrepareWrite(AThread *t, AValue *a)
+{
+    AValue base = AMemberDirect(*a, PA_BASE);
+
+    if (AMemberDirect(base, PA_SHARED) == ATrue) {
+        Asize_t size = AGetStrLen(AValueToStr(AMemberDirect(base, PA_DATA)));
+        AValue data = AAllocMem(t, size);
+        if (AIsError(data))
+            return FALSE;
+        base = AMemberDirect(*a, PA_BASE);
+        memcpy(AMemPtr(data), AMemPtr(AMemberDirect(base, PA_DATA)), size);
+        ASetMemberDirect(t, base, PA_DATA, data);
+        ASetMemberDirect(t, base, PA_SHARED, AFalse);
+    }
+
+    return TRUE;
+}
+
+
+A_MODULE(packedarray, "packedarray")
+    A_CLASS_PRIV_P("IntArray", PA_NUM_SLOTS, &IntArrayNum)
+        A_IMPLEMENT("std::Sequence")
+        A_IMPLEMENT("std::Iterable")
+        A_METHOD("create", 1, 3, PackedArrayCreate)
+        A_METHOD("length", 0, 0, PackedArrayLength)
+        A_METHOD("_get", 1, 1, PackedArray_get)
+        A_METHOD("_set", 2, 0, PackedArray_set)
+        A_METHOD("iterator", 0, 1, PackedArrayIter)
+        A_METHOD("_eq", 1, 0, PackedArray_eq)
+        A_METHOD("_str", 0, 1, PackedArray_str)
+        A_METHOD("_add", 1, 2, PackedArray_add)
+        A_METHOD("_sub", 1, 2, PackedArray_sub)
+        A_METHOD("_mul", 1, 2, PackedArray_mul)
+        A_METHOD("sum", 0, 2, PackedArraySum)
+        A_METHOD("min", 0, 0, PackedArrayMin)
+        A_METHOD("max", 0, 0, PackedArrayMax)
+        A_METHOD("dot", 1, 3, PackedArrayDot)
+        A_METHOD("copy", 0, 2, PackedArrayCopy)
+        A_METHOD("toStr", 0, 1, PackedArrayToStr)
+    A_END_CLASS()
+
+    A_CLASS_PRIV_P("FloatArray", PA_NUM_SLOTS, &FloatArrayNum)
+        A_IMPLEMENT("std::Sequence")
+        A_IMPLEMENT("std::Iterable")
+        A_METHOD("create", 1, 3, PackedArrayCreate)
+        A_METHOD("length", 0, 0, PackedArrayLength)
+        A_METHOD("_get", 1, 1, PackedArray_get)
+        A_METHOD("_set", 2, 0, PackedArray_set)
+        A_METHOD("iterator", 0, 1, PackedArrayIter)
+        A_METHOD("_eq", 1, 0, PackedArray_eq)
+        A_METHOD("_str", 0, 1, PackedArray_str)
+        A_METHOD("_add", 1, 2, PackedArray_add)
+        A_METHOD("_sub", 1, 2, PackedArray_sub)
+        A_METHOD("_mul", 1, 2, PackedArray_mul)
+        A_METHOD("_div", 1, 2, PackedArray_div)
+        A_METHOD("sum", 0, 2, PackedArraySum)
+        A_METHOD("min", 0, 0, PackedArrayMin)
+        A_METHOD("max", 0, 0, PackedArrayMax)
+        A_METHOD("dot", 1, 3, PackedArrayDot)
+        A_METHOD("copy", 0, 2, PackedArrayCopy)
+        A_METHOD("toStr", 0, 1, PackedArrayToStr)
+    A_END_CLASS()
+
+    A_CLASS_PRIV_P("ByteArray", PA_NUM_SLOTS, &ByteArrayNum)
+        A_IMPLEMENT("std::Sequence")
+        A_IMPLEMENT("std::Iterable")
+        A_METHOD("create", 1, 3, PackedArrayCreate)
+        A_METHOD("length", 0, 0, PackedArrayLength)
+        A_METHOD("_get", 1, 1, PackedArray_get)
+        A_METHOD("_set", 2, 0, PackedArray_set)
+        A_METHOD("iterator", 0, 1, PackedArrayIter)
+        A_METHOD("_eq", 1, 0, PackedArray_eq)
+        A_METHOD("_str", 0, 1, PackedArray_str)
+        A_METHOD("_add", 1, 2, PackedArray_add)
+        A_METHOD("_sub", 1, 2, PackedArray_sub)
+        A_METHOD("_mul", 1, 2, PackedArray_mul)
+        A_METHOD("sum", 0, 2, PackedArraySum)
+        A_METHOD("min", 0, 0, PackedArrayMin)
+        A_METHOD("max", 0, 0, PackedArrayMax)
+        A_METHOD("dot", 1, 3, PackedArrayDot)
+        A_METHOD("copy", 0, 2, PackedArrayCopy)
+        A_METHOD("toStr", 0, 1, PackedArrayToStr)
+    A_END_CLASS()
+
+    A_CLASS_PRIV_P(A_PRIVATE("PackedArrayIter"), 2, &IterNum)
+        A_IMPLEMENT("std::Iterator")
+        A_METHOD("create", 1, 0, PackedArrayIterCreate)
+        A_METHOD("hasNext", 0, 0, PackedArrayIterHasNext)
+        A_METHOD("next", 0, 0, PackedArrayIterNext)
+    A_END_CLASS()
+A_END_MODULE()
@@ -775,13 +775,16 @@ AToken *AParseAnonymousFunction(AToken *tok)
 
     /* Reserve space for exposed variables referenced in this anonymous
        function but defined in an outer function. The containers of these
-       variables will be copied to the frame of this anonymous function
-       before the actual function arguments. */
+       variables (or the values of variables captured by value) will be copied
+       to the frame of this anonymous function before the actual function
+       arguments. */
     for (i = 0; i < ANumAccessedExposedVariables; i++) {
         AIdType type;
         int n;
 
-        if (AAccessedExposedVariables[i].isConst)
+        if (AAccessedExposedVariables[i].isCaptured)
+            type = ID_LOCAL_CONST_CAPTURED;
+        else if (AAccessedExposedVariables[i].isConst)
             type = ID_LOCAL_CONST_EXPOSED;
         else
             type = ID_LOCAL_EXPOSED;
@@ -954,6 +957,17 @@ static AToken *ParseGetterOrSetterMethodHeader(AToken *tok, ABool isPrivate,
 static AToken *ParseFunctionArguments(AToken *tok, int *minArgs, int *maxArgs,
                                       ABool allowAnnotation, ABool isInterface)
 {
+    /* Since missing arguments are always trailing, a call that provides the
+       last optional argument provides all of them. If there are at least two
+       optional arguments, an extra check for the last one is compiled after
+       the default value code of the first one so that such calls can skip the
+       rest of the default value code. */
+    int numOptional = 0;
+    int fastEntryIndex = -1;
+    int lastOptional = 0;
+    int bodyIndex = 0;
+    ABool isFastEntryValid = TRUE;
+
     /* Skip any <...> after function name. */
     tok = AParseGenericAnnotation(tok);
 
@@ -980,6 +994,14 @@ static AToken *ParseFunctionArguments(AToken *tok, int *minArgs, int *maxArgs,
                     int branchIndex;
                     ABool isErr;
 
+                    if (numOptional == 1) {
+                        /* The target is filled in after the argument list. */
+                        fastEntryIndex = AGetCodeIndex();
+                        AEmitOpcode2Args(OP_IS_DEFAULT, 0, 0);
+                    }
+                    numOptional++;
+                    lastOptional = ANumLocalsActive;
+
                     branchIndex = AGetCodeIndex();
                     AEmitOpcode2Args(OP_IS_DEFAULT, ANumLocalsActive, 0);
 
@@ -989,6 +1011,7 @@ static AToken *ParseFunctionArguments(AToken *tok, int *minArgs, int *maxArgs,
                     AEmitArg(ANumLocalsActive);
 
                     ASetBranchDest(branchIndex, AGetCodeIndex());
+                    bodyIndex = AGetCodeIndex();
 
                     if (isErr)
                         goto ArgsDone;
@@ -1006,6 +1029,14 @@ static AToken *ParseFunctionArguments(AToken *tok, int *minArgs, int *maxArgs,
 
             type = PrepareLocalVariable(arg);
             AddLocalVariable(arg, type);
+
+            if (*minArgs != *maxArgs) {
+                /* The fast entry must not skip code that initializes exposed
+                   arguments. */
+                if (fastEntryIndex >= 0 && AGetCodeIndex() != bodyIndex)
+                    isFastEntryValid = FALSE;
+                bodyIndex = AGetCodeIndex();
+            }
         } else if (tok->type == TT_ASTERISK) {
             tok = AAdvanceTok(tok);
 
@@ -1027,6 +1058,15 @@ static AToken *ParseFunctionArguments(AToken *tok, int *minArgs, int *maxArgs,
         tok = AParseTypeAnnotationUntilSeparator(tok);
     } while (tok->type == TT_COMMA);
 
+    if (fastEntryIndex >= 0) {
+        if (isFastEntryValid) {
+            ASetOpcode(fastEntryIndex + 1, lastOptional);
+            ASetBranchDest(fastEntryIndex, bodyIndex);
+        } else
+            ASetBranchDest(fastEntryIndex, fastEntryIndex +
+                           AOpcodeSizes[OP_IS_DEFAULT]);
+    }
+
     if (tok->type != TT_RPAREN)
         tok = AGenerateParseError(tok);
     else {
@@ -2677,19 +2717,24 @@ static void CheckSuperInitializer(ATypeInfo *type)
 }
 
 
-/* Return the type of the local variable (ID_LOCAL or ID_LOCAL_EXPOSED). The
-   argument token is the name of variable. If the local variable is exposed,
-   also emit opcode for creating the exposed value container. */
+/* Return the type of the local variable (ID_LOCAL, ID_LOCAL_CAPTURED or
+   ID_LOCAL_EXPOSED). The argument token is the name of variable. If the local
+   variable is exposed, also emit opcode for creating the exposed value
+   container. */
 static AIdType PrepareLocalVariable(AToken *tok)
 {
-    /* Determine local variable type (ordinary or exposed). Exposed local
-       variables are accessed by anonymous functions. */
+    /* Determine local variable type (ordinary, captured or exposed). Captured
+       and exposed local variables are accessed by anonymous functions, but
+       captured variables are never assigned to after definition and can be
+       copied to the anonymous function by value. */
     if (tok->type == TT_ID_EXPOSED) {
         /* Create exposed variable containers for exposed local
            variables. */
         AEmitOpcodeArg(OP_CREATE_EXPOSED, ANumLocalsActive);
         return ID_LOCAL_EXPOSED;
-    } else
+    } else if (tok->type == TT_ID_CAPTURED)
+        return ID_LOCAL_CAPTURED;
+    else
         return ID_LOCAL;
 }
 
@@ -3119,6 +3164,8 @@ static void AddExposedVariable(ASymbol *sym)
     AAccessedExposedVariables[ANumAccessedExposedVariables].sym = sym;
     AAccessedExposedVariables[ANumAccessedExposedVariables].isConst =
         sym->info->type == ID_LOCAL_CONST_EXPOSED;
+    AAccessedExposedVariables[ANumAccessedExposedVariables].isCaptured =
+        !AIsExposedLocalId(sym->info->type);
     ANumAccessedExposedVariables++;
 }
 
@@ -3178,9 +3225,10 @@ static void CalculateExposedVariableMappingInAnonFunc(AToken *tok)
 
             sym = tok->info.sym->info;
 
-            /* Process all references to exposed local variables defined in an
-               outer scope (i.e. not within the target function). */
-            if (AIsExposedLocalId(sym->type)) {
+            /* Process all references to exposed or captured local variables
+               defined in an outer scope (i.e. not within the target
+               function). */
+            if (AIsCapturedLocalId(sym->type)) {
                 /* An identifier after :: or . and before :: does not refer to
                    a local variable. */
                 if (prev != TT_SCOPEOP && prev != TT_DOT
@@ -132,6 +132,7 @@ typedef struct AReturnList_ {
 typedef struct {
     ASymbol *sym;
     ABool isConst;
+    ABool isCaptured; /* Captured by value (no exposed variable container) */
 } AExposedInfo;
 
 
@@ -629,9 +629,10 @@ AToken *ParseSubExpression(AToken *tok, APrecedence prec, AExpression *result,
 
         if (AIsLocalId(sym->type) && (tok + 1)->type != TT_SCOPEOP) {
             left.num = sym->num;
-            if (sym->type == ID_LOCAL)
+            if (sym->type == ID_LOCAL || sym->type == ID_LOCAL_CAPTURED)
                 left.type = ET_LOCAL_LVALUE;
-            else if (sym->type == ID_LOCAL_CONST)
+            else if (sym->type == ID_LOCAL_CONST
+                     || sym->type == ID_LOCAL_CONST_CAPTURED)
                 left.type = ET_LOCAL;
             else if (sym->type == ID_LOCAL_EXPOSED)
                 left.type = ET_LOCAL_LVALUE_EXPOSED;
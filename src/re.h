@@ -93,6 +93,10 @@ AValue ACompileRegExp(AThread *t, AValue str, int flags);
    1 if matched. */
 int AMatchRegExp(AValue *reValue,  AValue *strValue, int len, int pos,
                  int matchFlags, AReRange *subExp, int maxNumSubExp);
+/* Search for a regular expression in a buffer of 8-bit characters that is not
+   moved by the garbage collector. */
+int AMatchRegExpBuffer(AValue *reValue, unsigned char *buf, int len, int pos,
+                       int matchFlags, AReRange *subExp, int maxNumSubExp);
 
 #ifdef A_DEBUG
 /* Display a compiled regular expression in human-readable form. */
@@ -510,7 +510,8 @@ static void ParseConcat(ParseInfo *info)
                 for (i = 0; i < 256; i++)
                     if (AIsInSet(set, i)) {
                         AAddToSet(set, ALower(i));
-                        AAddToSet(set, AUpper(i));
+                        if (AUpper(i) < 256)
+                            AAddToSet(set, AUpper(i));
                     }
             }
 
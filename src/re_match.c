@@ -40,7 +40,8 @@ typedef struct {
     StackEntry *stack;
     StackEntry *stackTop;
     StackEntry *stackBase;
-    AValue *strValue;
+    AValue *strValue; /* NULL if matching against buf */
+    unsigned char *buf;
     int strLen;
     void *strEnd;
     void *strBeg;
@@ -68,7 +69,10 @@ static AReOpcode EmptyOpcode = A_EMPTY;
 
 #define GetStrPointers(info) \
     do { \
-        if (AIsNarrowStr(*(info)->strValue)                                \
+        if ((info)->strValue == NULL) {                                    \
+            (info)->strBeg = (info)->buf;                                  \
+            (info)->strEnd = (info)->buf + (info)->strLen;                 \
+        } else if (AIsNarrowStr(*(info)->strValue)                         \
             || AIsNarrowSubStr(*(info)->strValue)) {                       \
             (info)->strBeg = ANarrowStrItems(*(info)->strValue);           \
             (info)->strEnd = (char *)(info)->strBeg + (info)->strLen;      \
@@ -79,10 +83,35 @@ static AReOpcode EmptyOpcode = A_EMPTY;
     } while (0)
 
 
+static int MatchRegExp(AValue *reValue, AValue *strValue, unsigned char *buf,
+                       int len, int pos, int matchFlags, AReRange *subExp,
+                       int maxNumSubExps);
+
+
 /* Match a regular expression against a string. Return 1 if matched, 0 if
    did not match and -1 if out of memory. */
 int AMatchRegExp(AValue *reValue, AValue *strValue, int len, int pos,
                 int matchFlags, AReRange *subExp, int maxNumSubExps)
+{
+    return MatchRegExp(reValue, strValue, NULL, len, pos, matchFlags, subExp,
+                       maxNumSubExps);
+}
+
+
+/* Match a regular expression against 8-bit characters in a buffer that is
+   not managed by the garbage collector. Otherwise equivalent to
+   AMatchRegExp. */
+int AMatchRegExpBuffer(AValue *reValue, unsigned char *buf, int len, int pos,
+                       int matchFlags, AReRange *subExp, int maxNumSubExps)
+{
+    return MatchRegExp(reValue, NULL, buf, len, pos, matchFlags, subExp,
+                       maxNumSubExps);
+}
+
+
+static int MatchRegExp(AValue *reValue, AValue *strValue, unsigned char *buf,
+                       int len, int pos, int matchFlags, AReRange *subExp,
+                       int maxNumSubExps)
 {
     MatchInfo info;
     int subExpBeg[DEFAULT_NUM_SUBEXPS];
@@ -127,6 +156,7 @@ int AMatchRegExp(AValue *reValue, AValue *strValue, int len, int pos,
 
     info.ip = APtrAdd(AValueToPtr(re->code), sizeof(AValue));
     info.strValue = strValue;
+    info.buf = buf;
     info.strLen = len;
 
     info.stackBase = stack;
@@ -165,7 +195,8 @@ int AMatchRegExp(AValue *reValue, AValue *strValue, int len, int pos,
     } else
 #endif
 
-    isNarrow = AIsNarrowStr(*strValue) || AIsNarrowSubStr(*strValue);
+    isNarrow = strValue == NULL || AIsNarrowStr(*strValue)
+        || AIsNarrowSubStr(*strValue);
 
     if (isNarrow) {
         unsigned char *str = (unsigned char *)info.strBeg + pos;
@@ -8,16 +8,25 @@
 
 #include "alore.h"
 #include "re.h"
+#include "io_module.h"
 #include "debug_params.h"
 
 
+/* Maximum number of characters of an io::MappedFile object that are examined
+   by a single call to the regular expression matcher. Larger mappings are
+   searched in overlapping windows of this size. */
+#define MAX_MAPPED_WINDOW (1 << 30)
+
+
 /* The re module implementation is divided between modules re (implemented in
    Alore) and __re (this module). */
 
 
 static AValue BuildMatchObject(AThread *t, AValue *frame, int numGroups,
-                              AReRange *subExp);
-static ABool GetArguments(AThread *t, AValue *frame, int *pos);
+                              AReRange *subExp, AInt64 offset);
+static ABool GetArguments(AThread *t, AValue *frame, AInt64 *pos);
+static AValue MatchMapped(AThread *t, AValue *frame, AInt64 pos,
+                          int matchFlags);
 
 
 /* Global nums of definitions */
@@ -58,16 +67,23 @@ static AValue ReMatch(AThread *t, AValue *frame)
     ARegExp *re;
     AReRange subExp[11];
     int status;
-    int pos;
+    AInt64 pos;
 
     if (!GetArguments(t, frame, &pos))
         return AError;
 
+    if (!AIsStr(frame[1]))
+        return MatchMapped(t, frame, pos, A_RE_NOSEARCH);
+
+    /* A position beyond the end of the string can never match. */
+    if (pos > AStrLen(frame[1]))
+        return ANil;
+
     status = AMatchRegExp(frame + 2, frame + 1, AStrLen(frame[1]), pos,
                           A_RE_NOSEARCH, subExp, 10);
     if (status > 0) {
         re = AValueToPtr(frame[2]);
-        return BuildMatchObject(t, frame, re->numGroups, subExp);
+        return BuildMatchObject(t, frame, re->numGroups, subExp, 0);
     } else if (status == 0)
         return ANil;
     else
@@ -82,16 +98,23 @@ static AValue ReSearch(AThread *t, AValue *frame)
     ARegExp *re;
     AReRange subExp[11];
     int status;
-    int pos;
+    AInt64 pos;
 
     if (!GetArguments(t, frame, &pos))
         return AError;
 
+    if (!AIsStr(frame[1]))
+        return MatchMapped(t, frame, pos, 0);
+
+    /* A position beyond the end of the string can never match. */
+    if (pos > AStrLen(frame[1]))
+        return ANil;
+
     status = AMatchRegExp(frame + 2, frame + 1, AStrLen(frame[1]), pos, 0,
                          subExp, 10);
     if (status > 0) {
         re = AValueToPtr(frame[2]);
-        return BuildMatchObject(t, frame, re->numGroups, subExp);
+        return BuildMatchObject(t, frame, re->numGroups, subExp, 0);
     } else if (status == 0)
         return ANil;
     else
@@ -99,13 +122,72 @@ static AValue ReSearch(AThread *t, AValue *frame)
 }
 
 
+/* Match or search a regular expression in an io::MappedFile object frame[1]
+   starting at pos. The compiled expression is in frame[2]. The contents of the
+   mapping are matched directly without creating strings. */
+static AValue MatchMapped(AThread *t, AValue *frame, AInt64 pos,
+                          int matchFlags)
+{
+    AReRange subExp[11];
+    unsigned char *data;
+    AInt64 len;
+    AInt64 winStart;
+    int status;
+
+    if (AGetMappedFileContents(t, frame[1], &data, &len) < 0)
+        return AError;
+
+    if (pos > len)
+        return ANil;
+
+    /* Usually the whole mapping fits in a single window. Otherwise the
+       window starts at pos, and following windows overlap the previous
+       window by half. A match longer than half a window may not be found. */
+    winStart = len <= MAX_MAPPED_WINDOW ? 0 : pos;
+    for (;;) {
+        AInt64 winLen = len - winStart;
+        int flags = matchFlags;
+
+        if (winLen > MAX_MAPPED_WINDOW) {
+            winLen = MAX_MAPPED_WINDOW;
+            flags |= A_RE_NOEOL;
+        }
+        if (winStart > 0)
+            flags |= A_RE_NOBOL;
+
+        status = AMatchRegExpBuffer(frame + 2, data + winStart, winLen,
+                                    pos - winStart, flags, subExp, 10);
+        if (status > 0) {
+            ARegExp *re = AValueToPtr(frame[2]);
+            return BuildMatchObject(t, frame, re->numGroups, subExp,
+                                    winStart);
+        } else if (status < 0)
+            return ARaiseMemoryErrorND(t);
+
+        if ((matchFlags & A_RE_NOSEARCH) || winStart + winLen == len)
+            return ANil;
+
+        winStart += MAX_MAPPED_WINDOW / 2;
+        pos = winStart;
+
+        if (ACheckInterrupt(t))
+            return AError;
+    }
+}
+
+
 /* Process the arguments to ReMatch or ReSearch. */
-static ABool GetArguments(AThread *t, AValue *frame, int *pos)
+static ABool GetArguments(AThread *t, AValue *frame, AInt64 *pos)
 {
-    AExpectStr(t, frame[1]);
+    unsigned char *data;
+    AInt64 len;
+
+    if (!AIsStr(frame[1])
+        && AGetMappedFileContents(t, frame[1], &data, &len) == 0)
+        AExpectStr(t, frame[1]);
 
     if (!AIsDefault(frame[2])) {
-        *pos = AGetInt(t, frame[2]);
+        *pos = AGetInt64(t, frame[2]);
         if (*pos < 0) {
             ARaiseValueError(t, "Invalid position");
             return FALSE;
@@ -146,8 +228,12 @@ static AValue MatchResultGroup(AThread *t, AValue *frame)
 
     if (i1 < 0)
         return ANil;
-    else
+    else if (AIsStr(AMemberDirect(frame[0], 1)))
         return ASubStr(t, AMemberDirect(frame[0], 1), i1, i2);
+    else
+        return AMappedFileSubStr(t, AMemberDirect(frame[0], 1),
+                                 AGetInt64(t, AArrayItem(a, 2 * ind)),
+                                 AGetInt64(t, AArrayItem(a, 2 * ind + 1)));
 }
 
 
@@ -207,9 +293,9 @@ static AValue MatchResultSpan(AThread *t, AValue *frame)
 /* Build a MatchResult object from match results.
    Frame points to the frame of ReMatch or ReSearch. The subExp argument
    should have numGroups items that specify the ranges matched by different
-   subexpressions. */
+   subexpressions. Offset is added to all the ranges. */
 static AValue BuildMatchObject(AThread *t, AValue *frame,
-                              int numGroups, AReRange *subExp)
+                              int numGroups, AReRange *subExp, AInt64 offset)
 {
     AValue match;
     int i;
@@ -220,8 +306,14 @@ static AValue BuildMatchObject(AThread *t, AValue *frame,
         int beg = subExp[i].beg;
         int end = subExp[i].end;
 
-        ASetArrayItem(t, frame[3], 2 * i, AIntToValue(beg));
-        ASetArrayItem(t, frame[3], 2 * i + 1, AIntToValue(end));
+        if (offset == 0 || beg < 0) {
+            ASetArrayItem(t, frame[3], 2 * i, AIntToValue(beg));
+            ASetArrayItem(t, frame[3], 2 * i + 1, AIntToValue(end));
+        } else {
+            ASetArrayItem(t, frame[3], 2 * i, AMakeInt64(t, beg + offset));
+            ASetArrayItem(t, frame[3], 2 * i + 1,
+                          AMakeInt64(t, end + offset));
+        }
     }
 
     /* Create the MatchResult object. */
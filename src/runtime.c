@@ -54,41 +54,15 @@ AValue AWrapObject(AThread *t, AValue obj)
     if (AIsInstance(obj))
         return obj;
 
+    /* Determine the corresponding wrapper class. */
+    type = AWrapperType(obj);
+    if (type == NULL)
+        return ARaiseMemberErrorND(t, obj, -1);
+
     *t->tempStack = obj;
     instance = AAlloc(t, 2 * sizeof(AValue));
     if (instance == NULL)
         return AError;
-    obj = *t->tempStack;
-
-    /* Determine the corresponding wrapper class. */
-    /* IDEA: Use InternalType instead. */
-    if (AIsStr(obj))
-        type = AStrClass;
-    else if (AIsShortInt(obj) || AIsLongInt(obj))
-        type = AIntClass;
-    else if (AIsFloat(obj))
-        type = AFloatClass;
-    else if (AIsRange(obj))
-        type = ARangeClass;
-    else if (AIsPair(obj))
-        type = APairClass;
-    else if (AIsConstant(obj))
-        type = AConstantClass;
-    else if (AIsGlobalFunction(obj)) {
-        /* obj can be a function or a primitive type object. */
-        ASymbolInfo *sym = AValueToFunction(obj)->sym;
-        if (AInternalTypeSymbol(sym) != sym)
-            type = ATypeClass;
-        else
-            type = AFunctionClass;
-    } else if (AIsMethod(obj))
-        type = AFunctionClass;
-    else if (AIsNonSpecialType(obj))
-        type = ATypeClass;
-    else {
-        *t->tempStack = AZero;
-        return ARaiseMemberErrorND(t, obj, -1);
-    }
 
     /* Initialize the wrapper object. */
     AInitInstanceBlock(&instance->type, type);
@@ -99,9 +73,11 @@ AValue AWrapObject(AThread *t, AValue obj)
 }
 
 
-/* Return the internal wrapper type corresponding to an object. Assume that the
-   object is not an instance. */
-static ATypeInfo *InternalType(AValue obj)
+/* Return the wrapper class corresponding to a non-instance object, or NULL if
+   there is no such class. Never allocate memory. Method calls use this to
+   find the methods of primitive objects without creating wrapper
+   instances. */
+ATypeInfo *AWrapperType(AValue obj)
 {
     if (AIsStr(obj))
         return AStrClass;
@@ -126,29 +102,39 @@ static ATypeInfo *InternalType(AValue obj)
         return AFunctionClass;
     else if (AIsNonSpecialType(obj))
         return ATypeClass;
-    else {
-        AEpicInternalFailure("InternalType called with invalid object");
+    else
         return NULL;
-    }
+}
+
+
+/* Return the internal wrapper type corresponding to an object. Assume that the
+   object is not an instance. */
+static ATypeInfo *InternalType(AValue obj)
+{
+    ATypeInfo *type = AWrapperType(obj);
+    if (type == NULL)
+        AEpicInternalFailure("InternalType called with invalid object");
+    return type;
 }
 
 
 /* Read the member of an object via a member id. */
 AValue AMemberByNum(AThread *t, AValue val, int member)
 {
-    AInstance *inst;
     ATypeInfo *type;
     AMemberHashTable *table;
     AMemberNode *node;
 
-    if (!AIsInstance(val)) {
-        val = AWrapObject(t, val);
-        if (AIsError(val))
-            return AError;
+    /* Values with special object representations are only wrapped if the
+       member is not a getter method. */
+    if (AIsInstance(val))
+        type = AGetInstanceType(AValueToInstance(val));
+    else {
+        type = AWrapperType(val);
+        if (type == NULL)
+            return ARaiseMemberErrorND(t, val, -1);
     }
 
-    inst = AValueToInstance(val);
-    type = AGetInstanceType(inst);
     table = AGetMemberTable(type, MT_VAR_GET_PUBLIC);
 
     node = &table->item[member & table->size];
@@ -156,9 +142,13 @@ AValue AMemberByNum(AThread *t, AValue val, int member)
     /* Search the get hash table. */
     while (node->key != member) {
         if (node->next == NULL) {
-            if (type->super == NULL)
-                return AGetInstanceCodeMember(t, inst, member);
-            else {
+            if (type->super == NULL) {
+                val = AWrapObject(t, val);
+                if (AIsError(val))
+                    return AError;
+                return AGetInstanceCodeMember(t, AValueToInstance(val),
+                                              member);
+            } else {
                 type = type->super;
                 table = AGetMemberTable(type, MT_VAR_GET_PUBLIC);
                 node = &table->item[member & table->size];
@@ -167,9 +157,12 @@ AValue AMemberByNum(AThread *t, AValue val, int member)
             node = node->next;
     }
 
-    if (node->item < A_VAR_METHOD)
-        return inst->member[node->item];
-    else {
+    if (node->item < A_VAR_METHOD) {
+        val = AWrapObject(t, val);
+        if (AIsError(val))
+            return AError;
+        return AValueToInstance(val)->member[node->item];
+    } else {
         AValue funcVal;
         AValue ret;
 
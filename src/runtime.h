@@ -68,6 +68,32 @@ extern const AOpcode AArgInd[A_ARG_IND_LENGTH];
     APtrSub((sp), (frameSizeValue))
 
 
+/* Return the size of the stack frame of func when called with argc
+   arguments (argc and maxArgs exclude self for methods). Functions flagged
+   with A_FUNC_VAR_ARG_SLICE get room for their extra arguments at the end of
+   the frame, unless the caller passes an Array or a Tuple using *. */
+#define ACallFrameSize(func, argc, maxArgs) \
+    (((func)->flags & A_FUNC_VAR_ARG_SLICE) && !((argc) & A_VAR_ARG_FLAG) \
+     && (argc) > (((maxArgs) - 1) & ~A_VAR_ARG_FLAG) \
+     ? (func)->stackFrameSize \
+       + ((argc) - (((maxArgs) - 1) & ~A_VAR_ARG_FLAG)) * sizeof(AValue) \
+     : (func)->stackFrameSize)
+
+/* Varargs of a function flagged with A_FUNC_VAR_ARG_SLICE are either an
+   Array/Tuple or a short Int n, in which case the arguments are the n last
+   items of the active stack frame. These macros are only valid in the body of
+   the C function that received the arguments (or functions that it calls
+   directly with the same frame). */
+#define AVarArgLen(t, args) \
+    (AIsShortInt(args) ? AValueToInt(args) : AArrayOrTupleLen(args))
+#define AVarArgItem(t, args, i) \
+    (AIsShortInt(args) ? AVarArgSlice(t, args)[i] : \
+     AArrayOrTupleItem(args, i))
+#define AVarArgSlice(t, args) \
+    ((AValue *)ANextFrame((t)->stackPtr, (t)->stackPtr[0]) - \
+     AValueToInt(args))
+
+
 int AGetExceptionHandler(AThread *t, AFunction *func, int codeInd);
 
 AValue ACreateBasicExceptionInstance(AThread *t, int num, const char *message);
@@ -115,6 +141,7 @@ AValue AIsIn(AThread *t, AValue left, AValue right);
 AValue AGetTypeObject(AThread *t, AValue object);
 
 AValue AWrapObject(AThread *thread, AValue obj);
+ATypeInfo *AWrapperType(AValue obj);
 
 
 AValue AGetInstanceCodeMember(AThread *t, AInstance *inst,
@@ -54,6 +54,11 @@ static AUnresolvedNameList *Imports;
 static AToken **VariableDefTokens;
 static int VariableDefTokensSize;
 
+/* Flags parallel to VariableDefTokens that record whether a local variable is
+   (potentially) assigned to after its definition. Only variables that are
+   never assigned to can be captured by value by anonymous functions. */
+static char *VariableIsAssigned;
+
 /* Block depths of nested functions, used to keep track of which "end" ends a
    particular nested function */
 static int FunDepthBlockDepth[A_MAX_ANON_SUB_DEPTH + 1];
@@ -83,6 +88,7 @@ ABool AScan(AModuleId *module, AToken *tok)
 
     VariableDefTokens = NULL;
     VariableDefTokensSize = 0;
+    VariableIsAssigned = NULL;
 
     /* Find all global definitions. Don't care about errors. */
     while (tok->type != TT_EOF) {
@@ -172,6 +178,7 @@ ABool AScan(AModuleId *module, AToken *tok)
 
     AFreeUnresolvedNameList(Imports);
     AFreeStatic(VariableDefTokens);
+    AFreeStatic(VariableIsAssigned);
 
     ADebugVerifyMemory();
     ADebugCompilerMsg(("End scan"));
@@ -981,6 +988,7 @@ static void AddPotentiallyExposedLocalVariable(AToken *tok)
        memory. */
     while (ANumLocalsActive >= VariableDefTokensSize) {
         AToken **toks;
+        char *assigned;
         int newSize;
 
         newSize = AMax(MIN_VARIABLE_DEF_TOKENS_SIZE,
@@ -990,15 +998,23 @@ static void AddPotentiallyExposedLocalVariable(AToken *tok)
             /* Do nothing if ran out of memory. */
             AGenerateOutOfMemoryError();
             return;
-        } else {
-            VariableDefTokens = toks;
-            VariableDefTokensSize = newSize;
         }
+        VariableDefTokens = toks;
+
+        assigned = AGrowStatic(VariableIsAssigned, newSize);
+        if (assigned == NULL) {
+            AGenerateOutOfMemoryError();
+            return;
+        }
+        VariableIsAssigned = assigned;
+
+        VariableDefTokensSize = newSize;
     }
 
     AAddLocalVariableSymbol(tok->info.sym, ID_LOCAL, ANumLocalsActive);
 
     VariableDefTokens[ANumLocalsActive] = tok;
+    VariableIsAssigned[ANumLocalsActive] = FALSE;
     ANumLocalsActive++;
 }
 
@@ -1064,11 +1080,71 @@ static void AddFunctionArgumentVariables(AToken *tok)
     ((sym)->info.blockDepth < FunDepthBlockDepth[AFunDepth])
 
 
+/* Record that the local variable with the given number is accessed within an
+   anonymous function. A variable that is never assigned to after its
+   definition is captured by value (TT_ID_CAPTURED); otherwise it must be
+   stored in an exposed variable container (TT_ID_EXPOSED) so that all the
+   functions see the same value. */
+static void MarkCapturedVariable(int num)
+{
+    AToken *def = VariableDefTokens[num];
+
+    if (VariableIsAssigned[num])
+        def->type = TT_ID_EXPOSED;
+    else if (def->type != TT_ID_EXPOSED)
+        def->type = TT_ID_CAPTURED;
+}
+
+
+/* Record that the local variables starting from the given number may be
+   assigned to. For loop and except variables get a new value each time the
+   statement is executed, and anonymous functions must see the current
+   value. */
+static void MarkAssignedLocals(int first)
+{
+    int i;
+
+    for (i = first; i < ANumLocalsActive && i < VariableDefTokensSize; i++)
+        VariableIsAssigned[i] = TRUE;
+}
+
+
+/* Record that all the local variables that appear in the statement starting
+   at tok before the assignment token assign may be assigned to. This is
+   conservative: for example, in "a[i] = x" the variable i is treated as
+   assigned to, but this only causes i to be stored in an exposed variable
+   container if it is accessed in an anonymous function. */
+static void MarkAssignedVariables(AToken *tok, AToken *assign)
+{
+    ATokenType prev = TT_NEWLINE;
+
+    for (; tok != assign; tok = AAdvanceTok(tok)) {
+        if (tok->type == TT_ID) {
+            ASymbolInfo *sym = tok->info.sym->info;
+            ATokenType next = AAdvanceTok(tok)->type;
+
+            /* Ignore member and global references, and variables that
+               are only used as the base of an indexing or a member access
+               lvalue. */
+            if (AIsLocalId(sym->type) && prev != TT_SCOPEOP && prev != TT_DOT
+                && next != TT_SCOPEOP && next != TT_DOT
+                && next != TT_LBRACKET) {
+                VariableIsAssigned[sym->num] = TRUE;
+                if (VariableDefTokens[sym->num]->type == TT_ID_CAPTURED)
+                    VariableDefTokens[sym->num]->type = TT_ID_EXPOSED;
+            }
+        }
+        prev = tok->type;
+    }
+}
+
+
 /* Mark all variable name tokens in variable definitions within a block or
    non-anonymous function definition (including any anonymous functions that
    might be included in the function) that refer to an exposed variable (the
-   token type will be changed to TT_ID_EXPOSED). The tok argument should point
-   to the start of a function or method definition.
+   token type will be changed to TT_ID_EXPOSED, or to TT_ID_CAPTURED if the
+   variable is never assigned to after its definition). The tok argument
+   should point to the start of a function or method definition.
 
    The results might not be correct if there are errors in the block, but
    these errors will not cause problems since in that case the code will never
@@ -1076,6 +1152,8 @@ static void AddFunctionArgumentVariables(AToken *tok)
 static void ScanExposedVariableDefinitions(AToken *tok)
 {
     ATokenType prev;
+    AToken *stmt;
+    int first;
 
     ABlockDepth = 1;
 
@@ -1110,13 +1188,18 @@ static void ScanExposedVariableDefinitions(AToken *tok)
 
         case TT_EXCEPT:
             tok = AAdvanceTok(tok);
-            if (tok->type == TT_ID && (tok + 1)->type == TT_IS)
+            if (tok->type == TT_ID && (tok + 1)->type == TT_IS) {
+                first = ANumLocalsActive;
                 AddPotentiallyExposedLocalVariable(tok);
+                MarkAssignedLocals(first);
+            }
             break;
 
         case TT_FOR:
             ABlockDepth++;
+            first = ANumLocalsActive;
             tok = AddVariableList(AAdvanceTok(tok));
+            MarkAssignedLocals(first);
             break;
 
         case TT_IF:
@@ -1145,8 +1228,21 @@ static void ScanExposedVariableDefinitions(AToken *tok)
         /* Now loop over token untils we reach a newline. Process any
            identifiers and anonymous functions that we meet. */
 
+        stmt = tok;
+
         while (tok->type != TT_NEWLINE) {
             switch (tok->type) {
+            case TT_ASSIGN:
+            case TT_ASSIGN_ADD:
+            case TT_ASSIGN_SUB:
+            case TT_ASSIGN_MUL:
+            case TT_ASSIGN_DIV:
+            case TT_ASSIGN_POW:
+                /* Assignment (or a default argument value, which is
+                   harmless) */
+                MarkAssignedVariables(stmt, tok);
+                break;
+
             case TT_SUB:
             case TT_DEF:
                 /* Anonymous function */
@@ -1178,8 +1274,8 @@ static void ScanExposedVariableDefinitions(AToken *tok)
                     if (prev != TT_SCOPEOP && prev != TT_DOT
                         && AAdvanceTok(tok)->type != TT_SCOPEOP) {
                         /* Mark the original token at variable definition
-                           exposed. */
-                        VariableDefTokens[sym->num]->type = TT_ID_EXPOSED;
+                           exposed or captured. */
+                        MarkCapturedVariable(sym->num);
                     }
                 }
 
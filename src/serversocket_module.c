@@ -20,12 +20,14 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <unistd.h>
+#include <fcntl.h>
 #else
 #include <winsock.h>
 #endif
 
 #include "alore.h"
 #include "thread_athread.h"
+#include "thread_fiber.h"
 #include "runtime.h"
 #include "io_module.h"
 
@@ -43,6 +45,7 @@
 
 
 static AValue RaiseSocketError(AThread *t);
+static ABool SetBlocking(AThread *t, int handle, ABool blocking);
 
 
 #ifdef A_HAVE_WINDOWS
@@ -155,6 +158,11 @@ static AValue ServerSocketAccept(AThread *t, AValue *frame)
 
     /* Wait for an incoming connection. */
     for (;;) {
+        /* A fiber waits until there is a pending connection so that it does
+           not block the other fibers. */
+        if (AIsFiber(t))
+            AFiberWaitForIo(t, handle, A_FIBER_READABLE);
+
         AAllowBlocking();
         conn = accept(handle, (struct sockaddr *)&address, &len);
         AEndBlocking();
@@ -183,8 +191,17 @@ static AValue ServerSocketAccept(AThread *t, AValue *frame)
         break;
     }
 
-    if (conn < 0)
+    if (conn < 0) {
+#ifndef A_HAVE_WINDOWS
+        /* No pending connections in non-blocking mode */
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return ANil;
+#else
+        if (WSAGetLastError() == WSAEWOULDBLOCK)
+            return ANil;
+#endif
         return RaiseSocketError(t);
+    }
 
     /* Construct a Socket object for the new connection. */
     frame[5] = frame[1];
@@ -218,6 +235,32 @@ static AValue ServerSocketClose(AThread *t, AValue *frame)
 }
 
 
+/* ServerSocket setBlocking(flag)
+   Set the socket to blocking (flag is True) or non-blocking mode. In
+   non-blocking mode, accept returns nil if there are no pending
+   connections. */
+static AValue ServerSocketSetBlocking(AThread *t, AValue *frame)
+{
+    int handle = AGetInt(t, AMemberDirect(frame[0], HANDLE));
+
+    if (frame[1] != ATrue && frame[1] != AFalse)
+        return ARaiseTypeError(t, AMsgBooleanExpectedBut, frame[1]);
+    if (handle < 0)
+        return ARaiseIoError(t, "Socket is closed");
+    if (!SetBlocking(t, handle, frame[1] == ATrue))
+        return AError;
+
+    return ANil;
+}
+
+
+/* ServerSocket __handle() */
+static AValue ServerSocket__Handle(AThread *t, AValue *frame)
+{
+    return AMemberDirect(frame[0], HANDLE);
+}
+
+
 static AValue ServerSocketInitialize(AThread *t, AValue *frame)
 {
     AValue handle = AMakeInt(t, -1);
@@ -236,6 +279,35 @@ static AValue RaiseSocketError(AThread *t)
 }
 
 
+/* Set a socket to blocking or non-blocking mode. Return FALSE and raise an
+   exception on error. */
+static ABool SetBlocking(AThread *t, int handle, ABool blocking)
+{
+#ifndef A_HAVE_WINDOWS
+    int flags = fcntl(handle, F_GETFL, 0);
+    if (flags < 0) {
+        RaiseSocketError(t);
+        return FALSE;
+    }
+    if (blocking)
+        flags &= ~O_NONBLOCK;
+    else
+        flags |= O_NONBLOCK;
+    if (fcntl(handle, F_SETFL, flags) < 0) {
+        RaiseSocketError(t);
+        return FALSE;
+    }
+#else
+    u_long nonBlocking = !blocking;
+    if (ioctlsocket(handle, FIONBIO, &nonBlocking) == SOCKET_ERROR) {
+        RaiseSocketError(t);
+        return FALSE;
+    }
+#endif
+    return TRUE;
+}
+
+
 A_MODULE(serversocket, "serversocket")
     A_IMPORT("io")
     A_IMPORT("socket")
@@ -244,6 +316,8 @@ A_MODULE(serversocket, "serversocket")
         A_METHOD_OPT("create", 1, 2, 0, ServerSocketCreate)
         A_METHOD_OPT("accept", 0, 1, 4, ServerSocketAccept)
         A_METHOD("close", 0, 0, ServerSocketClose)
+        A_METHOD("setBlocking", 1, 0, ServerSocketSetBlocking)
+        A_METHOD("__handle", 0, 0, ServerSocket__Handle)
         A_METHOD("#i", 0, 0, ServerSocketInitialize)
     A_END_CLASS()
 A_END_MODULE()
@@ -17,15 +17,19 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
 #else
 #include <winsock.h>
 #endif
 
 #include "alore.h"
 #include "thread_athread.h"
+#include "thread_fiber.h"
 #include "io_module.h"
 #include "athread.h"
 #include "runtime.h"
+#include "memberid.h"
 
 
 #define MAX_ADDRESS_LEN 1024
@@ -50,11 +54,16 @@ static int GetHErrno(void);
 static AValue RaiseGetHostByNameException(AThread *t, int code);
 static ABool GetHostByName(AThread *t, const char *host,
                            struct in_addr *address);
+static ABool SetBlocking(AThread *t, int handle, ABool blocking);
+#ifndef A_HAVE_WINDOWS
+static int FiberConnect(AThread *t, int handle, struct sockaddr_in *address);
+#endif
 
 
 /* Global nums of definitions */
 static int NameErrorNum;
 static int SocketDeinitNum;
+static int SocketClassNum;
 
 
 /* Mutex for guarding calls to gethostbyname etc. */
@@ -81,13 +90,14 @@ static int inet_pton(int af, const char *src, void *dst)
 #endif
 
 
-/* Socket create(destination, port[, buffering]) */
+/* Socket create(destination, port[, buffering[, bufferSize]]) */
 static AValue SocketCreate(AThread *t, AValue *frame)
 {
     char addressStr[MAX_ADDRESS_LEN];
     int handle;
     struct sockaddr_in address;
     int port;
+    int bufSize;
 
     /* Get host name. */
     AGetStr(t, frame[1], addressStr, MAX_ADDRESS_LEN);
@@ -105,6 +115,15 @@ static AValue SocketCreate(AThread *t, AValue *frame)
     else
         return ARaiseValueError(t, "Invalid arguments");
 
+    /* Get buffer size. */
+    if (AIsDefault(frame[4]) || AIsNil(frame[4]))
+        bufSize = 0;
+    else {
+        bufSize = AGetInt(t, frame[4]);
+        if (bufSize <= 0 || bufSize > A_MAX_READ_SIZE)
+            return ARaiseValueError(t, "Invalid buffer size");
+    }
+
     frame[2] = AGlobalByNum(AInputNum);
     frame[3] = AGlobalByNum(AOutputNum);
     frame[4] = AGlobalByNum(ANarrowNum);
@@ -112,6 +131,9 @@ static AValue SocketCreate(AThread *t, AValue *frame)
     if (AIsError(AStreamCreate(t, frame)))
         return AError;
 
+    AValueToInstance(frame[0])->member[A_STREAM_BUF_SIZE] =
+        AIntToValue(bufSize);
+
     /* Initialize address structure. */
     memset(&address, 0, sizeof(address));
     address.sin_family = AF_INET;
@@ -130,10 +152,17 @@ static AValue SocketCreate(AThread *t, AValue *frame)
     for (;;) {
         int status;
 
-        AAllowBlocking();
-        status = connect(handle, (struct sockaddr *)&address,
-                         sizeof(address));
-        AEndBlocking();
+#ifndef A_HAVE_WINDOWS
+        if (AIsFiber(t))
+            status = FiberConnect(t, handle, &address);
+        else
+#endif
+        {
+            AAllowBlocking();
+            status = connect(handle, (struct sockaddr *)&address,
+                             sizeof(address));
+            AEndBlocking();
+        }
 
         if (status < 0) {
             if (errno == EINTR) {
@@ -188,6 +217,120 @@ static AValue SocketClose(AThread *t, AValue *frame)
 }
 
 
+/* Socket setBlocking(flag)
+   Set the socket to blocking (flag is True) or non-blocking mode. In
+   non-blocking mode, operations that would block raise IoError. */
+static AValue SocketSetBlocking(AThread *t, AValue *frame)
+{
+    int handle = AGetInt(t, AMemberDirect(frame[0], A_FILE_ID));
+
+    if (frame[1] != ATrue && frame[1] != AFalse)
+        return ARaiseTypeError(t, AMsgBooleanExpectedBut, frame[1]);
+    if (handle < 0)
+        return ARaiseIoError(t, "Socket is closed");
+    if (!SetBlocking(t, handle, frame[1] == ATrue))
+        return AError;
+
+    return ANil;
+}
+
+
+/* Socket sendFile(file[, offset[, count]])
+   Send the contents of a File object through the socket. If offset is not
+   given (or is nil), send data starting from the current position of the
+   file and move the position past the sent data. Otherwise send data
+   starting at offset and leave the position unchanged. Send at most count
+   bytes (or until the end of the file if count is omitted). Return the
+   number of bytes sent. */
+static AValue SocketSendFile(AThread *t, AValue *frame)
+{
+    AInt64 offset;
+    AInt64 count;
+    AInt64 sent;
+    int handle;
+
+    if (AIsOfType(frame[1], AGlobalByNum(AFileClassNum)) != A_IS_TRUE)
+        return ARaiseTypeError(t, "File expected (%T found)", frame[1]);
+
+    count = -1;
+    if (!AIsDefault(frame[3]) && !AIsNil(frame[3])) {
+        count = AGetInt64(t, frame[3]);
+        if (count < 0)
+            return ARaiseValueError(t, "Negative count");
+    }
+
+    if (AIsDefault(frame[2]) || AIsNil(frame[2])) {
+        /* Send data from the current file position. copyTo does this and
+           also takes care of data buffered in the file object. */
+        frame[4] = frame[1];
+        frame[5] = frame[0];
+        frame[6] = count < 0 ? ANil : frame[3];
+        return ACallMethod(t, "copyTo", 2, frame + 4);
+    }
+
+    offset = AGetInt64(t, frame[2]);
+    if (offset < 0)
+        return ARaiseValueError(t, "Negative offset");
+
+    handle = AGetInt(t, AMemberDirect(frame[0], A_FILE_ID));
+    if (handle < 0)
+        return ARaiseIoError(t, "Socket is closed");
+
+    /* Data written earlier must be sent first. */
+    if (AIsError(ACallMethodByNum(t, AM_FLUSH, 0, frame)))
+        return AError;
+
+#ifndef A_HAVE_WINDOWS
+    {
+        int fileHandle;
+
+        if (AMemberDirect(frame[1], A_STREAM_MODE) == AZero)
+            return ARaiseIoError(t, "File is closed");
+        fileHandle = AGetInt(t, AMemberDirect(frame[1], A_FILE_ID));
+
+        sent = ACopyFileDescriptor(t, handle, fileHandle, offset, count);
+        if (sent < 0)
+            return AError;
+    }
+#else
+    {
+        /* Seek to offset, copy and restore the original position. */
+        frame[4] = frame[1];
+        frame[7] = ACallMethod(t, "pos", 0, frame + 4);
+        if (AIsError(frame[7]))
+            return AError;
+
+        frame[4] = frame[1];
+        frame[5] = AMakeInt64(t, offset);
+        if (AIsError(ACallMethod(t, "seek", 1, frame + 4)))
+            return AError;
+
+        frame[4] = frame[1];
+        frame[5] = frame[0];
+        frame[6] = count < 0 ? ANil : frame[3];
+        frame[6] = ACallMethod(t, "copyTo", 2, frame + 4);
+        if (AIsError(frame[6]))
+            return AError;
+        sent = AGetInt64(t, frame[6]);
+
+        frame[4] = frame[1];
+        frame[5] = frame[7];
+        if (AIsError(ACallMethod(t, "seek", 1, frame + 4)))
+            return AError;
+    }
+#endif
+
+    return AMakeInt64(t, sent);
+}
+
+
+/* Socket __handle() */
+static AValue Socket__Handle(AThread *t, AValue *frame)
+{
+    return AMemberDirect(frame[0], A_FILE_ID);
+}
+
+
 /* Initialize the state of a socket instance (#i method). */
 static AValue SocketInitialize(AThread *t, AValue *frame)
 {
@@ -209,6 +352,9 @@ static AValue SocketMain(AThread *t, AValue *frame)
     if (athread_mutex_init(&GetHostByNameLock, NULL) < 0)
         return ARaiseMemoryError(t);
 
+    /* Sockets can be the target of zero-copy Stream copyTo operations. */
+    ARegisterFileDescriptorStream(SocketClassNum);
+
     /* Call SocketDeinit when shutting down. */
     frame[0] = AGlobalByNum(SocketDeinitNum);
     return AAddExitHandler(t, frame);
@@ -464,6 +610,81 @@ static ABool GetHostByName(AThread *t, const char *hostStr,
 }
 
 
+/* Set a socket to blocking or non-blocking mode. Return FALSE and raise an
+   exception on error. */
+static ABool SetBlocking(AThread *t, int handle, ABool blocking)
+{
+#ifndef A_HAVE_WINDOWS
+    int flags = fcntl(handle, F_GETFL, 0);
+    if (flags < 0) {
+        RaiseSocketError(t);
+        return FALSE;
+    }
+    if (blocking)
+        flags &= ~O_NONBLOCK;
+    else
+        flags |= O_NONBLOCK;
+    if (fcntl(handle, F_SETFL, flags) < 0) {
+        RaiseSocketError(t);
+        return FALSE;
+    }
+#else
+    u_long nonBlocking = !blocking;
+    if (ioctlsocket(handle, FIONBIO, &nonBlocking) == SOCKET_ERROR) {
+        RaiseSocketError(t);
+        return FALSE;
+    }
+#endif
+    return TRUE;
+}
+
+
+#ifndef A_HAVE_WINDOWS
+/* Connect a socket in a fiber. Suspend the fiber instead of blocking the
+   thread while the connection is being established. Return 0 on success, or
+   -1 and set errno on failure. */
+static int FiberConnect(AThread *t, int handle, struct sockaddr_in *address)
+{
+    int flags = fcntl(handle, F_GETFL, 0);
+    int status;
+    int error;
+
+    if (flags < 0 || fcntl(handle, F_SETFL, flags | O_NONBLOCK) < 0)
+        return -1;
+
+    status = connect(handle, (struct sockaddr *)address, sizeof(*address));
+    if (status < 0 && errno == EINPROGRESS) {
+        SOCKLEN_T len = sizeof(error);
+
+        if (!AFiberWaitForIo(t, handle, A_FIBER_WRITABLE)) {
+            /* Another fiber is waiting for the socket; block the thread. */
+            struct pollfd fd;
+            fd.fd = handle;
+            fd.events = POLLOUT;
+            AAllowBlocking();
+            poll(&fd, 1, -1);
+            AEndBlocking();
+        }
+
+        if (getsockopt(handle, SOL_SOCKET, SO_ERROR, &error, &len) < 0)
+            status = -1;
+        else if (error != 0) {
+            errno = error;
+            status = -1;
+        } else
+            status = 0;
+    }
+
+    /* Restore the original mode without modifying errno. */
+    error = errno;
+    fcntl(handle, F_SETFL, flags);
+    errno = error;
+
+    return status;
+}
+#endif
+
+
 A_MODULE(socket, "socket")
     A_IMPORT("io")
     A_DEF(A_PRIVATE("Main"), 0, 1, SocketMain)
@@ -479,9 +700,9 @@ A_MODULE(socket, "socket")
 
     /* The first additional private member is for FILE_ID; the others are
        for source/destination addresses. */
-    A_CLASS_PRIV("Socket", 5)
+    A_CLASS_PRIV_P("Socket", 5, &SocketClassNum)
         A_INHERIT("io::Stream")
-        A_METHOD_OPT("create", 2, 3, 1, SocketCreate)
+        A_METHOD_OPT("create", 2, 4, 1, SocketCreate)
         A_METHOD_VARARG("_write", 0, 0, 1, Socket_Write)
         A_METHOD("_read", 1, 2, Socket_Read)
         A_METHOD("close", 0, 0, SocketClose)
@@ -489,6 +710,9 @@ A_MODULE(socket, "socket")
         A_METHOD("localPort", 0, 0, SocketLocalPort)
         A_METHOD("remoteAddress", 0, 0, SocketRemoteAddress)
         A_METHOD("remotePort", 0, 0, SocketRemotePort)
+        A_METHOD("setBlocking", 1, 0, SocketSetBlocking)
+        A_METHOD_OPT("sendFile", 1, 3, 4, SocketSendFile)
+        A_METHOD("__handle", 0, 0, Socket__Handle)
         A_METHOD("#i", 0, 0, SocketInitialize)
     A_END_CLASS()
     /* FIX: add a #f method? */
@@ -9,6 +9,7 @@
 #include "alore.h"
 #include "memberid.h"
 #include "float.h"
+#include "floatconv.h"
 #include "int.h"
 #include "mem.h"
 #include "gc.h"
@@ -35,6 +36,24 @@ AValue AStdFloat(AThread *t, AValue *frame)
         double f;
         AValue ret;
 
+        if (AIsNarrowStr(frame[0]) || AIsNarrowSubStr(frame[0])) {
+            /* Fast path for narrow strings in the usual syntax. Other inputs
+               (such as hexadecimal floats and special values) are handled by
+               strtod below. */
+            const unsigned char *p = ANarrowStrItems(frame[0]);
+            const unsigned char *pEnd = p + AStrLen(frame[0]);
+
+            while (p != pEnd && (*p == ' ' || *p == '\t'))
+                p++;
+            p = AParseFloat(p, pEnd, &f);
+            if (p != NULL) {
+                while (p != pEnd && (*p == ' ' || *p == '\t'))
+                    p++;
+                if (p == pEnd)
+                    return ACreateFloat(t, f);
+            }
+        }
+
         s = AAllocCStrFromString(t, frame[0], buf, 64);
         if (s  == NULL)
             return AError;
@@ -33,6 +33,7 @@ AValue AStdInt(AThread *t, AValue *frame)
     int ind;
     int end;
     unsigned char *buf;
+    int digitsBeg;
     ABool isNeg;
     ASignedValue num;
 
@@ -65,6 +66,7 @@ AValue AStdInt(AThread *t, AValue *frame)
         }
 
         num = 0;
+        digitsBeg = ind;
 
         if (ind < end && AIsDigit(buf[ind])) {
             /* Process digits until we find a non-digit character or until
@@ -167,33 +169,21 @@ AValue AStdInt(AThread *t, AValue *frame)
   HandleLongInt:
 
     {
-        /* Perform string-to-int conversion when the result is a long int. */
-        ALongInt *li;
-        AValue val;
-
-        val = ACreateLongIntFromIntND(t, num);
-        if (AIsError(val))
-            return AError;
-
-        li = AValueToLongInt(val);
-
-        do {
-            unsigned char ch = AValueToStr(frame[0])->elem[ind];
-
-            if (!AIsDigit(ch))
-                break;
-
-            li = AMulAddSingle(t, li, 10, ch - '0');
-            if (li == NULL)
-                return AError;
+        /* The result is a long int. Find the end of the digits and check
+           that only whitespace follows them. */
+        int digitsEnd;
 
+        while (ind < end && AIsDigit(buf[ind]))
             ind++;
-        } while (ind < end);
+        digitsEnd = ind;
 
-        if (isNeg)
-            ASetLongIntSign(li);
+        for (; ind < end; ind++) {
+            if (buf[ind] != ' ' && buf[ind] != '\t')
+                return RaiseValueErrorForInvalidIntStr(t, frame[0]);
+        }
 
-        return ALongIntToValue(li);
+        return AStrToLongInt(t, &frame[0], buf + digitsBeg,
+                             digitsEnd - digitsBeg, 10, isNeg);
     }
 }
 
@@ -253,15 +243,13 @@ AValue ASubInts(AThread *t, AValue a, AValue b)
    std::Int, but the second argument is always present. */
 static AValue RadixInt(AThread *t, AValue *frame)
 {
-    int i, j;
+    int i, j, k;
     int radix = AGetInt(t, frame[1]);
     ABool isNeg;
 
     if (radix < 2 || radix > 36)
         return ARaiseValueError(t, "Invalid radix");
 
-    frame[1] = AZero;
-
     AExpectStr(t, frame[0]);
 
     /* Skip initial whitespace. */
@@ -278,7 +266,7 @@ static AValue RadixInt(AThread *t, AValue *frame)
     } else
         isNeg = FALSE;
 
-    /* Process the number. */
+    /* Validate the digits. */
     j = i;
     for (; i < AStrLen(frame[0]); i++) {
         int ch = AStrItem(frame[0], i);
@@ -295,13 +283,11 @@ static AValue RadixInt(AThread *t, AValue *frame)
 
         if (digit >= radix)
             ARaiseValueError(t, "Invalid character");
-
-        frame[1] = AMul(t, frame[1], AMakeShortInt(radix));
-        frame[1] = AAdd(t, frame[1], AMakeShortInt(digit));
     }
 
     if (i == j)
         return ARaiseValueError(t, "Argument not number");
+    k = i;
 
     /* Skip trailing whitespace. */
     for (; i < AStrLen(frame[0]); i++) {
@@ -310,10 +296,17 @@ static AValue RadixInt(AThread *t, AValue *frame)
             return ARaiseValueError(t, "Invalid character");
     }
 
-    if (!isNeg)
-        return frame[1];
-    else
-        return ANeg(t, frame[1]);
+    /* Convert the digits. They are all ASCII characters, so a wide string can
+       be narrowed. */
+    frame[1] = ASubStr(t, frame[0], j, k);
+    if (AIsWideStr(frame[1]) || AIsWideSubStr(frame[1])) {
+        frame[1] = AWideStringToNarrow(t, frame[1], NULL);
+        if (AIsError(frame[1]))
+            return AError;
+    }
+
+    return AStrToLongInt(t, &frame[1], ANarrowStrItems(frame[1]),
+                         AStrLen(frame[1]), radix, isNeg);
 }
 
 
@@ -0,0 +1,935 @@
+/* std_int_conv.c - Conversions between long Int objects and strings
+
+   Copyright (c) 2010-2011 Jukka Lehtosalo
+
+   Alore is licensed under the terms of the MIT license.  See the file
+   LICENSE.txt in the distribution.
+*/
+
+/* Let R be the largest power of the radix that fits in a long int digit. Long
+   integers are converted to strings by dividing them recursively by the
+   powers R**(2**j), and strings are converted to long integers in the reverse
+   way by multiplying by the same powers. The divisions use reciprocals of the
+   powers computed using Newton's iteration. With Karatsuba multiplication,
+   both directions take O(n**1.6 log n) time for n digits. Radixes that are
+   powers of two are converted in linear time by moving bits, and short
+   numbers using simple quadratic algorithms. */
+
+#include "int.h"
+#include "value.h"
+#include "gc.h"
+#include "mem.h"
+#include "str.h"
+#include "internal.h"
+#include "alore.h"
+#include "runtime.h"
+
+
+#define BITS A_LONG_INT_DIGIT_BITS
+#define MASK A_LONGINT_DIGIT_MASK
+
+#define Len(l) AGetLongIntLen(l)
+#define Sign(l) AGetLongIntSign(l)
+
+#define DoubleDigit ALongIntDoubleDigit
+#define Digit ALongIntDigit
+
+
+/* Numbers shorter than these (in digits) are converted using the simple
+   quadratic algorithms */
+#define TO_STR_DC_CUTOFF 1000
+#define TO_INT_DC_CUTOFF 250
+
+/* Numbers shorter than this (in digits) are converted using buffers allocated
+   in the stack */
+#define STACK_DIGITS 64
+
+/* Maximum number of powers R**(2**j) */
+#define MAX_POWERS (int)(sizeof(long) * 8)
+
+/* Size of the character buffer allocated in the stack for the conversion of
+   short numbers */
+#define STACK_BUF_SIZE (STACK_DIGITS * BITS + 2)
+
+#define DigitValue(ch) \
+    ((ch) <= '9' ? (ch) - '0' : ((ch) | 0x20) - 'a' + 10)
+
+/* The largest power of 10 that fits in a digit. Decimal conversions divide
+   by this constant so that the compiler can avoid slow division
+   instructions. */
+#if A_LONG_INT_DIGIT_BITS == 32
+#define DECIMAL_CHUNK 1000000000
+#else
+#define DECIMAL_CHUNK 10000
+#endif
+
+/* Divide x[0..n) in place by divisor and store the remainder in rem. */
+#define DivideDigits(x, n, divisor, rem)                \
+    do {                                                \
+        long i_;                                        \
+        rem = 0;                                        \
+        for (i_ = (n) - 1; i_ >= 0; i_--) {             \
+            rem = (rem << BITS) | (x)[i_];              \
+            (x)[i_] = rem / (divisor);                  \
+            rem %= (divisor);                           \
+        }                                               \
+    } while (0)
+
+
+typedef struct {
+    int radix;
+    int bitsPerChar;    /* log2(radix) if radix is a power of two, else 0 */
+    int chunkLen;       /* Number of characters per chunk */
+    Digit chunk;        /* R = radix**chunkLen */
+    int numPowers;
+    Digit *power[MAX_POWERS];     /* R**(2**j) */
+    long powerLen[MAX_POWERS];
+    /* The powers shifted left by shift[j] bits so that the most significant
+       bit is set, and the reciprocals B**(2 * powerLen[j]) / normPower[j]
+       (B is the base of long int digits). These are only needed for Int ->
+       Str conversions. A reciprocal is calculated when it is first needed;
+       until then recipLen[j] is 0. */
+    Digit *normPower[MAX_POWERS];
+    int shift[MAX_POWERS];
+    Digit *recip[MAX_POWERS];
+    long recipLen[MAX_POWERS];
+} Radix;
+
+
+static void InitRadix(Radix *r, int radix);
+static void InitPowers(Radix *r, long n, ABool toStr, Digit *mem,
+                       Digit *scratch);
+static void InitReciprocals(Radix *r, Digit *mem);
+static char *ToStrPow2(const Digit *x, long n, const Radix *r, char *end);
+static char *ToStrBasic(Digit *x, long n, const Radix *r, char *end,
+                        long width);
+static char *ToStrRec(Digit *x, long n, int j, Radix *r, char *end,
+                      long width, Digit *scratch);
+static long StrToDigitsPow2(Digit *d, const unsigned char *s, long len,
+                            const Radix *r);
+static long StrToDigitsBasic(Digit *d, const unsigned char *s, long len,
+                             const Radix *r);
+static void ChunksToDigits(Digit *d, const Digit *c, long n, const Radix *r,
+                           Digit *scratch);
+static long Reciprocal(Digit *v, const Digit *d, long n, Digit *scratch);
+static long ApproxReciprocal(Digit *v, const Digit *d, long n,
+                             Digit *scratch);
+static long DivModPower(Digit *x, long n, int j, Radix *r, Digit *q,
+                        Digit *scratch);
+static long StripLen(const Digit *a, long n);
+static int CompareDigits(const Digit *a, long aLen, const Digit *b,
+                         long bLen);
+static int CompareWithPower(const Digit *a, long aLen, long k);
+static void NegateDigits(Digit *a, long n);
+static void ShiftLeft(Digit *a, long n, int shift);
+static void ShiftRight(Digit *a, long n, int shift);
+
+
+static const Digit One[1] = { 1 };
+
+
+/* Convert a long integer to a string with the given radix (base). The result
+   will have at least minWidth digits; if necessary, pad it with zeroes. Return
+   a Str value. Assume that the argument is a long integer. */
+AValue ALongIntToStr(AThread *t, AValue liVal, int radix, int minWidth)
+{
+    Radix r;
+    ALongInt *li;
+    long n;
+    long maxLen;
+    long numDigits;
+    ABool isNeg;
+    Digit stackDigits[STACK_DIGITS];
+    char stackBuf[STACK_BUF_SIZE];
+    Digit *mem;
+    Digit *x;
+    char *buf;
+    char *end;
+    char *s;
+    AValue res;
+
+    InitRadix(&r, radix);
+
+    li = AValueToLongInt(liVal);
+    n = Len(li);
+    isNeg = Sign(li) != 0;
+
+    if (radix < 8)
+        maxLen = n * BITS + 1;
+    else if (radix < 16)
+        maxLen = n * BITS / 3 + 2;
+    else
+        maxLen = n * BITS / 4 + 2;
+    if (maxLen < minWidth)
+        maxLen = minWidth;
+    maxLen++;
+
+    numDigits = n + 1;
+    if (r.bitsPerChar == 0 && n >= TO_STR_DC_CUTOFF)
+        numDigits += 32 * (n + MAX_POWERS) + 1024;
+
+    if (numDigits <= STACK_DIGITS && maxLen <= STACK_BUF_SIZE) {
+        /* Use buffers allocated in the stack (quicker!). */
+        mem = NULL;
+        x = stackDigits;
+        buf = stackBuf;
+    } else {
+        if (!AAllocTempStack(t, 1))
+            return AError;
+        t->tempStackPtr[-1] = liVal;
+        mem = AAllocStatic(numDigits * sizeof(Digit) + maxLen);
+        li = AValueToLongInt(t->tempStackPtr[-1]);
+        t->tempStackPtr--;
+        if (mem == NULL)
+            return ARaiseMemoryErrorND(t);
+
+        x = mem;
+        buf = (char *)(mem + numDigits);
+    }
+
+    ACopyMem(x, li->digit, n * sizeof(Digit));
+    end = buf + maxLen;
+
+    if (r.bitsPerChar != 0)
+        s = ToStrPow2(x, n, &r, end);
+    else if (n < TO_STR_DC_CUTOFF)
+        s = ToStrBasic(x, n, &r, end, 0);
+    else {
+        /* Layout: x, powers, normalized powers and reciprocals, scratch */
+        Digit *powers = x + n + 1;
+        Digit *scratch = powers + 12 * (n + MAX_POWERS);
+        InitPowers(&r, n, TRUE, powers, scratch);
+        InitReciprocals(&r, powers + 4 * (n + MAX_POWERS));
+        s = ToStrRec(x, n, r.numPowers - 1, &r, end, 0, scratch);
+    }
+
+    /* Insert zeroes as padding if the result is too short. */
+    while (end - s < minWidth)
+        *--s = '0';
+
+    if (isNeg)
+        *--s = '-';
+
+    res = ACreateString(t, s, end - s);
+
+    if (mem != NULL) {
+        /* Freeing may block, and the garbage collector may move res. */
+        if (!AIsError(res)) {
+            if (!AAllocTempStack(t, 1))
+                return AError;
+            t->tempStackPtr[-1] = res;
+        }
+        AFreeStatic(mem);
+        if (!AIsError(res)) {
+            res = t->tempStackPtr[-1];
+            t->tempStackPtr--;
+        }
+    }
+
+    return res;
+}
+
+
+/* Convert the len digits s[0..len) in the given radix to an Int. If str is
+   not NULL, s points inside the narrow string *str, which must be reachable
+   by the garbage collector; otherwise s must not point to a movable object.
+   The digits must be valid. If isNeg is TRUE, negate the result. */
+AValue AStrToLongInt(AThread *t, AValue *str, const unsigned char *s,
+                     Assize_t len, int radix, ABool isNeg)
+{
+    Radix r;
+    long maxDigits;
+    long n;
+    long offset;
+    Digit stackDigits[STACK_DIGITS];
+    Digit *mem;
+    Digit *d;
+    ALongInt *li;
+    int bits;
+
+    InitRadix(&r, radix);
+
+    for (bits = 1; (1 << bits) < radix; bits++);
+    maxDigits = (long)(((AIntU64)len * bits + BITS - 1) / BITS) + 1;
+
+    if (str != NULL)
+        offset = s - ANarrowStrItems(*str);
+    else
+        offset = 0;
+
+    mem = NULL;
+    if (r.bitsPerChar != 0 || len < (Assize_t)TO_INT_DC_CUTOFF * r.chunkLen) {
+        if (maxDigits <= STACK_DIGITS)
+            d = stackDigits;
+        else {
+            mem = AAllocStatic(maxDigits * sizeof(Digit));
+            if (mem == NULL)
+                return ARaiseMemoryErrorND(t);
+            d = mem;
+        }
+
+        if (str != NULL)
+            s = ANarrowStrItems(*str) + offset;
+
+        if (r.bitsPerChar != 0)
+            n = StrToDigitsPow2(d, s, len, &r);
+        else
+            n = StrToDigitsBasic(d, s, len, &r);
+    } else {
+        long numChunks = (len + r.chunkLen - 1) / r.chunkLen;
+        long first = len - (numChunks - 1) * r.chunkLen;
+        Digit *chunks;
+        Digit *scratch;
+        long i;
+
+        mem = AAllocStatic((12 * (numChunks + MAX_POWERS) + 1024)
+                           * sizeof(Digit));
+        if (mem == NULL)
+            return ARaiseMemoryErrorND(t);
+
+        if (str != NULL)
+            s = ANarrowStrItems(*str) + offset;
+
+        /* Split the string into chunks of chunkLen characters; only the first
+           chunk may be shorter. */
+        chunks = mem;
+        for (i = 0; i < numChunks; i++) {
+            int k = i == 0 ? first : r.chunkLen;
+            Digit c = 0;
+            for (; k > 0; k--) {
+                c = c * radix + DigitValue(*s);
+                s++;
+            }
+            chunks[i] = c;
+        }
+
+        d = chunks + numChunks;
+        scratch = d + 3 * numChunks + 2 * MAX_POWERS;
+        InitPowers(&r, numChunks, FALSE, d + numChunks, scratch);
+        ChunksToDigits(d, chunks, numChunks, &r, scratch);
+        n = StripLen(d, numChunks);
+    }
+
+    if (n * BITS <= 64) {
+        /* Return a short int if the value is small enough. */
+        AIntU64 v = 0;
+        long i;
+        for (i = n - 1; i >= 0; i--)
+            v = (v << BITS) | d[i];
+        if (v <= A_SHORT_INT_MAX || (isNeg && v == A_SHORT_INT_MAX + 1)) {
+            AFreeStatic(mem);
+            return AIntToValue(isNeg ? -(ASignedValue)v : (ASignedValue)v);
+        }
+    }
+
+    li = AAlloc(t, AGetLongIntSize(n));
+    if (li == NULL) {
+        AFreeStatic(mem);
+        return ARaiseMemoryErrorND(t);
+    }
+
+    AInitLongIntBlock(li, n, 0);
+    ACopyMem(li->digit, d, n * sizeof(Digit));
+
+    if (mem != NULL) {
+        /* Freeing may block, and the garbage collector may move li. */
+        if (!AAllocTempStack(t, 1))
+            return AError;
+        t->tempStackPtr[-1] = ALongIntToValue(li);
+        AFreeStatic(mem);
+        li = AValueToLongInt(t->tempStackPtr[-1]);
+        t->tempStackPtr--;
+    }
+
+    return ANormalize(t, li, isNeg);
+}
+
+
+static void InitRadix(Radix *r, int radix)
+{
+    int i;
+
+    r->radix = radix;
+
+    r->bitsPerChar = 0;
+    if ((radix & (radix - 1)) == 0) {
+        for (i = 1; (1 << i) < radix; i++);
+        r->bitsPerChar = i;
+    }
+
+    r->chunk = radix;
+    r->chunkLen = 1;
+    while ((DoubleDigit)r->chunk * radix <= MASK) {
+        r->chunk *= radix;
+        r->chunkLen++;
+    }
+
+    r->numPowers = 0;
+}
+
+
+/* Calculate the powers R**(2**j) that are needed for converting an integer
+   with n digits to a string (if toStr is TRUE) or a string with n chunks to
+   an integer, and store them at mem (at most 2 * n + 2 * MAX_POWERS digits).
+   The scratch array must have room for 4 * n + 512 digits. */
+static void InitPowers(Radix *r, long n, ABool toStr, Digit *mem,
+                       Digit *scratch)
+{
+    int j;
+
+    mem[0] = r->chunk;
+    r->power[0] = mem;
+    r->powerLen[0] = 1;
+
+    /* Str -> Int needs powers with 2**j < n. Int -> Str needs powers up to P
+       with P**2 > x; this is true if 2 * (length of P - 1) >= n. */
+    for (j = 0; (2L << j) < n || (toStr && 2 * (r->powerLen[j] - 1) < n);
+         j++) {
+        long len = r->powerLen[j];
+        Digit *next = r->power[j] + len;
+
+        AMultiplyDigits(next, r->power[j], len, r->power[j], len, scratch);
+        r->power[j + 1] = next;
+        r->powerLen[j + 1] = StripLen(next, 2 * len);
+    }
+
+    r->numPowers = j + 1;
+}
+
+
+/* Calculate the normalized powers and store them at mem. Reserve space for
+   their reciprocals after them. */
+static void InitReciprocals(Radix *r, Digit *mem)
+{
+    int j;
+
+    for (j = 0; j < r->numPowers; j++) {
+        long len = r->powerLen[j];
+        Digit top = r->power[j][len - 1];
+        int shift = 0;
+
+        while ((top << shift & ((Digit)1 << (BITS - 1))) == 0)
+            shift++;
+
+        r->normPower[j] = mem;
+        r->shift[j] = shift;
+        ACopyMem(mem, r->power[j], len * sizeof(Digit));
+        ShiftLeft(mem, len, shift);
+        mem += len;
+
+        r->recip[j] = mem;
+        r->recipLen[j] = 0;
+        mem += len + 2;
+    }
+}
+
+
+/* Store the characters of x[0..n) in a radix that is a power of two ending at
+   end. Return a pointer to the first character. */
+static char *ToStrPow2(const Digit *x, long n, const Radix *r, char *end)
+{
+    int b = r->bitsPerChar;
+    char *s = end;
+    DoubleDigit acc = 0;
+    int accBits = 0;
+    long i;
+
+    n = StripLen(x, n);
+
+    for (i = 0; i < n; i++) {
+        acc |= (DoubleDigit)x[i] << accBits;
+        accBits += BITS;
+        while (accBits >= b && (i < n - 1 || acc != 0)) {
+            *--s = ADigits[acc & (r->radix - 1)];
+            acc >>= b;
+            accBits -= b;
+        }
+    }
+
+    if (acc != 0 || s == end)
+        *--s = ADigits[acc];
+
+    return s;
+}
+
+
+/* Store the characters of x[0..n) ending at end using repeated division by R.
+   Pad the result with zeroes to width characters. Modify x. Return a pointer
+   to the first character. */
+static char *ToStrBasic(Digit *x, long n, const Radix *r, char *end,
+                        long width)
+{
+    char *s = end;
+
+    n = StripLen(x, n);
+
+    while (n > 0) {
+        DoubleDigit rem;
+        Digit c;
+        int k;
+
+        if (r->chunk == DECIMAL_CHUNK) {
+            DivideDigits(x, n, DECIMAL_CHUNK, rem);
+            n = StripLen(x, n);
+            c = rem;
+            for (k = 0; k < r->chunkLen && (n > 0 || c != 0); k++) {
+                *--s = '0' + c % 10;
+                c /= 10;
+            }
+        } else {
+            DivideDigits(x, n, r->chunk, rem);
+            n = StripLen(x, n);
+            /* Generate the characters of the chunk. Omit leading zeroes of
+               the most significant chunk. */
+            c = rem;
+            for (k = 0; k < r->chunkLen && (n > 0 || c != 0); k++) {
+                *--s = ADigits[c % r->radix];
+                c /= r->radix;
+            }
+        }
+    }
+
+    if (s == end && width == 0)
+        *--s = '0';
+
+    while (end - s < width)
+        *--s = '0';
+
+    return s;
+}
+
+
+/* Store the characters of x[0..n) ending at end, assuming that x is smaller
+   than the square of the power j. Pad the result with zeroes to width
+   characters. Modify x; there must be room for n + 1 digits. The scratch array
+   must have room for 18 * n + 1024 digits. Return a pointer to the first
+   character. */
+static char *ToStrRec(Digit *x, long n, int j, Radix *r, char *end,
+                      long width, Digit *scratch)
+{
+    long powerLen;
+    long lowWidth;
+    long qLen;
+    Digit *q;
+    char *s;
+
+    n = StripLen(x, n);
+    if (j < 0 || n < TO_STR_DC_CUTOFF)
+        return ToStrBasic(x, n, r, end, width);
+
+    powerLen = r->powerLen[j];
+    if (CompareDigits(x, n, r->power[j], powerLen) < 0)
+        return ToStrRec(x, n, j - 1, r, end, width, scratch);
+
+    /* x = q * R**(2**j) + x', where both q and x' are smaller than R**(2**j)
+       and thus x' has exactly chunkLen * 2**j characters. */
+    q = scratch;
+    scratch += powerLen + 2;
+    qLen = DivModPower(x, n, j, r, q, scratch);
+
+    lowWidth = (long)r->chunkLen << j;
+    s = ToStrRec(x, powerLen, j - 1, r, end, lowWidth, scratch);
+    return ToStrRec(q, qLen, j - 1, r, s, width > 0 ? width - lowWidth : 0,
+                    scratch);
+}
+
+
+/* Convert the characters s[0..len) in a radix that is a power of two to
+   digits. Return the number of digits. */
+static long StrToDigitsPow2(Digit *d, const unsigned char *s, long len,
+                            const Radix *r)
+{
+    int b = r->bitsPerChar;
+    DoubleDigit acc = 0;
+    int accBits = 0;
+    long n = 0;
+    long i;
+
+    for (i = len - 1; i >= 0; i--) {
+        acc |= (DoubleDigit)DigitValue(s[i]) << accBits;
+        accBits += b;
+        if (accBits >= BITS) {
+            d[n++] = acc & MASK;
+            acc >>= BITS;
+            accBits -= BITS;
+        }
+    }
+
+    if (accBits > 0)
+        d[n++] = acc;
+
+    return StripLen(d, n);
+}
+
+
+/* Convert the characters s[0..len) to digits by repeated multiplication by
+   R. Return the number of digits. */
+static long StrToDigitsBasic(Digit *d, const unsigned char *s, long len,
+                             const Radix *r)
+{
+    long n = 0;
+    long i = 0;
+    int k = len % r->chunkLen;
+
+    if (k == 0)
+        k = r->chunkLen;
+
+    while (i < len) {
+        Digit c = 0;
+        Digit mul = 1;
+        DoubleDigit carry;
+        long j;
+
+        for (; k > 0; k--) {
+            c = c * r->radix + DigitValue(s[i]);
+            mul *= r->radix;
+            i++;
+        }
+        k = r->chunkLen;
+
+        carry = c;
+        for (j = 0; j < n; j++) {
+            carry += (DoubleDigit)d[j] * mul;
+            d[j] = carry & MASK;
+            carry >>= BITS;
+        }
+        if (carry != 0)
+            d[n++] = carry;
+    }
+
+    return n;
+}
+
+
+/* Store the value of the chunks c[0..n) (the most significant first, each
+   smaller than R) in d[0..n). The scratch array must have room for
+   6 * n + 512 digits. */
+static void ChunksToDigits(Digit *d, const Digit *c, long n, const Radix *r,
+                           Digit *scratch)
+{
+    long h;
+    long highLen;
+    long prodLen;
+    long i;
+    int j;
+    Digit *high;
+    Digit *prod;
+
+    if (n < TO_INT_DC_CUTOFF) {
+        long len = 0;
+
+        for (i = 0; i < n; i++) {
+            DoubleDigit carry = c[i];
+            long k;
+
+            for (k = 0; k < len; k++) {
+                carry += (DoubleDigit)d[k] * r->chunk;
+                d[k] = carry & MASK;
+                carry >>= BITS;
+            }
+            if (carry != 0)
+                d[len++] = carry;
+        }
+
+        for (; len < n; len++)
+            d[len] = 0;
+
+        return;
+    }
+
+    /* value = high * R**h + low, where low has h = 2**j chunks. */
+    for (j = 0; (2L << j) < n; j++);
+    h = 1L << j;
+
+    ChunksToDigits(d, c + n - h, h, r, scratch);
+
+    high = scratch;
+    scratch += n - h;
+    ChunksToDigits(high, c, n - h, r, scratch);
+    highLen = StripLen(high, n - h);
+
+    for (i = h; i < n; i++)
+        d[i] = 0;
+
+    if (highLen > 0) {
+        prod = scratch;
+        prodLen = highLen + r->powerLen[j];
+        AMultiplyDigits(prod, high, highLen, r->power[j], r->powerLen[j],
+                        prod + prodLen);
+        AAddDigits(d, n, prod, StripLen(prod, prodLen));
+    }
+}
+
+
+/* Calculate v = floor(B**(2 * n) / d), where d has n digits and the most
+   significant bit of d is set. There must be room for n + 2 digits in v.
+   The scratch array must have room for 17 * n + 600 digits. Return the
+   number of digits in v. */
+static long Reciprocal(Digit *v, const Digit *d, long n, Digit *scratch)
+{
+    long vLen;
+    long tLen;
+
+    vLen = ApproxReciprocal(v, d, n, scratch);
+
+    /* Correct the small remaining error. */
+    tLen = n + vLen;
+    AMultiplyDigits(scratch, d, n, v, vLen, scratch + tLen);
+    while (CompareWithPower(scratch, tLen, 2 * n) > 0) {
+        ASubDigits(scratch, tLen, d, n);
+        ASubDigits(v, vLen, One, 1);
+    }
+    for (; tLen < 2 * n; tLen++)
+        scratch[tLen] = 0;
+    NegateDigits(scratch, 2 * n);
+    while (CompareDigits(scratch, 2 * n, d, n) >= 0) {
+        ASubDigits(scratch, 2 * n, d, n);
+        v[vLen] = 0;
+        AAddDigits(v, vLen + 1, One, 1);
+        vLen = StripLen(v, vLen + 1);
+    }
+
+    return StripLen(v, vLen);
+}
+
+
+/* Calculate an approximation of floor(B**(2 * n) / d) that is off by at most
+   a few units. The arguments are as for Reciprocal. */
+static long ApproxReciprocal(Digit *v, const Digit *d, long n,
+                             Digit *scratch)
+{
+    long h;
+    long l;
+    long k;
+    long shift;
+    long vLen;
+    long vhLen;
+    long tLen;
+    long eLen;
+    long pLen;
+    long i;
+    Digit *vh;
+    Digit *tp;
+    Digit *p;
+    int sign;
+
+    if (n == 1) {
+        DoubleDigit max = ~(DoubleDigit)0;
+        DoubleDigit q = max / d[0];
+        if (max - q * d[0] == (DoubleDigit)d[0] - 1)
+            q++;
+        v[0] = q & MASK;
+        v[1] = q >> BITS;
+        return StripLen(v, 2);
+    }
+
+    /* Start from the reciprocal of the most significant half of d. Include a
+       guard digit so that the errors do not accumulate. */
+    h = (n + 1) / 2 + 1;
+    if (h >= n)
+        h = n - 1;
+    l = n - h;
+    vh = v + l;
+    vhLen = ApproxReciprocal(vh, d + l, h, scratch);
+    for (i = 0; i < l; i++)
+        v[i] = 0;
+    vLen = l + vhLen;
+
+    /* Newton's iteration: v = v + v * (B**(2 * n) - d * v) / B**(2 * n).
+       This doubles the number of correct digits. Since the l least
+       significant digits of v are zero, multiply by vh and shift the
+       products. */
+    tp = scratch;
+    tLen = n + vLen;
+    for (i = 0; i < l; i++)
+        tp[i] = 0;
+    AMultiplyDigits(tp + l, d, n, vh, vhLen, tp + tLen);
+    for (; tLen < 2 * n; tLen++)
+        tp[tLen] = 0;
+    sign = CompareWithPower(tp, tLen, 2 * n);
+    if (sign != 0) {
+        if (sign > 0) {
+            ASubDigits(tp + 2 * n, tLen - 2 * n, One, 1);
+            eLen = StripLen(tp, tLen);
+        } else {
+            NegateDigits(tp, 2 * n);
+            eLen = StripLen(tp, 2 * n);
+        }
+
+        /* The k least significant digits of the error e only affect the
+           last unit of the result, so ignore them. */
+        k = h - 2;
+        if (eLen > k) {
+            p = tp + tLen;
+            pLen = vhLen + eLen - k;
+            AMultiplyDigits(p, vh, vhLen, tp + k, eLen - k, p + pLen);
+
+            shift = 2 * n - l - k;
+            if (pLen > shift) {
+                long corrLen = StripLen(p + shift, pLen - shift);
+                if (sign > 0)
+                    ASubDigits(v, vLen, p + shift, corrLen);
+                else {
+                    v[vLen] = 0;
+                    AAddDigits(v, vLen + 1, p + shift, corrLen);
+                    vLen++;
+                }
+                vLen = StripLen(v, vLen);
+            }
+        }
+    }
+
+    return vLen;
+}
+
+
+/* Divide x[0..n) by the power j using Barrett reduction, assuming that x is
+   smaller than the square of the power. Store the quotient in q (room for
+   powerLen + 2 digits) and the remainder in x[0..powerLen). There must be
+   room for n + 1 digits in x. The scratch array must have room for
+   17 * n + 600 digits. Return the number of digits in q. */
+static long DivModPower(Digit *x, long n, int j, Radix *r, Digit *q,
+                        Digit *scratch)
+{
+    const Digit *d = r->normPower[j];
+    long dn = r->powerLen[j];
+    const Digit *v = r->recip[j];
+    long vn;
+    int shift = r->shift[j];
+    long q1Len;
+    long pLen;
+    long qLen;
+    long i;
+
+    if (r->recipLen[j] == 0)
+        r->recipLen[j] = Reciprocal(r->recip[j], d, dn, scratch);
+    vn = r->recipLen[j];
+
+    /* Divide x * 2**shift by the normalized power; the quotient is the
+       same. */
+    x[n] = 0;
+    ShiftLeft(x, n + 1, shift);
+    n = StripLen(x, n + 1);
+    for (i = n; i < dn; i++)
+        x[i] = 0;
+
+    qLen = 0;
+    if (n >= dn) {
+        /* q = floor(floor(x / B**(dn - 1)) * v / B**(dn + 1)) is at most 2
+           smaller than the real quotient. */
+        q1Len = n - (dn - 1);
+        pLen = q1Len + vn;
+        AMultiplyDigits(scratch, x + dn - 1, q1Len, v, vn, scratch + pLen);
+        if (pLen > dn + 1) {
+            qLen = StripLen(scratch + dn + 1, pLen - (dn + 1));
+            ACopyMem(q, scratch + dn + 1, qLen * sizeof(Digit));
+        }
+
+        if (qLen > 0) {
+            pLen = qLen + dn;
+            AMultiplyDigits(scratch, q, qLen, d, dn, scratch + pLen);
+            ASubDigits(x, n, scratch, StripLen(scratch, pLen));
+        }
+
+        while (CompareDigits(x, n, d, dn) >= 0) {
+            ASubDigits(x, n, d, dn);
+            q[qLen] = 0;
+            AAddDigits(q, qLen + 1, One, 1);
+            qLen = StripLen(q, qLen + 1);
+        }
+    }
+
+    ShiftRight(x, dn, shift);
+
+    return qLen;
+}
+
+
+/* Return the length of a digit array without leading zero digits. */
+static long StripLen(const Digit *a, long n)
+{
+    while (n > 0 && a[n - 1] == 0)
+        n--;
+    return n;
+}
+
+
+/* Compare two digit arrays. Return a negative value if a < b, 0 if a == b
+   and a positive value if a > b. */
+static int CompareDigits(const Digit *a, long aLen, const Digit *b, long bLen)
+{
+    long i;
+
+    aLen = StripLen(a, aLen);
+    bLen = StripLen(b, bLen);
+
+    if (aLen != bLen)
+        return aLen < bLen ? -1 : 1;
+
+    for (i = aLen - 1; i >= 0; i--) {
+        if (a[i] != b[i])
+            return a[i] < b[i] ? -1 : 1;
+    }
+
+    return 0;
+}
+
+
+/* Compare a digit array with B**k. */
+static int CompareWithPower(const Digit *a, long aLen, long k)
+{
+    long i;
+
+    aLen = StripLen(a, aLen);
+    if (aLen <= k)
+        return -1;
+    if (aLen > k + 1 || a[k] > 1)
+        return 1;
+
+    for (i = 0; i < k; i++) {
+        if (a[i] != 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+
+/* Replace a[0..n) with B**n - a (modulo B**n). */
+static void NegateDigits(Digit *a, long n)
+{
+    long i;
+
+    for (i = 0; i < n; i++)
+        a[i] = ~a[i] & MASK;
+    AAddDigits(a, n, One, 1);
+}
+
+
+/* Shift a[0..n) left by shift bits (0 <= shift < BITS). The most significant
+   bits are discarded. */
+static void ShiftLeft(Digit *a, long n, int shift)
+{
+    long i;
+
+    if (shift == 0)
+        return;
+
+    for (i = n - 1; i > 0; i--)
+        a[i] = ((a[i] << shift) | (a[i - 1] >> (BITS - shift))) & MASK;
+    a[0] = (a[0] << shift) & MASK;
+}
+
+
+/* Shift a[0..n) right by shift bits (0 <= shift < BITS). */
+static void ShiftRight(Digit *a, long n, int shift)
+{
+    long i;
+
+    if (shift == 0)
+        return;
+
+    for (i = 0; i < n - 1; i++)
+        a[i] = ((a[i] >> shift) | (a[i + 1] << (BITS - shift))) & MASK;
+    a[n - 1] >>= shift;
+}
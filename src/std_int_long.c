@@ -30,7 +30,8 @@
    otherwise. Some parts of the interpreter may assume that no direct
    exceptions are raised, so be careful with this when updating the code. */
 
-/* NOTE: These routines are not optimized for speed. */
+/* NOTE: Apart from multiplication of long operands, these routines are not
+         optimized for speed. */
 
 
 /* Define some alias macros for commonly used constants and macros. */
@@ -57,6 +58,7 @@
 static ALongInt *CreateLongInt(AThread *t, long len, ALongInt **a,
                                ALongInt **b);
 
+static AValue MultiplyLarge(AThread *t, AValue aVal, AValue bVal);
 static AValue AddAbsolute(AThread *t, ALongInt *a, ALongInt *b,
                           ABool isNorm);
 static AValue SubAbsolute(AThread *t, ALongInt *a, ALongInt *b,
@@ -228,6 +230,9 @@ AValue AMultiplyLongInt(AThread *t, AValue aVal, AValue bVal)
     lenB = Len(b);
     lenD = lenA + lenB;
 
+    if (lenA >= A_KARATSUBA_CUTOFF && lenB >= A_KARATSUBA_CUTOFF)
+        return MultiplyLarge(t, aVal, bVal);
+
     d = CreateLongInt(t, lenD, &a, &b);
     if (d == NULL)
         return AError;
@@ -253,6 +258,219 @@ AValue AMultiplyLongInt(AThread *t, AValue aVal, AValue bVal)
 }
 
 
+/* Multiply two long integers using Karatsuba multiplication. Assume that
+   arguments are long integers. */
+static AValue MultiplyLarge(AThread *t, AValue aVal, AValue bVal)
+{
+    ALongInt *a;
+    ALongInt *b;
+    ALongInt *d;
+    Digit *scratch;
+    long lenA;
+    long lenB;
+    ABool isNeg;
+
+    if (!AAllocTempStack(t, 2))
+        return AError;
+
+    t->tempStackPtr[-2] = aVal;
+    t->tempStackPtr[-1] = bVal;
+
+    lenA = Len(AValueToLongInt(aVal));
+    lenB = Len(AValueToLongInt(bVal));
+
+    scratch = AAllocStatic(sizeof(Digit) * A_MULTIPLY_SCRATCH_LEN(lenA, lenB));
+    if (scratch == NULL)
+        goto OutOfMemory;
+
+    a = AValueToLongInt(t->tempStackPtr[-2]);
+    b = AValueToLongInt(t->tempStackPtr[-1]);
+
+    d = CreateLongInt(t, lenA + lenB, &a, &b);
+    if (d == NULL) {
+        AFreeStatic(scratch);
+        goto OutOfMemory;
+    }
+
+    AMultiplyDigits(d->digit, a->digit, lenA, b->digit, lenB, scratch);
+    isNeg = Sign(a) ^ Sign(b);
+
+    /* Freeing may block, and the garbage collector may move d. */
+    t->tempStackPtr[-1] = ALongIntToValue(d);
+    AFreeStatic(scratch);
+    d = AValueToLongInt(t->tempStackPtr[-1]);
+
+    t->tempStackPtr -= 2;
+
+    return ANormalize(t, d, isNeg);
+
+  OutOfMemory:
+
+    t->tempStackPtr -= 2;
+
+    return ARaiseMemoryErrorND(t);
+}
+
+
+/* Multiply the digit arrays a and b using the schoolbook method and store the
+   aLen + bLen digits of the result in d. */
+static void MultiplyDigitsBasic(Digit *d, const Digit *a, long aLen,
+                                const Digit *b, long bLen)
+{
+    long i, j;
+
+    for (i = 0; i < bLen; i++)
+        d[i] = 0;
+
+    for (i = 0; i < aLen; i++) {
+        DoubleDigit carry = 0;
+        DoubleDigit ai = a[i];
+
+        for (j = 0; j < bLen; j++) {
+            carry += d[i + j] + ai * b[j];
+            d[i + j] = carry & MASK;
+            carry >>= BITS;
+        }
+
+        d[i + bLen] = carry;
+    }
+}
+
+
+/* Multiply the digit arrays a and b and store the aLen + bLen digits of the
+   result in d, which must not overlap a or b. Use Karatsuba multiplication for
+   long operands. The scratch array must have room for at least
+   A_MULTIPLY_SCRATCH_LEN(aLen, bLen) digits. */
+void AMultiplyDigits(Digit *d, const Digit *a, long aLen, const Digit *b,
+                     long bLen, Digit *scratch)
+{
+    const Digit *a0, *a1, *b0, *b1;
+    long h;
+    Digit *sa, *sb, *z1;
+    long saLen, sbLen, z1Len;
+
+    if (aLen < bLen) {
+        const Digit *tmp = a;
+        long tmpLen = aLen;
+        a = b;
+        aLen = bLen;
+        b = tmp;
+        bLen = tmpLen;
+    }
+
+    if (bLen < A_KARATSUBA_CUTOFF) {
+        MultiplyDigitsBasic(d, a, aLen, b, bLen);
+        return;
+    }
+
+    if (2 * bLen <= aLen) {
+        /* Unbalanced operands. Multiply b by bLen-digit slices of a. */
+        Digit *tmp = scratch;
+        long i;
+
+        scratch += 2 * bLen;
+
+        for (i = 0; i < aLen + bLen; i++)
+            d[i] = 0;
+
+        for (i = 0; i < aLen; i += bLen) {
+            long n = aLen - i < bLen ? aLen - i : bLen;
+            AMultiplyDigits(tmp, a + i, n, b, bLen, scratch);
+            AAddDigits(d + i, aLen + bLen - i, tmp, n + bLen);
+        }
+
+        return;
+    }
+
+    /* Let a = a1 * B**h + a0 and b = b1 * B**h + b0. Now
+       a * b = z2 * B**(2 * h) + z1 * B**h + z0, where z2 = a1 * b1,
+       z0 = a0 * b0 and z1 = (a0 + a1) * (b0 + b1) - z2 - z0. */
+    h = aLen / 2;
+    a0 = a;
+    a1 = a + h;
+    b0 = b;
+    b1 = b + h;
+
+    saLen = aLen - h + 1;
+    sbLen = (bLen - h > h ? bLen - h : h) + 1;
+    z1Len = saLen + sbLen;
+    sa = scratch;
+    sb = sa + saLen;
+    z1 = sb + sbLen;
+    scratch = z1 + z1Len;
+
+    AMultiplyDigits(d, a0, h, b0, h, scratch);
+    AMultiplyDigits(d + 2 * h, a1, aLen - h, b1, bLen - h, scratch);
+
+    ACopyMem(sa, a1, (aLen - h) * sizeof(Digit));
+    sa[aLen - h] = 0;
+    AAddDigits(sa, saLen, a0, h);
+
+    if (bLen - h >= h) {
+        ACopyMem(sb, b1, (bLen - h) * sizeof(Digit));
+        sb[bLen - h] = 0;
+        AAddDigits(sb, sbLen, b0, h);
+    } else {
+        ACopyMem(sb, b0, h * sizeof(Digit));
+        sb[h] = 0;
+        AAddDigits(sb, sbLen, b1, bLen - h);
+    }
+
+    AMultiplyDigits(z1, sa, saLen, sb, sbLen, scratch);
+    ASubDigits(z1, z1Len, d, 2 * h);
+    ASubDigits(z1, z1Len, d + 2 * h, aLen + bLen - 2 * h);
+
+    while (z1Len > 0 && z1[z1Len - 1] == 0)
+        z1Len--;
+    AAddDigits(d + h, aLen + bLen - h, z1, z1Len);
+}
+
+
+/* Add the digit array a to r in place. Assume that aLen <= rLen. Return the
+   carry out of the most significant digit of r. */
+Digit AAddDigits(Digit *r, long rLen, const Digit *a, long aLen)
+{
+    DoubleDigit carry = 0;
+    long i;
+
+    for (i = 0; i < aLen; i++) {
+        carry += (DoubleDigit)r[i] + a[i];
+        r[i] = carry & MASK;
+        carry >>= BITS;
+    }
+
+    for (; carry != 0 && i < rLen; i++) {
+        carry += r[i];
+        r[i] = carry & MASK;
+        carry >>= BITS;
+    }
+
+    return carry;
+}
+
+
+/* Subtract the digit array a from r in place. Assume that aLen <= rLen.
+   Return the borrow out of the most significant digit of r. */
+Digit ASubDigits(Digit *r, long rLen, const Digit *a, long aLen)
+{
+    DoubleDigit borrow = 0;
+    long i;
+
+    for (i = 0; i < aLen; i++) {
+        DoubleDigit s = a[i] + borrow;
+        borrow = r[i] < s;
+        r[i] = (r[i] - s) & MASK;
+    }
+
+    for (; borrow != 0 && i < rLen; i++) {
+        borrow = r[i] == 0;
+        r[i] = (r[i] - 1) & MASK;
+    }
+
+    return borrow;
+}
+
+
 /* Add two long integers. Assume that the arguments are long integers. */
 AValue AAddLongInt(AThread *t, AValue aVal, AValue bVal)
 {
@@ -913,8 +1131,10 @@ static ALongInt *TruncateZeroDigits(AThread *t, ALongInt *li, ABool isNeg)
 
         /* Truncate block if possible. This might be impossible if the
            difference in block sizes is too small. In that case, we need to
-           allocate a new block and copy the contents there. */
-        if (!isNewGen && newSize < oldSize
+           allocate a new block and copy the contents there. Big new
+           generation blocks are outside the nursery and are retired in place,
+           so they have the same restriction as old generation blocks. */
+        if (!AIsInNursery(li) && newSize < oldSize
                 && oldSize - newSize < A_MIN_BLOCK_SIZE) {
             /* Allocate a new block and copy the digits from the old block. */
             ALongInt *li2;
@@ -1213,121 +1433,6 @@ AValue APowInt(AThread *t, AValue baseVal, AValue expVal)
 const char ADigits[36] = "0123456789abcdefghijklmnopqrstuvwxyz";
 
 
-#define LONGINT_STACK_BUF_SIZE 128
-
-
-/* Convert a long integer to a string with the given radix (base). The result
-   will have at least minWidth digits; if necessary, pad it with zeroes. Return
-   a Str value. Assume that the argument is a long integer. */
-AValue ALongIntToStr(AThread *t, AValue liVal, int radix, int minWidth)
-{
-    ALongInt *li;
-    long maxLen;
-    unsigned char stackBuf[LONGINT_STACK_BUF_SIZE];
-    unsigned char *buf;
-    long ind;
-    ABool isNeg;
-    AString *s;
-    long len;
-
-    if (!AAllocTempStack(t, 1))
-        return AError;
-
-    t->tempStackPtr[-1] = liVal;
-
-    li = AValueToLongInt(liVal);
-
-    if (Sign(li))
-        isNeg = TRUE;
-    else
-        isNeg = FALSE;
-
-    if (radix < 8)
-        maxLen = Len(li) * BITS + 1;
-    else if (radix < 16)
-        maxLen = Len(li) * BITS / 3 + 2;
-    else
-        maxLen = Len(li) * BITS / 4 + 2;
-    if (maxLen < minWidth + 1)
-        maxLen = minWidth + 1;
-
-    /* Allocate space for the string if necessary, or use a fixed-length
-       buffer allocated in the stack (quicker!) when possible. */
-    if (maxLen > LONGINT_STACK_BUF_SIZE) {
-        AValue *heapBuf;
-
-        heapBuf = AAlloc(t, sizeof(AValue) + maxLen);
-        if (heapBuf == NULL)
-            goto MemoryError;
-
-        li = AValueToLongInt(t->tempStackPtr[-1]);
-
-        AInitNonPointerBlock(heapBuf, maxLen);
-
-        buf = (unsigned char *)(heapBuf + 1);
-
-        t->tempStackPtr[-1] = AStrToValue(heapBuf);
-    } else
-        buf = stackBuf;
-
-    ind = maxLen;
-
-    /* Process one digit at a time.
-       IDEA: This could be faster by processing more than one digit at a
-             time. */
-    do {
-        unsigned rem;
-        char ch;
-
-        li = ADivModSingle(t, li, radix, &rem);
-        if (li == NULL)
-            goto MemoryError;
-
-        if (buf != stackBuf)
-            buf = APtrAdd(AValueToPtr(t->tempStackPtr[-1]), sizeof(AValue));
-
-        if (rem < 10)
-            ch = rem + '0';
-        else
-            ch = rem - 10 + 'a';
-
-        buf[--ind] = ch;
-    } while (Len(li) > 0 || li->digit[0] != 0);
-
-    /* Insert zeroes as padding if the result is too short. */
-    while (maxLen - ind < minWidth)
-        buf[--ind] = '0';
-
-    if (isNeg)
-        buf[--ind] = '-';
-
-    len = maxLen - ind;
-
-    /* Allocate the string. */
-    s = AAlloc(t, sizeof(AValue) + len);
-    if (s == NULL)
-        goto MemoryError;
-
-    if (buf != stackBuf)
-        buf = APtrAdd(AValueToPtr(t->tempStackPtr[-1]), sizeof(AValue));
-
-    AInitNonPointerBlock(&s->header, len);
-
-    /* Copy stuff to the string */
-    ACopyMem(s->elem, buf + ind, len);
-
-    t->tempStackPtr--;
-
-    return AStrToValue(s);
-
-  MemoryError:
-
-    t->tempStackPtr--;
-
-    return ARaiseMemoryErrorND(t);
-}
-
-
 #define F2LI_BUF_SIZE 64
 
 
@@ -22,6 +22,8 @@
 #define INITIAL_MAP_CAPACITY 4
 
 
+/* Global num of std::Map */
+int AStdMapNum;
 /* Global num of Map iterator type */
 int AMapIterNum;
 /* Global num of constant that marks empty locations in the hash table */
@@ -65,8 +67,8 @@ AValue AMapCreate(AThread *t, AValue *frame)
         return AError;
 
     frame[2] = frame[0];
-    for (i = 0; i < AArrayLen(frame[1]); i++) {
-        AGetPair(t, AArrayItem(frame[1], i), frame + 3, frame + 4);
+    for (i = 0; i < AVarArgLen(t, frame[1]); i++) {
+        AGetPair(t, AVarArgItem(t, frame[1], i), frame + 3, frame + 4);
         AMap_set(t, frame + 2);
     }
 
@@ -93,6 +95,62 @@ AValue AMapInitialize(AThread *t, AValue *frame)
 }
 
 
+/* Construct an empty Map object that can hold at least numItems items
+   without resizing the hash table. */
+AValue AMakeMapWithCapacity(AThread *t, Assize_t numItems)
+{
+    AValue *tmp;
+    Assize_t size;
+    AValue a;
+    AValue map;
+
+    size = INITIAL_MAP_CAPACITY;
+    while (numItems * 3 >= size * 2)
+        size *= 2;
+    if (size > A_SHORT_INT_MAX)
+        return ARaiseValueError(t, "Map size overflow");
+
+    tmp = AAllocTemps(t, 1);
+    *tmp = AMakeUninitializedObject(t, AGlobalByNum(AStdMapNum));
+    a = AMakeFixArray(t, 2 * size, EmptyMarker);
+    if (AIsError(a))
+        ADispatchException(t);
+    ASetMemberDirect(t, *tmp, MAP_A, a);
+    ASetMemberDirect(t, *tmp, MAP_SIZE, AIntToValue(size));
+    ASetMemberDirect(t, *tmp, MAP_LEN, AZero);
+    ASetMemberDirect(t, *tmp, MAP_NUM_REMOVED, AZero);
+    map = *tmp;
+    AFreeTemps(t, 1);
+
+    return map;
+}
+
+
+/* Get the next item of a Map object, starting from the hash table location
+   *index (initially 0). Store the key and the value of the item in *key and
+   *value, update *index and return TRUE, or return FALSE if there are no
+   more items. The map must not be modified during the iteration. */
+ABool AMapNextItem(AValue map, Assize_t *index, AValue *key, AValue *value)
+{
+    AValue a = AMemberDirect(map, MAP_A);
+    Assize_t size = 2 * AValueToInt(AMemberDirect(map, MAP_SIZE));
+    Assize_t i;
+
+    for (i = *index; i < size; i += 2) {
+        AValue k = AFixArrayItem(a, i);
+        if (k != EmptyMarker && k != RemovedMarker) {
+            *key = k;
+            *value = AFixArrayItem(a, i + 1);
+            *index = i + 2;
+            return TRUE;
+        }
+    }
+
+    *index = size;
+    return FALSE;
+}
+
+
 /* Convert a hash value to a C integer. Raise direct exception if v is not an
    integer value. */
 #define HashToInt(t, v) \
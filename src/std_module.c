@@ -18,6 +18,7 @@
 #include "str.h"
 #include "int.h"
 #include "float.h"
+#include "floatconv.h"
 #include "internal.h"
 #include "gc.h"
 #include "class.h"
@@ -39,7 +40,6 @@ static ASymbolInfo *TypeSymbol(int globalnum);
 static int StdBooleanNum;
 static int StdArrayNum;
 static int StdTupleNum;
-static int StdMapNum;
 int AStdObjectNum;
 int AStdStrNum;
 int AStdIntNum;
@@ -272,7 +272,7 @@ static AValue StdMain(AThread *t, AValue *frame)
 
 #ifdef HAVE_JIT_COMPILER
     {
-        AValue map = ACallValue(t, AGlobalByNum(StdMapNum), 0, frame);
+        AValue map = ACallValue(t, AGlobalByNum(AStdMapNum), 0, frame);
         if (AIsError(map))
             return AError;
         ASetGlobalByNum(AJitInfoMapNum, map);
@@ -353,12 +353,10 @@ AValue AStdRepr(AThread *t, AValue *frame)
                               frame[0])->data.boundMethod.method))));
         retVal = ACreateStringFromCStr(t, buf);
     } else if (AIsFloat(frame[0])) {
-        char buf[100];
-        /* IDEA: Verify that the length of the buffer is reasonable. */
-        sprintf(buf, "%.17g", AValueToFloat(frame[0]));
-        /* If the float is an infinity or a NaN, the result of sprintf varies
-           from system to system. Normalize any non-standard values. */
-        AFixInfAndNanStrings(buf);
+        /* Use the shortest representation that converts back to the same
+           float. */
+        char buf[A_FLOAT_BUF_SIZE];
+        AFormatFloat(buf, AValueToFloat(frame[0]), 0);
         retVal = ACreateStringFromCStr(t, buf);
     } else
         retVal = ARaiseTypeErrorND(t, NULL);
@@ -879,12 +877,12 @@ static AValue WriteLn(AThread *t, AValue *frame)
 static AValue Print(AThread *t, AValue *frame)
 {
     Assize_t i;
-    Assize_t n = AArrayLen(frame[0]);
+    Assize_t n = AVarArgLen(t, frame[0]);
 
     frame[1] = AGlobalByNum(AStdOutNum);
 
     for (i = 0; i < n; i++) {
-        frame[2] = AArrayItem(frame[0], i);
+        frame[2] = AVarArgItem(t, frame[0], i);
         if (ACallMethod(t, "write", 1, frame + 1) == AError)
             return AError;
 
@@ -1138,9 +1136,9 @@ A_MODULE(std, "std")
         A_METHOD("next", 0, 0, ATupleIterNext)
     A_END_CLASS()
 
-    A_CLASS_PRIV_P("Map", 4, &StdMapNum)
+    A_CLASS_PRIV_P("Map", 4, &AStdMapNum)
         A_IMPLEMENT("std::Iterable")
-        A_METHOD_VARARG("create", 0, 0, 6, AMapCreate)
+        A_METHOD_VARARG_SLICE("create", 0, 0, 6, AMapCreate)
         A_METHOD("#i", 0, 0, AMapInitialize)
         A_METHOD("_get", 1, 3, AMap_get)
         A_METHOD("_set", 2, 3, AMap_set)
@@ -1178,7 +1176,7 @@ A_MODULE(std, "std")
         A_METHOD("strip", 0, 0, AStrStrip)
         A_METHOD_OPT("find", 1, 2, 2, AStrFind)
         A_METHOD("index", 1, 2, AStrIndex)
-        A_METHOD_VARARG("format", 0, 0, 4, AStrFormat)
+        A_METHOD_VARARG_SLICE("format", 0, 0, 5, AStrFormat)
         A_METHOD("startsWith", 1, 0, AStrStartsWith)
         A_METHOD("endsWith", 1, 0, AStrEndsWith)
         A_METHOD_OPT("replace", 2, 3, 1, AStrReplace)
@@ -1328,14 +1326,15 @@ A_MODULE(std, "std")
     A_DEF_P("Hash", 1, 2, AStdHash, &AStdHashNum) /* NOTE: don't change */
     A_DEF_OPT("Min", 1, 2, 2, StdMin)
     A_DEF_OPT("Max", 1, 2, 2, StdMax)
-    A_DEF_OPT("Sort", 1, 2, 5, AStdSort)
+    A_DEF_OPT("Sort", 1, 3, 6, AStdSort)
     A_DEF("Reversed", 1, 3, StdReversed)
 
     A_DEF_OPT("Exit", 0, 1, 2, StdExit)
 
-    A_DEF_VARARG("Print", 0, 0, 3, Print)
-    A_DEF_VARARG("WriteLn", 0, 0, 2, WriteLn) /* NOTE: See Print and Stream */
-    A_DEF_VARARG("Write", 0, 0, 2, Write)     /* NOTE: See Print and Stream */
+    A_DEF_VARARG_SLICE("Print", 0, 0, 3, Print)
+    /* NOTE: See Print and Stream */
+    A_DEF_VARARG_SLICE("WriteLn", 0, 0, 2, WriteLn)
+    A_DEF_VARARG_SLICE("Write", 0, 0, 2, Write)
     A_DEF("ReadLn", 0, 5, ReadLn)
 
     A_EMPTY_CONST_P("False", &FalseNum)
@@ -83,6 +83,15 @@ AValue AMapIterCreate(AThread *t, AValue *frame);
 AValue AMapIterHasNext(AThread *t, AValue *frame);
 AValue AMapIterNext(AThread *t, AValue *frame);
 
+AValue AMakeMapWithCapacity(AThread *t, Assize_t numItems);
+ABool AMapNextItem(AValue map, Assize_t *index, AValue *key, AValue *value);
+
+/* Is v a std::Map instance? Instances of subclasses are not included. */
+#define AIsMap(v) \
+    (AIsInstance(v) && AGetInstanceType(AValueToInstance(v)) == \
+     AValueToType(AGlobalByNum(AStdMapNum)))
+
+extern int AStdMapNum;
 extern int AMapIterNum;
 extern int AEmptyMarkerNum;
 extern int ARemovedMarkerNum;
@@ -6,94 +6,445 @@
    LICENSE.txt in the distribution.
 */
 
+/* Sort is a stable natural merge sort. Existing ascending and strictly
+   descending runs in the input are detected and used as is (descending runs
+   are reversed), short runs are extended using binary insertion sort and
+   runs are merged using a temporary buffer. Sorted and reversed inputs are
+   thus sorted in linear time.
+
+   If all the sort keys are short integers, Float objects or Str objects and
+   no comparison function is given, the keys are compared directly without
+   calling the generic comparison operations. Otherwise the comparisons may
+   call arbitrary Alore code, and the sort operates on indices of the key
+   array instead of references to the keys, since the garbage collector does
+   not see the contents of the sort buffer. */
+
 #include "alore.h"
+#include "runtime.h"
+#include "array.h"
+#include "str.h"
 #include "std_module.h"
 
 
-static ABool QSort(AThread *t, AValue *frame, int b, int e);
+/* Frame slots */
+#define SEQ 0    /* Sequence argument */
+#define FUNC 1   /* Comparison function argument */
+#define KEY 2    /* Key function argument */
+#define ITEMS 3  /* Array of items to sort */
+#define KEYS 4   /* Array of sort keys (equal to ITEMS if no key function) */
+#define BUF 5    /* Memory block that contains the sort buffers */
+#define ARGS 6   /* 3 slots for function arguments (ACallValue may use one
+                    extra slot) */
+
+
+/* Comparison kinds */
+enum {
+    SORT_INT,     /* All keys are short Int values */
+    SORT_FLOAT,   /* All keys are Float values */
+    SORT_STR,     /* All keys are Str values */
+    SORT_DEFAULT, /* Generic comparison using the > operation */
+    SORT_FUNC     /* Comparison using a comparison function */
+};
+
+
+/* Shorter runs are extended using insertion sort. */
+#define MIN_MERGE 64
+
+/* Enough for any sequence, since the lengths of the runs in the run stack
+   grow at least by a factor of 2 towards the bottom of the stack. */
+#define MAX_RUN_STACK (8 * sizeof(Assize_t) + 2)
+
+
+typedef struct {
+    AThread *t;
+    AValue *frame;
+    int kind;
+    /* If TRUE, the sorted values are the keys. Otherwise they are indices
+       to the KEYS array. */
+    ABool direct;
+    /* Pointer to the items of the KEYS array; valid only if kind is not
+       SORT_DEFAULT or SORT_FUNC (no garbage collection can happen during the
+       sort). */
+    AValue *keys;
+} SortContext;
+
+
+static int GetKind(AValue *keys, Assize_t len);
+static ABool SortBuffer(SortContext *c, AValue *a, AValue *tmp, Assize_t n);
 
 
 AValue AStdSort(AThread *t, AValue *frame)
 {
-    int len;
-    int i;
+    SortContext c;
+    Assize_t len;
+    Assize_t i;
+    AValue *a;
+
+    if (AIsNil(frame[FUNC]))
+        frame[FUNC] = ADefault;
+    if (AIsNil(frame[KEY]))
+        frame[KEY] = ADefault;
 
-    len = ALen(t, frame[0]);
+    len = ALen(t, frame[SEQ]);
     if (len < 0)
         return AError;
 
     /* Copy the items in the source sequence to an Array object. */
-    frame[2] = AMakeArray(t, len);
+    frame[ITEMS] = AMakeArray(t, len);
     for (i = 0; i < len; i++) {
-        AValue item = AGetItemAt(t, frame[0], i);
+        AValue item = AGetItemAt(t, frame[SEQ], i);
         if (AIsError(item))
             return AError;
-        ASetArrayItem(t, frame[2], i, item);
+        ASetArrayItem(t, frame[ITEMS], i, item);
     }
 
-    if (!QSort(t, frame, 0, len - 1))
+    if (len < 2)
+        return frame[ITEMS];
+
+    /* Calculate the sort keys, calling the key function only once per
+       item. */
+    if (AIsDefault(frame[KEY]))
+        frame[KEYS] = frame[ITEMS];
+    else {
+        frame[KEYS] = AMakeArray(t, len);
+        for (i = 0; i < len; i++) {
+            AValue key;
+            frame[ARGS] = AArrayItem(frame[ITEMS], i);
+            key = ACallValue(t, frame[KEY], 1, frame + ARGS);
+            if (AIsError(key))
+                return AError;
+            ASetArrayItem(t, frame[KEYS], i, key);
+        }
+    }
+
+    /* Allocate the sort buffer and the temporary merge buffer. */
+    frame[BUF] = AAllocMemFixed(t, 2 * len * sizeof(AValue));
+    if (AIsError(frame[BUF]))
         return AError;
+    a = AMemPtr(frame[BUF]);
+
+    c.t = t;
+    c.frame = frame;
+    if (AIsDefault(frame[FUNC]))
+        c.kind = GetKind(&AArrayItem(frame[KEYS], 0), len);
     else
-        return frame[2];
+        c.kind = SORT_FUNC;
+    c.direct = c.kind == SORT_INT && frame[KEYS] == frame[ITEMS];
+    c.keys = &AArrayItem(frame[KEYS], 0);
+
+    if (c.direct) {
+        /* Sort the short Int values directly. There are no references
+           visible to the garbage collector. */
+        for (i = 0; i < len; i++)
+            a[i] = AArrayItem(frame[ITEMS], i);
+        SortBuffer(&c, a, a + len, len);
+        for (i = 0; i < len; i++)
+            ASetArrayItem(t, frame[ITEMS], i, a[i]);
+        return frame[ITEMS];
+    }
+
+    for (i = 0; i < len; i++)
+        a[i] = i;
+    if (!SortBuffer(&c, a, a + len, len))
+        return AError;
+
+    /* Build the result by permuting the items. The buffer is fixed, so it
+       remains valid even if the allocation triggers garbage collection. */
+    frame[ARGS] = AMakeArray(t, len);
+    for (i = 0; i < len; i++)
+        ASetArrayItem(t, frame[ARGS], i, AArrayItem(frame[ITEMS], a[i]));
+
+    return frame[ARGS];
+}
+
+
+/* Return the most specialized comparison kind that supports all the keys. */
+static int GetKind(AValue *keys, Assize_t len)
+{
+    Assize_t i;
+
+    if (AIsShortInt(keys[0])) {
+        for (i = 1; i < len && AIsShortInt(keys[i]); i++);
+        if (i == len)
+            return SORT_INT;
+    } else if (AIsFloat(keys[0])) {
+        for (i = 1; i < len && AIsFloat(keys[i]); i++);
+        if (i == len)
+            return SORT_FLOAT;
+    } else if (AIsStr(keys[0])) {
+        for (i = 1; i < len && AIsStr(keys[i]); i++);
+        if (i == len)
+            return SORT_STR;
+    }
+
+    return SORT_DEFAULT;
 }
 
 
-static ABool QSort(AThread *t, AValue *frame, int b, int e)
+/* Return 1 if y must be placed before x in the sorted sequence (i.e. x > y
+   using the default comparison), 0 if not, or -1 if an exception was
+   raised. Equal items are never out of order, which makes the sort
+   stable. */
+static int IsOutOfOrder(SortContext *c, AValue x, AValue y)
 {
-    while (b < e) {
-        int l = b + 1;
-        int r = e;
-        frame[3] = AArrayItem(frame[2], b);
-
-        if (AIsDefault(frame[1])) {
-            /* Use the default comparison operations. */
-            while (l <= r) {
-                int res = AIsLte(t, AArrayItem(frame[2], l), frame[3]);
-                if (res > 0)
-                    l++;
-                else if (res == 0) {
-                    frame[4] = AArrayItem(frame[2], r);
-                    ASetArrayItem(t, frame[2], r, AArrayItem(frame[2], l));
-                    ASetArrayItem(t, frame[2], l, frame[4]);
-                    r--;
-                } else
-                    return FALSE;
-            }
+    if (!c->direct) {
+        if (c->kind < SORT_DEFAULT) {
+            x = c->keys[x];
+            y = c->keys[y];
         } else {
-            /* Use the provided comparison function. */
-            while (l <= r) {
-                AValue res;
-
-                frame[4] = frame[3];
-                frame[5] = AArrayItem(frame[2], l);
-                res = ACallValue(t, frame[1], 2, frame + 4);
-                if (AIsFalse(res))
-                    l++;
-                else if (AIsTrue(res)) {
-                    frame[4] = AArrayItem(frame[2], r);
-                    ASetArrayItem(t, frame[2], r, AArrayItem(frame[2], l));
-                    ASetArrayItem(t, frame[2], l, frame[4]);
-                    r--;
-                } else {
-                    if (!AIsError(res))
-                        ARaiseValueError(t, NULL);
-                    return FALSE;
-                }
-            }
+            x = AArrayItem(c->frame[KEYS], x);
+            y = AArrayItem(c->frame[KEYS], y);
+        }
+    }
+
+    switch (c->kind) {
+    case SORT_INT:
+        return (ASignedValue)x > (ASignedValue)y;
+
+    case SORT_FLOAT:
+        return AValueToFloat(x) > AValueToFloat(y);
+
+    case SORT_STR:
+        if (AIsNarrowStr(x) && AIsNarrowStr(y)) {
+            Assize_t len1 = AGetStrLen(AValueToStr(x));
+            Assize_t len2 = AGetStrLen(AValueToStr(y));
+            int res = memcmp(AStrPtr(x), AStrPtr(y),
+                             len1 < len2 ? len1 : len2);
+            return res > 0 || (res == 0 && len1 > len2);
+        } else
+            return ACompareStrings(x, y) > 0;
+
+    case SORT_DEFAULT:
+        return AIsGt(c->t, x, y);
+
+    default: {
+        /* The comparison function returns True if its first argument should
+           be placed before the second. */
+        AValue res;
+        c->frame[ARGS] = y;
+        c->frame[ARGS + 1] = x;
+        res = ACallValue(c->t, c->frame[FUNC], 2, c->frame + ARGS);
+        if (AIsTrue(res))
+            return 1;
+        else if (AIsFalse(res))
+            return 0;
+        else {
+            if (!AIsError(res))
+                ARaiseValueError(c->t, NULL);
+            return -1;
+        }
+    }
+    }
+}
+
+
+/* Return the smallest index i in a[lo:hi] for which IsOutOfOrder(a[i], x)
+   is true, or hi if there is no such index, or -1 on error. The range must
+   be sorted. */
+static Assize_t FindUpper(SortContext *c, AValue *a, Assize_t lo, Assize_t hi,
+                          AValue x)
+{
+    while (lo < hi) {
+        Assize_t mid = lo + (hi - lo) / 2;
+        int res = IsOutOfOrder(c, a[mid], x);
+        if (res < 0)
+            return -1;
+        if (res)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
+}
+
+
+/* Return the smallest index i in a[lo:hi] for which IsOutOfOrder(x, a[i])
+   is false, or hi if there is no such index, or -1 on error. The range must
+   be sorted. */
+static Assize_t FindLower(SortContext *c, AValue *a, Assize_t lo, Assize_t hi,
+                          AValue x)
+{
+    while (lo < hi) {
+        Assize_t mid = lo + (hi - lo) / 2;
+        int res = IsOutOfOrder(c, x, a[mid]);
+        if (res < 0)
+            return -1;
+        if (res)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+
+/* Sort a[lo:hi] using binary insertion sort, assuming that a[lo:start] is
+   already sorted. */
+static ABool InsertionSort(SortContext *c, AValue *a, Assize_t lo,
+                           Assize_t hi, Assize_t start)
+{
+    Assize_t i;
+
+    for (i = start; i < hi; i++) {
+        AValue x = a[i];
+        Assize_t pos = FindUpper(c, a, lo, i, x);
+        if (pos < 0)
+            return FALSE;
+        memmove(a + pos + 1, a + pos, (i - pos) * sizeof(AValue));
+        a[pos] = x;
+    }
+
+    return TRUE;
+}
+
+
+/* Return the length of the run starting at a[lo] (an ascending run or a
+   strictly descending run, which is reversed), or -1 on error. */
+static Assize_t CountRun(SortContext *c, AValue *a, Assize_t lo, Assize_t hi)
+{
+    Assize_t i;
+    int res;
+
+    if (lo + 1 == hi)
+        return 1;
+
+    res = IsOutOfOrder(c, a[lo], a[lo + 1]);
+    if (res < 0)
+        return -1;
+
+    if (res) {
+        /* Strictly descending run */
+        Assize_t l, r;
+        for (i = lo + 2; i < hi; i++) {
+            res = IsOutOfOrder(c, a[i - 1], a[i]);
+            if (res < 0)
+                return -1;
+            if (!res)
+                break;
         }
-        l--;
+        for (l = lo, r = i - 1; l < r; l++, r--) {
+            AValue tmp = a[l];
+            a[l] = a[r];
+            a[r] = tmp;
+        }
+        return i - lo;
+    } else {
+        /* Ascending run */
+        for (i = lo + 2; i < hi; i++) {
+            res = IsOutOfOrder(c, a[i - 1], a[i]);
+            if (res < 0)
+                return -1;
+            if (res)
+                break;
+        }
+        return i - lo;
+    }
+}
+
+
+/* Merge the adjacent sorted ranges a[lo:mid] and a[mid:hi]. */
+static ABool Merge(SortContext *c, AValue *a, AValue *tmp, Assize_t lo,
+                   Assize_t mid, Assize_t hi)
+{
+    Assize_t i, j, k, n;
+    int res;
+
+    /* Nothing to do if the ranges are already in order. */
+    res = IsOutOfOrder(c, a[mid - 1], a[mid]);
+    if (res <= 0)
+        return res == 0;
+
+    /* Items at the start of the left range that precede every item in the
+       right range and items at the end of the right range that follow every
+       item in the left range are already in their final positions. */
+    lo = FindUpper(c, a, lo, mid - 1, a[mid]);
+    if (lo < 0)
+        return FALSE;
+    hi = FindLower(c, a, mid + 1, hi, a[mid - 1]);
+    if (hi < 0)
+        return FALSE;
+
+    n = mid - lo;
+    memcpy(tmp, a + lo, n * sizeof(AValue));
+
+    i = 0;
+    j = mid;
+    k = lo;
+    while (i < n && j < hi) {
+        res = IsOutOfOrder(c, tmp[i], a[j]);
+        if (res < 0)
+            return FALSE;
+        if (res)
+            a[k++] = a[j++];
+        else
+            a[k++] = tmp[i++];
+    }
+    memcpy(a + k, tmp + i, (n - i) * sizeof(AValue));
+
+    return TRUE;
+}
+
+
+/* Calculate the minimum run length for a sequence of length n so that the
+   number of runs is a power of two or slightly less. */
+static Assize_t MinRunLength(Assize_t n)
+{
+    Assize_t r = 0;
+    while (n >= MIN_MERGE) {
+        r |= n & 1;
+        n >>= 1;
+    }
+    return n + r;
+}
 
-        frame[3] = AArrayItem(frame[2], l);
-        ASetArrayItem(t, frame[2], l, AArrayItem(frame[2], b));
-        ASetArrayItem(t, frame[2], b, frame[3]);
 
-        if (!QSort(t, frame, b, l - 1))
+/* Sort the n items in a using tmp (with space for n items) as the temporary
+   merge buffer. */
+static ABool SortBuffer(SortContext *c, AValue *a, AValue *tmp, Assize_t n)
+{
+    Assize_t runBase[MAX_RUN_STACK];
+    Assize_t runLen[MAX_RUN_STACK];
+    int numRuns = 0;
+    Assize_t minRun = MinRunLength(n);
+    Assize_t lo = 0;
+
+    while (lo < n) {
+        Assize_t len = CountRun(c, a, lo, n);
+        if (len < 0)
             return FALSE;
 
-        b = l + 1;
+        if (len < minRun) {
+            Assize_t force = n - lo < minRun ? n - lo : minRun;
+            if (!InsertionSort(c, a, lo, lo + force, lo + len))
+                return FALSE;
+            len = force;
+        }
+
+        runBase[numRuns] = lo;
+        runLen[numRuns] = len;
+        numRuns++;
+
+        /* Merge runs of similar length to keep the merges balanced. */
+        while (numRuns >= 2
+               && runLen[numRuns - 2] <= 2 * runLen[numRuns - 1]) {
+            Assize_t base = runBase[numRuns - 2];
+            Assize_t mid = runBase[numRuns - 1];
+            if (!Merge(c, a, tmp, base, mid, mid + runLen[numRuns - 1]))
+                return FALSE;
+            runLen[numRuns - 2] += runLen[numRuns - 1];
+            numRuns--;
+        }
+
+        lo += len;
+    }
 
-        /* The next while iteration logically corresponds to recursive call
-           QSort(frame, l + 1, e). */
+    while (numRuns >= 2) {
+        Assize_t base = runBase[numRuns - 2];
+        Assize_t mid = runBase[numRuns - 1];
+        if (!Merge(c, a, tmp, base, mid, mid + runLen[numRuns - 1]))
+            return FALSE;
+        runLen[numRuns - 2] += runLen[numRuns - 1];
+        numRuns--;
     }
 
     return TRUE;
@@ -21,6 +21,8 @@
 #include "symtable.h"
 #include "std_module.h"
 #include "encodings_module.h"
+#include "utf8.h"
+#include "floatconv.h"
 
 
 /* Note that the method of Str must wrap the self instance in their bodies,
@@ -128,14 +130,9 @@ AValue AStdStr(AThread *t, AValue *frame)
                 t, "_str of %T returned non-string (%T)", frame[0], v);
     } else if (AIsFloat(frame[0])) {
         /* Float to Str */
-        /* IDEA: sprintf might produce inconsistent results compared with
-                 format() of Str. Verify that they are reasonable. */
-        /* IDEA: Verify that the length of the buffer is reasonable. */
-        char buf[100];
-        sprintf(buf, "%.10g", AValueToFloat(frame[0]));
-        /* If the float is an infinity or a NaN, the result of sprintf varies
-           from system to system. Normalize any non-standard values. */
-        AFixInfAndNanStrings(buf);
+        /* Use 10 significant digits (like "%.10g" in printf). */
+        char buf[A_FLOAT_BUF_SIZE];
+        AFormatFloat(buf, AValueToFloat(frame[0]), 10);
         return ACreateStringFromCStr(t, buf);
     } else if (AIsLongInt(frame[0]))
         return ALongIntToStr(t, frame[0], 10, 0);
@@ -160,8 +157,8 @@ AValue AStdStr(AThread *t, AValue *frame)
 /* Str length() */
 AValue AStrLengthMethod(AThread *t, AValue *frame)
 {
-    frame[0] = AWrapObject(t, frame[0]);
-    return AMakeInt_ssize_t(t, AStrLen(A_UNWRAP(frame[0])));
+    frame[0] = A_UNWRAP_SELF(frame[0]);
+    return AMakeInt_ssize_t(t, AStrLen(frame[0]));
 }
 
 
@@ -170,9 +167,9 @@ AValue AStrCount(AThread *t, AValue *frame)
 {
     Assize_t n;
 
-    frame[0] = AWrapObject(t, frame[0]);
+    frame[0] = A_UNWRAP_SELF(frame[0]);
     AExpectStr(t, frame[1]);
-    frame[2] = A_UNWRAP(frame[0]);
+    frame[2] = frame[0];
 
     n = Count(frame[2], frame[1], A_SSIZE_T_MAX);
     return AMakeInt_ssize_t(t, n);
@@ -185,8 +182,8 @@ AValue AStrUpper(AThread *t, AValue *frame)
     Assize_t begIndex;
     Assize_t len;
 
-    frame[0] = AWrapObject(t, frame[0]);
-    frame[1] = A_UNWRAP(frame[0]);
+    frame[0] = A_UNWRAP_SELF(frame[0]);
+    frame[1] = frame[0];
 
     /* Use optimized alternative implementations for different string
        representations. */
@@ -210,7 +207,12 @@ AValue AStrUpper(AThread *t, AValue *frame)
 
         src = AValueToStr(frame[1])->elem + begIndex;
 
+        /* Convert runs of ASCII characters with a fast primitive and use the
+           case table for the rest. */
         for (i = 0; i < len; i++) {
+            i += AAsciiUpper(s->elem + i, src + i, len - i);
+            if (i == len)
+                break;
             if (src[i] == 255)
                 goto ConvertToWide;
             s->elem[i] = AUpperCase[src[i]];
@@ -223,6 +225,7 @@ AValue AStrUpper(AThread *t, AValue *frame)
         frame[1] = ANarrowStringToWide(t, frame[0], frame);
         if (AIsError(frame[1]))
             return AError;
+        begIndex = 0;
         goto Wide;
     } else if (AIsWideStr(frame[1])) {
         AWideString *s;
@@ -272,8 +275,8 @@ AValue AStrLower(AThread *t, AValue *frame)
     Assize_t begIndex;
     Assize_t len;
 
-    frame[0] = AWrapObject(t, frame[0]);
-    frame[1] = A_UNWRAP(frame[0]);
+    frame[0] = A_UNWRAP_SELF(frame[0]);
+    frame[1] = frame[0];
 
     /* Use optimized alternative implementations for different string
        representations. */
@@ -296,8 +299,12 @@ AValue AStrLower(AThread *t, AValue *frame)
 
         src = AValueToStr(frame[1])->elem + begIndex;
 
-        for (i = 0; i < len; i++)
+        for (i = 0; i < len; i++) {
+            i += AAsciiLower(s->elem + i, src + i, len - i);
+            if (i == len)
+                break;
             s->elem[i] = ALowerCase[src[i]];
+        }
 
         return AStrToValue(s);
     } else if (AIsWideStr(frame[1])) {
@@ -342,33 +349,36 @@ AValue AStrLower(AThread *t, AValue *frame)
 }
 
 
+#define IS_SPLIT_SPACE(ch) \
+    ((ch) == ' ' || (ch) == '\n' || (ch) == '\r' || (ch) == '\t')
+
+
 /* Str strip() */
 AValue AStrStrip(AThread *t, AValue *frame)
 {
     Assize_t i1, i2, len;
     AValue str;
 
-    frame[0] = AWrapObject(t, frame[0]);
-    str = A_UNWRAP(frame[0]);
+    frame[0] = A_UNWRAP_SELF(frame[0]);
+    str = frame[0];
 
     len = AStrLen(str);
-    i1 = 0;
-    while (i1 < len) {
-        int ch = AStrItem(str, i1);
-        if (ch != ' ' && ch != '\t' && ch != '\n' && ch != '\r')
-            break;
-        i1++;
+    if (AIsNarrowStr(str) || AIsNarrowSubStr(str)) {
+        const unsigned char *s = ANarrowStrItems(str);
+        for (i1 = 0; i1 < len && IS_SPLIT_SPACE(s[i1]); i1++);
+        for (i2 = len; i2 > i1 && IS_SPLIT_SPACE(s[i2 - 1]); i2--);
+    } else {
+        for (i1 = 0; i1 < len && IS_SPLIT_SPACE(AStrItem(str, i1)); i1++);
+        for (i2 = len; i2 > i1 && IS_SPLIT_SPACE(AStrItem(str, i2 - 1));
+             i2--);
     }
 
-    i2 = len - 1;
-    while (i2 > i1) {
-        int ch = AStrItem(str, i2);
-        if (ch != ' ' && ch != '\t' && ch != '\n' && ch != '\r')
-            break;
-        i2--;
-    }
+    /* Strings are immutable, so there is no need to copy the string if
+       there is nothing to strip. */
+    if (i1 == 0 && i2 == len)
+        return str;
 
-    return ASubStr(t, str, i1, i2 + 1);
+    return ASubStr(t, str, i1, i2);
 }
 
 
@@ -378,7 +388,7 @@ AValue AStrFind(AThread *t, AValue *frame)
     Assize_t index;
     Assize_t startIndex;
 
-    frame[0] = AWrapObject(t, frame[0]);
+    frame[0] = A_UNWRAP_SELF(frame[0]);
 
     AExpectStr(t, frame[1]);
 
@@ -389,7 +399,7 @@ AValue AStrFind(AThread *t, AValue *frame)
     } else
         startIndex = 0;
 
-    index = Find(A_UNWRAP(frame[0]), startIndex, frame[1]);
+    index = Find(frame[0], startIndex, frame[1]);
 
     if (index >= 0)
         return AMakeInt_ssize_t(t, index);
@@ -403,11 +413,11 @@ AValue AStrIndex(AThread *t, AValue *frame)
 {
     Assize_t index;
 
-    frame[0] = AWrapObject(t, frame[0]);
+    frame[0] = A_UNWRAP_SELF(frame[0]);
 
     AExpectStr(t, frame[1]);
 
-    index = Find(A_UNWRAP(frame[0]), 0, frame[1]);
+    index = Find(frame[0], 0, frame[1]);
 
     if (index >= 0)
         return AMakeInt_ssize_t(t, index);
@@ -419,9 +429,9 @@ AValue AStrIndex(AThread *t, AValue *frame)
 /* Str format(fmt, ...) */
 AValue AStrFormat(AThread *t, AValue *frame)
 {
-    frame[0] = AWrapObject(t, frame[0]);
+    frame[0] = A_UNWRAP_SELF(frame[0]);
     frame[2] = frame[1];
-    frame[1] = A_UNWRAP(frame[0]);
+    frame[1] = frame[0];
     return AFormat(t, frame + 1);
 }
 
@@ -432,8 +442,8 @@ AValue AStrStartsWith(AThread *t, AValue *frame)
     Assize_t len, prefixLen, i;
     AValue str;
 
-    frame[0] = AWrapObject(t, frame[0]);
-    str = A_UNWRAP(frame[0]);
+    frame[0] = A_UNWRAP_SELF(frame[0]);
+    str = frame[0];
     AExpectStr(t, frame[1]);
 
     len = AStrLen(str);
@@ -457,8 +467,8 @@ AValue AStrEndsWith(AThread *t, AValue *frame)
     Assize_t len, suffixLen, i;
     AValue str;
 
-    frame[0] = AWrapObject(t, frame[0]);
-    str = A_UNWRAP(frame[0]);
+    frame[0] = A_UNWRAP_SELF(frame[0]);
+    str = frame[0];
     AExpectStr(t, frame[1]);
 
     len = AStrLen(str);
@@ -486,7 +496,7 @@ AValue AStrReplace(AThread *t, AValue *frame)
     int ch;
     Assize_t n;
 
-    frame[0] = AWrapObject(t, frame[0]);
+    frame[0] = A_UNWRAP_SELF(frame[0]);
 
     AExpectStr(t, frame[1]);
     AExpectStr(t, frame[2]);
@@ -496,7 +506,7 @@ AValue AStrReplace(AThread *t, AValue *frame)
     else
         max = AGetInt(t, frame[3]);
 
-    frame[3] = A_UNWRAP(frame[0]);
+    frame[3] = frame[0];
     origLen = AStrLen(frame[3]);
     srcLen = AStrLen(frame[1]);
     dstLen = AStrLen(frame[2]);
@@ -579,8 +589,101 @@ static ABool IsMatchAt(AValue src, Assize_t i, AValue dst, Assize_t dstLen)
 }
 
 
-#define IS_SPLIT_SPACE(ch) \
-    ((ch) == ' ' || (ch) == '\n' || (ch) == '\r' || (ch) == '\t')
+static Assize_t FindNarrow(const unsigned char *s, Assize_t len, Assize_t i,
+                           const unsigned char *sub, Assize_t subLen);
+
+
+/* Find the end of a field of a narrow string s[0..len) for split(), when the
+   field starts at index i. If sep is NULL, fields are separated by runs of
+   whitespace; otherwise they are separated by sep[0..sepLen). Store the index
+   of the start of the next field in *next, or -1 if the field is the last
+   one. */
+static Assize_t FindFieldEnd(const unsigned char *s, Assize_t len, Assize_t i,
+                             const unsigned char *sep, Assize_t sepLen,
+                             Assize_t *next)
+{
+    if (sep == NULL) {
+        Assize_t j;
+
+        while (i < len && !IS_SPLIT_SPACE(s[i]))
+            i++;
+        for (j = i; j < len && IS_SPLIT_SPACE(s[j]); j++);
+        *next = j < len ? j : -1;
+        return i;
+    } else {
+        Assize_t end = FindNarrow(s, len, i, sep, sepLen);
+        if (end < 0) {
+            *next = -1;
+            return len;
+        }
+        *next = end + sepLen;
+        return end;
+    }
+}
+
+
+/* Split a narrow string frame[3] using narrow separator frame[1] or, if
+   isDefaultSep is true, runs of whitespace. Perform at most max splits.
+   Count the fields first so that the result array is allocated only once.
+   The fields are created using ASubStr, which does not copy long fields. */
+static AValue SplitNarrow(AThread *t, AValue *frame, ABool isDefaultSep,
+                          Assize_t max)
+{
+    const unsigned char *s;
+    const unsigned char *sep;
+    Assize_t len, sepLen;
+    Assize_t i, i0, end, next;
+    Assize_t n, numFields;
+    ABool isLimited;
+    AValue field;
+
+    len = AStrLen(frame[3]);
+    sepLen = isDefaultSep ? 0 : AStrLen(frame[1]);
+    s = ANarrowStrItems(frame[3]);
+    sep = isDefaultSep ? NULL : ANarrowStrItems(frame[1]);
+
+    i0 = 0;
+    if (isDefaultSep) {
+        /* Whitespace at the start and the end of the string is ignored. */
+        while (i0 < len && IS_SPLIT_SPACE(s[i0]))
+            i0++;
+        if (i0 == len)
+            return AMakeArray(t, 0);
+    }
+
+    /* Count the fields. */
+    isLimited = FALSE;
+    numFields = 1;
+    for (i = i0;; i = next) {
+        if (numFields > max) {
+            isLimited = TRUE;
+            break;
+        }
+        FindFieldEnd(s, len, i, sep, sepLen, &next);
+        if (next < 0)
+            break;
+        numFields++;
+    }
+
+    frame[4] = AMakeArray(t, numFields);
+
+    /* Create the fields. The string contents may move whenever a field is
+       allocated. */
+    i = i0;
+    for (n = 0; n < numFields; n++) {
+        s = ANarrowStrItems(frame[3]);
+        sep = isDefaultSep ? NULL : ANarrowStrItems(frame[1]);
+        if (n < numFields - 1 || !isLimited)
+            end = FindFieldEnd(s, len, i, sep, sepLen, &next);
+        else
+            end = len;
+        field = ASubStr(t, frame[3], i, end);
+        ASetArrayItem(t, frame[4], n, field);
+        i = next;
+    }
+
+    return frame[4];
+}
 
 
 /* Str split([sep[, max]]) */
@@ -592,10 +695,8 @@ AValue AStrSplit(AThread *t, AValue *frame)
     ssize_t n;
     AValue ss;
 
+    frame[0] = A_UNWRAP_SELF(frame[0]);
     frame[3] = frame[0];
-    frame[0] = AWrapObject(t, frame[0]);
-
-    frame[4] = AMakeArray(t, 0);
 
     strLen = AStrLen(frame[3]);
     if (!AIsDefault(frame[2]))
@@ -616,6 +717,12 @@ AValue AStrSplit(AThread *t, AValue *frame)
         if (sepLen == 0)
             return ARaiseValueError(t, "Empty separator");
 
+        if ((AIsNarrowStr(frame[3]) || AIsNarrowSubStr(frame[3]))
+            && (AIsNarrowStr(frame[1]) || AIsNarrowSubStr(frame[1])))
+            return SplitNarrow(t, frame, FALSE, max);
+
+        frame[4] = AMakeArray(t, 0);
+
         ch = AStrItem(frame[1], 0);
         i0 = 0;
         for (i = 0; i <= strLen - sepLen;) {
@@ -632,6 +739,10 @@ AValue AStrSplit(AThread *t, AValue *frame)
     } else {
         /* Run of whitespace as a separator. Whitespace at the start and the
            end of the string is ignored. */
+        if (AIsNarrowStr(frame[3]) || AIsNarrowSubStr(frame[3]))
+            return SplitNarrow(t, frame, TRUE, max);
+
+        frame[4] = AMakeArray(t, 0);
         for (i0 = 0; i0 < strLen; i0++) {
             int ch = AStrItem(frame[3], i0);
             if (!IS_SPLIT_SPACE(ch))
@@ -677,11 +788,11 @@ AValue AStrJoin(AThread *t, AValue *frame)
     ABool isWide;
     ssize_t sepLen;
 
+    frame[0] = A_UNWRAP_SELF(frame[0]);
     frame[3] = frame[0];
-    frame[0] = AWrapObject(t, frame[0]);
 
     sepLen = AStrLen(frame[3]);
-    isWide = AIsWideStr(frame[3]) || AIsWideSubStr(frame[3]);
+    isWide = !AIsNarrowStringContents(frame[3]);
 
     /* Calculate the total length of the result. */
     len = ALen(t, frame[1]);
@@ -694,9 +805,10 @@ AValue AStrJoin(AThread *t, AValue *frame)
     for (i = 0; i < len; i++) {
         AValue s = AGetItemAt(t, frame[1], i);
         if (!AIsNarrowStr(s) && !AIsNarrowSubStr(s)) {
-            if (AIsStr(s))
-                isWide = TRUE;
-            else if (AIsError(s))
+            if (AIsStr(s)) {
+                if (!isWide)
+                    isWide = !AIsNarrowStringContents(s);
+            } else if (AIsError(s))
                 return AError;
             else
                 ARaiseTypeError(t, AMsgStrExpected);
@@ -746,12 +858,12 @@ AValue AStrDecode(AThread *t, AValue *frame)
 {
     ABool isStrict = TRUE;
 
-    frame[0] = AWrapObject(t, frame[0]);
+    frame[0] = A_UNWRAP_SELF(frame[0]);
 
     /* Shift arguments by 1. */
     frame[3] = frame[2];
     frame[2] = frame[1];
-    frame[1] = A_UNWRAP(frame[0]);
+    frame[1] = frame[0];
 
     /* Did caller provide a strictness argument? */
     if (AIsDefault(frame[3])) {
@@ -793,7 +905,7 @@ AValue AStrDecode(AThread *t, AValue *frame)
 /* Str encode(encoding[, strictness]) */
 AValue AStrEncode(AThread *t, AValue *frame)
 {
-    frame[0] = AWrapObject(t, frame[0]);
+    frame[0] = A_UNWRAP_SELF(frame[0]);
 
     /* Did caller provide a strictness argument? */
     if (AIsDefault(frame[2])) {
@@ -807,7 +919,7 @@ AValue AStrEncode(AThread *t, AValue *frame)
     if (AIsError(frame[2]))
         return AError;
 
-    frame[3] = A_UNWRAP(frame[0]);
+    frame[3] = frame[0];
     return ACallMethod(t, "encode", 1, frame + 2);
 }
 
@@ -815,8 +927,8 @@ AValue AStrEncode(AThread *t, AValue *frame)
 /* Str iterator() */
 AValue AStrIter(AThread *t, AValue *frame)
 {
+    frame[0] = A_UNWRAP_SELF(frame[0]);
     frame[1] = frame[0];
-    frame[0] = AWrapObject(t, frame[0]);
 
     return ACallValue(t, AGlobalByNum(AStrIterNum), 1, frame + 1);
 }
@@ -923,16 +1035,10 @@ void ASetStrItem(AValue v, Assize_t index, AWideChar ch)
    UTF-8, without the null terminator. */
 Assize_t AStrLenUtf8(AValue v)
 {
-    Assize_t i;
-    Assize_t len;
-    Assize_t utf8len;
-
-    len = AStrLen(v);
-    utf8len = 0;
-    for (i = 0; i < len; i++)
-        utf8len += A_UTF8_LEN(AStrItem(v, i));
-
-    return utf8len;
+    if (AIsNarrowStr(v) || AIsNarrowSubStr(v))
+        return AUtf8Length(ANarrowStrItems(v), AStrLen(v));
+    else
+        return AUtf8LengthW(AWideStrItems(v), AStrLen(v));
 }
 
 
@@ -974,41 +1080,20 @@ Assize_t AGetStrW(AThread *t, AValue s, AWideChar *buf, Assize_t bufLen)
    the result is too long to fit within the buffer. */
 Assize_t AGetStrUtf8(AThread *t, AValue s, char *buf, Assize_t bufLen)
 {
-    Assize_t i, j;
-    Assize_t len;
     Assize_t resultLen;
 
     AExpectStr(t, s);
 
-    len = AStrLen(s);
-
-    /* Calculate the length of the UTF-8 encoded string. */
-    resultLen = 0;
-    for (i = 0; i < len; i++)
-        resultLen += A_UTF8_LEN(AStrItem(s, i));
-
+    resultLen = AStrLenUtf8(s);
     if (resultLen >= bufLen)
         ARaiseValueError(t, "Str too long");
 
     /* UTF-8 encode the input string into buf. */
-    j = 0;
-    for (i = 0; i < len; i++) {
-        AWideChar ch = AStrItem(s, i);
-        if (ch <= 0x7f) {
-            buf[j] = ch;
-            j++;
-        } else if (ch <= 0x7ff) {
-            buf[j] = 0xc0 | (ch >> 6);
-            buf[j + 1] = 0x80 | (ch & 0x3f);
-            j += 2;
-        } else {
-            buf[j] = 0xe0 | (ch >> 12);
-            buf[j + 1] = 0x80 | ((ch >> 6) & 0x3f);
-            buf[j + 2] = 0x80 | (ch & 0x3f);
-            j += 3;
-        }
-    }
-    buf[j] = '\0';
+    if (AIsNarrowStr(s) || AIsNarrowSubStr(s))
+        AEncodeUtf8((unsigned char *)buf, ANarrowStrItems(s), AStrLen(s));
+    else
+        AEncodeUtf8W((unsigned char *)buf, AWideStrItems(s), AStrLen(s));
+    buf[resultLen] = '\0';
 
     return resultLen;
 }
@@ -1041,58 +1126,26 @@ AValue AMakeStrW(AThread *t, const AWideChar *str)
 /* Make a string from a null-terminated UTF-8 string. */
 AValue AMakeStrUtf8(AThread *t, const char *str)
 {
-    int i, j;
-    int len;
-    int resultLen;
-    AValue s;
+    const unsigned char *s = (const unsigned char *)str;
+    Assize_t len;
+    Assize_t numChars;
+    int maxChar;
+    AValue v;
 
     len = strlen(str);
-    resultLen = 0;
-
-    for (i = 0; i < len; ) {
-        i += A_UTF8_SKIP((unsigned char)str[i]);
-        resultLen++;
-    }
-
-    if (i != len)
-        goto DecodeError;
-
-    s = AMakeEmptyStrW(t, resultLen);
-    j = 0;
-    for (i = 0; i < resultLen; i++) {
-        unsigned char ch1 = str[j];
-        AWideChar result;
-
-        if (ch1 <= 0x7f) {
-            result = ch1;
-            j++;
-        } else if (ch1 < 0xc2) {
-            j++;
-            goto DecodeError;
-        } else if (ch1 < 0xe0) {
-            unsigned char ch2 = str[j + 1];
-            j += 2;
-            if (ch2 < 0x80 || ch2 > 0xbf)
-                goto DecodeError;
-            result = ((ch1 & 0x1f) << 6) | (ch2 & 0x3f);
-        } else {
-            unsigned char ch2 = str[j + 1];
-            unsigned char ch3 = str[j + 2];
-            j += 3;
-            if (ch2 < 0x80 || ch2 > 0xbf || ch3 < 0x80 || ch3 > 0xbf
-                || (ch1 == 0xe0 && ch2 < 0xa0))
-                goto DecodeError;
-            result = ((ch1 & 0xf) << 12) | ((ch2 & 0x3f) << 6) | (ch3 & 0x3f);
-        }
+    if (AScanUtf8(s, len, &numChars, &maxChar) != len
+        || maxChar == A_UTF8_INVALID)
+        return ARaiseValueError(t, "Invalid UTF-8 sequence");
 
-        ASetStrItemW(s, i, result);
+    if (maxChar < 0x100) {
+        v = AMakeEmptyStr(t, numChars);
+        ADecodeUtf8(AGetStrElem(v), s, len);
+    } else {
+        v = AMakeEmptyStrW(t, numChars);
+        ADecodeUtf8W(AGetWideStrElem(v), s, len);
     }
 
-    return s;
-
-  DecodeError:
-
-    return ARaiseValueError(t, "Invalid UTF-8 sequence");
+    return v;
 }
 
 
@@ -1413,19 +1466,8 @@ ABool AIsNarrowStringContents(AValue str)
     if (AIsNarrowStr(str) || AIsNarrowSubStr(str))
         return TRUE;
     else {
-        Assize_t i;
-        Assize_t len;
-        AWideChar *elem;
-
-        len = AStrLen(str);
-        elem = AWideStrItems(str);
-
-        for (i = 0; i < len; i++) {
-            if (elem[i] > 0xff)
-                return FALSE;
-        }
-
-        return TRUE;
+        Assize_t len = AStrLen(str);
+        return ANarrowPrefixLength(AWideStrItems(str), len) == len;
     }
 }
 
@@ -1572,76 +1614,64 @@ AValue AConcatStrings(AThread *t, AValue left, AValue right)
 }
 
 
-/* Return the concatenation of two strings as a wide string. The arguments
-   can be any string values. */
+/* Return the concatenation of two strings when at least one of them is wide.
+   The arguments can be any string values. Use a narrow result if all the
+   characters are less than 256 (for example, if a wide operand is a substring
+   of a wide string). Narrow operands are widened directly into the result. */
 AValue AConcatWideStrings(AThread *t, AValue left, AValue right)
 {
     Assize_t leftLen;
     Assize_t rightLen;
     Assize_t blockSize;
-    AWideString *wideStr;
-    AWideChar *leftStr;
-    AWideChar *rightStr;
-
-    if (AIsNarrowStr(left) || AIsNarrowSubStr(left))
-        left = ANarrowStringToWide(t, left, &right);
+    ABool isNarrow;
+    void *block;
 
-    if (!AIsWideStr(right)) {
-        if (AIsNarrowStr(right) || AIsNarrowSubStr(right))
-            right = ANarrowStringToWide(t, right, &left);
-        else if (!AIsSubStr(right))
-            return ARaiseBinopTypeErrorND(t, OPER_PLUS, left, right);
-    }
-
-    if (AIsSubStr(left))
-        leftLen = AGetSubStrLen(AValueToSubStr(left));
-    else if (AIsWideStr(left))
-        leftLen = AGetWideStrLen(AValueToWideStr(left));
-    else
+    if (!AIsStr(left) || !AIsStr(right))
         return ARaiseBinopTypeErrorND(t, OPER_PLUS, left, right);
 
-    if (AIsSubStr(right))
-        rightLen = AGetSubStrLen(AValueToSubStr(right));
+    leftLen = AStrLen(left);
+    rightLen = AStrLen(right);
+
+    isNarrow = AIsNarrowStringContents(left)
+        && AIsNarrowStringContents(right);
+    if (isNarrow)
+        blockSize = AGetBlockSize(sizeof(AValue) + leftLen + rightLen);
     else
-        rightLen = AGetWideStrLen(AValueToWideStr(right));
+        blockSize = AGetBlockSize(sizeof(AValue) + sizeof(AWideChar) *
+                                  (leftLen + rightLen));
 
-    blockSize = AGetBlockSize(sizeof(AValue) + sizeof(AWideChar) *
-                              (leftLen + rightLen));
     /* Can we use optimized inline memory allocation? */
     if (t->heapPtr + blockSize > t->heapEnd || A_NO_INLINE_ALLOC) {
         /* Ordinary allocation. */
         t->tempStack[0] = left;
         t->tempStack[1] = right;
 
-        wideStr = AAlloc(t, blockSize);
-        if (wideStr == NULL)
+        block = AAlloc(t, blockSize);
+        if (block == NULL)
             return AError;
 
         left  = t->tempStack[0];
         right = t->tempStack[1];
     } else {
         /* Optimized allocation from nursery. */
-        wideStr = (AWideString *)t->heapPtr;
+        block = t->heapPtr;
         t->heapPtr += blockSize;
     }
 
-    if (AIsSubStr(left))
-        leftStr = AGetWideSubStrElem(left);
-    else
-        leftStr = AGetWideStrElem(left);
-
-    if (AIsSubStr(right))
-        rightStr = AGetWideSubStrElem(right);
-    else
-        rightStr = AGetWideStrElem(right);
-
-    AInitNonPointerBlock(&wideStr->header,
-                         (leftLen + rightLen) * sizeof(AWideChar));
-
-    ACopyMem(wideStr->elem, leftStr, leftLen * sizeof(AWideChar));
-    ACopyMem(wideStr->elem + leftLen, rightStr, rightLen * sizeof(AWideChar));
-
-    return AWideStrToValue(wideStr);
+    if (isNarrow) {
+        AString *str = block;
+        AInitNonPointerBlock(&str->header, leftLen + rightLen);
+        ACopySubStr(AStrToValue(str), 0, left, 0, leftLen);
+        ACopySubStr(AStrToValue(str), leftLen, right, 0, rightLen);
+        return AStrToValue(str);
+    } else {
+        AWideString *wideStr = block;
+        AInitNonPointerBlock(&wideStr->header,
+                             (leftLen + rightLen) * sizeof(AWideChar));
+        ACopySubStr(AWideStrToValue(wideStr), 0, left, 0, leftLen);
+        ACopySubStr(AWideStrToValue(wideStr), leftLen, right, 0, rightLen);
+        return AWideStrToValue(wideStr);
+    }
 }
 
 
@@ -1780,6 +1810,30 @@ AValue ACreateSubStr(AThread *t, AValue strVal, Assize_t begInd,
 
       WideStr:
 
+        if (len < (A_MIN_SUBSTR_LEN + 1) / 2
+            && ANarrowPrefixLength(wideStr->elem + begInd, len) == len) {
+            /* The characters fit in a short narrow string. */
+            AString *newStr;
+
+            if (t->heapPtr + A_COPY_SUBSTR_SIZE > t->heapEnd
+                || A_NO_INLINE_ALLOC) {
+                *t->tempStack = strVal;
+                newStr = AAlloc(t, A_COPY_SUBSTR_SIZE);
+                if (newStr == NULL)
+                    return AError;
+                strVal = *t->tempStack;
+                wideStr = AValueToWideStr(strVal);
+            } else {
+                newStr = (AString *)t->heapPtr;
+                t->heapPtr += A_COPY_SUBSTR_SIZE;
+            }
+
+            AInitNonPointerBlock(&newStr->header, len);
+            ANarrowChars(newStr->elem, wideStr->elem + begInd, len);
+
+            return AStrToValue(newStr);
+        }
+
         if (len < (A_MIN_SUBSTR_LEN + 1) / 2) {
             /* Optimized inline memory allocation? */
             if (t->heapPtr + A_COPY_SUBSTR_SIZE > t->heapEnd
@@ -1790,7 +1844,7 @@ AValue ACreateSubStr(AThread *t, AValue strVal, Assize_t begInd,
                 if (newWideStr == NULL)
                     return AError;
                 strVal = *t->tempStack;
-                str = AValueToStr(strVal);
+                wideStr = AValueToWideStr(strVal);
             } else {
                 /* Yes; optimzied inline allocation */
                 newWideStr = (AWideString *)t->heapPtr;
@@ -1855,13 +1909,10 @@ int ACompareStrings(AValue s1, AValue s2)
 
           NarrowVsNarrow:
 
-            while (len1 > 0 && len2 > 0) {
-                if (*str1 != *str2)
-                    return *str1 - *str2;
-                len1--;
-                len2--;
-                str1++;
-                str2++;
+            {
+                int result = memcmp(str1, str2, len1 < len2 ? len1 : len2);
+                if (result != 0)
+                    return result < 0 ? -1 : 1;
             }
 
             return len1 - len2;
@@ -2305,6 +2356,57 @@ AValue AJoin(AThread *t, AValue sequence, AValue separator)
 }
 
 
+/* Find the leftmost instance of sub[0..subLen) in s[i..len) when both are
+   narrow. Assume subLen > 0. */
+static Assize_t FindNarrow(const unsigned char *s, Assize_t len, Assize_t i,
+                           const unsigned char *sub, Assize_t subLen)
+{
+    const unsigned char *p = s + i;
+    const unsigned char *last = s + len - subLen;
+
+    while (p <= last) {
+        p = memchr(p, sub[0], last - p + 1);
+        if (p == NULL)
+            break;
+        if (memcmp(p + 1, sub + 1, subLen - 1) == 0)
+            return p - s;
+        p++;
+    }
+
+    return -1;
+}
+
+
+/* Include the generic find function for the other combinations of narrow and
+   wide operands. */
+
+#define STR_CHAR unsigned char
+#define SUB_CHAR AWideChar
+#define FIND_FN FindNarrowWide
+
+#include "std_str_inc.c"
+
+#undef STR_CHAR
+#undef SUB_CHAR
+#undef FIND_FN
+
+#define STR_CHAR AWideChar
+#define SUB_CHAR unsigned char
+#define FIND_FN FindWideNarrow
+
+#include "std_str_inc.c"
+
+#undef STR_CHAR
+#undef SUB_CHAR
+#undef FIND_FN
+
+#define STR_CHAR AWideChar
+#define SUB_CHAR AWideChar
+#define FIND_FN FindWide
+
+#include "std_str_inc.c"
+
+
 /* Find leftmost instance of sub-string in a string starting from the specified
    index (0 == start of string). Return -1 if not found, otherwise return the
    index at which the substring was found. Assume str and substr are Str
@@ -2313,8 +2415,6 @@ static Assize_t Find(AValue str, Assize_t i, AValue substr)
 {
     Assize_t len1;
     Assize_t len2;
-    int ch;
-    Assize_t j;
 
     len1 = AStrLen(str);
     len2 = AStrLen(substr);
@@ -2326,70 +2426,70 @@ static Assize_t Find(AValue str, Assize_t i, AValue substr)
             return -1;
     }
 
-    /* Get the string start character. */
-    ch = AStrItem(substr, 0);
+    if (i > len1 - len2)
+        return -1;
 
-    for (; i <= len1 - len2; i++) {
-        if (AStrItem(str, i) == ch) {
-            /* Potential match. Verify it. */
-            for (j = 1; j < len2; j++) {
-                if (AStrItem(str, i + j) != AStrItem(substr, j))
-                   break;
-            }
-            /* Found a match? */
-            if (j >= len2)
-                return i;
+    if (AIsNarrowStr(str) || AIsNarrowSubStr(str)) {
+        if (AIsNarrowStr(substr) || AIsNarrowSubStr(substr))
+            return FindNarrow(ANarrowStrItems(str), len1, i,
+                              ANarrowStrItems(substr), len2);
+        else {
+            /* A narrow string cannot contain characters larger than 255. */
+            const AWideChar *sub = AWideStrItems(substr);
+            if (ANarrowPrefixLength(sub, len2) < len2)
+                return -1;
+            return FindNarrowWide(ANarrowStrItems(str), len1, i, sub, len2);
         }
+    } else {
+        if (AIsNarrowStr(substr) || AIsNarrowSubStr(substr))
+            return FindWideNarrow(AWideStrItems(str), len1, i,
+                                  ANarrowStrItems(substr), len2);
+        else
+            return FindWide(AWideStrItems(str), len1, i,
+                            AWideStrItems(substr), len2);
     }
-
-    return -1;
 }
 
 
 /* Count the number of time substr appears within str. The max argument is an
-   upper bound for the result. */
+   upper bound for the result. An empty substring matches at every index. */
 static Assize_t Count(AValue str, AValue substr, Assize_t max)
 {
     Assize_t len1 = AStrLen(str);
     Assize_t len2 = AStrLen(substr);
     Assize_t count = 0;
     Assize_t i = 0;
-    Assize_t j;
-    int ch;
 
-    ch = AStrItem(substr, 0);
+    if (len2 == 0)
+        return len1 < max ? len1 + 1 : max;
 
-    while (i <= len1 - len2) {
-        if (AStrItem(str, i) == ch) {
-            /* Potential match. Verify it. */
-            for (j = 1; j < len2; j++) {
-                if (AStrItem(str, i + j) !=
-                    AStrItem(substr, j))
-                   break;
-            }
-            /* Found a match? */
-            if (j >= len2) {
-                count++;
-                if (count == max)
-                    return count;
-                i += len2;
-            } else
-                i++;
-        } else
-            i++;
+    while (count < max && (i = Find(str, i, substr)) >= 0) {
+        count++;
+        i += len2;
     }
+
     return count;
 }
 
 
+/* Copy srcLen characters starting at srcIndex in src to dst starting at
+   dstIndex. The strings may have different widths, but if dst is narrow, all
+   the copied characters must be less than 256. */
 void ACopySubStr(AValue dst, ssize_t dstIndex, AValue src, ssize_t srcIndex,
                  ssize_t srcLen)
 {
     if (AIsNarrowStr(dst)) {
-        /* narrow -> narrow (assume src is narrow) */
-        const unsigned char *srcItems = ANarrowStrItems(src);
         unsigned char *dstItems = AGetStrElem(dst);
-        memcpy(dstItems + dstIndex, srcItems + srcIndex, srcLen);
+
+        if (AIsNarrowStr(src) || AIsNarrowSubStr(src)) {
+            /* narrow -> narrow */
+            const unsigned char *srcItems = ANarrowStrItems(src);
+            memcpy(dstItems + dstIndex, srcItems + srcIndex, srcLen);
+        } else {
+            /* wide -> narrow */
+            const AWideChar *srcItems = AWideStrItems(src);
+            ANarrowChars(dstItems + dstIndex, srcItems + srcIndex, srcLen);
+        }
     } else {
         AWideChar *dstItems = AGetWideStrElem(dst);
 
@@ -2400,10 +2500,8 @@ void ACopySubStr(AValue dst, ssize_t dstIndex, AValue src, ssize_t srcIndex,
                    srcLen * sizeof(AWideChar));
         } else {
             /* narrow -> wide */
-            ssize_t i;
             const unsigned char *srcItems = ANarrowStrItems(src);
-            for (i = 0; i < srcLen; i++)
-                dstItems[dstIndex + i] = srcItems[srcIndex + i];
+            AWidenChars(dstItems + dstIndex, srcItems + srcIndex, srcLen);
         }
     }
 }
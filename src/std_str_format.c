@@ -10,6 +10,9 @@
 #include "std_module.h"
 #include "str.h"
 #include "internal.h"
+#include "runtime.h"
+#include "floatconv.h"
+#include "utf8.h"
 
 #include <math.h>
 
@@ -44,6 +47,14 @@ typedef struct {
 } FormatOutput;
 
 
+/* Length of the output, excluding WIDE_BUF_FLAG. */
+#define OutputLen(out) ((out)->index & ~WIDE_BUF_FLAG)
+
+/* Is the output stored in the internal buffer? */
+#define IsInBuf(out) \
+    (!((out)->index & WIDE_BUF_FLAG) && (out)->len == FORMAT_BUF_SIZE)
+
+
 /* Append a character to the output buffer. */
 #define Append(out, ch) \
     ((out)->index < FORMAT_BUF_SIZE && (ch) < 0x100 \
@@ -57,54 +68,187 @@ typedef struct {
      : (Append_(out, ch), 0))
 
 
+/* Types of compiled format template items */
+enum {
+    LITERAL_ITEM,    /* Text copied directly from the format string */
+    STR_ITEM,        /* Sequence without a format, such as {} or {5:} */
+    NUMBER_ITEM,     /* Number format such as {0.00} */
+    SCIENTIFIC_ITEM, /* Number format such as {0.00e+00} */
+    INVALID_ITEM     /* Only valid for objects with a _format method */
+};
+
+
+/* A compiled format template is an array of FormatItem structs that is stored
+   in a narrow Str object used as a buffer. The array contains the literal
+   segments of the format string and the parsed {...} sequences in order, so
+   that format() only needs to parse each distinct format string once. */
+typedef struct {
+    int type;
+    /* Index range in the format string. For literal items this is the text
+       to copy. For other items this is the format after the alignment
+       prefix, not including the closing '}'. */
+    int beg;
+    int end;
+    /* The remaining fields are only used for sequences. */
+    int align;
+    ABool negAlign;
+    /* Is the sequence terminated by '}'? */
+    ABool isTerminated;
+    int minNumLen;
+    int fractionLen;
+    int optFractionLen;
+    int expLen;
+    ABool plusExp;
+    int expChar;
+} FormatItem;
+
+
+/* Maximum number of items parsed to a local buffer before compiling them */
+#define MAX_STACK_ITEMS 32
+
+
+#define NumItems(compiled) (AStrLen(compiled) / sizeof(FormatItem))
+#define Items(compiled) ((FormatItem *)AGetStrElem(compiled))
+
+
+/* Make room for n more characters in the output buffer. If isWide is TRUE,
+   also convert the buffer to a wide buffer, if necessary. Move the output to
+   a heap-allocated buffer if the internal buffer cannot hold it. */
+static void Reserve(FormatOutput *out, Assize_t n, ABool isWide)
+{
+    unsigned index = OutputLen(out);
+    ABool inBuf = IsInBuf(out);
+    ABool wasWide = (out->index & WIDE_BUF_FLAG) != 0;
+    unsigned len;
+    AValue s;
+
+    if (index + n <= out->len && (wasWide || !isWide))
+        return;
+
+    isWide |= wasWide;
+
+    len = out->len;
+    while (index + n > len)
+        len *= 2;
+
+    if (isWide) {
+        s = AMakeEmptyStrW(out->t, len);
+        if (inBuf)
+            AWidenChars(AGetWideStrElem(s), out->buf, index);
+        else
+            ACopySubStr(s, 0, *out->str, 0, index);
+        out->index = index | WIDE_BUF_FLAG;
+    } else {
+        s = AMakeEmptyStr(out->t, len);
+        if (inBuf)
+            ACopyMem(AGetStrElem(s), out->buf, index);
+        else
+            ACopyMem(AGetStrElem(s), AGetStrElem(*out->str), index);
+    }
+
+    *out->str = s;
+    out->len = len;
+}
+
+
 /* Append a character to a heap-allocated buffer. Also convert the buffer to
    a wide buffer, if necessary. Also allocate the buffer, if necessary. */
 static void Append_(FormatOutput *out, int ch)
 {
-    if ((out->index & ~WIDE_BUF_FLAG) == out->len) {
-        /* Allocate larger buffer. */
-        if (out->index == FORMAT_BUF_SIZE && !(out->index & WIDE_BUF_FLAG)) {
-            *out->str = AMakeEmptyStr(out->t, FORMAT_BUF_SIZE * 2);
-            ACopyMem(AGetStrElem(*out->str), out->buf, FORMAT_BUF_SIZE);
-        } else if (out->index & WIDE_BUF_FLAG) {
-            AValue s = AMakeEmptyStrW(out->t, out->len * 2);
-            ACopyMem(AGetWideStrElem(s), AGetWideStrElem(*out->str), out->len *
-                    sizeof(AWideChar));
-            *out->str = s;
-        } else {
-            AValue s = AMakeEmptyStr(out->t, out->len * 2);
-            ACopyMem(AGetStrElem(s), AGetStrElem(*out->str), out->len);
-            *out->str = s;
-        }
-        out->len *= 2;
-    }
-    if (ch >= 0x100 && !(out->index & WIDE_BUF_FLAG)) {
-        /* Widen the buffer. */
-        AValue s = AMakeEmptyStrW(out->t, out->len);
-        int i;
-        if (out->len > FORMAT_BUF_SIZE) {
-            for (i = 0; i < out->len; i++)
-                ASetStrItem(s, i, AStrItem(*out->str, i));
-        } else {
-            for (i = 0; i < out->index; i++)
-                ASetStrItem(s, i, out->buf[i]);
-        }
-        *out->str = s;
-        out->index |= WIDE_BUF_FLAG;
-    }
-
-    ASetStrItem(*out->str, (out->index & ~WIDE_BUF_FLAG), ch);
+    Reserve(out, 1, ch >= 0x100);
+    if (IsInBuf(out))
+        out->buf[out->index] = ch;
+    else
+        ASetStrItem(*out->str, OutputLen(out), ch);
     out->index++;
 }
 
 
+/* Append len narrow characters to the output buffer. The characters must not
+   be stored in the garbage collected heap. */
+static void AppendChars(FormatOutput *out, const char *s, Assize_t len)
+{
+    if (out->index + len > FORMAT_BUF_SIZE) {
+        Reserve(out, len, FALSE);
+        if (out->index & WIDE_BUF_FLAG)
+            AWidenChars(AGetWideStrElem(*out->str) + OutputLen(out),
+                        (const unsigned char *)s, len);
+        else
+            ACopyMem(AGetStrElem(*out->str) + out->index, s, len);
+    } else
+        ACopyMem(out->buf + out->index, s, len);
+    out->index += len;
+}
+
+
 /* Append a narrow zero-terminated string to the output buffer. */
 static void AppendStr(FormatOutput *out, const char *str)
 {
-    while (*str != '\0') {
-        AppendCh(out, *str);
-        str++;
+    AppendChars(out, str, strlen(str));
+}
+
+
+/* Append len characters of the string *str starting at index beg to the
+   output buffer. */
+static void AppendSubStr(FormatOutput *out, AValue *str, Assize_t beg,
+                         Assize_t len)
+{
+    ABool isWide;
+
+    if (AIsNarrowStr(*str) || AIsNarrowSubStr(*str)) {
+        if (out->index + len <= FORMAT_BUF_SIZE) {
+            ACopyMem(out->buf + out->index, ANarrowStrItems(*str) + beg, len);
+            out->index += len;
+            return;
+        }
+        isWide = FALSE;
+    } else {
+        /* Only widen the output if there are wide characters. */
+        isWide = ANarrowPrefixLength(AWideStrItems(*str) + beg, len) < len;
     }
+
+    Reserve(out, len, isWide);
+    if (IsInBuf(out))
+        ANarrowChars(out->buf + out->index, AWideStrItems(*str) + beg, len);
+    else
+        ACopySubStr(*out->str, OutputLen(out), *str, beg, len);
+    out->index += len;
+}
+
+
+/* Pad the output generated after index start with spaces so that it is at
+   least width characters long. The padding is inserted before the output
+   unless alignLeft is TRUE. */
+static void Align(FormatOutput *out, unsigned start, int width,
+                  ABool alignLeft)
+{
+    unsigned index = OutputLen(out);
+    unsigned pos;
+    int pad;
+    int i;
+
+    pad = width - (int)(index - start);
+    if (pad <= 0)
+        return;
+
+    Reserve(out, pad, FALSE);
+
+    pos = alignLeft ? index : start;
+    if (IsInBuf(out)) {
+        AMoveMem(out->buf + pos + pad, out->buf + pos, index - pos);
+        memset(out->buf + pos, ' ', pad);
+    } else if (out->index & WIDE_BUF_FLAG) {
+        AWideChar *w = AGetWideStrElem(*out->str);
+        AMoveMem(w + pos + pad, w + pos, (index - pos) * sizeof(AWideChar));
+        for (i = 0; i < pad; i++)
+            w[pos + i] = ' ';
+    } else {
+        unsigned char *n = AGetStrElem(*out->str);
+        AMoveMem(n + pos + pad, n + pos, index - pos);
+        memset(n + pos, ' ', pad);
+    }
+
+    out->index += pad;
 }
 
 
@@ -126,8 +270,29 @@ static void NumberToStr(FormatOutput *output, AValue num, int intLen,
 {
     int i;
 
-    if (AIsInt(num)) {
-        /* Int */
+    if (AIsShortInt(num)) {
+        /* Short Int; convert directly to the output buffer without creating
+           a Str object. */
+        char s[NUM_BUF_SIZE];
+        ASignedValue n = AValueToInt(num);
+        int si = NUM_BUF_SIZE;
+
+        if (n < 0) {
+            AppendCh(output, '-');
+            n = -n;
+        }
+
+        do {
+            s[--si] = n % 10 + '0';
+            n /= 10;
+        } while (n != 0);
+
+        for (i = NUM_BUF_SIZE - si; i < intLen; i++)
+            AppendCh(output, '0');
+
+        AppendChars(output, s + si, NUM_BUF_SIZE - si);
+    } else if (AIsLongInt(num)) {
+        /* Long Int */
         int sign;
 
         output->str[1] = num;
@@ -136,22 +301,16 @@ static void NumberToStr(FormatOutput *output, AValue num, int intLen,
             ADispatchException(output->t);
 
         if (AStrItem(output->str[1], 0) == '-') {
-            Append(output, '-');
+            AppendCh(output, '-');
             sign = 1;
         } else
             sign = 0;
 
         for (i = 0; i < intLen - AStrLen(output->str[1]) + sign; i++)
-            Append(output, '0');
+            AppendCh(output, '0');
 
-        for (i = sign; i < AStrLen(output->str[1]); i++)
-            Append(output, AStrItem(output->str[1], i));
-
-        if (optFrac < fractionLen) {
-            Append(output, '.');
-            for (i = 0; i < fractionLen - optFrac; i++)
-                Append(output, '0');
-        }
+        AppendSubStr(output, output->str + 1, sign,
+                     AStrLen(output->str[1]) - sign);
     } else {
         /* Float */
         double f;
@@ -176,7 +335,7 @@ static void NumberToStr(FormatOutput *output, AValue num, int intLen,
         if (fractionLen + 50 + 5 > NUM_BUF_SIZE)
             ARaiseValueError(output->t, "Formatted Float is too long");
 
-        si = sprintf(s, "%.*f", fractionLen, AGetFloat(output->t, num));
+        si = AFormatFloatFixed(s, f, fractionLen);
 
         if (s[0] == '-') {
             AppendCh(output, '-');
@@ -198,8 +357,15 @@ static void NumberToStr(FormatOutput *output, AValue num, int intLen,
             fractionLen--;
         }
 
-        for (i = sign; i < si; i++)
-            AppendCh(output, s[i]);
+        AppendChars(output, s + sign, si - sign);
+        return;
+    }
+
+    /* Fraction of an Int value */
+    if (optFrac < fractionLen) {
+        AppendCh(output, '.');
+        for (i = 0; i < fractionLen - optFrac; i++)
+            AppendCh(output, '0');
     }
 }
 
@@ -214,15 +380,14 @@ static void NumberToScientific(FormatOutput *output, AValue num, int numFrac,
                                 int expLen, int expChar, ABool plusExp, int
                                 optFrac)
 {
-    /* FIX: Use sprintf for the conversion for better accuracy. */
-
     double f = AGetFloat(output->t, num);
-    int exp = 0;
-    ABool sign = f < 0.0;
-    int i;
-    char s[NUM_BUF_SIZE];
+    int exp;
+    char digits[A_MAX_FLOAT_DIGITS];
+    char s[NUM_BUF_SIZE + 4];
+    int numDigits;
+    int pointPos;
     int si;
-    int s0;
+    int i;
 
     /* Handle infinities and NaN's as special cases. */
     if (AIsNaN(f)) {
@@ -236,52 +401,289 @@ static void NumberToScientific(FormatOutput *output, AValue num, int numFrac,
         return;
     }
 
-    if (sign)
-        f = -f;
+    if (numFrac >= NUM_BUF_SIZE - 2)
+        ARaiseValueError(output->t, "Formatted Float is too long");
+
+    /* Digits beyond the first A_MAX_FLOAT_DIGITS are always zeroes. */
+    numDigits = AFloatDigits(fabs(f), numFrac + 1, digits, &pointPos);
+    exp = numDigits > 0 ? pointPos - 1 : 0;
+
+    while (optFrac > 0 && numFrac > 0 && numFrac >= numDigits) {
+        optFrac--;
+        numFrac--;
+    }
 
-    if (f != 0.0) {
-        double max = 10.0 - 0.5 * pow(10.0, -numFrac);
-        double min = 1.0 - 0.5 * pow(10.0, -numFrac);
-        while (f >= max) {
-            f /= 10.0;
-            exp++;
+    /* Build the mantissa in a local buffer and append it at once. */
+    si = 0;
+    if (f < 0.0)
+        s[si++] = '-';
+    s[si++] = numDigits > 0 ? digits[0] : '0';
+    if (numFrac > 0)
+        s[si++] = '.';
+    for (i = 1; i <= numFrac; i++)
+        s[si++] = i < numDigits ? digits[i] : '0';
+    s[si++] = expChar;
+    if (plusExp && exp >= 0)
+        s[si++] = '+';
+    AppendChars(output, s, si);
+
+    NumberToStr(output, AIntToValue(exp), expLen, 0, 0);
+}
+
+
+/* Parse a format string. Store the first maxItems compiled items in items and
+   return the total number of items. */
+static int ParseFormat(AValue fmt, FormatItem *items, int maxItems)
+{
+    int fi;      /* Format string index */
+    int fmtLen;  /* Format string length */
+    int litBeg;  /* Start index of the current literal segment */
+    int num;     /* Number of items */
+
+    fmtLen = AStrLen(fmt);
+    litBeg = 0;
+    num = 0;
+
+    /* Iterate over the format string. Handle { sequences and collect other
+       characters to literal segments (} may be duplicated). */
+    for (fi = 0; fi < fmtLen; fi++) {
+        int ch = AStrItem(fmt, fi);
+        if (ch == '{'
+            && (fi == fmtLen - 1 || AStrItem(fmt, fi + 1) == '{')) {
+            /* Literal '{'. */
+            if (num < maxItems) {
+                items[num].type = LITERAL_ITEM;
+                items[num].beg = litBeg;
+                items[num].end = fi + 1;
+            }
+            num++;
+            fi++;
+            litBeg = fi + 1;
+        } else if (ch == '{') {
+            /* A format sequence {...}. */
+            FormatItem item;
+            int oldInd;
+            int fraction = FALSE;
+            int scientific = FALSE;
+            ABool isInvalid = FALSE;
+
+            if (litBeg < fi) {
+                if (num < maxItems) {
+                    items[num].type = LITERAL_ITEM;
+                    items[num].beg = litBeg;
+                    items[num].end = fi;
+                }
+                num++;
+            }
+
+            item.negAlign = FALSE;
+            item.align = 0;
+            item.minNumLen = 0;
+            item.fractionLen = 0;
+            item.optFractionLen = 0;
+            item.expLen = 0;
+            item.plusExp = FALSE;
+            item.expChar = ' ';
+
+            fi++;
+            oldInd = fi;
+
+            /* Parse alignment */
+            if (fi < fmtLen - 1 && AStrItem(fmt, fi) == '-'
+                && AIsDigit(AStrItem(fmt, fi + 1))) {
+                item.negAlign = TRUE;
+                fi++;
+            }
+            if (fi < fmtLen && AIsDigit(AStrItem(fmt, fi))) {
+                do {
+                    item.align = item.align * 10 + AStrItem(fmt, fi) - '0';
+                    fi++;
+                } while (fi < fmtLen && AIsDigit(AStrItem(fmt, fi)));
+                if (fi == fmtLen || AStrItem(fmt, fi) != ':') {
+                    fi = oldInd;
+                    item.align = 0;
+                } else
+                    fi++;
+            }
+
+            /* Parse an Int/Float format. An invalid format is an error unless
+               the argument has a _format method. */
+            item.beg = fi;
+            while (fi < fmtLen && (ch = AStrItem(fmt, fi)) != '}') {
+                if (ch == '0') {
+                    if (scientific)
+                        item.expLen++;
+                    else if (fraction)
+                        item.fractionLen++;
+                    else
+                        item.minNumLen++;
+                } else if (ch == '.')
+                    fraction = TRUE;
+                else if (ch == 'e' || ch == 'E') {
+                    scientific = TRUE;
+                    item.expChar = ch;
+                } else if (ch == '+' && scientific)
+                    item.plusExp = TRUE;
+                else if (ch == '#' && fraction && !scientific) {
+                    item.fractionLen++;
+                    item.optFractionLen++;
+                } else
+                    isInvalid = TRUE;
+                fi++;
+            }
+            item.end = fi;
+            item.isTerminated = fi < fmtLen;
+
+            if (isInvalid)
+                item.type = INVALID_ITEM;
+            else if (scientific)
+                item.type = SCIENTIFIC_ITEM;
+            else if (item.minNumLen > 0 || fraction)
+                item.type = NUMBER_ITEM;
+            else
+                item.type = STR_ITEM;
+
+            if (num < maxItems)
+                items[num] = item;
+            num++;
+
+            litBeg = fi + 1;
+        } else if (ch == '}') {
+            /* Literal '}' can be duplicated (but does not need to be). */
+            if (fi < fmtLen - 1 && AStrItem(fmt, fi + 1) == '}') {
+                if (num < maxItems) {
+                    items[num].type = LITERAL_ITEM;
+                    items[num].beg = litBeg;
+                    items[num].end = fi + 1;
+                }
+                num++;
+                fi++;
+                litBeg = fi + 1;
+            }
         }
-        while (f < min) {
-            f *= 10.0;
-            exp--;
+    }
+
+    if (litBeg < fmtLen) {
+        if (num < maxItems) {
+            items[num].type = LITERAL_ITEM;
+            items[num].beg = litBeg;
+            items[num].end = fmtLen;
         }
+        num++;
     }
 
-    f = floor(f * pow(10.0, numFrac) + 0.5);
+    return num;
+}
 
-    if (numFrac >= NUM_BUF_SIZE - 2)
-        ARaiseValueError(output->t, "Formatted Float is too long");
 
-    si = 0;
-    for (i = 0; i <= numFrac; i++) {
-        int d = (int)fmod(f, 10.0);
-        s[si++] = '0' + d;
-        f /= 10.0;
+/* Return the compiled form of the format string *fmt (a narrow Str object that
+   contains an array of FormatItem structs). Use the per-thread format cache,
+   so that each distinct format string is only parsed once, and since the
+   cache is not shared, no locking is needed. */
+static AValue GetCompiledFormat(AThread *t, AValue *fmt)
+{
+    FormatItem items[MAX_STACK_ITEMS];
+    AValue *cache = t->formatCache;
+    AValue hash;
+    AValue compiled;
+    int num;
+    int i;
+
+    /* Format strings are usually constants, so look for the same object
+       first. */
+    for (i = 0; i < A_NUM_CACHED_FORMATS; i++) {
+        if (cache[3 * i] == *fmt)
+            return cache[3 * i + 2];
     }
 
-    s0 = 0;
-    while (optFrac > 0 && s0 < si && s[s0] == '0') {
-        s0++;
-        optFrac--;
-        numFrac--;
+    /* Look for an equal string. */
+    hash = AStringHashValue(*fmt);
+    for (i = 0; i < A_NUM_CACHED_FORMATS; i++) {
+        if (cache[3 * i + 1] == hash && AIsStr(cache[3 * i])
+            && ACompareStrings(cache[3 * i], *fmt) == 0)
+            return cache[3 * i + 2];
     }
 
-    if (sign)
-        AppendCh(output, '-');
-    AppendCh(output, s[si - 1]);
-    if (numFrac > 0)
-        AppendCh(output, '.');
-    for (i = si - 2; i >= s0; i--)
-        AppendCh(output, s[i]);
-    AppendCh(output, expChar);
-    if (plusExp && exp >= 0)
-        AppendCh(output, '+');
-    NumberToStr(output, AMakeInt(output->t, exp), expLen, 0, 0);
+    /* Not found; compile the format string and replace a cache entry. */
+    num = ParseFormat(*fmt, items, MAX_STACK_ITEMS);
+    compiled = AMakeEmptyStr(t, num * sizeof(FormatItem));
+    if (num <= MAX_STACK_ITEMS)
+        ACopyMem(Items(compiled), items, num * sizeof(FormatItem));
+    else
+        ParseFormat(*fmt, Items(compiled), num);
+
+    i = t->formatCacheIndex;
+    cache[3 * i] = *fmt;
+    cache[3 * i + 1] = hash;
+    cache[3 * i + 2] = compiled;
+    t->formatCacheIndex = (i + 1) % A_NUM_CACHED_FORMATS;
+
+    return compiled;
+}
+
+
+/* Append the formatted representation of frame[3] to the output, based on
+   the format sequence item. Return FALSE if an exception was raised. */
+static ABool FormatArg(FormatOutput *output, AValue *frame,
+                       const FormatItem *item)
+{
+    AThread *t = output->t;
+
+    if (AIsInstance(frame[3]) && item->beg < item->end
+        && AMember(t, frame[3], "_format") != AError) {
+        /* Use the _format method of the argument. */
+        if (!item->isTerminated)
+            ARaiseValueError(t, "Unterminated format");
+        frame[4] = ASubStr(t, frame[0], item->beg, item->end);
+        frame[3] = ACallMethod(t, "_format", 1, frame + 3);
+        if (AIsError(frame[3]))
+            return FALSE;
+        AExpectStr(t, frame[3]);
+        AppendSubStr(output, frame + 3, 0, AStrLen(frame[3]));
+        return TRUE;
+    }
+
+    if (item->type == INVALID_ITEM)
+        ARaiseValueError(t, "Invalid character in format");
+    if (!item->isTerminated)
+        ARaiseValueError(t, "Unterminated format");
+
+    /* Either format an Int/Float or use the default conversion by calling
+       std::Str. */
+    switch (item->type) {
+    case SCIENTIFIC_ITEM:
+        NumberToScientific(output, frame[3], item->fractionLen, item->expLen,
+                           item->expChar, item->plusExp,
+                           item->optFractionLen);
+        break;
+
+    case NUMBER_ITEM:
+        NumberToStr(output, frame[3], item->minNumLen, item->fractionLen,
+                    item->optFractionLen);
+        break;
+
+    default:
+        /* Short Int, Float and Str objects do not need a temporary
+           object. */
+        if (AIsShortInt(frame[3]))
+            NumberToStr(output, frame[3], 0, 0, 0);
+        else if (AIsFloat(frame[3])) {
+            /* Use the same format as std::Str. */
+            char buf[A_FLOAT_BUF_SIZE];
+            AFormatFloat(buf, AValueToFloat(frame[3]), 10);
+            AppendStr(output, buf);
+        } else {
+            if (!AIsStr(frame[3])) {
+                frame[3] = AStdStr(t, &frame[3]);
+                if (AIsError(frame[3]))
+                    return FALSE;
+            }
+            AppendSubStr(output, frame + 3, 0, AStrLen(frame[3]));
+        }
+        break;
+    }
+
+    return TRUE;
 }
 
 
@@ -291,9 +693,10 @@ static void NumberToScientific(FormatOutput *output, AValue num, int numFrac,
    The base string object represents the format string. */
 AValue AFormat(AThread *t, AValue *frame)
 {
-    int fi;      /* Format string index */
+    int numItems;
+    int numArgs;
     int ai;      /* Argument index */
-    int fmtLen;  /* Format string length */
+    int i;
     FormatOutput output;
 
     AExpectStr(t, frame[0]);
@@ -303,168 +706,33 @@ AValue AFormat(AThread *t, AValue *frame)
     output.len = FORMAT_BUF_SIZE;
     output.str = &frame[2];
 
-    fmtLen = AStrLen(frame[0]);
+    frame[5] = GetCompiledFormat(t, &frame[0]);
+    numItems = NumItems(frame[5]);
+    numArgs = AVarArgLen(t, frame[1]);
     ai = 0;
 
-    /* IDEA: Refactor this into multiple functions. */
-
-    /* Iterate over the format string. Handle { sequences and copy other
-       characters directly to the output buffer (} may be duplicated). */
-    for (fi = 0; fi < fmtLen; fi++) {
-        int ch = AStrItem(frame[0], fi);
-        if (ch == '{') {
-            if (fi == fmtLen - 1 || AStrItem(frame[0], fi + 1) == '{') {
-                /* Literal '{'. */
-                fi++;
-                Append(&output, ch);
-            } else {
-                /* A format sequence {...}. */
-                int negAlign = FALSE;
-                int align = 0;
-                int oldInd;
-                int oldOutInd;
-                AValue arg;
+    for (i = 0; i < numItems; i++) {
+        /* The items may be moved by the garbage collector; take a copy. */
+        FormatItem item = Items(frame[5])[i];
 
-                fi++;
-                oldInd = fi;
+        if (item.type == LITERAL_ITEM)
+            AppendSubStr(&output, &frame[0], item.beg, item.end - item.beg);
+        else {
+            unsigned oldOutInd = OutputLen(&output);
 
-                /* Parse alignment */
-                if (fi < fmtLen && AStrItem(frame[0], fi) == '-'
-                    && AIsDigit(AStrItem(frame[0], fi + 1))) {
-                    negAlign = TRUE;
-                    fi++;
-                }
-                if (fi < fmtLen && AIsDigit(AStrItem(frame[0], fi))) {
-                    do {
-                        align = align * 10 + AStrItem(frame[0], fi) - '0';
-                        fi++;
-                    } while (fi < fmtLen && AIsDigit(AStrItem(frame[0], fi)));
-                    if (AStrItem(frame[0], fi) != ':') {
-                        fi = oldInd;
-                        align = 0;
-                    } else
-                        fi++;
-                }
+            if (ai >= numArgs)
+                ARaiseValueError(t, "Too few arguments");
 
-                oldOutInd = output.index & ~WIDE_BUF_FLAG;
-
-                if (ai >= AArrayLen(frame[1]))
-                    ARaiseValueError(t, "Too few arguments");
-
-                arg = AArrayItem(frame[1], ai);
-                if (AIsInstance(arg)
-                    && AStrItem(frame[0], fi) != '}'
-                    && AMember(t, arg, "_format") != AError) {
-                    int i;
-                    oldInd = fi;
-                    while (fi <= fmtLen && AStrItem(frame[0], fi) != '}')
-                        fi++;
-                    if (fi >= fmtLen)
-                        ARaiseValueError(t, "Unterminated format");
-                    frame[3] = AArrayItem(frame[1], ai);
-                    frame[4] = ASubStr(t, frame[0], oldInd, fi);
-                    frame[3] = ACallMethod(t, "_format", 1, frame + 3);
-                    if (AIsError(frame[3]))
-                        return AError;
-                    AExpectStr(t, frame[3]);
-                    for (i = 0; i < AStrLen(frame[3]); i++)
-                        Append(&output, AStrItem(frame[3], i));
-                } else {
-                    /* Either format an Int/Float or use the default conversion
-                       by calling std::Str. */
-                    int minNumLen = 0;
-                    int fractionLen = 0;
-                    int optFractionLen = 0;
-                    int expLen = 0;
-                    int fraction = FALSE;
-                    int scientific = FALSE;
-                    int plusExp = FALSE;
-                    int expChar = ' ';
-
-                    while (fi < fmtLen &&
-                           (ch = AStrItem(frame[0], fi)) != '}') {
-                        if (ch == '0') {
-                            if (scientific)
-                                expLen++;
-                            else if (fraction)
-                                fractionLen++;
-                            else
-                                minNumLen++;
-                        } else if (ch == '.')
-                            fraction = TRUE;
-                        else if (ch == 'e' || ch == 'E') {
-                            scientific = TRUE;
-                            expChar = ch;
-                        } else if (ch == '+' && scientific)
-                            plusExp = TRUE;
-                        else if (ch == '#' && fraction && !scientific) {
-                            fractionLen++;
-                            optFractionLen++;
-                        } else
-                            ARaiseValueError(t, "Invalid character in format");
-                        fi++;
-                    }
+            frame[3] = AVarArgItem(t, frame[1], ai);
+            if (!FormatArg(&output, frame, &item))
+                return AError;
 
-                    if (scientific)
-                        NumberToScientific(&output, arg, fractionLen, expLen,
-                                           expChar, plusExp, optFractionLen);
-                    else if (minNumLen > 0 || fraction)
-                        NumberToStr(&output, arg, minNumLen, fractionLen,
-                                    optFractionLen);
-                    else {
-                        /* Not a number formatting sequence. Use std::Str to
-                           convert the argument. */
-                        int i;
-
-                        frame[3] = arg;
-                        frame[3] = AStdStr(t, &frame[3]);
-                        if (AIsError(frame[3]))
-                            return AError;
-
-                        for (i = 0; i < AStrLen(frame[3]); i++)
-                            Append(&output, AStrItem(frame[3], i));
-                    }
-                }
-
-                if (fi >= fmtLen)
-                    ARaiseValueError(t, "Unterminated format");
-
-                align -= (output.index & ~WIDE_BUF_FLAG) - oldOutInd;
-                if (align > 0) {
-                    int i;
-
-                    for (i = 0; i < align; i++)
-                        Append(&output, ' ');
-
-                    if (!negAlign) {
-                        if (output.index < FORMAT_BUF_SIZE) {
-                            AMoveMem(output.buf + oldOutInd + align,
-                                    output.buf + oldOutInd,
-                                    output.index - oldOutInd - align);
-                            for (i = 0; i < align; i++)
-                                output.buf[oldOutInd + i] = ' ';
-                        } else {
-                            for (i = (output.index & ~WIDE_BUF_FLAG) - 1;
-                                 i >= oldOutInd + align; i--)
-                                ASetStrItem(frame[2], i,
-                                            AStrItem(frame[2], i - align));
-                            for (i = 0; i < align; i++)
-                                ASetStrItem(frame[2], oldOutInd + i, ' ');
-                        }
-                    }
-                }
-                ai++;
-            }
-        } else if (ch == '}') {
-            /* Literal '}' can be duplicated (but does not need to be). */
-            if (fi < fmtLen - 1 && AStrItem(frame[0], fi + 1) == '}')
-                fi++;
-            Append(&output, ch);
-        } else
-            Append(&output, ch);
+            Align(&output, oldOutInd, item.align, item.negAlign);
+            ai++;
+        }
     }
 
-    if (ai < AArrayLen(frame[1]))
+    if (ai < numArgs)
         ARaiseValueError(t, "Too many arguments");
 
     if (output.index <= FORMAT_BUF_SIZE) {
@@ -478,6 +746,6 @@ AValue AFormat(AThread *t, AValue *frame)
     } else {
         /* The output is stored in a heap-allocated buffer (represented as a
            Str object). Return the initialized part of the buffer. */
-        return ASubStr(t, frame[2], 0, output.index & ~WIDE_BUF_FLAG);
+        return ASubStr(t, frame[2], 0, OutputLen(&output));
     }
 }
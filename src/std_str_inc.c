@@ -0,0 +1,42 @@
+/* std_str_inc.c - Str kernels (#included by std_str.c)
+
+   Copyright (c) 2010-2011 Jukka Lehtosalo
+
+   Alore is licensed under the terms of the MIT license.  See the file
+   LICENSE.txt in the distribution.
+*/
+
+/* NOTE: This file is not a stand-alone source file! It is included by
+         std_str.c several times, once for each combination of 8-bit and
+         16-bit operands that does not have a more specialized
+         implementation. */
+
+
+/* The following defines are required by this file:
+
+     STR_CHAR: character type of the searched string (unsigned char or
+               AWideChar)
+     SUB_CHAR: character type of the substring
+     FIND_FN: name of the find function */
+
+
+/* Find the leftmost instance of sub[0..subLen) in s[i..len). Assume
+   subLen > 0. Return the index of the match, or -1 if there is no match. */
+static Assize_t FIND_FN(const STR_CHAR *s, Assize_t len, Assize_t i,
+                        const SUB_CHAR *sub, Assize_t subLen)
+{
+    AWideChar first = sub[0];
+    Assize_t last = len - subLen;
+
+    for (; i <= last; i++) {
+        if (s[i] == first) {
+            /* Potential match. Verify it. */
+            Assize_t j;
+            for (j = 1; j < subLen && s[i + j] == sub[j]; j++);
+            if (j == subLen)
+                return i;
+        }
+    }
+
+    return -1;
+}
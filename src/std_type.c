@@ -24,11 +24,11 @@ AValue ATypeSupertype(AThread *t, AValue *frame)
     if (AIsGlobalFunction(frame[0]))
         return AGlobalByNum(AStdObjectNum);
 
-    /* Create a wrapper instance for the type object. */
-    frame[0] = AWrapObject(t, frame[0]);
+    /* Self is a wrapper instance if called via a bound method. */
+    frame[0] = A_UNWRAP_SELF(frame[0]);
 
     /* Examine the base type. */
-    type = AValueToType(A_UNWRAP(frame[0]));
+    type = AValueToType(frame[0]);
     if (type->super != NULL)
         return ATypeToValue(type->super);
     else
@@ -51,14 +51,14 @@ AValue ATypeInterfaces(AThread *t, AValue *frame)
         frame[0] = AGlobalByNum(sym->num);
     }
 
-    /* Create a wrapper instance for the type object. */
-    frame[0] = AWrapObject(t, frame[0]);
+    /* Self is a wrapper instance if called via a bound method. */
+    frame[0] = A_UNWRAP_SELF(frame[0]);
 
     frame[1] = AMakeArray(t, 0);
 
     /* Go though all types in the inheritance chain and collect the
        interfaces. */
-    for (type = AValueToType(A_UNWRAP(frame[0]));
+    for (type = AValueToType(frame[0]);
          type != NULL;
          type = type->super) {
         /* Go through all implemented interfaces for the current type. */
@@ -9,9 +9,9 @@
 /* Implementations of wrapper class methods. They represent methods of objects
    with special runtime representations.
 
-   These methods get a raw object as self (frame[0]). To generate correct
-   stack traces, the method should replace self with wrapped self (using
-   AWrapObject) if the method can raise an exception. */
+   These methods usually get a raw object as self (frame[0]), but self is a
+   wrapper instance if the method is called via a bound method. Use
+   A_UNWRAP_SELF to get the raw object. */
 
 #include "alore.h"
 #include "runtime.h"
@@ -23,12 +23,12 @@
 #include "float.h"
 
 
-/* Wrap self and call func(t, self, frame[1]). Assume t and frame are defined.
-   This only works for single-argument methods such as _add. */
+/* Unwrap self and call func(t, self, frame[1]). Assume t and frame are
+   defined. This only works for single-argument methods such as _add. */
 #define OP_WRAPPER(func) \
     do {                                                \
-        frame[0] = AWrapObject(t, frame[0]);            \
-        return (func)(t, A_UNWRAP(frame[0]), frame[1]); \
+        frame[0] = A_UNWRAP_SELF(frame[0]);             \
+        return (func)(t, frame[0], frame[1]);           \
     } while (0)
 
 
@@ -64,8 +64,8 @@ AValue AConcatWrapper(AThread *t, AValue *frame)
 /* Wrapper for the _neg() method. */
 AValue ANegWrapper(AThread *t, AValue *frame)
 {
-    frame[0] = AWrapObject(t, frame[0]);
-    return ANeg(t, A_UNWRAP(frame[0]));
+    frame[0] = A_UNWRAP_SELF(frame[0]);
+    return ANeg(t, frame[0]);
 }
 
 
@@ -100,16 +100,16 @@ AValue APowWrapper(AThread *t, AValue *frame)
 /* Wrapper for the _get(i) method. */
 AValue AGetItemWrapper(AThread *t, AValue *frame)
 {
-    frame[0] = AWrapObject(t, frame[0]);
-    return AGetItem(t, A_UNWRAP(frame[0]), frame[1]);
+    frame[0] = A_UNWRAP_SELF(frame[0]);
+    return AGetItem(t, frame[0], frame[1]);
 }
 
 
 /* Wrapper for the _set(i, x) method. */
 AValue ASetItemWrapper(AThread *t, AValue *frame)
 {
-    frame[0] = AWrapObject(t, frame[0]);
-    return ASetItem(t, A_UNWRAP(frame[0]), frame[1], frame[2]);
+    frame[0] = A_UNWRAP_SELF(frame[0]);
+    return ASetItem(t, frame[0], frame[1], frame[2]);
 }
 
 
@@ -117,8 +117,8 @@ AValue ASetItemWrapper(AThread *t, AValue *frame)
 AValue AEqWrapper(AThread *t, AValue *frame)
 {
     int ret;
-    frame[0] = AWrapObject(t, frame[0]);
-    ret = AIsEq(t, A_UNWRAP(frame[0]), frame[1]);
+    frame[0] = A_UNWRAP_SELF(frame[0]);
+    ret = AIsEq(t, frame[0], frame[1]);
     if (ret < 0)
         return AError;
     else if (ret == 0)
@@ -132,8 +132,8 @@ AValue AEqWrapper(AThread *t, AValue *frame)
 AValue ALtWrapper(AThread *t, AValue *frame)
 {
     int ret;
-    frame[0] = AWrapObject(t, frame[0]);
-    ret = AIsLt(t, A_UNWRAP(frame[0]), frame[1]);
+    frame[0] = A_UNWRAP_SELF(frame[0]);
+    ret = AIsLt(t, frame[0], frame[1]);
     if (ret < 0)
         return AError;
     else if (ret == 0)
@@ -147,8 +147,8 @@ AValue ALtWrapper(AThread *t, AValue *frame)
 AValue AGtWrapper(AThread *t, AValue *frame)
 {
     int ret;
-    frame[0] = AWrapObject(t, frame[0]);
-    ret = AIsGt(t, A_UNWRAP(frame[0]), frame[1]);
+    frame[0] = A_UNWRAP_SELF(frame[0]);
+    ret = AIsGt(t, frame[0], frame[1]);
     if (ret < 0)
         return AError;
     else if (ret == 0)
@@ -162,8 +162,8 @@ AValue AGtWrapper(AThread *t, AValue *frame)
 AValue AInWrapper(AThread *t, AValue *frame)
 {
     int val;
-    frame[0] = AWrapObject(t, frame[0]);
-    val = AIn(t, frame[1], A_UNWRAP(frame[0]));
+    frame[0] = A_UNWRAP_SELF(frame[0]);
+    val = AIn(t, frame[1], frame[0]);
     if (val == 0)
         return AFalse;
     else if (val == 1)
@@ -177,8 +177,8 @@ AValue AInWrapper(AThread *t, AValue *frame)
 /* NOTE: Requires 1 extra temp in the stack frame. */
 AValue ACallWrapper(AThread *t, AValue *frame)
 {
-    frame[0] = AWrapObject(t, frame[0]);
-    return ACallValueVarArg(t, A_UNWRAP(frame[0]), 0, frame + 1);
+    frame[0] = A_UNWRAP_SELF(frame[0]);
+    return ACallValueVarArg(t, frame[0], 0, frame + 1);
 }
 
 
@@ -188,9 +188,9 @@ AValue AStrWrapper(AThread *t, AValue *frame)
     AValue *args;
     AValue v;
 
-    frame[0] = AWrapObject(t, frame[0]);
+    frame[0] = A_UNWRAP_SELF(frame[0]);
 
-    args = AAllocTemp(t, A_UNWRAP(frame[0]));
+    args = AAllocTemp(t, frame[0]);
     v = AStdStr(t, args);
     AFreeTemp(t);
 
@@ -204,10 +204,10 @@ AValue AHashWrapper(AThread *t, AValue *frame)
     AValue *args;
     AValue v;
 
-    frame[0] = AWrapObject(t, frame[0]);
+    frame[0] = A_UNWRAP_SELF(frame[0]);
 
     args = AAllocTemps(t, 3);
-    args[0] = A_UNWRAP(frame[0]);
+    args[0] = frame[0];
     v = AStdHash(t, args);
     AFreeTemps(t, 3);
 
@@ -221,9 +221,9 @@ AValue AReprWrapper(AThread *t, AValue *frame)
     AValue *args;
     AValue v;
 
-    frame[0] = AWrapObject(t, frame[0]);
+    frame[0] = A_UNWRAP_SELF(frame[0]);
 
-    args = AAllocTemp(t, A_UNWRAP(frame[0]));
+    args = AAllocTemp(t, frame[0]);
     v = AStdRepr(t, args);
     AFreeTemp(t);
 
@@ -234,8 +234,8 @@ AValue AReprWrapper(AThread *t, AValue *frame)
 /* Wrapper for the iterator() method. */
 AValue AIterWrapper(AThread *t, AValue *frame)
 {
-    frame[0] = AWrapObject(t, frame[0]);
-    return AIterator(t, A_UNWRAP(frame[0]));
+    frame[0] = A_UNWRAP_SELF(frame[0]);
+    return AIterator(t, frame[0]);
 }
 
 
@@ -245,10 +245,10 @@ AValue AIntWrapper(AThread *t, AValue *frame)
     AValue *args;
     AValue v;
 
-    frame[0] = AWrapObject(t, frame[0]);
+    frame[0] = A_UNWRAP_SELF(frame[0]);
 
     args = AAllocTemps(t, 2);
-    args[0] = A_UNWRAP(frame[0]);
+    args[0] = frame[0];
     args[1] = ADefault;
     v = AStdInt(t, args);
     AFreeTemps(t, 2);
@@ -263,9 +263,9 @@ AValue AFloatWrapper(AThread *t, AValue *frame)
     AValue *args;
     AValue v;
 
-    frame[0] = AWrapObject(t, frame[0]);
+    frame[0] = A_UNWRAP_SELF(frame[0]);
 
-    args = AAllocTemp(t, A_UNWRAP(frame[0]));
+    args = AAllocTemp(t, frame[0]);
     v = AStdFloat(t, args);
     AFreeTemp(t);
 
@@ -279,16 +279,16 @@ AValue AFloatWrapper(AThread *t, AValue *frame)
 /* Wrapper for Range start getter. */
 AValue AStdRangeStart(AThread *t, AValue *frame)
 {
-    frame[0] = AWrapObject(t, frame[0]);
-    return AValueToMixedObject(A_UNWRAP(frame[0]))->data.range.start;
+    frame[0] = A_UNWRAP_SELF(frame[0]);
+    return AValueToMixedObject(frame[0])->data.range.start;
 }
 
 
 /* Wrapper for Range stop getter. */
 AValue AStdRangeStop(AThread *t, AValue *frame)
 {
-    frame[0] = AWrapObject(t, frame[0]);
-    return AValueToMixedObject(A_UNWRAP(frame[0]))->data.range.stop;
+    frame[0] = A_UNWRAP_SELF(frame[0]);
+    return AValueToMixedObject(frame[0])->data.range.stop;
 }
 
 
@@ -298,16 +298,16 @@ AValue AStdRangeStop(AThread *t, AValue *frame)
 /* Wrapper for Pair left getter. */
 AValue APairLeft(AThread *t, AValue *frame)
 {
-    frame[0] = AWrapObject(t, frame[0]);
-    return AValueToMixedObject(A_UNWRAP(frame[0]))->data.pair.head;
+    frame[0] = A_UNWRAP_SELF(frame[0]);
+    return AValueToMixedObject(frame[0])->data.pair.head;
 }
 
 
 /* Wrapper for Pair right getter. */
 AValue APairRight(AThread *t, AValue *frame)
 {
-    frame[0] = AWrapObject(t, frame[0]);
-    return AValueToMixedObject(A_UNWRAP(frame[0]))->data.pair.tail;
+    frame[0] = A_UNWRAP_SELF(frame[0]);
+    return AValueToMixedObject(frame[0])->data.pair.tail;
 }
 
 
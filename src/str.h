@@ -132,10 +132,10 @@ AValue AStrJoin(AThread *t, AValue *frame);
 #define A_COPY_SUBSTR_SIZE AGetBlockSize(A_VALUE_SIZE + 1)
 
 
+/* Return the length of the UTF-8 sequence starting with byte ch. Invalid lead
+   bytes are treated as single-byte sequences. */
 #define A_UTF8_SKIP(ch) \
-    ((ch) < 0xc2 ? 1 : (ch) < 0xe0 ? 2 : 3)
-#define A_UTF8_SKIP_W(ch) \
-    ((ch) < 0xc2 ? 1 : (ch) < 0xe0 ? 2 : (ch) <= 0xff ? 3 : 1)
+    ((ch) < 0xc2 ? 1 : (ch) < 0xe0 ? 2 : (ch) < 0xf0 ? 3 : (ch) < 0xf5 ? 4 : 1)
 #define A_UTF8_LEN(ch) ((ch) <= 0x7f ? 1 : (ch) <= 0x7ff ? 2 : 3)
 
 
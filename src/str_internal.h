@@ -12,7 +12,9 @@
 #include "value.h"
 
 
-#define AUpper(ch) ((ch) < 256 ? AUpperCase[ch] : AUpper2(ch))
+/* The upper case of character 255 is not a narrow character, so it is not
+   included in AUpperCase. */
+#define AUpper(ch) ((ch) < 255 ? AUpperCase[ch] : AUpper2(ch))
 #define ALower(ch) ((ch) < 256 ? ALowerCase[ch] : ALower2(ch))
 
 
@@ -10,6 +10,7 @@
 #include "runtime.h"
 #include "int.h"
 #include "float.h"
+#include "floatconv.h"
 #include "internal.h"
 
 #include <stdlib.h>
@@ -75,33 +76,10 @@ unsigned char *AStrToInt(AThread *t, const unsigned char *beg,
 
   ConvertLongInt:
 
-    {
-        ALongInt *li;
-        AValue val;
-
-        val = ACreateLongIntFromIntND(t, num);
-        if (AIsError(val))
-            goto Error;
-
-        li = AValueToLongInt(val);
-
-        do {
-            li = AMulAddSingle(t, li, 10, *str - '0');
-            if (li == NULL)
-                goto Error;
-            str++;
-        } while (str != end && AIsDigit(*str));
-
-        *valPtr = ALongIntToValue(li);
-        return (unsigned char *)str;
-    }
-
-  Error:
-
     while (str != end && AIsDigit(*str))
         str++;
 
-    *valPtr = AError;
+    *valPtr = AStrToLongInt(t, NULL, beg, str - beg, 10, isNeg);
     return (unsigned char *)str;
 }
 
@@ -165,23 +143,27 @@ unsigned char *AStrToFloat(AThread *t, const unsigned char *beg,
     if (str == numBeg || isErr)
         *val = AError;
     else {
-        char buf[MAX_FLOAT_LEN + 1];
-
         /* We have a maximum length for floating point strings. */
         if (str - beg > MAX_FLOAT_LEN)
             *val = AError;
         else {
+            const unsigned char *numStart = beg;
             double num;
 
-            /* Copy the floating point number string to a temporary buffer
-               as a null-terminated string. */
-            memcpy(buf, beg, str - beg);
-            buf[str - beg] = '\0';
+            while (*numStart == ' ' || *numStart == '\t')
+                numStart++;
 
             /* Convert the string to a floating point number. We have already
-               checked the string to be valid, so we don't bother checking that
-               the call succeeds. */
-            num = strtod(buf, NULL);
+               checked the string to be valid, so the conversion always
+               consumes the whole number. */
+            if (AParseFloat(numStart, str, &num) != str) {
+                char buf[MAX_FLOAT_LEN + 1];
+
+                /* Should not happen, but fall back to strtod just in case. */
+                memcpy(buf, beg, str - beg);
+                buf[str - beg] = '\0';
+                num = strtod(buf, NULL);
+            }
 
             /* strtod may update errno. */
             errno = 0;
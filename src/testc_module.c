@@ -440,6 +440,22 @@ static AValue TestC_TempStackDepth(AThread *t, AValue *frame)
 }
 
 
+/* __testc::AllocatedBytes()
+   Return the number of bytes allocated from the heap so far. The result is
+   exact only if no other threads allocate memory and no garbage collection
+   has happened since the previous call. */
+static AValue TestC_AllocatedBytes(AThread *t, AValue *frame)
+{
+    AInt64 n;
+
+    ALockHeap();
+    n = AGCStat.allocCount - (t->heapEnd - t->heapPtr);
+    AReleaseHeap();
+
+    return AMakeInt64(t, n);
+}
+
+
 /* __testc::AGetInt(v)
    Wrapper for AGetInt() C API function. Return a string representation of the
    integer. */
@@ -1375,6 +1391,7 @@ A_MODULE(__testc, "__testc")
     A_DEF("RaiseDirectMemoryError", 0, 0, TestC_RaiseDirectMemoryError)
     A_DEF("ContextDepth", 0, 0, TestC_ContextDepth)
     A_DEF("TempStackDepth", 0, 0, TestC_TempStackDepth)
+    A_DEF("AllocatedBytes", 0, 0, TestC_AllocatedBytes)
     A_DEF("AGetInt", 1, 0, TestC_AGetInt)
     A_DEF("AGetIntU", 1, 0, TestC_AGetIntU)
     A_DEF("AGetInt64", 1, 0, TestC_AGetInt64)
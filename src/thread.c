@@ -62,6 +62,14 @@ AThread *ACreateMainThread(void)
 
 /* Allocate and initialize an AThread structure. */
 AThread *ACreateThread(AValue *temp)
+{
+    return ACreateThreadWithStack(temp, NULL, A_ALORE_STACK_SIZE);
+}
+
+
+/* Allocate and initialize an AThread structure that uses the given Alore
+   stack area of stackSize bytes. If stack is NULL, allocate the stack. */
+AThread *ACreateThreadWithStack(AValue *temp, AValue *stack, int stackSize)
 {
     AThread *t;
     void *ptr;
@@ -89,16 +97,21 @@ AThread *ACreateThread(AValue *temp)
     if (t == NULL)
         return NULL;
 
-    t->stack = AAllocStatic(A_ALORE_STACK_SIZE);
-    if (t->stack == NULL) {
-        AFreeStatic(t);
-        return NULL;
+    if (stack != NULL)
+        t->stack = stack;
+    else {
+        t->stack = AAllocStatic(stackSize);
+        if (t->stack == NULL) {
+            AFreeStatic(t);
+            return NULL;
+        }
     }
 
     /* FIX is this freed somewhere */
     t->tempStack = AAllocStatic(A_TEMP_STACK_SIZE);
     if (t->tempStack == NULL) {
-        AFreeStatic(t->stack);
+        if (stack == NULL)
+            AFreeStatic(t->stack);
         AFreeStatic(t);
         return NULL;
     }
@@ -109,14 +122,15 @@ AThread *ACreateThread(AValue *temp)
                                   sizeof(AExceptionContext));
     if (t->context == NULL) {
         AFreeStatic(t->tempStack);
-        AFreeStatic(t->stack);
+        if (stack == NULL)
+            AFreeStatic(t->stack);
         AFreeStatic(t);
         return NULL;
     }
 
-    t->stackTop = APtrAdd(t->stack, A_ALORE_STACK_SIZE);
+    t->stackTop = APtrAdd(t->stack, stackSize);
     t->stackPtr = t->stackTop; /* FIX ok? */
-    t->stackSize = A_ALORE_STACK_SIZE;
+    t->stackSize = stackSize;
 
     for (i = 0; i < A_NUM_FIXED_THREAD_TEMPS; i++)
         t->tempStack[i] = AZero;
@@ -145,10 +159,14 @@ AThread *ACreateThread(AValue *temp)
 
     t->exception = AZero;
     t->uncaughtExceptionStackPtr = NULL;
+    t->fiber = NULL;
     t->isExceptionReraised = FALSE;
 
     for (i = 0; i < 2 * A_NUM_CACHED_REGEXPS; i++)
         t->regExp[i] = AZero;
+    for (i = 0; i < 3 * A_NUM_CACHED_FORMATS; i++)
+        t->formatCache[i] = AZero;
+    t->formatCacheIndex = 0;
 
     ALockThreads();
     t->next = Threads;
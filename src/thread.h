@@ -22,6 +22,9 @@
 
 #define A_NUM_CACHED_REGEXPS 6
 
+/* Number of compiled Str format templates cached per thread */
+#define A_NUM_CACHED_FORMATS 64
+
 
 typedef struct AGCListBlock_ {
     AValue header;
@@ -82,7 +85,9 @@ typedef struct AThread_ {
     AValue exception;
 
     AValue *uncaughtExceptionStackPtr;
-    void *filler; /* FIX remove */
+    /* Fiber that uses this thread structure, or NULL if the structure is
+       used by an ordinary thread */
+    struct AFiber_ *fiber;
     /* Is the current exception raised again after leaving a finally block? */
     ABool isExceptionReraised;
 
@@ -102,6 +107,13 @@ typedef struct AThread_ {
        compiled with flags in regExpFalgs[n]. */
     AValue regExp[A_NUM_CACHED_REGEXPS * 2];
     AValue regExpFlags[A_NUM_CACHED_REGEXPS];
+
+    /* Cache for compiled Str format templates. formatCache[3n] is a format
+       string, formatCache[3n + 1] is its hash value and formatCache[3n + 2]
+       is the compiled template (see std_str_format.c). Entries are replaced
+       in round-robin order, starting from formatCacheIndex. */
+    AValue formatCache[A_NUM_CACHED_FORMATS * 3];
+    int formatCacheIndex;
 } AThread;
 
 
@@ -134,6 +146,7 @@ ABool AAdvanceNewRefList(AThread *t);
 ABool AAdvanceUntracedList(AThread *t);
 
 AThread *ACreateThread(AValue *temp);
+AThread *ACreateThreadWithStack(AValue *temp, AValue *stack, int stackSize);
 
 A_APIFUNC void AFreezeOtherThreads(void);
 A_APIFUNC void AFreezeOtherThreadsSilently(void);
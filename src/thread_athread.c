@@ -13,6 +13,7 @@
 #include "runtime.h"
 #include "thread_module.h"
 #include "thread_athread.h"
+#include "thread_fiber.h"
 #include "mem.h"
 #include "gc.h"
 #include "internal.h"
@@ -31,7 +32,6 @@ athread_mutex_t AStreamMutex;
 athread_mutex_t AFinalizerMutex;
 athread_mutex_t AInterpreterMutex; /* Protects the symbol table */
 
-static athread_cond_t AllFrozenCond;
 static athread_cond_t WakeUpCond;
 
 
@@ -40,7 +40,18 @@ volatile AAtomicInt AIsInterrupt;
 volatile AAtomicInt AIsKeyboardInterrupt;
 
 
-static int NumFreezableThreads;
+/* Number of threads that allow themselves to be frozen. This is modified
+   using atomic operations so that AAllowBlocking and AEndBlocking only need
+   to lock AThreadMutex if another thread is freezing threads. */
+static volatile int NumFreezableThreads;
+
+/* The thread that is freezing other threads waits on this futex word. It is
+   incremented whenever a thread becomes freezable during a freeze. */
+static volatile int FreezeProgress;
+
+/* Frozen threads wait on this futex word. It is incremented when the frozen
+   threads are woken up. */
+static volatile int FreezeEpoch;
 
 
 static int NumWaitingThreads;
@@ -76,20 +87,53 @@ static int FreezeDepth;
      sizeof(athread_mutex_t)))
 
 
+/* Maximum number of times a thread checks whether a Mutex has been unlocked
+   before going to sleep */
+#define MAX_SPIN_COUNT 100
+
+
+/* Data area of Mutex objects. The state is 0 if the mutex is unlocked, 1 if
+   it is locked and 2 if it is locked and other threads may be waiting for
+   it. */
+typedef struct {
+    volatile int state;
+    volatile int spinCount; /* Estimate of the number of iterations needed for
+                               acquiring the mutex by spinning */
+} MutexData;
+
+/* Data area of Condition objects */
+typedef struct {
+    volatile int seq;        /* Incremented when the condition is signaled */
+    volatile int numWaiters;
+} ConditionData;
+
+
 /* Return a pointer to the Mutex object data area when given a Mutex value. */
 #define GetMutexData(val) \
-    APtrAdd(AValueToPtr(AValueToInstance(val)->member[1]), sizeof(AValue))
+    ((MutexData *)APtrAdd(AValueToPtr(AValueToInstance(val)->member[0]), \
+                           sizeof(AValue)))
 
 /* Return a pointer to the Condition object data area when given a Condition
    value. */
 #define GetConditionData(val) \
-    APtrAdd(AValueToPtr(AValueToInstance(val)->member[1]), sizeof(AValue))
+    ((ConditionData *)APtrAdd(                                      \
+        AValueToPtr(AValueToInstance(val)->member[0]), sizeof(AValue)))
 
 
 static void *BeginNewThread(void *voidThread);
 static void AllowFreezeNoLock(void);
 static void DisallowFreezeNoLock(void);
 static void PerformFreeze(void);
+static void SignalFreezeProgress(void);
+static void RecordFreezeTime(double time);
+static void LockMutexSlow(MutexData *mutex);
+static void WaitForMutex(MutexData *mutex);
+static void UnlockMutex(MutexData *mutex);
+
+
+/* Is spinning useful, i.e. can the thread that holds a mutex be running
+   while another thread is waiting for the mutex? */
+static ABool IsMultiprocessor;
 
 
 ABool AInitializeThreads(void)
@@ -103,10 +147,10 @@ ABool AInitializeThreads(void)
         || athread_mutex_init(&AHashMutex, NULL)
         || athread_mutex_init(&AFinalizerMutex, NULL)
         || athread_mutex_init(&AInterpreterMutex, NULL)
-        || athread_cond_init(&AllFrozenCond, NULL)
         || athread_cond_init(&WakeUpCond, NULL)
         || athread_cond_init(&ArgBufRemoveCond, NULL)
-        || athread_cond_init(&ArgBufInsertCond, NULL))
+        || athread_cond_init(&ArgBufInsertCond, NULL)
+        || !AInitializeFibers())
         return FALSE;
 
     ArgBufFirst = 0;
@@ -118,9 +162,13 @@ ABool AInitializeThreads(void)
 
     NumWaitingThreads = 0;
     NumFreezableThreads = 0;
+    FreezeProgress = 0;
+    FreezeEpoch = 0;
 
     FreezeDepth = 0;
 
+    IsMultiprocessor = athread_num_cpus() > 1;
+
     return TRUE;
 }
 
@@ -253,7 +301,7 @@ static void *BeginNewThread(void *voidThread)
         /* Initially all the threads could be frozen. Make sure that the
            thread is not frozen after we start the execution of the thread,
            since otherwise the garbage collector might be active. */
-        NumFreezableThreads++;
+        athread_atomic_add(&NumFreezableThreads, 1);
         DisallowFreezeNoLock(); /* This decrements NumFreezableThreads. */
 
         /* If another thread may have read the arguments meanwhile, back off
@@ -339,8 +387,8 @@ static void *BeginNewThread(void *voidThread)
         NumWaitingThreads++;
         ANumThreads--;
 
-        if (AIsFreeze && NumFreezableThreads == ANumThreads - 1)
-            athread_cond_signal(&AllFrozenCond);
+        if (AIsFreeze)
+            SignalFreezeProgress();
 
         ADebugStatusMsg(("Alore thread ended   (%ld)\n", (long)t));
 
@@ -429,11 +477,57 @@ static void PerformFreeze(void)
     }
 
     AIsInterrupt = TRUE;
-    AIsFreeze = TRUE;
+    /* This must be visible to the threads in AEndBlocking before we read
+       NumFreezableThreads. */
+    athread_atomic_store(&AIsFreeze, TRUE);
+
+    if (ANumThreads > 1) {
+        double start = athread_time();
+
+        /* Wait until everybody can be frozen. Threads that are blocked or
+           running native code are already freezable, and we only have to
+           wait for the threads that are running Alore code to reach a
+           safepoint. Release the mutex while waiting, since threads may need
+           it to finish. */
+        for (;;) {
+            int progress = athread_atomic_load(&FreezeProgress);
+            if (athread_atomic_load(&NumFreezableThreads) >= ANumThreads - 1)
+                break;
+            athread_mutex_unlock(&AThreadMutex);
+            athread_futex_wait(&FreezeProgress, progress, -1.0);
+            athread_mutex_lock(&AThreadMutex);
+        }
 
-    /* Wait until everybody can be frozen. */
-    while (NumFreezableThreads < ANumThreads - 1)
-        athread_cond_wait(&AllFrozenCond, &AThreadMutex);
+        RecordFreezeTime(athread_time() - start);
+    }
+}
+
+
+/* Wake up the thread that is waiting for other threads to be frozen so that
+   it checks whether all threads are freezable. */
+static void SignalFreezeProgress(void)
+{
+    athread_atomic_add(&FreezeProgress, 1);
+    athread_futex_wake(&FreezeProgress, 1);
+}
+
+
+/* Record the time needed for freezing threads (time-to-safepoint) in the gc
+   statistics. Precondition: AThreadMutex locked. */
+static void RecordFreezeTime(double time)
+{
+    double limit;
+    int i;
+
+    AGCStat.freezeCount++;
+    AGCStat.freezeTime += time;
+    if (time > AGCStat.maxFreezeTime)
+        AGCStat.maxFreezeTime = time;
+
+    limit = 1e-6;
+    for (i = 0; i < A_FREEZE_HISTOGRAM_SIZE - 1 && time >= limit; i++)
+        limit *= 2;
+    AGCStat.freezeHistogram[i]++;
 }
 
 
@@ -448,9 +542,11 @@ void AWakeOtherThreads(void)
         ADebugStatusMsg(("Waking other threads\n"));
 
         AIsInterrupt = AIsKeyboardInterrupt;
-        AIsFreeze = FALSE;
+        athread_atomic_store(&AIsFreeze, FALSE);
+        athread_atomic_add(&FreezeEpoch, 1);
 
         athread_mutex_unlock(&AThreadMutex);
+        athread_futex_wake(&FreezeEpoch, INT_MAX);
         athread_cond_broadcast(&WakeUpCond);
     } else
         athread_mutex_unlock(&AThreadMutex);
@@ -466,51 +562,54 @@ void AWakeOtherThreadsSilently(void)
     FreezeDepth--;
     if (FreezeDepth == 0) {
         AIsInterrupt = AIsKeyboardInterrupt;
-        AIsFreeze = FALSE;
+        athread_atomic_store(&AIsFreeze, FALSE);
+        athread_atomic_add(&FreezeEpoch, 1);
 
         athread_mutex_unlock(&AThreadMutex);
+        athread_futex_wake(&FreezeEpoch, INT_MAX);
         athread_cond_broadcast(&WakeUpCond);
     } else
         athread_mutex_unlock(&AThreadMutex);
 }
 
 
+/* Mark the current thread as freezable, i.e. the thread promises not to
+   access the Alore heap until it calls AEndBlocking. */
 void AAllowBlocking(void)
 {
-    athread_mutex_lock(&AThreadMutex);
+    athread_atomic_add(&NumFreezableThreads, 1);
 
-    /* Mark thread as freezable. */
-    NumFreezableThreads++;
-
-    if (AIsFreeze && NumFreezableThreads == ANumThreads - 1)
-        athread_cond_signal(&AllFrozenCond);
-
-    athread_mutex_unlock(&AThreadMutex);
+    if (athread_atomic_load(&AIsFreeze))
+        SignalFreezeProgress();
 }
 
 
 void AllowFreezeNoLock(void)
 {
-    /* Mark thread as freezable. */
-    NumFreezableThreads++;
-
-    if (AIsFreeze && NumFreezableThreads == ANumThreads - 1)
-        athread_cond_signal(&AllFrozenCond);
+    AAllowBlocking();
 }
 
 
+/* Mark the current thread as not freezable, and wait if other threads are
+   frozen. These operations do not need any locks. */
 void AEndBlocking(void)
 {
-    athread_mutex_lock(&AThreadMutex);
-
-    /* Check if gotta freeze. */
-    while (AIsFreeze)
-        athread_cond_wait(&WakeUpCond, &AThreadMutex);
+    for (;;) {
+        /* Read the epoch before checking AIsFreeze so that we cannot miss a
+           wake-up. */
+        int epoch = athread_atomic_load(&FreezeEpoch);
 
-    /* Mark thread as not freezable. */
-    NumFreezableThreads--;
+        athread_atomic_add(&NumFreezableThreads, -1);
+        if (!athread_atomic_load(&AIsFreeze))
+            break;
 
-    athread_mutex_unlock(&AThreadMutex);
+        /* The freezing thread may have already seen this thread as frozen.
+           Mark the thread as freezable again and wait until the other
+           threads have been woken up. */
+        AAllowBlocking();
+        while (athread_atomic_load(&FreezeEpoch) == epoch)
+            athread_futex_wait(&FreezeEpoch, epoch, -1.0);
+    }
 }
 
 
@@ -521,68 +620,60 @@ void DisallowFreezeNoLock(void)
         athread_cond_wait(&WakeUpCond, &AThreadMutex);
 
     /* Mark thread as not freezable. */
-    NumFreezableThreads--;
+    athread_atomic_add(&NumFreezableThreads, -1);
 }
 
 
+/* Mutex and Condition objects are implemented using atomic operations and
+   futexes, and they do not need to be finalized. */
+
+
 AValue AMutexCreate(AThread *t, AValue *frame)
 {
     AValue *mutex;
+    MutexData *data;
 
-    mutex = AAllocUnmovable(sizeof(AValue) + sizeof(athread_mutex_t));
+    mutex = AAllocUnmovable(sizeof(AValue) + sizeof(MutexData));
     if (mutex == NULL)
         return ARaiseMemoryErrorND(t);
 
-    AInitNonPointerBlock(mutex, sizeof(athread_mutex_t));
+    AInitNonPointerBlock(mutex, sizeof(MutexData));
 
     *t->tempStack = AStrToValue(mutex);
-    ASetMemberDirect(t, frame[0], 1, *t->tempStack);
+    ASetMemberDirect(t, frame[0], 0, *t->tempStack);
+    *t->tempStack = AZero;
 
-    if (athread_mutex_init(APtrAdd(AValueToPtr(*t->tempStack), sizeof(AValue)),
-                           NULL))
-        return ARaiseMemoryErrorND(t);
+    data = GetMutexData(frame[0]);
+    data->state = 0;
+    data->spinCount = 0;
 
     return frame[0];
 }
 
 
-AValue AMutexFinalize(AThread *t, AValue *frame)
-{
-    if (AValueToInstance(frame[0])->member[1] != ANil)
-        athread_mutex_destroy(GetMutexData(frame[0]));
-    return AZero;
-}
-
-
 AValue AConditionCreate(AThread *t, AValue *frame)
 {
     AValue *cond;
+    ConditionData *data;
 
-    cond = AAllocUnmovable(sizeof(AValue) + sizeof(athread_cond_t));
+    cond = AAllocUnmovable(sizeof(AValue) + sizeof(ConditionData));
     if (cond == NULL)
         return ARaiseMemoryErrorND(t);
 
-    AInitNonPointerBlock(cond, sizeof(athread_cond_t));
+    AInitNonPointerBlock(cond, sizeof(ConditionData));
 
     *t->tempStack = AStrToValue(cond);
-    ASetMemberDirect(t, frame[0], 1, *t->tempStack);
+    ASetMemberDirect(t, frame[0], 0, *t->tempStack);
+    *t->tempStack = AZero;
 
-    if (athread_cond_init(APtrAdd(AValueToPtr(*t->tempStack), sizeof(AValue)),
-                          NULL))
-        return ARaiseMemoryErrorND(t);
+    data = GetConditionData(frame[0]);
+    data->seq = 0;
+    data->numWaiters = 0;
 
     return frame[0];
 }
 
 
-AValue AConditionFinalize(AThread *t, AValue *frame)
-{
-    if (AValueToInstance(frame[0])->member[1] != ANil)
-        athread_cond_destroy(GetConditionData(frame[0]));
-    return AZero;
-}
-
-
 AValue AThreadJoin(AThread *t, AValue *frame)
 {
     AInstance *inst;
@@ -641,11 +732,10 @@ AValue AThreadStop(AThread *t, AValue *frame)
 
 AValue AMutexLock(AThread *t, AValue *frame)
 {
-    if (athread_mutex_trylock(GetMutexData(frame[0])) == EBUSY) {
-        AAllowBlocking();
-        athread_mutex_lock(GetMutexData(frame[0]));
-        AEndBlocking();
-    }
+    MutexData *mutex = GetMutexData(frame[0]);
+
+    if (!athread_atomic_cas(&mutex->state, 0, 1))
+        LockMutexSlow(mutex);
 
     return ANil;
 }
@@ -653,35 +743,128 @@ AValue AMutexLock(AThread *t, AValue *frame)
 
 AValue AMutexUnlock(AThread *t, AValue *frame)
 {
-    athread_mutex_unlock(GetMutexData(frame[0]));
+    UnlockMutex(GetMutexData(frame[0]));
     return ANil;
 }
 
 
+/* Acquire a mutex that was locked by another thread. First spin for a while,
+   since mutexes are usually held only briefly, and then go to sleep. The
+   number of iterations is adapted to the number of iterations that were
+   needed previously. */
+static void LockMutexSlow(MutexData *mutex)
+{
+    if (IsMultiprocessor) {
+        int spinCount = mutex->spinCount;
+        int maxSpins = 2 * spinCount + 10;
+        int i;
+
+        if (maxSpins > MAX_SPIN_COUNT)
+            maxSpins = MAX_SPIN_COUNT;
+
+        for (i = 0; i < maxSpins; i++) {
+            athread_cpu_relax();
+            if (athread_atomic_load(&mutex->state) == 0
+                && athread_atomic_cas(&mutex->state, 0, 1)) {
+                mutex->spinCount = spinCount + (i - spinCount) / 8;
+                return;
+            }
+        }
+
+        mutex->spinCount = spinCount + (maxSpins - spinCount) / 8;
+    }
+
+    AAllowBlocking();
+    WaitForMutex(mutex);
+    AEndBlocking();
+}
+
+
+/* Acquire a mutex, sleeping if it is locked. The caller must allow blocking.
+   Since we cannot know whether other threads are waiting, the state of the
+   mutex is always 2 after this function. */
+static void WaitForMutex(MutexData *mutex)
+{
+    while (athread_atomic_swap(&mutex->state, 2) != 0)
+        athread_futex_wait(&mutex->state, 2, -1.0);
+}
+
+
+static void UnlockMutex(MutexData *mutex)
+{
+    if (athread_atomic_add(&mutex->state, -1) != 0) {
+        /* Other threads may be waiting. */
+        athread_atomic_store(&mutex->state, 0);
+        athread_futex_wake(&mutex->state, 1);
+    }
+}
+
+
+/* Condition wait(mutex[, timeout])
+   Release the mutex and wait until the condition is signaled or until the
+   timeout (in seconds) expires. Acquire the mutex again before returning.
+   Return FALSE if the timeout expired. */
 AValue AConditionWait(AThread *t, AValue *frame)
 {
+    ConditionData *cond;
+    MutexData *mutex;
+    double timeout;
+    int key;
+    int result;
+
     if (AIsOfType(frame[1], AGlobalByNum(AThreadMutexNum)) != A_IS_TRUE)
         return ARaiseTypeErrorND(t, NULL);
 
+    if (AIsDefault(frame[2]))
+        timeout = -1.0;
+    else {
+        timeout = AGetFloat(t, frame[2]);
+        if (timeout < 0.0)
+            timeout = 0.0;
+    }
+
+    cond = GetConditionData(frame[0]);
+    mutex = GetMutexData(frame[1]);
+
+    /* Read the sequence number before releasing the mutex so that signals
+       sent after releasing the mutex cannot be lost. */
+    athread_atomic_add(&cond->numWaiters, 1);
+    key = athread_atomic_load(&cond->seq);
+    UnlockMutex(mutex);
+
     AAllowBlocking();
-    athread_cond_wait(GetConditionData(frame[0]),
-                      GetMutexData(frame[1]));
+    result = athread_futex_wait(&cond->seq, key, timeout);
+    WaitForMutex(mutex);
     AEndBlocking();
 
-    return ANil;
+    athread_atomic_add(&cond->numWaiters, -1);
+
+    return result == ETIMEDOUT ? AFalse : ATrue;
 }
 
 
 AValue AConditionSignal(AThread *t, AValue *frame)
 {
-    athread_cond_signal(GetConditionData(frame[0]));
+    ConditionData *cond = GetConditionData(frame[0]);
+
+    if (athread_atomic_load(&cond->numWaiters) > 0) {
+        athread_atomic_add(&cond->seq, 1);
+        athread_futex_wake(&cond->seq, 1);
+    }
+
     return ANil;
 }
 
 
 AValue AConditionBroadcast(AThread *t, AValue *frame)
 {
-    athread_cond_broadcast(GetConditionData(frame[0]));
+    ConditionData *cond = GetConditionData(frame[0]);
+
+    if (athread_atomic_load(&cond->numWaiters) > 0) {
+        athread_atomic_add(&cond->seq, 1);
+        athread_futex_wake(&cond->seq, INT_MAX);
+    }
+
     return ANil;
 }
 
@@ -690,23 +873,13 @@ ABool AHandleInterrupt(AThread *t)
 {
     ABool retVal;
 
-    athread_mutex_lock(&AThreadMutex);
-
-    if (AIsFreeze) {
-        /* IDEA: Use AllowFreezeNoLock / DisallowFreezeNoLock. */
-        NumFreezableThreads++;
-
-        if (NumFreezableThreads == ANumThreads - 1)
-            athread_cond_signal(&AllFrozenCond);
-
-        while (AIsFreeze)
-            athread_cond_wait(&WakeUpCond, &AThreadMutex);
-
-        NumFreezableThreads--;
+    /* This is a safepoint. If another thread is freezing threads, stop here
+       until the threads are woken up. */
+    if (athread_atomic_load(&AIsFreeze)) {
+        AAllowBlocking();
+        AEndBlocking();
     }
 
-    athread_mutex_unlock(&AThreadMutex);
-
     /* Check if we should raise an InterruptException. It is only raised in the
        main thread and only once per ctrl+c press. */
     if (t == AMainThread && AIsKeyboardInterrupt) {
@@ -721,6 +894,39 @@ ABool AHandleInterrupt(AThread *t)
 }
 
 
+/* thread::__FreezeStats()
+   Return statistics about the time needed for freezing threads as an array
+   (count, total time, maximum time, histogram). See AGCStatistics for
+   details. */
+AValue AThreadFreezeStats(AThread *t, AValue *frame)
+{
+    unsigned long count;
+    double total;
+    double max;
+    unsigned long histogram[A_FREEZE_HISTOGRAM_SIZE];
+    int i;
+
+    athread_mutex_lock(&AThreadMutex);
+    count = AGCStat.freezeCount;
+    total = AGCStat.freezeTime;
+    max = AGCStat.maxFreezeTime;
+    for (i = 0; i < A_FREEZE_HISTOGRAM_SIZE; i++)
+        histogram[i] = AGCStat.freezeHistogram[i];
+    athread_mutex_unlock(&AThreadMutex);
+
+    frame[0] = AMakeArray(t, 4);
+    ASetArrayItem(t, frame[0], 0, AMakeInt64(t, count));
+    ASetArrayItem(t, frame[0], 1, AMakeFloat(t, total));
+    ASetArrayItem(t, frame[0], 2, AMakeFloat(t, max));
+    frame[1] = AMakeArray(t, A_FREEZE_HISTOGRAM_SIZE);
+    ASetArrayItem(t, frame[0], 3, frame[1]);
+    for (i = 0; i < A_FREEZE_HISTOGRAM_SIZE; i++)
+        ASetArrayItem(t, frame[1], i, AMakeInt64(t, histogram[i]));
+
+    return frame[0];
+}
+
+
 /* Lock mutable interpreter data structures (currently only the symbol
    table). Accessing a known SymbolInfo structure is allowed without locking,
    since the structures are mostly immutable while not compiling, and during
@@ -0,0 +1,207 @@
+/* thread_atomic.c - thread module (AtomicInt and AtomicRef classes)
+
+   Copyright (c) 2010-2011 Jukka Lehtosalo
+
+   Alore is licensed under the terms of the MIT license.  See the file
+   LICENSE.txt in the distribution.
+*/
+
+/* AtomicInt and AtomicRef objects store their value in a single member
+   variable that is modified using atomic operations. This is safe even
+   though objects can be moved by the garbage collector, since garbage
+   collection only happens while all the other threads are frozen, and
+   threads cannot be frozen in the middle of these operations.
+
+   AtomicInt values are always short Int values. Since these are not
+   pointers, they can be stored without a write barrier. AtomicRef values are
+   arbitrary references, and the write barrier is performed before the atomic
+   store using AModifyObjectBarrier_M. */
+
+#include "alore.h"
+#include "runtime.h"
+#include "thread_module.h"
+#include "thread_athread.h"
+#include "int.h"
+#include "mem.h"
+#include "gc.h"
+
+
+/* Member index of the value of AtomicInt and AtomicRef objects */
+#define ATOMIC_VALUE 0
+
+
+/* Return a pointer to the value of an AtomicInt or AtomicRef object. */
+#define GetValuePtr(v) \
+    ((volatile AValue *)&AValueToInstance(v)->member[ATOMIC_VALUE])
+
+
+static AValue GetShortInt(AThread *t, AValue v);
+static AValue WriteBarrier(AThread *t, AValue *frame, AValue *newValue);
+
+
+/* AtomicInt create([value]) */
+AValue AAtomicIntCreate(AThread *t, AValue *frame)
+{
+    if (AIsDefault(frame[1]))
+        frame[1] = AZero;
+    AValueToInstance(frame[0])->member[ATOMIC_VALUE] =
+        GetShortInt(t, frame[1]);
+    return frame[0];
+}
+
+
+/* AtomicInt get() */
+AValue AAtomicIntGet(AThread *t, AValue *frame)
+{
+    return athread_atomic_load_long(GetValuePtr(frame[0]));
+}
+
+
+/* AtomicInt set(value) */
+AValue AAtomicIntSet(AThread *t, AValue *frame)
+{
+    AValue value = GetShortInt(t, frame[1]);
+    athread_atomic_store_long(GetValuePtr(frame[0]), value);
+    return ANil;
+}
+
+
+/* AtomicInt add([delta])
+   Add delta (default 1) to the value and return the new value. */
+AValue AAtomicIntAdd(AThread *t, AValue *frame)
+{
+    AValue delta;
+    AValue old;
+    AValue sum;
+
+    if (AIsDefault(frame[1]))
+        delta = AIntToValue(1);
+    else
+        delta = GetShortInt(t, frame[1]);
+
+    /* Short Int values can be added without untagging them. */
+    do {
+        old = athread_atomic_load_long(GetValuePtr(frame[0]));
+        sum = old + delta;
+        if (AIsAddOverflow(sum, old, delta))
+            return ARaiseArithmeticErrorND(t, "AtomicInt overflow");
+    } while (!athread_atomic_cas_long(GetValuePtr(frame[0]), old, sum));
+
+    return sum;
+}
+
+
+/* AtomicInt compareAndSet(expected, new)
+   If the value equals expected, replace it with new and return True.
+   Otherwise, return False. */
+AValue AAtomicIntCompareAndSet(AThread *t, AValue *frame)
+{
+    AValue new = GetShortInt(t, frame[2]);
+
+    if (!AIsShortInt(frame[1])) {
+        if (AIsLongInt(frame[1]))
+            return AFalse;
+        return ARaiseTypeErrorND(t, NULL);
+    }
+
+    return athread_atomic_cas_long(GetValuePtr(frame[0]), frame[1], new)
+        ? ATrue : AFalse;
+}
+
+
+/* AtomicInt exchange(value)
+   Replace the value and return the old value. */
+AValue AAtomicIntExchange(AThread *t, AValue *frame)
+{
+    AValue value = GetShortInt(t, frame[1]);
+    return athread_atomic_swap_long(GetValuePtr(frame[0]), value);
+}
+
+
+/* AtomicInt _str() */
+AValue AAtomicIntStr(AThread *t, AValue *frame)
+{
+    return AToStr(t, athread_atomic_load_long(GetValuePtr(frame[0])));
+}
+
+
+/* AtomicRef create([value]) */
+AValue AAtomicRefCreate(AThread *t, AValue *frame)
+{
+    if (AIsDefault(frame[1]))
+        frame[1] = ANil;
+    ASetMemberDirect(t, frame[0], ATOMIC_VALUE, frame[1]);
+    return frame[0];
+}
+
+
+/* AtomicRef get() */
+AValue AAtomicRefGet(AThread *t, AValue *frame)
+{
+    return athread_atomic_load_long(GetValuePtr(frame[0]));
+}
+
+
+/* AtomicRef set(value) */
+AValue AAtomicRefSet(AThread *t, AValue *frame)
+{
+    if (AIsError(WriteBarrier(t, frame, frame + 1)))
+        return AError;
+    athread_atomic_store_long(GetValuePtr(frame[0]), frame[1]);
+    return ANil;
+}
+
+
+/* AtomicRef compareAndSet(expected, new)
+   If the value is the same object as expected, replace it with new and return
+   True. Otherwise, return False. */
+AValue AAtomicRefCompareAndSet(AThread *t, AValue *frame)
+{
+    if (AIsError(WriteBarrier(t, frame, frame + 2)))
+        return AError;
+    return athread_atomic_cas_long(GetValuePtr(frame[0]), frame[1], frame[2])
+        ? ATrue : AFalse;
+}
+
+
+/* AtomicRef exchange(value)
+   Replace the value and return the old value. */
+AValue AAtomicRefExchange(AThread *t, AValue *frame)
+{
+    if (AIsError(WriteBarrier(t, frame, frame + 1)))
+        return AError;
+    return athread_atomic_swap_long(GetValuePtr(frame[0]), frame[1]);
+}
+
+
+/* Check that v is an Int that can be stored in an AtomicInt object and
+   return it. Raise a direct exception if it is not valid. */
+static AValue GetShortInt(AThread *t, AValue v)
+{
+    if (AIsShortInt(v))
+        return v;
+    else if (AIsLongInt(v))
+        ARaiseValueError(t, "AtomicInt value out of range");
+    else
+        ARaiseTypeError(t, AMsgIntExpected);
+
+    /* Not reached */
+    return AZero;
+}
+
+
+/* Perform the write barrier for storing *newValue in the AtomicRef object
+   frame[0]. The caller must store the value immediately after this, before
+   the thread can be frozen. */
+static AValue WriteBarrier(AThread *t, AValue *frame, AValue *newValue)
+{
+    AInstance *inst = AValueToInstance(frame[0]);
+    ABool result;
+
+    AModifyObjectBarrier_M(t, &inst->type, inst->member + ATOMIC_VALUE,
+                           newValue, result);
+    if (!result)
+        return ARaiseMemoryErrorND(t);
+
+    return ANil;
+}
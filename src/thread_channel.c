@@ -0,0 +1,514 @@
+/* thread_channel.c - thread module (Channel class)
+
+   Copyright (c) 2010-2011 Jukka Lehtosalo
+
+   Alore is licensed under the terms of the MIT license.  See the file
+   LICENSE.txt in the distribution.
+*/
+
+/* A Channel is a bounded multi-producer, multi-consumer queue. It is
+   implemented as a lock-free ring buffer: each slot has a sequence number
+   that tells whether the slot is ready to be written or read during the
+   current lap around the buffer, and the producers and consumers claim slots
+   by atomically incrementing the enqueue and dequeue positions. The sequence
+   number of a slot is 2 * pos if the slot is free for writing the item at
+   position pos, and 2 * pos + 1 if the slot contains that item.
+
+   Threads only block when the channel is full or empty. A blocked thread
+   waits on an event counter (a futex) and allows other threads to freeze it
+   while waiting. Threads that make progress increment the event counter and
+   wake up waiters only if there are any, so the non-blocking fast paths never
+   take a lock. A fiber that blocks only suspends itself and lets the other
+   fibers of its scheduler run. */
+
+#include "alore.h"
+#include "runtime.h"
+#include "thread_module.h"
+#include "thread_athread.h"
+#include "thread_fiber.h"
+#include "array.h"
+#include "mem.h"
+#include "gc.h"
+
+
+/* Maximum capacity of a channel */
+#define MAX_CAPACITY (1 << 28)
+
+
+/* Member indices of Channel objects */
+enum {
+    CHANNEL_DATA,       /* Non-pointer block containing ChannelData */
+    CHANNEL_BUFFER      /* Array that holds the items */
+};
+
+/* Member indices of ChannelIter objects */
+enum {
+    ITER_CHANNEL,
+    ITER_ITEM,
+    ITER_STATE          /* One of the ITER_x states below */
+};
+
+/* States of ChannelIter objects */
+enum {
+    ITER_UNKNOWN,       /* Next item has not been received yet */
+    ITER_HAS_ITEM,      /* Next item has been received and stored */
+    ITER_DONE           /* Channel has been closed and it is empty */
+};
+
+/* Return values of channel operations */
+enum {
+    CH_OK,
+    CH_WOULD_BLOCK,     /* Channel is full or empty or timeout expired */
+    CH_CLOSED,
+    CH_NO_MEMORY
+};
+
+
+/* Size of padding used to keep frequently modified fields in separate cache
+   lines */
+#define PAD_SIZE (64 - sizeof(int))
+
+
+typedef struct {
+    volatile int enqueuePos;  /* Position of the next slot to write */
+    char pad1[PAD_SIZE];
+    volatile int dequeuePos;  /* Position of the next slot to read */
+    char pad2[PAD_SIZE];
+    volatile int sendEvent;   /* Incremented when space becomes available */
+    volatile int receiveEvent; /* Incremented when an item is added */
+    volatile int numSenders;  /* Number of senders waiting for sendEvent */
+    volatile int numReceivers; /* Number of receivers waiting for
+                                  receiveEvent */
+    volatile int isClosed;
+    int capacity;             /* Capacity (a power of two) */
+    volatile int seq[1];      /* Sequence numbers (capacity items) */
+} ChannelData;
+
+
+/* Return a pointer to the ChannelData structure when given a Channel
+   value. */
+#define GetChannelData(ch) \
+    ((ChannelData *)APtrAdd(AValueToPtr(AMemberDirect(ch, CHANNEL_DATA)), \
+                            sizeof(AValue)))
+
+
+static int Send(AThread *t, AValue *channel, AValue *item, double timeout);
+static int Receive(AThread *t, AValue *channel, AValue *item,
+                   double timeout);
+static int TrySend(AThread *t, AValue *channel, AValue *item);
+static int TryReceive(AValue *channel, AValue *item);
+static void WakeUp(volatile int *event, volatile int *numWaiters);
+static ABool WaitForEvent(AThread *t, volatile int *event, int key,
+                          double timeout, double deadline);
+static AValue RaiseError(AThread *t, int status);
+static double GetTimeout(AThread *t, AValue timeout);
+
+
+/* Channel create(capacity) */
+AValue AChannelCreate(AThread *t, AValue *frame)
+{
+    int capacity;
+    int requested;
+    unsigned long size;
+    AValue *block;
+    ChannelData *data;
+    int i;
+
+    requested = AGetInt(t, frame[1]);
+    if (requested < 1)
+        return ARaiseValueError(t, "Invalid capacity");
+    if (requested > MAX_CAPACITY)
+        return ARaiseValueError(t, "Capacity too large");
+
+    /* Round the capacity up to a power of two so that the slot of a position
+       can be calculated using a mask even if the positions wrap around. */
+    for (capacity = 1; capacity < requested; capacity *= 2);
+
+    frame[2] = AMakeArray(t, capacity);
+    ASetMemberDirect(t, frame[0], CHANNEL_BUFFER, frame[2]);
+
+    size = sizeof(ChannelData) + (capacity - 1) * sizeof(int);
+    block = AAllocUnmovable(sizeof(AValue) + size);
+    if (block == NULL)
+        return ARaiseMemoryError(t);
+
+    AInitNonPointerBlockOld(block, size);
+
+    *t->tempStack = ANonPointerBlockToValue(block);
+    ASetMemberDirect(t, frame[0], CHANNEL_DATA, *t->tempStack);
+    *t->tempStack = AZero;
+    data = GetChannelData(frame[0]);
+
+    data->enqueuePos = 0;
+    data->dequeuePos = 0;
+    data->sendEvent = 0;
+    data->receiveEvent = 0;
+    data->numSenders = 0;
+    data->numReceivers = 0;
+    data->isClosed = FALSE;
+    data->capacity = capacity;
+    for (i = 0; i < capacity; i++)
+        data->seq[i] = 2 * i;
+
+    return frame[0];
+}
+
+
+/* Channel send(item[, timeout])
+   Add an item to the channel. Wait until there is space in the channel. */
+AValue AChannelSend(AThread *t, AValue *frame)
+{
+    int status = Send(t, frame, frame + 1, GetTimeout(t, frame[2]));
+    if (status != CH_OK)
+        return RaiseError(t, status);
+    return ANil;
+}
+
+
+/* Channel receive([timeout])
+   Remove an item from the channel and return it. Wait until there is an item
+   in the channel. */
+AValue AChannelReceive(AThread *t, AValue *frame)
+{
+    int status = Receive(t, frame, frame + 2, GetTimeout(t, frame[1]));
+    if (status != CH_OK)
+        return RaiseError(t, status);
+    return frame[2];
+}
+
+
+/* Channel receiveBatch(maxCount[, timeout])
+   Wait until there is at least one item in the channel, and remove and return
+   up to maxCount items as an array. */
+AValue AChannelReceiveBatch(AThread *t, AValue *frame)
+{
+    int maxCount;
+    int status;
+    int n;
+
+    maxCount = AGetInt(t, frame[1]);
+    if (maxCount < 1)
+        return ARaiseValueError(t, "Invalid count");
+
+    status = Receive(t, frame, frame + 4, GetTimeout(t, frame[2]));
+    if (status != CH_OK)
+        return RaiseError(t, status);
+
+    frame[3] = AMakeArray(t, 0);
+    AAppendArray(t, frame[3], frame[4]);
+    for (n = 1; n < maxCount && TryReceive(frame, frame + 4) == CH_OK; n++)
+        AAppendArray(t, frame[3], frame[4]);
+
+    return frame[3];
+}
+
+
+/* Channel close()
+   Close the channel. Items cannot be sent to a closed channel, but the items
+   that are already in the channel can still be received. */
+AValue AChannelClose(AThread *t, AValue *frame)
+{
+    ChannelData *data = GetChannelData(frame[0]);
+
+    athread_atomic_store(&data->isClosed, TRUE);
+
+    /* Wake up all the waiting threads. */
+    athread_atomic_add(&data->sendEvent, 1);
+    AFiberFutexWake(&data->sendEvent, INT_MAX);
+    athread_atomic_add(&data->receiveEvent, 1);
+    AFiberFutexWake(&data->receiveEvent, INT_MAX);
+
+    return ANil;
+}
+
+
+/* Channel isClosed() */
+AValue AChannelIsClosed(AThread *t, AValue *frame)
+{
+    ChannelData *data = GetChannelData(frame[0]);
+    return athread_atomic_load(&data->isClosed) ? ATrue : AFalse;
+}
+
+
+/* Channel length()
+   Return the number of items in the channel. The result may be inaccurate
+   if other threads are modifying the channel concurrently. */
+AValue AChannelLength(AThread *t, AValue *frame)
+{
+    ChannelData *data = GetChannelData(frame[0]);
+    int n = (int)((unsigned)athread_atomic_load(&data->enqueuePos)
+                  - (unsigned)athread_atomic_load(&data->dequeuePos));
+    if (n < 0)
+        n = 0;
+    else if (n > data->capacity)
+        n = data->capacity;
+    return AIntToValue(n);
+}
+
+
+/* Channel iterator() */
+AValue AChannelIter(AThread *t, AValue *frame)
+{
+    frame[1] = AMakeUninitializedObject(t,
+                                        AGlobalByNum(AChannelIterClassNum));
+    ASetMemberDirect(t, frame[1], ITER_CHANNEL, frame[0]);
+    ASetMemberDirect(t, frame[1], ITER_STATE, AIntToValue(ITER_UNKNOWN));
+    return frame[1];
+}
+
+
+/* ChannelIter hasNext()
+   Wait until there is an item in the channel or the channel has been closed
+   and it is empty. */
+AValue AChannelIterHasNext(AThread *t, AValue *frame)
+{
+    int status;
+
+    if (AMemberDirect(frame[0], ITER_STATE) == AIntToValue(ITER_UNKNOWN)) {
+        frame[1] = AMemberDirect(frame[0], ITER_CHANNEL);
+        status = Receive(t, frame + 1, frame + 2, -1.0);
+        if (status == CH_OK) {
+            ASetMemberDirect(t, frame[0], ITER_ITEM, frame[2]);
+            ASetMemberDirect(t, frame[0], ITER_STATE,
+                             AIntToValue(ITER_HAS_ITEM));
+        } else if (status == CH_CLOSED)
+            ASetMemberDirect(t, frame[0], ITER_STATE,
+                             AIntToValue(ITER_DONE));
+        else
+            return RaiseError(t, status);
+    }
+
+    return AMemberDirect(frame[0], ITER_STATE) == AIntToValue(ITER_HAS_ITEM)
+        ? ATrue : AFalse;
+}
+
+
+/* ChannelIter next() */
+AValue AChannelIterNext(AThread *t, AValue *frame)
+{
+    if (AChannelIterHasNext(t, frame) == AFalse)
+        return ARaiseValueError(t, "No items left");
+
+    frame[1] = AMemberDirect(frame[0], ITER_ITEM);
+    AValueToInstance(frame[0])->member[ITER_ITEM] = ANil;
+    AValueToInstance(frame[0])->member[ITER_STATE] =
+        AIntToValue(ITER_UNKNOWN);
+    return frame[1];
+}
+
+
+/* Add *item to the channel *channel. Wait for at most timeout seconds for
+   space if the channel is full (timeout < 0 means no timeout). */
+static int Send(AThread *t, AValue *channel, AValue *item, double timeout)
+{
+    ChannelData *data = GetChannelData(*channel);
+    double deadline = timeout > 0.0 ? athread_time() + timeout : 0.0;
+    int status;
+
+    for (;;) {
+        int key;
+        ABool isTimedOut;
+
+        status = TrySend(t, channel, item);
+        if (status != CH_WOULD_BLOCK || timeout == 0.0)
+            return status;
+
+        /* Register as a waiter and try again, since a receiver may have made
+           space in the channel before it saw our registration. */
+        key = athread_atomic_load(&data->sendEvent);
+        athread_atomic_add(&data->numSenders, 1);
+        status = TrySend(t, channel, item);
+        if (status == CH_WOULD_BLOCK)
+            isTimedOut = WaitForEvent(t, &data->sendEvent, key, timeout,
+                                      deadline);
+        else
+            isTimedOut = FALSE;
+        athread_atomic_add(&data->numSenders, -1);
+
+        if (status != CH_WOULD_BLOCK)
+            return status;
+        if (isTimedOut)
+            timeout = 0.0;
+    }
+}
+
+
+/* Remove an item from the channel *channel and store it in *item. Wait for
+   at most timeout seconds for an item if the channel is empty (timeout < 0
+   means no timeout). */
+static int Receive(AThread *t, AValue *channel, AValue *item, double timeout)
+{
+    ChannelData *data = GetChannelData(*channel);
+    double deadline = timeout > 0.0 ? athread_time() + timeout : 0.0;
+    int status;
+
+    for (;;) {
+        int key;
+        ABool isTimedOut;
+
+        status = TryReceive(channel, item);
+        if (status != CH_WOULD_BLOCK || timeout == 0.0)
+            return status;
+
+        key = athread_atomic_load(&data->receiveEvent);
+        athread_atomic_add(&data->numReceivers, 1);
+        status = TryReceive(channel, item);
+        if (status == CH_WOULD_BLOCK)
+            isTimedOut = WaitForEvent(t, &data->receiveEvent, key, timeout,
+                                      deadline);
+        else
+            isTimedOut = FALSE;
+        athread_atomic_add(&data->numReceivers, -1);
+
+        if (status != CH_WOULD_BLOCK)
+            return status;
+        if (isTimedOut)
+            timeout = 0.0;
+    }
+}
+
+
+/* Try to add *item to the channel *channel without blocking. */
+static int TrySend(AThread *t, AValue *channel, AValue *item)
+{
+    ChannelData *data = GetChannelData(*channel);
+    unsigned mask = data->capacity - 1;
+    unsigned pos;
+    volatile int *seq;
+    ABool result;
+
+    if (athread_atomic_load(&data->isClosed))
+        return CH_CLOSED;
+
+    pos = athread_atomic_load(&data->enqueuePos);
+    for (;;) {
+        int diff;
+
+        seq = &data->seq[pos & mask];
+        diff = (int)((unsigned)athread_atomic_load(seq) - 2 * pos);
+        if (diff == 0) {
+            /* The slot is free. Try to claim it. */
+            if (athread_atomic_cas(&data->enqueuePos, (int)pos,
+                                   (int)(pos + 1)))
+                break;
+        } else if (diff < 0) {
+            /* The slot still contains an item from the previous lap. */
+            return CH_WOULD_BLOCK;
+        }
+        pos = athread_atomic_load(&data->enqueuePos);
+    }
+
+    /* Store the item and publish it to receivers. The slot cannot be given
+       back, since other senders may have claimed later slots. If the store
+       fails, publish AError instead; receivers skip these slots. */
+    result = ASetArrayItemND(t, AMemberDirect(*channel, CHANNEL_BUFFER),
+                             pos & mask, *item);
+    if (!result)
+        AArrayItem(AMemberDirect(*channel, CHANNEL_BUFFER), pos & mask) =
+            AError;
+    athread_atomic_store(seq, (int)(2 * pos + 1));
+
+    WakeUp(&data->receiveEvent, &data->numReceivers);
+
+    return result ? CH_OK : CH_NO_MEMORY;
+}
+
+
+/* Try to remove an item from the channel *channel without blocking. */
+static int TryReceive(AValue *channel, AValue *item)
+{
+    ChannelData *data = GetChannelData(*channel);
+    unsigned mask = data->capacity - 1;
+    unsigned pos;
+    volatile int *seq;
+    AValue buffer;
+
+    for (;;) {
+        pos = athread_atomic_load(&data->dequeuePos);
+        for (;;) {
+            int diff;
+
+            seq = &data->seq[pos & mask];
+            diff = (int)((unsigned)athread_atomic_load(seq) - (2 * pos + 1));
+            if (diff == 0) {
+                /* The slot contains an item. Try to claim it. */
+                if (athread_atomic_cas(&data->dequeuePos, (int)pos,
+                                       (int)(pos + 1)))
+                    break;
+            } else if (diff < 0) {
+                /* The slot has not been written during this lap. If the
+                   channel has been closed, a sender may still be storing an
+                   item that it claimed before the channel was closed. */
+                if (athread_atomic_load(&data->isClosed)
+                    && (unsigned)athread_atomic_load(&data->enqueuePos)
+                       == pos)
+                    return CH_CLOSED;
+                else
+                    return CH_WOULD_BLOCK;
+            }
+            pos = athread_atomic_load(&data->dequeuePos);
+        }
+
+        buffer = AMemberDirect(*channel, CHANNEL_BUFFER);
+        *item = AArrayItem(buffer, pos & mask);
+        AArrayItem(buffer, pos & mask) = ANil;
+        /* Mark the slot as free for the next lap. */
+        athread_atomic_store(seq, (int)(2 * (pos + mask + 1)));
+
+        WakeUp(&data->sendEvent, &data->numSenders);
+
+        /* Skip slots of failed sends (see TrySend). */
+        if (!AIsError(*item))
+            return CH_OK;
+    }
+}
+
+
+/* Wake up a thread waiting for an event if there are any waiters. */
+static void WakeUp(volatile int *event, volatile int *numWaiters)
+{
+    if (athread_atomic_load(numWaiters) > 0) {
+        athread_atomic_add(event, 1);
+        AFiberFutexWake(event, 1);
+    }
+}
+
+
+/* Wait until the event counter differs from key. Allow other threads to be
+   frozen while waiting. Return TRUE if the timeout expired. */
+static ABool WaitForEvent(AThread *t, volatile int *event, int key,
+                          double timeout, double deadline)
+{
+    if (timeout > 0.0) {
+        timeout = deadline - athread_time();
+        if (timeout <= 0.0)
+            return TRUE;
+    }
+
+    return AFiberFutexWait(t, event, key, timeout) == ETIMEDOUT;
+}
+
+
+static AValue RaiseError(AThread *t, int status)
+{
+    if (status == CH_CLOSED)
+        return ARaiseByNum(t, AChannelClosedErrorClassNum, NULL);
+    else if (status == CH_WOULD_BLOCK)
+        return ARaiseByNum(t, ATimeoutErrorClassNum, NULL);
+    else
+        return ARaiseMemoryError(t);
+}
+
+
+/* Convert an optional timeout argument to seconds. Return -1.0 if there is no
+   timeout. */
+static double GetTimeout(AThread *t, AValue timeout)
+{
+    double seconds;
+
+    if (AIsDefault(timeout) || AIsNil(timeout))
+        return -1.0;
+
+    seconds = AGetFloat(t, timeout);
+    return seconds >= 0.0 ? seconds : 0.0;
+}
@@ -0,0 +1,1438 @@
+/* thread_fiber.c - thread module (Scheduler and Fiber classes)
+
+   Copyright (c) 2010-2011 Jukka Lehtosalo
+
+   Alore is licensed under the terms of the MIT license.  See the file
+   LICENSE.txt in the distribution.
+*/
+
+/* Fibers are lightweight threads that are scheduled cooperatively by a
+   Scheduler within a single operating system thread.
+
+   Each fiber has an AThread structure of its own. The structure is in the
+   global list of threads like the structures of ordinary threads, and thus
+   the garbage collector scans the Alore stack of a suspended fiber like any
+   other thread stack. Each fiber also has a C stack, and switching to a fiber
+   switches both the C stack (using the ucontext functions) and the AThread
+   structure that is used. The thread-local allocation area of the scheduler
+   thread is handed over to the fiber that is running, so suspended fibers do
+   not reserve any space in the nursery. The stacks of a fiber are allocated
+   using a single memory mapping that is only committed as needed.
+
+   A fiber runs until it finishes or performs an operation that would block:
+   reading from or writing to a socket or a pipe, sleeping, waiting on a
+   Channel or joining a fiber. Instead of blocking the thread, the fiber
+   records what it is waiting for and switches to the scheduler. The
+   scheduler runs the other ready fibers, and when there are none, it waits
+   for I/O readiness events (using epoll on Linux and poll elsewhere) and
+   timers.
+
+   Fibers waiting for a futex word (Channel and Fiber objects use these) are
+   kept in a global hash table so that any thread can wake them up. Wake-ups
+   from other threads (and new fibers) are added to a mutex-protected queue of
+   the scheduler, and if the scheduler is waiting for events, it is woken up
+   by writing to a pipe.
+
+   Fibers never migrate between schedulers. Programs that want to use several
+   processors can run a scheduler in each of several threads. Finished fibers
+   are kept in a global pool and reused. */
+
+#include "aconfig.h"
+
+#if defined(A_HAVE_POSIX) && !defined(A_HAVE_WINDOWS)
+#define A_HAVE_FIBERS
+#endif
+
+#ifdef A_HAVE_FIBERS
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__linux__)
+#define A_HAVE_EPOLL
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+#endif
+
+#include "alore.h"
+#include "runtime.h"
+#include "thread_module.h"
+#include "thread_athread.h"
+#include "thread_fiber.h"
+#include "io_module.h"
+#include "mem.h"
+#include "gc.h"
+
+
+/* Member indices of Fiber objects */
+enum {
+    FIBER_FINALIZER_LIST, /* Next object in the list of finalizable objects */
+    FIBER_DATA,           /* Non-pointer block containing FiberData */
+    FIBER_RESULT          /* Return value or raised exception */
+};
+
+/* States of Fiber objects */
+enum {
+    FIBER_RUNNING,      /* The fiber has not finished */
+    FIBER_RETURNED,
+    FIBER_RAISED
+};
+
+typedef struct {
+    volatile int state;
+} FiberData;
+
+
+/* Return a pointer to the FiberData structure when given a Fiber value. */
+#define GetFiberData(v) \
+    ((FiberData *)APtrAdd(AValueToPtr(AMemberDirect(v, FIBER_DATA)), \
+                          sizeof(AValue)))
+
+
+#ifdef A_HAVE_FIBERS
+
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+
+/* Maximum number of I/O events processed per wait */
+#define MAX_EVENTS 256
+
+/* Number of buckets in the hash table of fibers waiting for futex words */
+#define NUM_BUCKETS 64
+
+
+struct Scheduler_;
+
+
+/* Fiber state that is independent of the Fiber object. The structure is
+   reused after the fiber has finished. */
+typedef struct AFiber_ {
+    struct AFiber_ *next;       /* Next fiber in a queue or in the pool */
+    AThread *thread;            /* Alore stack etc. of the fiber */
+    struct Scheduler_ *scheduler;
+    ucontext_t context;         /* Saved context of a suspended fiber */
+    ABool isDone;
+    /* Futex word the fiber is waiting for, or NULL. isQueued and waitNext are
+       protected by the mutex of the bucket of waitPtr. */
+    volatile int *waitPtr;
+    ABool isQueued;
+    struct AFiber_ *waitNext;
+    ABool isTimedOut;
+    int timerIndex;             /* Index in the timer heap or -1 */
+    double deadline;
+} AFiber;
+
+
+typedef struct {
+    AFiber *first;
+    AFiber *last;
+} FiberQueue;
+
+
+/* Fibers waiting for a file descriptor */
+typedef struct {
+    AFiber *reader;
+    AFiber *writer;
+    ABool isRegistered;         /* Has the descriptor been added to epoll? */
+} IoWaiters;
+
+
+typedef struct Scheduler_ {
+    AThread *thread;            /* Thread running run(), or NULL */
+    ucontext_t context;         /* Saved context of run() */
+    FiberQueue ready;
+
+    /* The following fields are protected by mutex. */
+    athread_mutex_t mutex;
+    int numFibers;              /* Number of fibers that have not finished */
+    FiberQueue remote;          /* New fibers and fibers woken up by other
+                                   threads */
+    ABool isPolling;            /* Is the scheduler waiting for events? */
+    ABool isWakePending;        /* Has the wake pipe been written to? */
+
+    int wakePipe[2];
+    IoWaiters *io;              /* Indexed by file descriptor */
+    int ioSize;
+    int numIoWaiters;
+#ifdef A_HAVE_EPOLL
+    int epoll;
+    struct epoll_event events[MAX_EVENTS];
+#else
+    struct pollfd *fds;
+    int fdsSize;
+#endif
+    AFiber **timers;            /* Binary heap of fibers ordered by deadline */
+    int numTimers;
+    int timersSize;
+} Scheduler;
+
+
+/* Traceback of an exception raised by a fiber that has not been joined. The
+   report is displayed if the Fiber object is freed or the program exits
+   before the fiber is joined. */
+typedef struct FiberReport_ {
+    struct FiberReport_ *prev;
+    struct FiberReport_ *next;
+    char *text;                 /* Lines separated by newlines, or NULL */
+    int len;
+} FiberReport;
+
+
+typedef struct {
+    athread_mutex_t mutex;
+    AFiber *first;
+} WaitBucket;
+
+
+static WaitBucket Buckets[NUM_BUCKETS];
+/* Number of fibers in Buckets */
+static volatile int NumFutexWaiters;
+
+/* Pool of finished fibers */
+static athread_mutex_t FiberPoolMutex;
+static AFiber *FiberPool;
+
+/* List of reports of fibers that raised an exception and have not been
+   joined, protected by ReportMutex */
+static athread_mutex_t ReportMutex;
+static FiberReport *Reports;
+
+
+#define GetBucket(ptr) \
+    (&Buckets[((unsigned long)(ptr) >> 2) & (NUM_BUCKETS - 1)])
+
+
+/* Return a pointer to the Scheduler structure when given a Scheduler
+   value. */
+#define GetScheduler(v) (*(Scheduler **)ADataPtr(v, ASchedulerDataOffset))
+
+/* Return a reference to the FiberReport pointer when given a Fiber value. */
+#define GetReportPtr(v) ((FiberReport **)ADataPtr(v, AFiberDataOffset))
+
+
+static AValue RunScheduler(AThread *t, Scheduler *s);
+static AFiber *AllocateFiber(AValue *temp);
+static void FiberMain(unsigned hi, unsigned lo);
+static void RunFiber(AThread *t);
+static ABool Resume(Scheduler *s, AFiber *f);
+static void Suspend(AFiber *f);
+static void ReleaseFiber(Scheduler *s, AFiber *f);
+static void Enqueue(FiberQueue *queue, AFiber *f);
+static void MakeReadyRemote(AFiber *f);
+static void TakeRemoteFibers(Scheduler *s);
+static ABool CancelFutexWait(AFiber *f);
+static void RemoveWaiters(Scheduler *s);
+static ABool Poll(AThread *t, Scheduler *s, double timeout);
+static void HandleIoEvent(Scheduler *s, int handle, int events);
+static ABool UpdateIo(Scheduler *s, int handle);
+static void DrainWakePipe(Scheduler *s);
+static ABool SetNonBlocking(int handle);
+static void AddTimer(Scheduler *s, AFiber *f, double deadline);
+static void RemoveTimer(Scheduler *s, AFiber *f);
+static void RunTimers(Scheduler *s);
+static void FreeScheduler(Scheduler *s);
+static void AddReport(AThread *t, AValue *fiber);
+static ABool AppendReportLine(const char *msg, void *data);
+static FiberReport *TakeReport(AValue fiber);
+static void DisplayReport(FiberReport *r);
+
+
+ABool AInitializeFibers(void)
+{
+    int i;
+
+    for (i = 0; i < NUM_BUCKETS; i++) {
+        if (athread_mutex_init(&Buckets[i].mutex, NULL))
+            return FALSE;
+    }
+    return athread_mutex_init(&FiberPoolMutex, NULL) == 0
+        && athread_mutex_init(&ReportMutex, NULL) == 0;
+}
+
+
+/* Scheduler create() */
+AValue ASchedulerCreate(AThread *t, AValue *frame)
+{
+    Scheduler *s;
+
+    s = malloc(sizeof(Scheduler));
+    if (s == NULL)
+        return ARaiseMemoryError(t);
+    memset(s, 0, sizeof(Scheduler));
+
+    if (athread_mutex_init(&s->mutex, NULL)) {
+        free(s);
+        return ARaiseMemoryError(t);
+    }
+
+    s->wakePipe[0] = s->wakePipe[1] = -1;
+#ifdef A_HAVE_EPOLL
+    s->epoll = -1;
+#endif
+    *(Scheduler **)ADataPtr(frame[0], ASchedulerDataOffset) = s;
+
+    if (pipe(s->wakePipe) < 0 || !SetNonBlocking(s->wakePipe[0])
+        || !SetNonBlocking(s->wakePipe[1]))
+        return ARaiseErrnoIoError(t, NULL);
+
+#ifdef A_HAVE_EPOLL
+    {
+        struct epoll_event event;
+
+        s->epoll = epoll_create(MAX_EVENTS);
+        if (s->epoll < 0)
+            return ARaiseErrnoIoError(t, NULL);
+        fcntl(s->epoll, F_SETFD, FD_CLOEXEC);
+
+        event.events = EPOLLIN;
+        event.data.u64 = 0;
+        event.data.fd = s->wakePipe[0];
+        if (epoll_ctl(s->epoll, EPOLL_CTL_ADD, s->wakePipe[0], &event) < 0)
+            return ARaiseErrnoIoError(t, NULL);
+    }
+#endif
+
+    return frame[0];
+}
+
+
+/* Scheduler spawn(function, *args)
+   Create a fiber that calls the function with the arguments. The fiber starts
+   running when the scheduler is run. This can be called from any thread. */
+AValue ASchedulerSpawn(AThread *t, AValue *frame)
+{
+    Scheduler *s = GetScheduler(frame[0]);
+    AValue *block;
+    AValue *stack;
+    AFiber *f;
+
+    frame[3] = AMakeUninitializedObject(t, AGlobalByNum(AFiberClassNum));
+
+    block = AAllocUnmovable(sizeof(AValue) + sizeof(FiberData));
+    if (block == NULL)
+        return ARaiseMemoryError(t);
+    AInitNonPointerBlockOld(block, sizeof(FiberData));
+    ((FiberData *)APtrAdd(block, sizeof(AValue)))->state = FIBER_RUNNING;
+
+    *t->tempStack = ANonPointerBlockToValue(block);
+    ASetMemberDirect(t, frame[3], FIBER_DATA, *t->tempStack);
+    *t->tempStack = AZero;
+
+    f = AllocateFiber(frame + 4);
+    if (f == NULL)
+        return ARaiseMemoryError(t);
+
+    /* Construct a stack frame at the bottom of the fiber stack like at the
+       bottom of thread stacks. It holds the Fiber object, the function and
+       the arguments. */
+    stack = f->thread->stackPtr - 7;
+    stack[0] = 7 * sizeof(AValue);
+    stack[1] = A_THREAD_BOTTOM_FUNCTION;
+    stack[2] = A_COMPILED_FRAME_FLAG;
+    stack[3] = frame[3];
+    stack[4] = frame[1];
+    stack[5] = frame[2];
+    stack[6] = AZero;
+    f->thread->stackPtr = stack;
+
+    f->scheduler = s;
+    f->isDone = FALSE;
+
+    athread_mutex_lock(&s->mutex);
+    s->numFibers++;
+    athread_mutex_unlock(&s->mutex);
+
+    MakeReadyRemote(f);
+
+    return frame[3];
+}
+
+
+/* Scheduler run()
+   Run fibers until all the fibers spawned in the scheduler have finished. */
+AValue ASchedulerRun(AThread *t, AValue *frame)
+{
+    Scheduler *s = GetScheduler(frame[0]);
+    AValue result;
+
+    athread_mutex_lock(&s->mutex);
+    if (s->thread != NULL) {
+        athread_mutex_unlock(&s->mutex);
+        return ARaiseValueError(t, "Scheduler is already running");
+    }
+    s->thread = t;
+    athread_mutex_unlock(&s->mutex);
+
+    result = RunScheduler(t, s);
+
+    athread_mutex_lock(&s->mutex);
+    s->thread = NULL;
+    athread_mutex_unlock(&s->mutex);
+
+    return result;
+}
+
+
+/* Free the resources of a scheduler. Fibers that have not finished are
+   never run (this can only happen if run() was not called or it was
+   interrupted by an exception). */
+AValue ASchedulerFinalize(AThread *t, AValue *frame)
+{
+    Scheduler *s = GetScheduler(frame[0]);
+    if (s != NULL) {
+        RemoveWaiters(s);
+        FreeScheduler(s);
+    }
+    return ANil;
+}
+
+
+/* Fiber join()
+   Wait until the fiber has finished and return its return value. If the
+   fiber raised an exception, raise it again. */
+AValue AFiberJoin(AThread *t, AValue *frame)
+{
+    FiberData *data;
+    int state;
+
+    if (AIsNil(AMemberDirect(frame[0], FIBER_DATA)))
+        return ARaiseValueError(t, "Fiber not started");
+
+    data = GetFiberData(frame[0]);
+    while ((state = athread_atomic_load(&data->state)) == FIBER_RUNNING) {
+        AFiberFutexWait(t, &data->state, FIBER_RUNNING, -1.0);
+        if (AIsInterrupt && AHandleInterrupt(t))
+            return AError;
+    }
+
+    if (state == FIBER_RAISED) {
+        FiberReport *r = TakeReport(frame[0]);
+        if (r != NULL) {
+            free(r->text);
+            free(r);
+        }
+        t->exception = AMemberDirect(frame[0], FIBER_RESULT);
+        t->uncaughtExceptionStackPtr = t->stackPtr;
+        t->isExceptionReraised = FALSE;
+        return AError;
+    } else
+        return AMemberDirect(frame[0], FIBER_RESULT);
+}
+
+
+/* Fiber #f()
+   Display the exception raised by the fiber if it was never joined. */
+AValue AFiberFinalize(AThread *t, AValue *frame)
+{
+    FiberReport *r = TakeReport(frame[0]);
+    if (r != NULL) {
+        DisplayReport(r);
+        free(r->text);
+        free(r);
+    }
+    return ANil;
+}
+
+
+/* Fiber isDone() */
+AValue AFiberIsDone(AThread *t, AValue *frame)
+{
+    if (AIsNil(AMemberDirect(frame[0], FIBER_DATA)))
+        return AFalse;
+    return athread_atomic_load(&GetFiberData(frame[0])->state)
+        != FIBER_RUNNING ? ATrue : AFalse;
+}
+
+
+/* thread::Yield()
+   Let the other ready fibers run before continuing the current fiber. Do
+   nothing if not called in a fiber. */
+AValue AFiberYield(AThread *t, AValue *frame)
+{
+    if (AIsFiber(t)) {
+        AFiber *f = t->fiber;
+        Enqueue(&f->scheduler->ready, f);
+        Suspend(f);
+    }
+    return ANil;
+}
+
+
+ABool AFiberWaitForIo(AThread *t, int handle, int events)
+{
+    AFiber *f;
+    Scheduler *s;
+    IoWaiters *w;
+
+    if (!AIsFiber(t) || handle < 0)
+        return FALSE;
+
+    f = t->fiber;
+    s = f->scheduler;
+
+    if (handle >= s->ioSize) {
+        int newSize = 2 * s->ioSize > handle ? 2 * s->ioSize : handle + 64;
+        IoWaiters *io = realloc(s->io, newSize * sizeof(IoWaiters));
+        if (io == NULL)
+            return FALSE;
+        memset(io + s->ioSize, 0, (newSize - s->ioSize) * sizeof(IoWaiters));
+        s->io = io;
+        s->ioSize = newSize;
+    }
+
+    w = &s->io[handle];
+    /* Only a single fiber may wait for each kind of event. */
+    if (((events & A_FIBER_READABLE) && w->reader != NULL)
+        || ((events & A_FIBER_WRITABLE) && w->writer != NULL))
+        return FALSE;
+
+    if (events & A_FIBER_READABLE)
+        w->reader = f;
+    if (events & A_FIBER_WRITABLE)
+        w->writer = f;
+
+    if (!UpdateIo(s, handle)) {
+        /* The descriptor cannot be monitored (for example, it refers to a
+           regular file, which is always ready). */
+        if (w->reader == f)
+            w->reader = NULL;
+        if (w->writer == f)
+            w->writer = NULL;
+        return FALSE;
+    }
+
+    s->numIoWaiters++;
+    Suspend(f);
+
+    return TRUE;
+}
+
+
+ABool AFiberSleep(AThread *t, double seconds)
+{
+    AFiber *f;
+
+    if (!AIsFiber(t))
+        return FALSE;
+
+    f = t->fiber;
+    if (seconds > 0.0)
+        AddTimer(f->scheduler, f, athread_time() + seconds);
+    else
+        Enqueue(&f->scheduler->ready, f);
+    Suspend(f);
+
+    return TRUE;
+}
+
+
+int AFiberFutexWait(AThread *t, volatile int *ptr, int value, double timeout)
+{
+    if (AIsFiber(t)) {
+        AFiber *f = t->fiber;
+        WaitBucket *bucket = GetBucket(ptr);
+        AFiber **prev;
+
+        /* Increment the waiter count before checking the futex word, so that
+           a thread that modifies the word and then sees a zero count cannot
+           miss this fiber. */
+        athread_atomic_add(&NumFutexWaiters, 1);
+        athread_mutex_lock(&bucket->mutex);
+
+        if (athread_atomic_load(ptr) != value || timeout == 0.0) {
+            athread_mutex_unlock(&bucket->mutex);
+            athread_atomic_add(&NumFutexWaiters, -1);
+            return timeout == 0.0 ? ETIMEDOUT : 0;
+        }
+
+        /* Add the fiber to the end of the bucket. */
+        for (prev = &bucket->first; *prev != NULL; prev = &(*prev)->waitNext);
+        *prev = f;
+        f->waitNext = NULL;
+        f->waitPtr = ptr;
+        f->isQueued = TRUE;
+        f->isTimedOut = FALSE;
+
+        athread_mutex_unlock(&bucket->mutex);
+
+        if (timeout > 0.0)
+            AddTimer(f->scheduler, f, athread_time() + timeout);
+
+        Suspend(f);
+
+        f->waitPtr = NULL;
+        return f->isTimedOut ? ETIMEDOUT : 0;
+    } else {
+        int result;
+
+        AAllowBlocking();
+        result = athread_futex_wait(ptr, value, timeout);
+        AEndBlocking();
+
+        return result;
+    }
+}
+
+
+void AFiberFutexWake(volatile int *ptr, int count)
+{
+    athread_futex_wake(ptr, count);
+
+    if (athread_atomic_load(&NumFutexWaiters) > 0) {
+        WaitBucket *bucket = GetBucket(ptr);
+        AFiber *woken;
+        AFiber **last;
+        AFiber **prev;
+        AFiber *f;
+
+        woken = NULL;
+        last = &woken;
+
+        athread_mutex_lock(&bucket->mutex);
+        prev = &bucket->first;
+        while ((f = *prev) != NULL && count > 0) {
+            if (f->waitPtr == ptr) {
+                *prev = f->waitNext;
+                f->isQueued = FALSE;
+                athread_atomic_add(&NumFutexWaiters, -1);
+                *last = f;
+                last = &f->next;
+                count--;
+            } else
+                prev = &f->waitNext;
+        }
+        *last = NULL;
+        athread_mutex_unlock(&bucket->mutex);
+
+        while (woken != NULL) {
+            f = woken;
+            woken = f->next;
+            MakeReadyRemote(f);
+        }
+    }
+}
+
+
+static AValue RunScheduler(AThread *t, Scheduler *s)
+{
+    for (;;) {
+        FiberQueue round;
+        AFiber *f;
+        double timeout;
+        int numFibers;
+
+        TakeRemoteFibers(s);
+
+        /* Run each ready fiber once. Fibers that become ready during the round
+           are run in the next round, after checking for I/O events. */
+        round = s->ready;
+        s->ready.first = s->ready.last = NULL;
+        while ((f = round.first) != NULL) {
+            round.first = f->next;
+            if (!Resume(s, f)) {
+                /* Put the remaining fibers back to the ready queue. */
+                round.first = f;
+                if (s->ready.first != NULL)
+                    round.last->next = s->ready.first;
+                else
+                    s->ready.last = round.last;
+                s->ready.first = round.first;
+                return ARaiseMemoryError(t);
+            }
+            if (f->isDone)
+                ReleaseFiber(s, f);
+        }
+
+        if (AIsInterrupt && AHandleInterrupt(t))
+            return AError;
+
+        athread_mutex_lock(&s->mutex);
+        numFibers = s->numFibers;
+        if (s->ready.first != NULL || s->remote.first != NULL)
+            timeout = 0.0;
+        else if (s->numTimers > 0) {
+            timeout = s->timers[0]->deadline - athread_time();
+            if (timeout < 0.0)
+                timeout = 0.0;
+        } else
+            timeout = -1.0;
+        s->isPolling = numFibers > 0 && timeout != 0.0;
+        athread_mutex_unlock(&s->mutex);
+
+        if (numFibers == 0)
+            break;
+
+        if (!Poll(t, s, timeout))
+            return AError;
+
+        athread_mutex_lock(&s->mutex);
+        s->isPolling = FALSE;
+        athread_mutex_unlock(&s->mutex);
+
+        RunTimers(s);
+    }
+
+    return ANil;
+}
+
+
+/* Allocate a fiber from the pool, or create a new one if the pool is empty.
+   Use temp[0], ..., temp[2] as temporary storage. */
+static AFiber *AllocateFiber(AValue *temp)
+{
+    AFiber *f;
+    char *region;
+    unsigned long pageSize;
+    unsigned long size;
+    unsigned long ptr;
+
+    athread_mutex_lock(&FiberPoolMutex);
+    f = FiberPool;
+    if (f != NULL)
+        FiberPool = f->next;
+    athread_mutex_unlock(&FiberPoolMutex);
+
+    if (f != NULL)
+        return f;
+
+    f = malloc(sizeof(AFiber));
+    if (f == NULL)
+        return NULL;
+
+    /* The lowest page of the region is a guard page that catches C stack
+       overflows. It is followed by the C stack and the Alore stack. */
+    pageSize = sysconf(_SC_PAGESIZE);
+    size = pageSize + A_FIBER_C_STACK_SIZE + A_FIBER_STACK_SIZE;
+    region = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (region == MAP_FAILED) {
+        free(f);
+        return NULL;
+    }
+    mprotect(region, pageSize, PROT_NONE);
+
+    f->thread = ACreateThreadWithStack(
+        temp, (AValue *)(region + pageSize + A_FIBER_C_STACK_SIZE),
+        A_FIBER_STACK_SIZE);
+    if (f->thread == NULL) {
+        munmap(region, size);
+        free(f);
+        return NULL;
+    }
+    f->thread->fiber = f;
+
+    f->next = NULL;
+    f->scheduler = NULL;
+    f->waitPtr = NULL;
+    f->isQueued = FALSE;
+    f->timerIndex = -1;
+
+    getcontext(&f->context);
+    f->context.uc_stack.ss_sp = region + pageSize;
+    f->context.uc_stack.ss_size = A_FIBER_C_STACK_SIZE;
+    f->context.uc_link = NULL;
+    /* The arguments of the entry function must be ints, so pass the fiber
+       pointer in two halves. */
+    ptr = (unsigned long)f;
+    makecontext(&f->context, (void (*)(void))FiberMain, 2,
+                (unsigned)(ptr >> 16 >> 16), (unsigned)(ptr & 0xffffffffUL));
+
+    return f;
+}
+
+
+/* Entry point of the C stack of a fiber. A fiber structure runs a single
+   fiber at a time, and it is resumed when it is reused. */
+static void FiberMain(unsigned hi, unsigned lo)
+{
+    AFiber *f = (AFiber *)(((unsigned long)hi << 16 << 16) | lo);
+
+    for (;;) {
+        RunFiber(f->thread);
+        f->isDone = TRUE;
+        Suspend(f);
+    }
+}
+
+
+/* Call the function of a fiber and record the result in the Fiber object.
+   The bottom stack frame constructed by spawn() holds the Fiber object, the
+   function and the arguments. */
+static void RunFiber(AThread *t)
+{
+    AValue *stack = t->stackPtr;
+    FiberData *data;
+    int state;
+
+    if (AHandleException(t))
+        stack[4] = AError;
+    else
+        stack[4] = ACallValue(t, stack[4], 1 | A_VAR_ARG_FLAG, stack + 5);
+    t->contextIndex--;
+
+    if (AIsError(stack[4])) {
+        state = FIBER_RAISED;
+        stack[4] = t->exception;
+        ACreateTracebackArray(t);
+        AddReport(t, stack + 3);
+        t->exception = AZero;
+    } else
+        state = FIBER_RETURNED;
+
+    ASetMemberDirect(t, stack[3], FIBER_RESULT, stack[4]);
+
+    data = GetFiberData(stack[3]);
+    athread_atomic_store(&data->state, state);
+    AFiberFutexWake(&data->state, INT_MAX);
+
+    t->stackPtr = stack + 7;
+}
+
+
+/* Switch from the scheduler to a fiber. Return when the fiber has been
+   suspended or it has finished. Return FALSE if out of memory. */
+static ABool Resume(Scheduler *s, AFiber *f)
+{
+    AThread *t = s->thread;
+    AThread *ft = f->thread;
+
+    if (f->timerIndex >= 0)
+        RemoveTimer(s, f);
+
+    /* Make sure that the fiber can add a timer without allocating memory. */
+    if (s->numTimers == s->timersSize) {
+        int newSize = 2 * s->timersSize + 16;
+        AFiber **timers = realloc(s->timers, newSize * sizeof(AFiber *));
+        if (timers == NULL)
+            return FALSE;
+        s->timers = timers;
+        s->timersSize = newSize;
+    }
+
+    /* Hand over the thread-local allocation area to the fiber. */
+    ft->heapPtr = t->heapPtr;
+    ft->heapEnd = t->heapEnd;
+    t->heapPtr = t->heapEnd = A_EMPTY_THREAD_HEAP_PTR;
+
+    swapcontext(&s->context, &f->context);
+
+    t->heapPtr = ft->heapPtr;
+    t->heapEnd = ft->heapEnd;
+    ft->heapPtr = ft->heapEnd = A_EMPTY_THREAD_HEAP_PTR;
+
+    return TRUE;
+}
+
+
+/* Switch from a fiber to its scheduler. The fiber must have been added to a
+   queue or it must be waiting for an event before calling this. */
+static void Suspend(AFiber *f)
+{
+    swapcontext(&f->context, &f->scheduler->context);
+}
+
+
+static void ReleaseFiber(Scheduler *s, AFiber *f)
+{
+    athread_mutex_lock(&s->mutex);
+    s->numFibers--;
+    athread_mutex_unlock(&s->mutex);
+
+    f->scheduler = NULL;
+
+    athread_mutex_lock(&FiberPoolMutex);
+    f->next = FiberPool;
+    FiberPool = f;
+    athread_mutex_unlock(&FiberPoolMutex);
+}
+
+
+static void Enqueue(FiberQueue *queue, AFiber *f)
+{
+    f->next = NULL;
+    if (queue->first == NULL)
+        queue->first = f;
+    else
+        queue->last->next = f;
+    queue->last = f;
+}
+
+
+/* Add a fiber to the remote queue of its scheduler. This can be called from
+   any thread. */
+static void MakeReadyRemote(AFiber *f)
+{
+    Scheduler *s = f->scheduler;
+    ABool wake;
+
+    athread_mutex_lock(&s->mutex);
+    Enqueue(&s->remote, f);
+    wake = s->isPolling && !s->isWakePending;
+    if (wake)
+        s->isWakePending = TRUE;
+    athread_mutex_unlock(&s->mutex);
+
+    if (wake) {
+        char c = 0;
+        while (write(s->wakePipe[1], &c, 1) < 0 && errno == EINTR);
+    }
+}
+
+
+/* Move fibers from the remote queue to the ready queue. */
+static void TakeRemoteFibers(Scheduler *s)
+{
+    athread_mutex_lock(&s->mutex);
+    if (s->remote.first != NULL) {
+        if (s->ready.first == NULL)
+            s->ready.first = s->remote.first;
+        else
+            s->ready.last->next = s->remote.first;
+        s->ready.last = s->remote.last;
+        s->remote.first = s->remote.last = NULL;
+    }
+    athread_mutex_unlock(&s->mutex);
+}
+
+
+/* Remove a fiber from the futex wait queue. Return FALSE if it was already
+   removed by a thread that woke it up. */
+static ABool CancelFutexWait(AFiber *f)
+{
+    WaitBucket *bucket = GetBucket(f->waitPtr);
+    ABool result;
+
+    athread_mutex_lock(&bucket->mutex);
+    result = f->isQueued;
+    if (result) {
+        AFiber **prev;
+        for (prev = &bucket->first; *prev != f; prev = &(*prev)->waitNext);
+        *prev = f->waitNext;
+        f->isQueued = FALSE;
+        athread_atomic_add(&NumFutexWaiters, -1);
+    }
+    athread_mutex_unlock(&bucket->mutex);
+
+    return result;
+}
+
+
+/* Remove all the fibers of a scheduler from futex wait queues. */
+static void RemoveWaiters(Scheduler *s)
+{
+    int i;
+
+    for (i = 0; i < NUM_BUCKETS; i++) {
+        WaitBucket *bucket = &Buckets[i];
+        AFiber **prev;
+        AFiber *f;
+
+        athread_mutex_lock(&bucket->mutex);
+        prev = &bucket->first;
+        while ((f = *prev) != NULL) {
+            if (f->scheduler == s) {
+                *prev = f->waitNext;
+                f->isQueued = FALSE;
+                athread_atomic_add(&NumFutexWaiters, -1);
+            } else
+                prev = &f->waitNext;
+        }
+        athread_mutex_unlock(&bucket->mutex);
+    }
+}
+
+
+/* Wait for I/O events for at most timeout seconds (no timeout if timeout is
+   negative) and make the fibers waiting for them ready. */
+static ABool Poll(AThread *t, Scheduler *s, double timeout)
+{
+    int ms;
+    int n;
+    int i;
+
+    ms = timeout < 0.0 ? -1 : (int)(timeout * 1000.0 + 0.999);
+
+#ifdef A_HAVE_EPOLL
+    AAllowBlocking();
+    n = epoll_wait(s->epoll, s->events, MAX_EVENTS, ms);
+    AEndBlocking();
+
+    if (n < 0) {
+        if (errno == EINTR)
+            return TRUE;
+        ARaiseErrnoIoError(t, NULL);
+        return FALSE;
+    }
+
+    for (i = 0; i < n; i++) {
+        unsigned events = s->events[i].events;
+        int handle = s->events[i].data.fd;
+        int ready = 0;
+
+        if (handle == s->wakePipe[0]) {
+            DrainWakePipe(s);
+            continue;
+        }
+
+        if (events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+            ready |= A_FIBER_READABLE;
+        if (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+            ready |= A_FIBER_WRITABLE;
+        HandleIoEvent(s, handle, ready);
+    }
+#else
+    /* Collect the descriptors that have waiters. The wake pipe is always the
+       first item. */
+    if (s->fdsSize < s->numIoWaiters + 1) {
+        struct pollfd *fds = realloc(s->fds, (s->numIoWaiters + 1)
+                                     * sizeof(struct pollfd));
+        if (fds == NULL) {
+            ARaiseMemoryError(t);
+            return FALSE;
+        }
+        s->fds = fds;
+        s->fdsSize = s->numIoWaiters + 1;
+    }
+
+    s->fds[0].fd = s->wakePipe[0];
+    s->fds[0].events = POLLIN;
+    n = 1;
+    for (i = 0; i < s->ioSize && n < s->numIoWaiters + 1; i++) {
+        IoWaiters *w = &s->io[i];
+        if (w->reader != NULL || w->writer != NULL) {
+            s->fds[n].fd = i;
+            s->fds[n].events = (w->reader != NULL ? POLLIN : 0)
+                | (w->writer != NULL ? POLLOUT : 0);
+            n++;
+        }
+    }
+
+    AAllowBlocking();
+    n = poll(s->fds, n, ms);
+    AEndBlocking();
+
+    if (n < 0) {
+        if (errno == EINTR)
+            return TRUE;
+        ARaiseErrnoIoError(t, NULL);
+        return FALSE;
+    }
+
+    if (n > 0) {
+        int num = s->numIoWaiters + 1;
+
+        if (s->fds[0].revents != 0)
+            DrainWakePipe(s);
+
+        /* Waking up fibers does not modify the fds array. */
+        for (i = 1; i < num; i++) {
+            short events = s->fds[i].revents;
+            int ready = 0;
+
+            if (events & (POLLIN | POLLERR | POLLHUP | POLLNVAL))
+                ready |= A_FIBER_READABLE;
+            if (events & (POLLOUT | POLLERR | POLLHUP | POLLNVAL))
+                ready |= A_FIBER_WRITABLE;
+            if (ready != 0)
+                HandleIoEvent(s, s->fds[i].fd, ready);
+        }
+    }
+#endif
+
+    return TRUE;
+}
+
+
+/* Make the fibers waiting for the events of a descriptor ready. */
+static void HandleIoEvent(Scheduler *s, int handle, int events)
+{
+    IoWaiters *w = &s->io[handle];
+
+    if ((events & A_FIBER_READABLE) && w->reader != NULL) {
+        Enqueue(&s->ready, w->reader);
+        w->reader = NULL;
+        s->numIoWaiters--;
+    }
+    if ((events & A_FIBER_WRITABLE) && w->writer != NULL) {
+        Enqueue(&s->ready, w->writer);
+        w->writer = NULL;
+        s->numIoWaiters--;
+    }
+
+    /* The descriptor was disabled after the event (EPOLLONESHOT). Enable it
+       again if there is a fiber waiting for the other event. */
+    if (w->reader != NULL || w->writer != NULL)
+        UpdateIo(s, handle);
+}
+
+
+/* Update the events monitored for a descriptor. */
+static ABool UpdateIo(Scheduler *s, int handle)
+{
+#ifdef A_HAVE_EPOLL
+    IoWaiters *w = &s->io[handle];
+    struct epoll_event event;
+
+    event.events = EPOLLONESHOT | (w->reader != NULL ? EPOLLIN : 0)
+        | (w->writer != NULL ? EPOLLOUT : 0);
+    event.data.u64 = 0;
+    event.data.fd = handle;
+
+    /* The descriptor stays registered after it has been waited for once.
+       However, if it has been closed and the number has been reused, the
+       registration has been removed. */
+    if (w->isRegistered) {
+        if (epoll_ctl(s->epoll, EPOLL_CTL_MOD, handle, &event) == 0)
+            return TRUE;
+        if (errno != ENOENT)
+            return FALSE;
+    }
+    if (epoll_ctl(s->epoll, EPOLL_CTL_ADD, handle, &event) < 0
+        && (errno != EEXIST
+            || epoll_ctl(s->epoll, EPOLL_CTL_MOD, handle, &event) < 0))
+        return FALSE;
+
+    w->isRegistered = TRUE;
+    return TRUE;
+#else
+    /* The descriptors are collected before each poll call. Check that the
+       descriptor is valid, since poll does not report errors for individual
+       descriptors. */
+    return fcntl(handle, F_GETFL) >= 0;
+#endif
+}
+
+
+static void DrainWakePipe(Scheduler *s)
+{
+    char buf[64];
+
+    while (read(s->wakePipe[0], buf, sizeof(buf)) > 0);
+
+    athread_mutex_lock(&s->mutex);
+    s->isWakePending = FALSE;
+    athread_mutex_unlock(&s->mutex);
+}
+
+
+static ABool SetNonBlocking(int handle)
+{
+    int flags = fcntl(handle, F_GETFL);
+    return flags >= 0 && fcntl(handle, F_SETFL, flags | O_NONBLOCK) >= 0
+        && fcntl(handle, F_SETFD, FD_CLOEXEC) >= 0;
+}
+
+
+/* Timers are stored in a binary heap. Each fiber has at most a single timer,
+   and Resume makes sure that there is space for it in the heap. */
+
+
+static void SetTimer(Scheduler *s, int i, AFiber *f)
+{
+    s->timers[i] = f;
+    f->timerIndex = i;
+}
+
+
+static void SiftUp(Scheduler *s, int i)
+{
+    AFiber *f = s->timers[i];
+
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (s->timers[parent]->deadline <= f->deadline)
+            break;
+        SetTimer(s, i, s->timers[parent]);
+        i = parent;
+    }
+    SetTimer(s, i, f);
+}
+
+
+static void SiftDown(Scheduler *s, int i)
+{
+    AFiber *f = s->timers[i];
+
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= s->numTimers)
+            break;
+        if (child + 1 < s->numTimers
+            && s->timers[child + 1]->deadline < s->timers[child]->deadline)
+            child++;
+        if (f->deadline <= s->timers[child]->deadline)
+            break;
+        SetTimer(s, i, s->timers[child]);
+        i = child;
+    }
+    SetTimer(s, i, f);
+}
+
+
+static void AddTimer(Scheduler *s, AFiber *f, double deadline)
+{
+    f->deadline = deadline;
+    s->timers[s->numTimers] = f;
+    SiftUp(s, s->numTimers++);
+}
+
+
+static void RemoveTimer(Scheduler *s, AFiber *f)
+{
+    int i = f->timerIndex;
+
+    f->timerIndex = -1;
+    s->numTimers--;
+    if (i < s->numTimers) {
+        SetTimer(s, i, s->timers[s->numTimers]);
+        SiftUp(s, i);
+        SiftDown(s, s->timers[i] == f ? i : s->timers[i]->timerIndex);
+    }
+}
+
+
+/* Make the fibers whose timers have expired ready. */
+static void RunTimers(Scheduler *s)
+{
+    double now = athread_time();
+
+    while (s->numTimers > 0 && s->timers[0]->deadline <= now) {
+        AFiber *f = s->timers[0];
+
+        RemoveTimer(s, f);
+
+        /* A fiber waiting for a futex word may have been woken up by another
+           thread, which has added it to the remote queue. */
+        if (f->waitPtr != NULL) {
+            if (!CancelFutexWait(f))
+                continue;
+            f->isTimedOut = TRUE;
+        }
+
+        Enqueue(&s->ready, f);
+    }
+}
+
+
+/* Record the traceback of the exception raised by a fiber (t->exception) so
+   that it can be displayed if the fiber is never joined. The fiber argument
+   points to the Fiber object. Do nothing if out of memory. */
+static void AddReport(AThread *t, AValue *fiber)
+{
+    FiberReport *r = malloc(sizeof(FiberReport));
+    if (r == NULL)
+        return;
+    r->text = NULL;
+    r->len = 0;
+
+    if (!ADisplayStackTraceback(t, AppendReportLine, r)) {
+        free(r->text);
+        free(r);
+        return;
+    }
+
+    athread_mutex_lock(&ReportMutex);
+    r->prev = NULL;
+    r->next = Reports;
+    if (Reports != NULL)
+        Reports->prev = r;
+    Reports = r;
+    *GetReportPtr(*fiber) = r;
+    athread_mutex_unlock(&ReportMutex);
+}
+
+
+/* Append a traceback line to a FiberReport (the data argument). */
+static ABool AppendReportLine(const char *msg, void *data)
+{
+    FiberReport *r = data;
+    int len = strlen(msg);
+    char *text = realloc(r->text, r->len + len + 2);
+
+    if (text == NULL)
+        return FALSE;
+    memcpy(text + r->len, msg, len);
+    text[r->len + len] = '\n';
+    text[r->len + len + 1] = '\0';
+    r->text = text;
+    r->len += len + 1;
+    return TRUE;
+}
+
+
+/* Detach the report of a fiber from the fiber and from the list of reports.
+   Return NULL if the fiber has no report. */
+static FiberReport *TakeReport(AValue fiber)
+{
+    FiberReport *r;
+
+    athread_mutex_lock(&ReportMutex);
+    r = *GetReportPtr(fiber);
+    if (r != NULL) {
+        *GetReportPtr(fiber) = NULL;
+        if (r->prev != NULL)
+            r->prev->next = r->next;
+        else
+            Reports = r->next;
+        if (r->next != NULL)
+            r->next->prev = r->prev;
+    }
+    athread_mutex_unlock(&ReportMutex);
+
+    return r;
+}
+
+
+static void DisplayReport(FiberReport *r)
+{
+    if (r->text != NULL)
+        fprintf(stderr, "alore: Uncaught exception in a fiber that was never "
+                "joined\n%s", r->text);
+}
+
+
+/* Display the exceptions of all fibers that have not been joined. The
+   reports remain attached to their fibers but are not displayed again. */
+void ADisplayUnjoinedFiberExceptions(void)
+{
+    FiberReport *r;
+
+    athread_mutex_lock(&ReportMutex);
+    for (r = Reports; r != NULL; r = r->next) {
+        DisplayReport(r);
+        free(r->text);
+        r->text = NULL;
+    }
+    athread_mutex_unlock(&ReportMutex);
+}
+
+
+static void FreeScheduler(Scheduler *s)
+{
+    if (s->wakePipe[0] >= 0)
+        close(s->wakePipe[0]);
+    if (s->wakePipe[1] >= 0)
+        close(s->wakePipe[1]);
+#ifdef A_HAVE_EPOLL
+    if (s->epoll >= 0)
+        close(s->epoll);
+#else
+    free(s->fds);
+#endif
+    free(s->io);
+    free(s->timers);
+    athread_mutex_destroy(&s->mutex);
+    free(s);
+}
+
+
+#else /* A_HAVE_FIBERS */
+
+
+/* Fibers are not supported on this platform. Blocking operations always
+   block the thread. */
+
+
+ABool AInitializeFibers(void)
+{
+    return TRUE;
+}
+
+
+AValue ASchedulerCreate(AThread *t, AValue *frame)
+{
+    return ARaiseRuntimeError(t, "Fibers not supported on this platform");
+}
+
+
+AValue ASchedulerSpawn(AThread *t, AValue *frame)
+{
+    return ARaiseRuntimeError(t, "Fibers not supported on this platform");
+}
+
+
+AValue ASchedulerRun(AThread *t, AValue *frame)
+{
+    return ARaiseRuntimeError(t, "Fibers not supported on this platform");
+}
+
+
+AValue ASchedulerFinalize(AThread *t, AValue *frame)
+{
+    return ANil;
+}
+
+
+AValue AFiberJoin(AThread *t, AValue *frame)
+{
+    return ARaiseValueError(t, "Fiber not started");
+}
+
+
+AValue AFiberFinalize(AThread *t, AValue *frame)
+{
+    return ANil;
+}
+
+
+AValue AFiberIsDone(AThread *t, AValue *frame)
+{
+    return AFalse;
+}
+
+
+void ADisplayUnjoinedFiberExceptions(void)
+{
+}
+
+
+AValue AFiberYield(AThread *t, AValue *frame)
+{
+    return ANil;
+}
+
+
+ABool AFiberWaitForIo(AThread *t, int handle, int events)
+{
+    return FALSE;
+}
+
+
+ABool AFiberSleep(AThread *t, double seconds)
+{
+    return FALSE;
+}
+
+
+int AFiberFutexWait(AThread *t, volatile int *ptr, int value, double timeout)
+{
+    int result;
+
+    AAllowBlocking();
+    result = athread_futex_wait(ptr, value, timeout);
+    AEndBlocking();
+
+    return result;
+}
+
+
+void AFiberFutexWake(volatile int *ptr, int count)
+{
+    athread_futex_wake(ptr, count);
+}
+
+
+#endif /* A_HAVE_FIBERS */
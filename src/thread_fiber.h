@@ -0,0 +1,49 @@
+/* thread_fiber.h - Fibers (lightweight threads run by a Scheduler)
+
+   Copyright (c) 2010-2011 Jukka Lehtosalo
+
+   Alore is licensed under the terms of the MIT license.  See the file
+   LICENSE.txt in the distribution.
+*/
+
+#ifndef THREAD_FIBER_H_INCL
+#define THREAD_FIBER_H_INCL
+
+#include "thread.h"
+
+
+/* Events for AFiberWaitForIo */
+#define A_FIBER_READABLE 1
+#define A_FIBER_WRITABLE 2
+
+
+/* Is the code running in a fiber? Blocking operations should call the
+   functions below instead of blocking if this is true. */
+#define AIsFiber(t) ((t)->fiber != NULL)
+
+
+/* Suspend the current fiber until the file descriptor is ready for the
+   events. Return FALSE without waiting if the thread is not a fiber or if the
+   file descriptor cannot be waited for (for example, if it refers to a
+   regular file). */
+A_APIFUNC ABool AFiberWaitForIo(AThread *t, int handle, int events);
+
+/* Suspend the current fiber for the given number of seconds. Return FALSE
+   without waiting if the thread is not a fiber. */
+A_APIFUNC ABool AFiberSleep(AThread *t, double seconds);
+
+/* Like athread_futex_wait, but suspend only the current fiber if the thread
+   is a fiber. Otherwise, block the thread and allow other threads to freeze
+   it while waiting. */
+A_APIFUNC int AFiberFutexWait(AThread *t, volatile int *ptr, int value,
+                              double timeout);
+
+/* Like athread_futex_wake, but also wake up fibers waiting in
+   AFiberFutexWait. */
+A_APIFUNC void AFiberFutexWake(volatile int *ptr, int count);
+
+
+ABool AInitializeFibers(void);
+
+
+#endif
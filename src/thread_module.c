@@ -14,10 +14,42 @@
 AThread *AMainThread;
 
 int AThreadMutexNum;
+int AThreadClassNum;
+int AFutureClassNum;
+int APoolWorkerClassNum;
+int ATimeoutErrorClassNum;
+int AChannelIterClassNum;
+int AChannelClosedErrorClassNum;
+int AFiberClassNum;
+int ASchedulerDataOffset;
+int AFiberDataOffset;
+
+static int ThreadDeinitNum;
+
+
+/* thread::Main() */
+static AValue ThreadMain(AThread *t, AValue *frame)
+{
+    /* Call ThreadDeinit when shutting down. */
+    frame[0] = AGlobalByNum(ThreadDeinitNum);
+    return AAddExitHandler(t, frame);
+}
+
+
+/* Deinitialize the thread module. Display the exceptions raised by fibers
+   that were never joined. */
+static AValue ThreadDeinit(AThread *t, AValue *frame)
+{
+    ADisplayUnjoinedFiberExceptions();
+    return ANil;
+}
 
 
 A_MODULE(thread, "thread")
-    A_CLASS_PRIV("Thread", 3)
+    A_DEF(A_PRIVATE("Main"), 0, 1, ThreadMain)
+    A_DEF_P(A_PRIVATE("Deinit"), 0, 0, ThreadDeinit, &ThreadDeinitNum)
+
+    A_CLASS_PRIV_P("Thread", 3, &AThreadClassNum)
         A_METHOD("create", 1, 5, AThreadCreate)
         A_METHOD("join", 0, 0, AThreadJoin)
         A_METHOD("stop", 0, 0, AThreadStop)
@@ -31,16 +63,80 @@ A_MODULE(thread, "thread")
         A_METHOD("lock", 0, 0, AMutexLock)
         A_METHOD("unlock", 0, 0, AMutexUnlock)
         A_METHOD("#i", 0, 0, AMutexCreate)
-        A_METHOD("#f", 0, 0, AMutexFinalize)
     A_END_CLASS()
     A_CLASS_PRIV("Condition", 1)
         /* NOTE: A_CONDITION_DATA_SIZE currently is 0. */
         A_BINARY_DATA(A_CONDITION_DATA_SIZE)
         A_METHOD("create", 0, 0, AConditionCreate)
-        A_METHOD("wait", 1, 1, AConditionWait)
+        A_METHOD_OPT("wait", 1, 2, 0, AConditionWait)
         A_METHOD("signal", 0, 0, AConditionSignal)
         A_METHOD("broadcast", 0, 0, AConditionBroadcast)
         A_METHOD("#i", 0, 0, AConditionCreate)
-        A_METHOD("#f", 0, 0, AConditionFinalize)
     A_END_CLASS()
+    A_CLASS_PRIV("ThreadPool", 2)
+        A_METHOD_OPT("create", 0, 2, 4, AThreadPoolCreate)
+        A_METHOD_VARARG("submit", 1, 1, 4, AThreadPoolSubmit)
+        A_METHOD("map", 2, 9, AThreadPoolMap)
+        A_METHOD("shutdown", 0, 0, AThreadPoolShutdown)
+        A_METHOD("#f", 0, 0, AThreadPoolFinalize)
+    A_END_CLASS()
+    A_CLASS_PRIV_P("Future", 5, &AFutureClassNum)
+        A_METHOD_OPT("get", 0, 1, 6, AFutureGet)
+        A_METHOD_OPT("wait", 0, 1, 6, AFutureWait)
+        A_METHOD("isDone", 0, 0, AFutureIsDone)
+    A_END_CLASS()
+    A_CLASS_PRIV_P(A_PRIVATE("PoolWorker"), 2, &APoolWorkerClassNum)
+        A_METHOD("_call", 0, 5, AThreadPoolWorkerMain)
+    A_END_CLASS()
+    A_CLASS_PRIV("AtomicInt", 1)
+        A_METHOD_OPT("create", 0, 1, 0, AAtomicIntCreate)
+        A_METHOD("get", 0, 0, AAtomicIntGet)
+        A_METHOD("set", 1, 0, AAtomicIntSet)
+        A_METHOD_OPT("add", 0, 1, 0, AAtomicIntAdd)
+        A_METHOD("compareAndSet", 2, 0, AAtomicIntCompareAndSet)
+        A_METHOD("exchange", 1, 0, AAtomicIntExchange)
+        A_METHOD("_str", 0, 0, AAtomicIntStr)
+    A_END_CLASS()
+    A_CLASS_PRIV("AtomicRef", 1)
+        A_METHOD_OPT("create", 0, 1, 0, AAtomicRefCreate)
+        A_METHOD("get", 0, 0, AAtomicRefGet)
+        A_METHOD("set", 1, 0, AAtomicRefSet)
+        A_METHOD("compareAndSet", 2, 0, AAtomicRefCompareAndSet)
+        A_METHOD("exchange", 1, 0, AAtomicRefExchange)
+    A_END_CLASS()
+    A_CLASS_PRIV("Channel", 2)
+        A_METHOD("create", 1, 1, AChannelCreate)
+        A_METHOD_OPT("send", 1, 2, 0, AChannelSend)
+        A_METHOD_OPT("receive", 0, 1, 1, AChannelReceive)
+        A_METHOD_OPT("receiveBatch", 1, 2, 2, AChannelReceiveBatch)
+        A_METHOD("close", 0, 0, AChannelClose)
+        A_METHOD("isClosed", 0, 0, AChannelIsClosed)
+        A_METHOD("length", 0, 0, AChannelLength)
+        A_METHOD("iterator", 0, 1, AChannelIter)
+    A_END_CLASS()
+    A_CLASS_PRIV_P(A_PRIVATE("ChannelIter"), 3, &AChannelIterClassNum)
+        A_METHOD("hasNext", 0, 2, AChannelIterHasNext)
+        A_METHOD("next", 0, 2, AChannelIterNext)
+    A_END_CLASS()
+    A_CLASS_P("TimeoutError", &ATimeoutErrorClassNum)
+        A_INHERIT("std::Exception")
+    A_END_CLASS()
+    A_CLASS_P("ChannelClosedError", &AChannelClosedErrorClassNum)
+        A_INHERIT("std::Exception")
+    A_END_CLASS()
+    A_CLASS("Scheduler")
+        A_BINARY_DATA_P(sizeof(void *), &ASchedulerDataOffset)
+        A_METHOD("create", 0, 0, ASchedulerCreate)
+        A_METHOD_VARARG("spawn", 1, 1, 4, ASchedulerSpawn)
+        A_METHOD("run", 0, 0, ASchedulerRun)
+        A_METHOD("#f", 0, 0, ASchedulerFinalize)
+    A_END_CLASS()
+    A_CLASS_PRIV_P("Fiber", 3, &AFiberClassNum)
+        A_BINARY_DATA_P(sizeof(void *), &AFiberDataOffset)
+        A_METHOD("join", 0, 0, AFiberJoin)
+        A_METHOD("isDone", 0, 0, AFiberIsDone)
+        A_METHOD("#f", 0, 0, AFiberFinalize)
+    A_END_CLASS()
+    A_DEF("Yield", 0, 0, AFiberYield)
+    A_DEF("__FreezeStats", 0, 2, AThreadFreezeStats)
 A_END_MODULE()
@@ -16,20 +16,74 @@ AValue AThreadCreate(AThread *t, AValue *frame);
 AValue AThreadJoin(AThread *t, AValue *frame);
 AValue AThreadStop(AThread *t, AValue *frame);
 AValue AThreadFinalize(AThread *t, AValue *frame);
+AValue AThreadFreezeStats(AThread *t, AValue *frame);
 
 AValue AMutexCreate(AThread *t, AValue *frame);
 AValue AMutexLock(AThread *t, AValue *frame);
 AValue AMutexUnlock(AThread *t, AValue *frame);
-AValue AMutexFinalize(AThread *t, AValue *frame);
 
 AValue AConditionCreate(AThread *t, AValue *frame);
 AValue AConditionWait(AThread *t, AValue *frame);
 AValue AConditionSignal(AThread *t, AValue *frame);
 AValue AConditionBroadcast(AThread *t, AValue *frame);
-AValue AConditionFinalize(AThread *t, AValue *frame);
+
+AValue AThreadPoolCreate(AThread *t, AValue *frame);
+AValue AThreadPoolSubmit(AThread *t, AValue *frame);
+AValue AThreadPoolMap(AThread *t, AValue *frame);
+AValue AThreadPoolShutdown(AThread *t, AValue *frame);
+AValue AThreadPoolFinalize(AThread *t, AValue *frame);
+AValue AThreadPoolWorkerMain(AThread *t, AValue *frame);
+
+AValue AFutureGet(AThread *t, AValue *frame);
+AValue AFutureWait(AThread *t, AValue *frame);
+AValue AFutureIsDone(AThread *t, AValue *frame);
+
+AValue AAtomicIntCreate(AThread *t, AValue *frame);
+AValue AAtomicIntGet(AThread *t, AValue *frame);
+AValue AAtomicIntSet(AThread *t, AValue *frame);
+AValue AAtomicIntAdd(AThread *t, AValue *frame);
+AValue AAtomicIntCompareAndSet(AThread *t, AValue *frame);
+AValue AAtomicIntExchange(AThread *t, AValue *frame);
+AValue AAtomicIntStr(AThread *t, AValue *frame);
+
+AValue AAtomicRefCreate(AThread *t, AValue *frame);
+AValue AAtomicRefGet(AThread *t, AValue *frame);
+AValue AAtomicRefSet(AThread *t, AValue *frame);
+AValue AAtomicRefCompareAndSet(AThread *t, AValue *frame);
+AValue AAtomicRefExchange(AThread *t, AValue *frame);
+
+AValue AChannelCreate(AThread *t, AValue *frame);
+AValue AChannelSend(AThread *t, AValue *frame);
+AValue AChannelReceive(AThread *t, AValue *frame);
+AValue AChannelReceiveBatch(AThread *t, AValue *frame);
+AValue AChannelClose(AThread *t, AValue *frame);
+AValue AChannelIsClosed(AThread *t, AValue *frame);
+AValue AChannelLength(AThread *t, AValue *frame);
+AValue AChannelIter(AThread *t, AValue *frame);
+AValue AChannelIterHasNext(AThread *t, AValue *frame);
+AValue AChannelIterNext(AThread *t, AValue *frame);
+
+AValue ASchedulerCreate(AThread *t, AValue *frame);
+AValue ASchedulerSpawn(AThread *t, AValue *frame);
+AValue ASchedulerRun(AThread *t, AValue *frame);
+AValue ASchedulerFinalize(AThread *t, AValue *frame);
+AValue AFiberJoin(AThread *t, AValue *frame);
+AValue AFiberIsDone(AThread *t, AValue *frame);
+AValue AFiberFinalize(AThread *t, AValue *frame);
+AValue AFiberYield(AThread *t, AValue *frame);
+void ADisplayUnjoinedFiberExceptions(void);
 
 
 extern int AThreadMutexNum;
+extern int AThreadClassNum;
+extern int AFutureClassNum;
+extern int APoolWorkerClassNum;
+extern int ATimeoutErrorClassNum;
+extern int AChannelIterClassNum;
+extern int AChannelClosedErrorClassNum;
+extern int AFiberClassNum;
+extern int ASchedulerDataOffset;
+extern int AFiberDataOffset;
 
 
 #endif
@@ -0,0 +1,733 @@
+/* thread_pool.c - thread module (ThreadPool and Future classes)
+
+   Copyright (c) 2010-2011 Jukka Lehtosalo
+
+   Alore is licensed under the terms of the MIT license.  See the file
+   LICENSE.txt in the distribution.
+*/
+
+/* A ThreadPool has a fixed number of worker threads. Each worker has a
+   private double-ended queue (deque) of tasks. Tasks submitted by a worker
+   are added to the deque of the worker; other tasks are distributed to the
+   deques in a round-robin fashion. A worker takes the newest task from its
+   own deque, and if it is empty, steals the oldest task from another deque.
+
+   Each deque is protected by a separate mutex. The pool mutex protects the
+   counters that are used for bounding the queue length and for putting idle
+   workers to sleep. Tasks are represented by Future objects that hold the
+   function and the arguments until the task is run.
+
+   The deques are ring buffers stored in Alore arrays, since the tasks must be
+   visible to the garbage collector. The mutexes are never held while calling
+   functions that might raise direct exceptions. */
+
+#include "alore.h"
+#include "runtime.h"
+#include "thread_module.h"
+#include "thread_athread.h"
+#include "array.h"
+#include "mem.h"
+#include "gc.h"
+
+
+/* Default maximum number of queued tasks */
+#define DEFAULT_MAX_QUEUED 1024
+
+
+/* Member indices of ThreadPool objects */
+enum {
+    POOL_FINALIZER_LIST,
+    POOL_DATA,          /* Non-pointer block containing PoolData */
+    POOL_DEQUES         /* Array of ring buffers (one per worker) */
+};
+
+/* Member indices of Future objects */
+enum {
+    FUTURE_POOL,
+    FUTURE_FUNC,        /* Task function (nil after the task has started) */
+    FUTURE_ARGS,        /* Argument array (nil after the task has started) */
+    FUTURE_STATE,       /* One of the FUTURE_x states below */
+    FUTURE_RESULT       /* Return value or raised exception */
+};
+
+/* States of Future objects */
+enum {
+    FUTURE_PENDING,
+    FUTURE_RETURNED,
+    FUTURE_RAISED
+};
+
+/* Member indices of PoolWorker objects */
+enum {
+    WORKER_POOL,
+    WORKER_INDEX
+};
+
+
+typedef struct {
+    athread_mutex_t mutex;
+    int head;        /* Index of the oldest task in the ring buffer */
+    int count;       /* Number of tasks in the ring buffer */
+    AThread *thread; /* Worker thread that owns the deque (or NULL) */
+} PoolDeque;
+
+
+typedef struct {
+    athread_mutex_t mutex;
+    athread_cond_t workCond;  /* Signaled when a task becomes available */
+    athread_cond_t spaceCond; /* Signaled when the queue has free space */
+    athread_cond_t doneCond;  /* Broadcast when a task has finished */
+    int numWorkers;
+    int maxQueued;
+    int capacity;             /* Capacity of each ring buffer */
+    int numQueued;            /* Number of tasks not yet claimed by workers
+                                 (including tasks that are being added) */
+    int numAvailable;         /* Number of tasks in the deques that can be
+                                 claimed by workers */
+    int numAlive;             /* Number of running worker threads */
+    int numIdle;              /* Number of workers waiting for workCond */
+    int numSpaceWaiters;      /* Number of threads waiting for spaceCond */
+    int numDoneWaiters;       /* Number of threads waiting for doneCond */
+    int numHelpers;           /* Number of workers waiting for doneCond */
+    int nextDeque;
+    ABool isShutdown;
+    PoolDeque deque[1];       /* Actually numWorkers items */
+} PoolData;
+
+
+/* Return a pointer to the PoolData structure when given a ThreadPool
+   value. */
+#define GetPoolData(pool) \
+    ((PoolData *)APtrAdd(AValueToPtr(AMemberDirect(pool, POOL_DATA)), \
+                         sizeof(AValue)))
+
+
+static AValue SubmitTask(AThread *t, AValue *pool, AValue *temp);
+static ABool WaitFuture(AThread *t, AValue *temp, double timeout);
+static void RunTask(AThread *t, AValue *temp);
+static ABool PushTask(AThread *t, AValue *pool, PoolData *data, int index,
+                      AValue *task);
+static AValue TakeTask(AValue *pool, PoolData *data, int index);
+static void ClaimTask(PoolData *data);
+static int FindWorkerIndex(PoolData *data, AThread *t);
+static void Lock(athread_mutex_t *mutex);
+static void Wait(athread_cond_t *cond, athread_mutex_t *mutex);
+static double GetTimeout(AThread *t, AValue timeout);
+
+
+/* ThreadPool create([numWorkers[, maxQueued]])
+   Create the data structures of a pool and start the worker threads. */
+AValue AThreadPoolCreate(AThread *t, AValue *frame)
+{
+    int numWorkers;
+    int maxQueued;
+    unsigned long size;
+    AValue *block;
+    PoolData *data;
+    int i;
+
+    if (AIsDefault(frame[1]) || AIsNil(frame[1]))
+        numWorkers = athread_num_cpus();
+    else {
+        numWorkers = AGetInt(t, frame[1]);
+        if (numWorkers < 1)
+            return ARaiseValueError(t, "Invalid number of workers");
+    }
+
+    if (AIsDefault(frame[2]) || AIsNil(frame[2]))
+        maxQueued = DEFAULT_MAX_QUEUED;
+    else {
+        maxQueued = AGetInt(t, frame[2]);
+        if (maxQueued < 1)
+            return ARaiseValueError(t, "Invalid maximum queue length");
+    }
+
+    if (maxQueued > INT_MAX - numWorkers)
+        return ARaiseMemoryError(t);
+
+    size = sizeof(PoolData) + (numWorkers - 1) * sizeof(PoolDeque);
+    block = AAllocUnmovable(sizeof(AValue) + size);
+    if (block == NULL)
+        return ARaiseMemoryError(t);
+
+    AInitNonPointerBlockOld(block, size);
+
+    *t->tempStack = ANonPointerBlockToValue(block);
+    ASetMemberDirect(t, frame[0], POOL_DATA, *t->tempStack);
+    *t->tempStack = AZero;
+    data = GetPoolData(frame[0]);
+
+    if (athread_mutex_init(&data->mutex, NULL)
+        || athread_cond_init(&data->workCond, NULL)
+        || athread_cond_init(&data->spaceCond, NULL)
+        || athread_cond_init(&data->doneCond, NULL))
+        return ARaiseMemoryError(t);
+
+    data->numWorkers = numWorkers;
+    data->maxQueued = maxQueued;
+    data->capacity = maxQueued + numWorkers;
+    data->numQueued = 0;
+    data->numAvailable = 0;
+    data->numAlive = 0;
+    data->numIdle = 0;
+    data->numSpaceWaiters = 0;
+    data->numDoneWaiters = 0;
+    data->numHelpers = 0;
+    data->nextDeque = 0;
+    data->isShutdown = FALSE;
+
+    for (i = 0; i < numWorkers; i++) {
+        if (athread_mutex_init(&data->deque[i].mutex, NULL))
+            return ARaiseMemoryError(t);
+        data->deque[i].head = 0;
+        data->deque[i].count = 0;
+        data->deque[i].thread = NULL;
+    }
+
+    /* Create the ring buffers. A single deque may contain up to maxQueued
+       tasks plus the tasks that have been claimed by workers but not yet
+       removed from the deque. */
+    frame[3] = AMakeArray(t, numWorkers);
+    for (i = 0; i < numWorkers; i++) {
+        frame[4] = AMakeArray(t, data->capacity);
+        ASetArrayItem(t, frame[3], i, frame[4]);
+    }
+    ASetMemberDirect(t, frame[0], POOL_DEQUES, frame[3]);
+
+    /* Start the worker threads. */
+    for (i = 0; i < numWorkers; i++) {
+        frame[4] = AMakeUninitializedObject(t,
+                                           AGlobalByNum(APoolWorkerClassNum));
+        ASetMemberDirect(t, frame[4], WORKER_POOL, frame[0]);
+        ASetMemberDirect(t, frame[4], WORKER_INDEX, AIntToValue(i));
+
+        Lock(&data->mutex);
+        data->numAlive++;
+        athread_mutex_unlock(&data->mutex);
+
+        frame[5] = frame[4];
+        if (AIsError(ACallValue(t, AGlobalByNum(AThreadClassNum), 1,
+                                frame + 5))) {
+            /* Stop the workers that were already started. */
+            Lock(&data->mutex);
+            data->numAlive--;
+            data->isShutdown = TRUE;
+            athread_mutex_unlock(&data->mutex);
+            athread_cond_broadcast(&data->workCond);
+            return AError;
+        }
+    }
+
+    return frame[0];
+}
+
+
+/* ThreadPool submit(function, *args)
+   Queue a task and return a Future object that represents its result. */
+AValue AThreadPoolSubmit(AThread *t, AValue *frame)
+{
+    return SubmitTask(t, frame, frame + 1);
+}
+
+
+/* ThreadPool map(function, iterable)
+   Call function for each item in an iterable using the worker threads and
+   return an array of the return values in order. */
+AValue AThreadPoolMap(AThread *t, AValue *frame)
+{
+    Assize_t i;
+    int status;
+
+    /* Submit all the tasks. */
+    frame[3] = AMakeArray(t, 0);
+    frame[4] = AIterator(t, frame[2]);
+    for (;;) {
+        status = ANext(t, frame[4], frame + 7);
+        if (status < 0)
+            return AError;
+        if (status == 0)
+            break;
+
+        frame[6] = AMakeArray(t, 1);
+        ASetArrayItem(t, frame[6], 0, frame[7]);
+        frame[5] = frame[1];
+        if (AIsError(SubmitTask(t, frame, frame + 5)))
+            return AError;
+        AAppendArray(t, frame[3], frame[7]);
+    }
+
+    /* Collect the results. If a task raised an exception, raise it again,
+       but only after all the tasks have finished. */
+    for (i = 0; i < AArrayLen(frame[3]); i++) {
+        frame[5] = AArrayItem(frame[3], i);
+        WaitFuture(t, frame + 5, -1.0);
+    }
+
+    for (i = 0; i < AArrayLen(frame[3]); i++) {
+        frame[5] = AArrayItem(frame[3], i);
+        if (AMemberDirect(frame[5], FUTURE_STATE)
+                == AIntToValue(FUTURE_RAISED)) {
+            t->exception = AMemberDirect(frame[5], FUTURE_RESULT);
+            t->uncaughtExceptionStackPtr = t->stackPtr;
+            t->isExceptionReraised = FALSE;
+            return AError;
+        }
+        ASetArrayItem(t, frame[3], i, AMemberDirect(frame[5], FUTURE_RESULT));
+    }
+
+    return frame[3];
+}
+
+
+/* ThreadPool shutdown()
+   Wait until all the queued tasks have been run and stop the worker
+   threads. */
+AValue AThreadPoolShutdown(AThread *t, AValue *frame)
+{
+    PoolData *data = GetPoolData(frame[0]);
+
+    Lock(&data->mutex);
+
+    if (FindWorkerIndex(data, t) >= 0) {
+        athread_mutex_unlock(&data->mutex);
+        return ARaiseRuntimeError(t, "Worker thread cannot shut down pool");
+    }
+
+    data->isShutdown = TRUE;
+    athread_cond_broadcast(&data->workCond);
+    athread_cond_broadcast(&data->spaceCond);
+
+    while (data->numAlive > 0) {
+        data->numDoneWaiters++;
+        Wait(&data->doneCond, &data->mutex);
+        data->numDoneWaiters--;
+    }
+
+    athread_mutex_unlock(&data->mutex);
+
+    return ANil;
+}
+
+
+/* Free the mutexes and the condition variables of a pool. The worker threads
+   refer to the pool, and therefore they have all exited before the pool can
+   be finalized. */
+AValue AThreadPoolFinalize(AThread *t, AValue *frame)
+{
+    if (AMemberDirect(frame[0], POOL_DATA) != ANil) {
+        PoolData *data = GetPoolData(frame[0]);
+        int i;
+
+        for (i = 0; i < data->numWorkers; i++)
+            athread_mutex_destroy(&data->deque[i].mutex);
+        athread_cond_destroy(&data->doneCond);
+        athread_cond_destroy(&data->spaceCond);
+        athread_cond_destroy(&data->workCond);
+        athread_mutex_destroy(&data->mutex);
+    }
+    return AZero;
+}
+
+
+/* PoolWorker _call()
+   The thread function of a worker thread. Run tasks until the pool is shut
+   down and the queue is empty. */
+AValue AThreadPoolWorkerMain(AThread *t, AValue *frame)
+{
+    PoolData *data;
+    int index;
+
+    frame[1] = AMemberDirect(frame[0], WORKER_POOL);
+    index = AValueToInt(AMemberDirect(frame[0], WORKER_INDEX));
+    data = GetPoolData(frame[1]);
+
+    Lock(&data->mutex);
+    data->deque[index].thread = t;
+
+    for (;;) {
+        while (data->numAvailable == 0 && !data->isShutdown) {
+            data->numIdle++;
+            Wait(&data->workCond, &data->mutex);
+            data->numIdle--;
+        }
+
+        if (data->numAvailable == 0)
+            break;
+
+        ClaimTask(data);
+        athread_mutex_unlock(&data->mutex);
+
+        frame[2] = TakeTask(frame + 1, data, index);
+        RunTask(t, frame + 2);
+
+        Lock(&data->mutex);
+    }
+
+    data->deque[index].thread = NULL;
+    data->numAlive--;
+    if (data->numAlive == 0 && data->numDoneWaiters > 0)
+        athread_cond_broadcast(&data->doneCond);
+
+    athread_mutex_unlock(&data->mutex);
+
+    return ANil;
+}
+
+
+/* Future get([timeout])
+   Wait until the task has finished and return its return value. If the task
+   raised an exception, raise it again. */
+AValue AFutureGet(AThread *t, AValue *frame)
+{
+    double timeout = GetTimeout(t, frame[1]);
+
+    frame[2] = frame[0];
+    if (!WaitFuture(t, frame + 2, timeout))
+        return ARaiseByNum(t, ATimeoutErrorClassNum, NULL);
+
+    if (AMemberDirect(frame[0], FUTURE_STATE) == AIntToValue(FUTURE_RAISED)) {
+        t->exception = AMemberDirect(frame[0], FUTURE_RESULT);
+        t->uncaughtExceptionStackPtr = t->stackPtr;
+        t->isExceptionReraised = FALSE;
+        return AError;
+    } else
+        return AMemberDirect(frame[0], FUTURE_RESULT);
+}
+
+
+/* Future wait([timeout])
+   Wait until the task has finished. Return a boolean indicating whether the
+   task has finished. */
+AValue AFutureWait(AThread *t, AValue *frame)
+{
+    double timeout = GetTimeout(t, frame[1]);
+
+    frame[2] = frame[0];
+    return WaitFuture(t, frame + 2, timeout) ? ATrue : AFalse;
+}
+
+
+/* Future isDone() */
+AValue AFutureIsDone(AThread *t, AValue *frame)
+{
+    PoolData *data;
+    ABool isDone;
+
+    if (AIsNil(AMemberDirect(frame[0], FUTURE_POOL)))
+        return ARaiseValueError(t, "Future not associated with a pool");
+
+    data = GetPoolData(AMemberDirect(frame[0], FUTURE_POOL));
+    Lock(&data->mutex);
+    isDone = AMemberDirect(frame[0], FUTURE_STATE)
+        != AIntToValue(FUTURE_PENDING);
+    athread_mutex_unlock(&data->mutex);
+
+    return isDone ? ATrue : AFalse;
+}
+
+
+/* Create a Future for calling temp[0] with the arguments in the array temp[1]
+   and add it to the queue of the pool *pool. If successful, store the future
+   in temp[2] and also return it; otherwise raise an exception and return
+   AError without modifying temp[2]. Use temp[3], ..., temp[5] as temporary
+   storage. If the queue is full, wait until there is space. As an exception,
+   a worker thread runs the task immediately instead, since otherwise all the
+   workers could end up waiting for each other. */
+static AValue SubmitTask(AThread *t, AValue *pool, AValue *temp)
+{
+    PoolData *data = GetPoolData(*pool);
+    int index;
+
+    temp[3] = AMakeUninitializedObject(t, AGlobalByNum(AFutureClassNum));
+    ASetMemberDirect(t, temp[3], FUTURE_POOL, *pool);
+    ASetMemberDirect(t, temp[3], FUTURE_FUNC, temp[0]);
+    ASetMemberDirect(t, temp[3], FUTURE_ARGS, temp[1]);
+    ASetMemberDirect(t, temp[3], FUTURE_STATE, AIntToValue(FUTURE_PENDING));
+
+    Lock(&data->mutex);
+
+    index = FindWorkerIndex(data, t);
+    if (index >= 0 && data->numQueued >= data->maxQueued
+        && !data->isShutdown) {
+        athread_mutex_unlock(&data->mutex);
+        temp[2] = temp[3];
+        RunTask(t, temp + 2);
+        return temp[2];
+    }
+
+    while (data->numQueued >= data->maxQueued && !data->isShutdown) {
+        data->numSpaceWaiters++;
+        Wait(&data->spaceCond, &data->mutex);
+        data->numSpaceWaiters--;
+    }
+
+    if (data->isShutdown) {
+        athread_mutex_unlock(&data->mutex);
+        return ARaiseRuntimeError(t, "Pool has been shut down");
+    }
+
+    data->numQueued++;
+    if (index < 0) {
+        index = data->nextDeque;
+        data->nextDeque = (index + 1) % data->numWorkers;
+    }
+
+    athread_mutex_unlock(&data->mutex);
+
+    if (!PushTask(t, pool, data, index, temp + 3)) {
+        Lock(&data->mutex);
+        data->numQueued--;
+        if (data->numSpaceWaiters > 0)
+            athread_cond_signal(&data->spaceCond);
+        athread_mutex_unlock(&data->mutex);
+        return ARaiseMemoryErrorND(t);
+    }
+
+    Lock(&data->mutex);
+    data->numAvailable++;
+    if (data->numIdle > 0)
+        athread_cond_signal(&data->workCond);
+    else if (data->numHelpers > 0)
+        athread_cond_broadcast(&data->doneCond);
+    athread_mutex_unlock(&data->mutex);
+
+    temp[2] = temp[3];
+    return temp[2];
+}
+
+
+/* Wait until the future temp[0] has finished or until timeout seconds have
+   passed (timeout < 0 means no timeout). Return TRUE if the future has
+   finished. Use temp[1], ..., temp[5] as temporary storage. If called in a
+   worker thread of the pool, run queued tasks while waiting. */
+static ABool WaitFuture(AThread *t, AValue *temp, double timeout)
+{
+    PoolData *data;
+    int index;
+    double deadline;
+    ABool isTimedOut;
+    ABool isDone;
+
+    temp[1] = AMemberDirect(temp[0], FUTURE_POOL);
+    if (AIsNil(temp[1]))
+        ARaiseValueError(t, "Future not associated with a pool");
+
+    data = GetPoolData(temp[1]);
+    deadline = timeout >= 0.0 ? athread_time() + timeout : 0.0;
+    isTimedOut = FALSE;
+
+    Lock(&data->mutex);
+
+    index = FindWorkerIndex(data, t);
+
+    for (;;) {
+        isDone = AMemberDirect(temp[0], FUTURE_STATE)
+            != AIntToValue(FUTURE_PENDING);
+        if (isDone || isTimedOut)
+            break;
+
+        if (index >= 0 && data->numAvailable > 0) {
+            ClaimTask(data);
+            athread_mutex_unlock(&data->mutex);
+
+            temp[2] = TakeTask(temp + 1, data, index);
+            RunTask(t, temp + 2);
+
+            Lock(&data->mutex);
+            continue;
+        }
+
+        data->numDoneWaiters++;
+        if (index >= 0)
+            data->numHelpers++;
+
+        if (timeout < 0.0)
+            Wait(&data->doneCond, &data->mutex);
+        else {
+            double remaining = deadline - athread_time();
+            AAllowBlocking();
+            if (remaining <= 0.0
+                || athread_cond_timedwait(&data->doneCond, &data->mutex,
+                                          remaining) == ETIMEDOUT)
+                isTimedOut = TRUE;
+            AEndBlocking();
+        }
+
+        data->numDoneWaiters--;
+        if (index >= 0)
+            data->numHelpers--;
+    }
+
+    athread_mutex_unlock(&data->mutex);
+
+    return isDone;
+}
+
+
+/* Run the task represented by the future temp[0] and record the result in the
+   future. Use temp[1], ..., temp[3] as temporary storage. */
+static void RunTask(AThread *t, AValue *temp)
+{
+    PoolData *data;
+    int state;
+
+    temp[1] = AMemberDirect(temp[0], FUTURE_FUNC);
+    temp[2] = AMemberDirect(temp[0], FUTURE_ARGS);
+    /* Allow the function and the arguments to be freed early. */
+    AValueToInstance(temp[0])->member[FUTURE_FUNC] = ANil;
+    AValueToInstance(temp[0])->member[FUTURE_ARGS] = ANil;
+
+    /* Call the function and catch any direct exceptions. */
+    if (AHandleException(t))
+        temp[1] = AError;
+    else
+        temp[1] = ACallValue(t, temp[1], 1 | A_VAR_ARG_FLAG, temp + 2);
+    t->contextIndex--;
+
+    if (AIsError(temp[1])) {
+        state = FUTURE_RAISED;
+        temp[1] = t->exception;
+        ACreateTracebackArray(t);
+    } else
+        state = FUTURE_RETURNED;
+
+    ASetMemberDirect(t, temp[0], FUTURE_RESULT, temp[1]);
+
+    data = GetPoolData(AMemberDirect(temp[0], FUTURE_POOL));
+    Lock(&data->mutex);
+    AValueToInstance(temp[0])->member[FUTURE_STATE] = AIntToValue(state);
+    if (data->numDoneWaiters > 0)
+        athread_cond_broadcast(&data->doneCond);
+    athread_mutex_unlock(&data->mutex);
+}
+
+
+/* Add the task *task to the newest end of a deque. Return FALSE if out of
+   memory. */
+static ABool PushTask(AThread *t, AValue *pool, PoolData *data, int index,
+                      AValue *task)
+{
+    PoolDeque *deque = &data->deque[index];
+    AValue ring;
+    ABool result;
+
+    Lock(&deque->mutex);
+
+    ring = AArrayItem(AMemberDirect(*pool, POOL_DEQUES), index);
+    result = ASetArrayItemND(t, ring,
+                             (deque->head + deque->count) % data->capacity,
+                             *task);
+    if (result)
+        deque->count++;
+
+    athread_mutex_unlock(&deque->mutex);
+
+    return result;
+}
+
+
+/* Remove and return a task from the deques of the pool *pool. The caller must
+   have claimed a task using ClaimTask. First try to take the newest task from
+   the deque of the current worker. If it is empty, steal the oldest task from
+   the deque of another worker. */
+static AValue TakeTask(AValue *pool, PoolData *data, int index)
+{
+    for (;;) {
+        int n;
+
+        for (n = 0; n < data->numWorkers; n++) {
+            int i = (index + n) % data->numWorkers;
+            PoolDeque *deque = &data->deque[i];
+
+            Lock(&deque->mutex);
+
+            if (deque->count > 0) {
+                AValue ring;
+                int pos;
+                AValue task;
+
+                if (n == 0)
+                    pos = (deque->head + deque->count - 1) % data->capacity;
+                else {
+                    pos = deque->head;
+                    deque->head = (deque->head + 1) % data->capacity;
+                }
+                deque->count--;
+
+                ring = AArrayItem(AMemberDirect(*pool, POOL_DEQUES), i);
+                task = AArrayItem(ring, pos);
+                AArrayItem(ring, pos) = ANil;
+
+                athread_mutex_unlock(&deque->mutex);
+
+                return task;
+            }
+
+            athread_mutex_unlock(&deque->mutex);
+        }
+
+        /* The claimed task was added to a deque that we already looked at
+           after we looked at it. Try again. */
+    }
+}
+
+
+/* Reserve a task for the current thread. There must be an available task in
+   the deques. Precondition: the pool mutex is locked. */
+static void ClaimTask(PoolData *data)
+{
+    data->numAvailable--;
+    data->numQueued--;
+    if (data->numSpaceWaiters > 0)
+        athread_cond_signal(&data->spaceCond);
+}
+
+
+/* Return the index of the worker running in thread t, or -1 if t is not a
+   worker thread of the pool. Precondition: the pool mutex is locked. */
+static int FindWorkerIndex(PoolData *data, AThread *t)
+{
+    int i;
+
+    for (i = 0; i < data->numWorkers; i++) {
+        if (data->deque[i].thread == t)
+            return i;
+    }
+
+    return -1;
+}
+
+
+/* Lock a mutex. Allow other threads to be frozen while waiting. */
+static void Lock(athread_mutex_t *mutex)
+{
+    if (athread_mutex_trylock(mutex) == EBUSY) {
+        AAllowBlocking();
+        athread_mutex_lock(mutex);
+        AEndBlocking();
+    }
+}
+
+
+/* Wait for a condition variable. Allow other threads to be frozen while
+   waiting. */
+static void Wait(athread_cond_t *cond, athread_mutex_t *mutex)
+{
+    AAllowBlocking();
+    athread_cond_wait(cond, mutex);
+    AEndBlocking();
+}
+
+
+/* Convert an optional timeout argument to seconds. Return -1.0 if there is no
+   timeout. */
+static double GetTimeout(AThread *t, AValue timeout)
+{
+    double seconds;
+
+    if (AIsDefault(timeout) || AIsNil(timeout))
+        return -1.0;
+
+    seconds = AGetFloat(t, timeout);
+    return seconds >= 0.0 ? seconds : 0.0;
+}
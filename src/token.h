@@ -17,6 +17,8 @@ typedef enum {
     TT_BOM,             /* Byte order mark (in a UTF-8 source file) */
     TT_ID,              /* Identifier */
     TT_ID_EXPOSED,      /* Identifier (exposed variable in a definition) */
+    TT_ID_CAPTURED,     /* Identifier (variable in a definition that is
+                           captured by value in an anonymous function) */
     TT_LITERAL_INT,
     TT_LITERAL_FLOAT,
     TT_LITERAL_STRING,
@@ -135,6 +137,8 @@ typedef enum {
     ID_GLOBAL_MODULE_MAIN,
     ID_MEMBER,
     ID_LOCAL_CONST,
+    ID_LOCAL_CONST_CAPTURED,
+    ID_LOCAL_CAPTURED,
     ID_LOCAL_CONST_EXPOSED,
     ID_LOCAL_EXPOSED,
     ID_LOCAL,
@@ -143,7 +147,8 @@ typedef enum {
 } AIdType;
 
 
-#define AIsIdTokenType(type) ((type) == TT_ID || (type) == TT_ID_EXPOSED)
+#define AIsIdTokenType(type) ((type) == TT_ID || (type) == TT_ID_EXPOSED \
+                              || (type) == TT_ID_CAPTURED)
 #define AIsBinaryOperator(type) ((type) >= TT_PLUS && (type) <= TT_OR)
 #define AIsAlphaOperator(type) ((type) == TT_IDIV || (type) == TT_MOD \
                                || (type) == TT_IS || (type) == TT_IN \
@@ -174,6 +179,10 @@ typedef enum {
 #define AIsLocalId(type) ((type) >= ID_LOCAL_CONST)
 #define AIsExposedLocalId(type) ((type) == ID_LOCAL_EXPOSED || \
                                  (type) == ID_LOCAL_CONST_EXPOSED)
+/* Is the local variable accessed by anonymous functions (either through an
+   exposed variable container or by value)? */
+#define AIsCapturedLocalId(type) ((type) >= ID_LOCAL_CONST_CAPTURED && \
+                                  (type) <= ID_LOCAL_EXPOSED)
 #define AIsGlobalId(type) ((type) >= ID_GLOBAL_CONST && (type) <= ID_GLOBAL)
 
 
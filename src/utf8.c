@@ -0,0 +1,703 @@
+/* utf8.c - UTF-8 encoding and decoding helpers
+
+   Copyright (c) 2010-2011 Jukka Lehtosalo
+
+   Alore is licensed under the terms of the MIT license.  See the file
+   LICENSE.txt in the distribution.
+*/
+
+/* Helpers for converting between UTF-8 and the 8-bit and 16-bit string
+   representations. Typical text is mostly ASCII, so runs of ASCII characters
+   are found and copied in blocks of 16 or 32 bytes using SSE2 or AVX2
+   instructions if available; other sequences are processed a character at a
+   time. The AVX2 variants are selected at runtime based on the features of
+   the processor. Other platforms use portable C code that processes a machine
+   word at a time. */
+
+#include "aconfig.h"
+#include "utf8.h"
+#include "str.h"
+
+#if defined(__GNUC__) && defined(__SSE2__) \
+    && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_SSE2
+#include <emmintrin.h>
+#if __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9) \
+    || defined(__clang__)
+#define HAVE_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+
+/* Is ch a UTF-8 continuation byte? */
+#define IsCont(ch) (((ch) & 0xc0) == 0x80)
+
+/* Mask with the highest bit of each byte of an unsigned long set */
+#define HIGH_BITS (~0UL / 255 * 128)
+
+
+static void SelectImplementation(void);
+
+static Assize_t AsciiPrefixLength_C(const unsigned char *s, Assize_t len);
+static Assize_t WidePrefixLength_C(const AWideChar *s, Assize_t len,
+                                   unsigned mask);
+static void WidenChars_C(AWideChar *dst, const unsigned char *src,
+                         Assize_t len);
+static void NarrowChars_C(unsigned char *dst, const AWideChar *src,
+                          Assize_t len);
+static Assize_t FlipAsciiCase_C(unsigned char *dst, const unsigned char *src,
+                                Assize_t len, int first);
+
+
+static ABool IsInitialized;
+
+/* The implementations of the primitives that have SIMD variants. Use the
+   portable implementations until SelectImplementation has been called. */
+static Assize_t (*AsciiPrefixLengthImpl)(const unsigned char *s,
+                                         Assize_t len) = AsciiPrefixLength_C;
+static Assize_t (*WidePrefixLengthImpl)(const AWideChar *s, Assize_t len,
+                                        unsigned mask) = WidePrefixLength_C;
+static void (*WidenCharsImpl)(AWideChar *dst, const unsigned char *src,
+                              Assize_t len) = WidenChars_C;
+static void (*NarrowCharsImpl)(unsigned char *dst, const AWideChar *src,
+                               Assize_t len) = NarrowChars_C;
+static Assize_t (*FlipAsciiCaseImpl)(unsigned char *dst,
+                                     const unsigned char *src, Assize_t len,
+                                     int first) = FlipAsciiCase_C;
+
+
+Assize_t AAsciiPrefixLength(const unsigned char *s, Assize_t len)
+{
+    if (!IsInitialized)
+        SelectImplementation();
+    return AsciiPrefixLengthImpl(s, len);
+}
+
+
+Assize_t AWideAsciiPrefixLength(const AWideChar *s, Assize_t len)
+{
+    if (!IsInitialized)
+        SelectImplementation();
+    return WidePrefixLengthImpl(s, len, 0xff80);
+}
+
+
+Assize_t ANarrowPrefixLength(const AWideChar *s, Assize_t len)
+{
+    if (!IsInitialized)
+        SelectImplementation();
+    return WidePrefixLengthImpl(s, len, 0xff00);
+}
+
+
+void AWidenChars(AWideChar *dst, const unsigned char *src, Assize_t len)
+{
+    if (!IsInitialized)
+        SelectImplementation();
+    WidenCharsImpl(dst, src, len);
+}
+
+
+void ANarrowChars(unsigned char *dst, const AWideChar *src, Assize_t len)
+{
+    if (!IsInitialized)
+        SelectImplementation();
+    NarrowCharsImpl(dst, src, len);
+}
+
+
+Assize_t AAsciiUpper(unsigned char *dst, const unsigned char *src,
+                      Assize_t len)
+{
+    if (!IsInitialized)
+        SelectImplementation();
+    return FlipAsciiCaseImpl(dst, src, len, 'a');
+}
+
+
+Assize_t AAsciiLower(unsigned char *dst, const unsigned char *src,
+                      Assize_t len)
+{
+    if (!IsInitialized)
+        SelectImplementation();
+    return FlipAsciiCaseImpl(dst, src, len, 'A');
+}
+
+
+Assize_t ANonAsciiCount(const unsigned char *s, Assize_t len)
+{
+    Assize_t i;
+    Assize_t n;
+
+    /* Skip the initial ASCII run quickly; the rest is usually short or
+       mostly non-ASCII. */
+    i = AAsciiPrefixLength(s, len);
+    n = 0;
+    for (; i < len; i++)
+        n += s[i] >> 7;
+    return n;
+}
+
+
+/* Decode a single UTF-8 sequence (see ADecodeUtf8Char). This is separate from
+   ADecodeUtf8Char so that the compiler can inline it in the loops below. */
+static int DecodeChar(const unsigned char *s)
+{
+    unsigned ch1 = s[0];
+
+    if (ch1 < 0x80)
+        return ch1;
+    else if (ch1 < 0xc2)
+        return A_UTF8_INVALID;
+    else if (ch1 < 0xe0) {
+        unsigned ch2 = s[1];
+        if (!IsCont(ch2))
+            return A_UTF8_INVALID;
+        return ((ch1 & 0x1f) << 6) | (ch2 & 0x3f);
+    } else if (ch1 < 0xf0) {
+        unsigned ch2, ch3;
+
+        ch2 = s[1];
+        if (!IsCont(ch2) || (ch1 == 0xe0 && ch2 < 0xa0))
+            return A_UTF8_INVALID;
+        ch3 = s[2];
+        if (!IsCont(ch3))
+            return A_UTF8_INVALID;
+        return ((ch1 & 0xf) << 12) | ((ch2 & 0x3f) << 6) | (ch3 & 0x3f);
+    } else {
+        /* 4-byte sequences encode characters outside the 16-bit range. Other
+           lead bytes are always invalid. */
+        return A_UTF8_INVALID;
+    }
+}
+
+
+int ADecodeUtf8Char(const unsigned char *s)
+{
+    return DecodeChar(s);
+}
+
+
+/* Return the length of the ASCII run starting at s[0] (which must be less than
+   128). Single ASCII characters between multi-byte sequences are common, so
+   avoid the overhead of the bulk scan for them. */
+#define ASCII_RUN(s, len) \
+    ((len) > 1 && (s)[1] < 0x80 ? AAsciiPrefixLength((s), (len)) : 1)
+
+
+Assize_t AScanUtf8(const unsigned char *s, Assize_t len, Assize_t *numChars,
+                   int *maxChar)
+{
+    Assize_t i;
+    Assize_t n;
+    int max;
+
+    i = 0;
+    n = 0;
+    max = 0;
+
+    while (i < len) {
+        unsigned ch1 = s[i];
+        int ch;
+
+        if (ch1 < 0x80) {
+            Assize_t ascii = ASCII_RUN(s + i, len - i);
+            i += ascii;
+            n += ascii;
+            continue;
+        } else if (ch1 >= 0xc2 && ch1 < 0xe0) {
+            /* Only the lead byte determines whether a valid 2-byte sequence
+               encodes a character larger than 255. */
+            if (i + 2 > len)
+                break;
+            ch = IsCont(s[i + 1]) ? (ch1 < 0xc4 ? 0xff : 0x7ff)
+                                  : A_UTF8_INVALID;
+            i += 2;
+        } else if (ch1 >= 0xe1 && ch1 < 0xf0) {
+            /* 3-byte sequence other than the special case 0xe0 */
+            if (i + 3 > len)
+                break;
+            ch = IsCont(s[i + 1]) && IsCont(s[i + 2]) ? 0xffff
+                                                      : A_UTF8_INVALID;
+            i += 3;
+        } else {
+            int skip = A_UTF8_SKIP(ch1);
+            if (i + skip > len)
+                break;
+            ch = DecodeChar(s + i);
+            i += skip;
+        }
+
+        if (ch > max)
+            max = ch;
+        n++;
+    }
+
+    *numChars = n;
+    *maxChar = max;
+    return i;
+}
+
+
+void ADecodeUtf8W(AWideChar *dst, const unsigned char *s, Assize_t len)
+{
+    Assize_t i;
+
+    i = 0;
+    while (i < len) {
+        unsigned ch1 = s[i];
+        int ch;
+
+        if (ch1 < 0x80) {
+            Assize_t ascii = ASCII_RUN(s + i, len - i);
+            if (ascii == 1)
+                *dst = ch1;
+            else
+                AWidenChars(dst, s + i, ascii);
+            dst += ascii;
+            i += ascii;
+            continue;
+        }
+
+        if (ch1 >= 0xe1 && ch1 < 0xf0 && IsCont(s[i + 1])
+            && IsCont(s[i + 2])) {
+            /* Valid 3-byte sequence (common for CJK text) */
+            *dst++ = ((ch1 & 0xf) << 12) | ((s[i + 1] & 0x3f) << 6)
+                | (s[i + 2] & 0x3f);
+            i += 3;
+            continue;
+        }
+
+        ch = DecodeChar(s + i);
+        *dst++ = ch == A_UTF8_INVALID ? 0xfffd : ch;
+        i += A_UTF8_SKIP(ch1);
+    }
+}
+
+
+void ADecodeUtf8(unsigned char *dst, const unsigned char *s, Assize_t len)
+{
+    Assize_t i;
+
+    i = 0;
+    while (i < len) {
+        if (s[i] < 0x80) {
+            Assize_t ascii = ASCII_RUN(s + i, len - i);
+            memcpy(dst, s + i, ascii);
+            dst += ascii;
+            i += ascii;
+        } else {
+            /* Only 2-byte sequences encode characters below 256. */
+            *dst++ = ((s[i] & 0x1f) << 6) | (s[i + 1] & 0x3f);
+            i += 2;
+        }
+    }
+}
+
+
+Assize_t AValidUtf8Length(const unsigned char *s, Assize_t len)
+{
+    Assize_t i;
+
+    i = 0;
+    while (i < len) {
+        int skip;
+
+        if (s[i] < 0x80) {
+            i += ASCII_RUN(s + i, len - i);
+            continue;
+        }
+
+        skip = A_UTF8_SKIP(s[i]);
+        if (i + skip > len || DecodeChar(s + i) == A_UTF8_INVALID)
+            break;
+        i += skip;
+    }
+
+    return i;
+}
+
+
+Assize_t AUtf8Length(const unsigned char *s, Assize_t len)
+{
+    return len + ANonAsciiCount(s, len);
+}
+
+
+Assize_t AUtf8LengthW(const AWideChar *s, Assize_t len)
+{
+    Assize_t i;
+    Assize_t n;
+
+    i = 0;
+    n = 0;
+    while (i < len) {
+        if (s[i] < 0x80) {
+            Assize_t ascii = AWideAsciiPrefixLength(s + i, len - i);
+            i += ascii;
+            n += ascii;
+        } else {
+            n += A_UTF8_LEN(s[i]);
+            i++;
+        }
+    }
+
+    return n;
+}
+
+
+void AEncodeUtf8(unsigned char *dst, const unsigned char *s, Assize_t len)
+{
+    Assize_t i;
+
+    i = 0;
+    while (i < len) {
+        if (s[i] < 0x80) {
+            Assize_t ascii = AAsciiPrefixLength(s + i, len - i);
+            memcpy(dst, s + i, ascii);
+            dst += ascii;
+            i += ascii;
+        } else {
+            *dst++ = 0xc0 | (s[i] >> 6);
+            *dst++ = 0x80 | (s[i] & 0x3f);
+            i++;
+        }
+    }
+}
+
+
+void AEncodeUtf8W(unsigned char *dst, const AWideChar *s, Assize_t len)
+{
+    Assize_t i;
+
+    i = 0;
+    while (i < len) {
+        AWideChar ch = s[i];
+
+        if (ch <= 0x7f) {
+            Assize_t ascii = AWideAsciiPrefixLength(s + i, len - i);
+            ANarrowChars(dst, s + i, ascii);
+            dst += ascii;
+            i += ascii;
+            continue;
+        } else if (ch <= 0x7ff) {
+            dst[0] = 0xc0 | (ch >> 6);
+            dst[1] = 0x80 | (ch & 0x3f);
+            dst += 2;
+        } else {
+            dst[0] = 0xe0 | (ch >> 12);
+            dst[1] = 0x80 | ((ch >> 6) & 0x3f);
+            dst[2] = 0x80 | (ch & 0x3f);
+            dst += 3;
+        }
+        i++;
+    }
+}
+
+
+/* Portable implementations */
+
+
+static Assize_t AsciiPrefixLength_C(const unsigned char *s, Assize_t len)
+{
+    Assize_t i;
+
+    /* Process a machine word at a time. */
+    for (i = 0; i + (Assize_t)sizeof(unsigned long) <= len;
+         i += sizeof(unsigned long)) {
+        unsigned long w;
+        memcpy(&w, s + i, sizeof(w));
+        if (w & HIGH_BITS)
+            break;
+    }
+
+    while (i < len && s[i] < 0x80)
+        i++;
+
+    return i;
+}
+
+
+/* Return the number of leading characters of s[0..len) that have no bits in
+   common with mask. */
+static Assize_t WidePrefixLength_C(const AWideChar *s, Assize_t len,
+                                   unsigned mask)
+{
+    Assize_t i;
+
+    for (i = 0; i < len && (s[i] & mask) == 0; i++);
+    return i;
+}
+
+
+static void WidenChars_C(AWideChar *dst, const unsigned char *src,
+                         Assize_t len)
+{
+    Assize_t i;
+
+    for (i = 0; i < len; i++)
+        dst[i] = src[i];
+}
+
+
+static void NarrowChars_C(unsigned char *dst, const AWideChar *src,
+                          Assize_t len)
+{
+    Assize_t i;
+
+    for (i = 0; i < len; i++)
+        dst[i] = src[i];
+}
+
+
+/* Copy the leading bytes of src[0..len) that are less than 128 to dst,
+   flipping the case of the letters first..first + 25. Return the number of
+   bytes copied. */
+static Assize_t FlipAsciiCase_C(unsigned char *dst, const unsigned char *src,
+                                Assize_t len, int first)
+{
+    const unsigned long ones = ~0UL / 255;
+    Assize_t i;
+
+    /* Process a machine word at a time. Since all the bytes of a word are
+       less than 128, adding 128 - c to each byte sets its high bit exactly
+       if the byte is at least c, without carries between bytes. */
+    for (i = 0; i + (Assize_t)sizeof(unsigned long) <= len;
+         i += sizeof(unsigned long)) {
+        unsigned long w, isLetter;
+        memcpy(&w, src + i, sizeof(w));
+        if (w & HIGH_BITS)
+            break;
+        isLetter = (w + ones * (128 - first))
+            & ~(w + ones * (128 - first - 26)) & HIGH_BITS;
+        w ^= isLetter >> 2;
+        memcpy(dst + i, &w, sizeof(w));
+    }
+
+    for (; i < len && src[i] < 0x80; i++) {
+        int ch = src[i];
+        if (ch >= first && ch < first + 26)
+            ch ^= 0x20;
+        dst[i] = ch;
+    }
+
+    return i;
+}
+
+
+#ifdef HAVE_SSE2
+
+
+/* SSE2 implementations (SSE2 is always available on x86-64) */
+
+
+static Assize_t AsciiPrefixLength_SSE2(const unsigned char *s, Assize_t len)
+{
+    Assize_t i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        int mask = _mm_movemask_epi8(v);
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+
+    while (i < len && s[i] < 0x80)
+        i++;
+
+    return i;
+}
+
+
+static Assize_t WidePrefixLength_SSE2(const AWideChar *s, Assize_t len,
+                                      unsigned mask)
+{
+    const __m128i high = _mm_set1_epi16((short)mask);
+    const __m128i zero = _mm_setzero_si128();
+    Assize_t i;
+
+    for (i = 0; i + 8 <= len; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i isLow = _mm_cmpeq_epi16(_mm_and_si128(v, high), zero);
+        int found = _mm_movemask_epi8(isLow) ^ 0xffff;
+        if (found != 0)
+            return i + __builtin_ctz(found) / 2;
+    }
+
+    while (i < len && (s[i] & mask) == 0)
+        i++;
+
+    return i;
+}
+
+
+static void WidenChars_SSE2(AWideChar *dst, const unsigned char *src,
+                            Assize_t len)
+{
+    const __m128i zero = _mm_setzero_si128();
+    Assize_t i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_unpacklo_epi8(v, zero));
+        _mm_storeu_si128((__m128i *)(dst + i + 8),
+                         _mm_unpackhi_epi8(v, zero));
+    }
+
+    for (; i < len; i++)
+        dst[i] = src[i];
+}
+
+
+static void NarrowChars_SSE2(unsigned char *dst, const AWideChar *src,
+                             Assize_t len)
+{
+    Assize_t i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        __m128i v1 = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i v2 = _mm_loadu_si128((const __m128i *)(src + i + 8));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(v1, v2));
+    }
+
+    for (; i < len; i++)
+        dst[i] = src[i];
+}
+
+
+static Assize_t FlipAsciiCase_SSE2(unsigned char *dst,
+                                   const unsigned char *src, Assize_t len,
+                                   int first)
+{
+    const __m128i lo = _mm_set1_epi8((char)(first - 1));
+    const __m128i hi = _mm_set1_epi8((char)(first + 26));
+    const __m128i caseBit = _mm_set1_epi8(0x20);
+    Assize_t i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i isLetter;
+        if (_mm_movemask_epi8(v) != 0)
+            break;
+        /* Signed comparisons are fine, since all bytes are less than 128. */
+        isLetter = _mm_and_si128(_mm_cmpgt_epi8(v, lo), _mm_cmplt_epi8(v, hi));
+        _mm_storeu_si128((__m128i *)(dst + i),
+                         _mm_xor_si128(v, _mm_and_si128(isLetter, caseBit)));
+    }
+
+    return i + FlipAsciiCase_C(dst + i, src + i, len - i, first);
+}
+
+
+#endif /* HAVE_SSE2 */
+
+
+#ifdef HAVE_AVX2
+
+
+/* AVX2 implementations (only used if the processor supports AVX2) */
+
+
+#define AVX2_FUNC __attribute__((target("avx2")))
+
+
+AVX2_FUNC
+static Assize_t AsciiPrefixLength_AVX2(const unsigned char *s, Assize_t len)
+{
+    Assize_t i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(v);
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+
+    return i + AsciiPrefixLength_SSE2(s + i, len - i);
+}
+
+
+AVX2_FUNC
+static Assize_t WidePrefixLength_AVX2(const AWideChar *s, Assize_t len,
+                                      unsigned mask)
+{
+    const __m256i high = _mm256_set1_epi16((short)mask);
+    const __m256i zero = _mm256_setzero_si256();
+    Assize_t i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i isLow = _mm256_cmpeq_epi16(_mm256_and_si256(v, high), zero);
+        unsigned found = ~(unsigned)_mm256_movemask_epi8(isLow);
+        if (found != 0)
+            return i + __builtin_ctz(found) / 2;
+    }
+
+    return i + WidePrefixLength_SSE2(s + i, len - i, mask);
+}
+
+
+AVX2_FUNC
+static void WidenChars_AVX2(AWideChar *dst, const unsigned char *src,
+                            Assize_t len)
+{
+    Assize_t i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_cvtepu8_epi16(v));
+    }
+
+    for (; i < len; i++)
+        dst[i] = src[i];
+}
+
+
+AVX2_FUNC
+static void NarrowChars_AVX2(unsigned char *dst, const AWideChar *src,
+                             Assize_t len)
+{
+    Assize_t i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        __m256i v1 = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i v2 = _mm256_loadu_si256((const __m256i *)(src + i + 16));
+        /* Packing operates within 128-bit lanes; fix the order of the
+           64-bit quarters afterwards. */
+        __m256i packed = _mm256_permute4x64_epi64(
+            _mm256_packus_epi16(v1, v2), 0xd8);
+        _mm256_storeu_si256((__m256i *)(dst + i), packed);
+    }
+
+    NarrowChars_SSE2(dst + i, src + i, len - i);
+}
+
+
+#endif /* HAVE_AVX2 */
+
+
+/* Choose the fastest implementations supported by the processor. Multiple
+   threads may call this simultaneously; they all store the same values. */
+static void SelectImplementation(void)
+{
+#ifdef HAVE_SSE2
+    AsciiPrefixLengthImpl = AsciiPrefixLength_SSE2;
+    WidePrefixLengthImpl = WidePrefixLength_SSE2;
+    WidenCharsImpl = WidenChars_SSE2;
+    NarrowCharsImpl = NarrowChars_SSE2;
+    FlipAsciiCaseImpl = FlipAsciiCase_SSE2;
+#endif
+
+#ifdef HAVE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        AsciiPrefixLengthImpl = AsciiPrefixLength_AVX2;
+        WidePrefixLengthImpl = WidePrefixLength_AVX2;
+        WidenCharsImpl = WidenChars_AVX2;
+        NarrowCharsImpl = NarrowChars_AVX2;
+    }
+#endif
+
+    IsInitialized = TRUE;
+}
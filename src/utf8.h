@@ -0,0 +1,78 @@
+/* utf8.h - UTF-8 encoding and decoding helpers
+
+   Copyright (c) 2010-2011 Jukka Lehtosalo
+
+   Alore is licensed under the terms of the MIT license.  See the file
+   LICENSE.txt in the distribution.
+*/
+
+#ifndef UTF8_H_INCL
+#define UTF8_H_INCL
+
+#include "common.h"
+
+
+/* A character code larger than any valid 16-bit character; ADecodeUtf8Char
+   and AScanUtf8 use it to signal an invalid sequence. */
+#define A_UTF8_INVALID 0x10000
+
+
+/* Return the number of leading bytes of s[0..len) that are less than 128. */
+Assize_t AAsciiPrefixLength(const unsigned char *s, Assize_t len);
+/* Return the number of leading characters of s[0..len) that are less than
+   128. */
+Assize_t AWideAsciiPrefixLength(const AWideChar *s, Assize_t len);
+/* Return the number of leading characters of s[0..len) that are less than
+   256. */
+Assize_t ANarrowPrefixLength(const AWideChar *s, Assize_t len);
+/* Copy the leading bytes of src[0..len) that are less than 128 to dst,
+   converting lower case letters to upper case. Return the number of bytes
+   copied. */
+Assize_t AAsciiUpper(unsigned char *dst, const unsigned char *src,
+                      Assize_t len);
+/* Like AAsciiUpper, but convert upper case letters to lower case. */
+Assize_t AAsciiLower(unsigned char *dst, const unsigned char *src,
+                      Assize_t len);
+/* Return the number of bytes in s[0..len) that are at least 128. */
+Assize_t ANonAsciiCount(const unsigned char *s, Assize_t len);
+/* Copy 8-bit characters to a 16-bit buffer. */
+void AWidenChars(AWideChar *dst, const unsigned char *src, Assize_t len);
+/* Copy 16-bit characters that are all less than 256 to an 8-bit buffer. */
+void ANarrowChars(unsigned char *dst, const AWideChar *src, Assize_t len);
+
+/* Decode a single UTF-8 sequence of A_UTF8_SKIP(s[0]) bytes. Return the
+   character code, or A_UTF8_INVALID if the sequence is invalid or encodes a
+   character outside the 16-bit range. Never read past the first byte that is
+   not a valid continuation byte. */
+int ADecodeUtf8Char(const unsigned char *s);
+
+/* Scan UTF-8 data s[0..len). Return the number of bytes in complete
+   sequences; the rest of the bytes (at most 3) form the beginning of an
+   incomplete sequence. Store the number of characters in *numChars. Each
+   invalid sequence is counted as a single character. Store A_UTF8_INVALID in
+   *maxChar if there were invalid sequences; otherwise store a value that is
+   less than 128 if all characters are ASCII, less than 256 if all characters
+   are less than 256 and at least 256 otherwise. */
+Assize_t AScanUtf8(const unsigned char *s, Assize_t len, Assize_t *numChars,
+                   int *maxChar);
+/* Decode complete UTF-8 sequences s[0..len) to 16-bit characters. Replace
+   invalid sequences with U+FFFD. */
+void ADecodeUtf8W(AWideChar *dst, const unsigned char *s, Assize_t len);
+/* Decode complete and valid UTF-8 sequences s[0..len) to 8-bit characters.
+   Assume that AScanUtf8 reported a maximum character code less than 256. */
+void ADecodeUtf8(unsigned char *dst, const unsigned char *s, Assize_t len);
+/* Return the number of leading bytes of s[0..len) that form complete and
+   valid UTF-8 sequences. */
+Assize_t AValidUtf8Length(const unsigned char *s, Assize_t len);
+
+/* Return the length of the UTF-8 encoding of 8-bit characters s[0..len). */
+Assize_t AUtf8Length(const unsigned char *s, Assize_t len);
+/* Return the length of the UTF-8 encoding of 16-bit characters s[0..len). */
+Assize_t AUtf8LengthW(const AWideChar *s, Assize_t len);
+/* Encode 8-bit characters s[0..len) in UTF-8. */
+void AEncodeUtf8(unsigned char *dst, const unsigned char *s, Assize_t len);
+/* Encode 16-bit characters s[0..len) in UTF-8. */
+void AEncodeUtf8W(unsigned char *dst, const AWideChar *s, Assize_t len);
+
+
+#endif
@@ -124,6 +124,10 @@ typedef struct {
 #define A_ARG_BITS 14
 #define A_MAX_ARG_COUNT ((1 << A_ARG_BITS) - 1)
 #define A_VAR_ARG_FLAG (1 << A_ARG_BITS)
+/* Set in the maxArgs field of a C function definition if the function
+   accepts its variable arguments as a slice of its stack frame instead of an
+   Array object (see AVarArgLen and AVarArgItem). */
+#define A_VAR_ARG_SLICE_FLAG (1 << (A_ARG_BITS + 1))
 
 
 #define A_FRAME_BITS 15
@@ -147,12 +151,13 @@ typedef struct {
     unsigned stackFrameSize; /* Size of function stack frame, in bytes */
     unsigned codeLen;
     unsigned short fileNum;
+    unsigned short flags;    /* A_FUNC_* flags */
 #ifdef HAVE_JIT_COMPILER
     unsigned short num; /* Number of the global variable that holds this
                            function (only valid for C and compiled
                            functions) */
     char isJitFunction; /* Is this function part of the JIT Compiler */
-    char filler[3];
+    char filler[1];
 #endif
     /* unsigned short lineNum; */ /* IDEA: Use this */
     union {
@@ -378,6 +383,11 @@ typedef struct {
     ((func)->header & A_COMPILED_FUNCTION_FLAG)
 
 
+/* AFunction flags */
+#define A_FUNC_VAR_ARG_SLICE 1 /* Varargs are stored at the end of the frame */
+#define A_FUNC_HANDLER_TABLE 2 /* Has exception handler table (see opcode.h) */
+
+
 typedef enum {
     A_IS_TRUE,
     A_IS_FALSE,
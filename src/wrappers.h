@@ -53,5 +53,11 @@ AValue AHiddenCreate(AThread *t, AValue *frame);
 
 #define A_UNWRAP(value) (AMemberDirect((value), 0))
 
+/* Return the raw value of self in a wrapper method. Method calls pass the raw
+   object as self, but self is a wrapper instance if the method is called via
+   a bound method object. */
+#define A_UNWRAP_SELF(value) \
+    (AIsInstance(value) ? A_UNWRAP(value) : (value))
+
 
 #endif